@@ -162,6 +162,7 @@ static struct drm_conn_prop_enum_list drm_connector_enum_list[] =
 	{ DRM_MODE_CONNECTOR_HDMIB, "HDMI-B", 0 },
 	{ DRM_MODE_CONNECTOR_TV, "TV", 0 },
 	{ DRM_MODE_CONNECTOR_eDP, "eDP", 0 },
+	{ DRM_MODE_CONNECTOR_VIRTUAL, "Virtual", 0},
 };
 
 static struct drm_prop_enum_list drm_encoder_enum_list[] =
@@ -170,6 +171,7 @@ static struct drm_prop_enum_list drm_encoder_enum_list[] =
 	{ DRM_MODE_ENCODER_TMDS, "TMDS" },
 	{ DRM_MODE_ENCODER_LVDS, "LVDS" },
 	{ DRM_MODE_ENCODER_TVDAC, "TV" },
+	{ DRM_MODE_ENCODER_VIRTUAL, "Virtual" },
 };
 
 char *drm_get_encoder_name(struct drm_encoder *encoder)
@@ -459,6 +461,7 @@ void drm_connector_init(struct drm_device *dev,
 	INIT_LIST_HEAD(&connector->probed_modes);
 	INIT_LIST_HEAD(&connector->modes);
 	connector->edid_blob_ptr = NULL;
+	connector->probe_generation = 0;
 
 	list_add_tail(&connector->head, &dev->mode_config.connector_list);
 	dev->mode_config.num_connector++;
@@ -877,9 +880,27 @@ void drm_mode_config_init(struct drm_device *dev)
 	dev->mode_config.num_connector = 0;
 	dev->mode_config.num_crtc = 0;
 	dev->mode_config.num_encoder = 0;
+
+	/* connectors start out at 0, so they get probed the first time */
+	atomic_set(&dev->mode_config.probe_generation, 1);
 }
 EXPORT_SYMBOL(drm_mode_config_init);
 
+/**
+ * drm_mode_config_invalidate_probes - forget the probed connector state
+ * @dev: DRM device
+ *
+ * Called on hotplug events so that the next GETCONNECTOR call probes the
+ * connectors again instead of returning the cached mode lists. Doesn't
+ * take any locks.
+ */
+void drm_mode_config_invalidate_probes(struct drm_device *dev)
+{
+	if (atomic_inc_return(&dev->mode_config.probe_generation) == 0)
+		atomic_inc(&dev->mode_config.probe_generation);
+}
+EXPORT_SYMBOL(drm_mode_config_invalidate_probes);
+
 int drm_mode_group_init(struct drm_device *dev, struct drm_mode_group *group)
 {
 	uint32_t total_objects = 0;
@@ -1281,6 +1302,30 @@ out:
 	return ret;
 }
 
+/*
+ * The mode list of a connector stays valid until we hear of a hotplug,
+ * which only happens for connectors with a hotplug interrupt or polled
+ * for both connection and disconnection.
+ */
+static bool drm_connector_probe_valid(struct drm_connector *connector)
+{
+	struct drm_mode_config *config = &connector->dev->mode_config;
+
+	if (connector->probe_generation !=
+	    atomic_read(&config->probe_generation))
+		return false;
+
+	if (!config->poll_enabled)
+		return false;
+
+	if (connector->polled & DRM_CONNECTOR_POLL_HPD)
+		return true;
+
+	return config->poll_running &&
+		(connector->polled & DRM_CONNECTOR_POLL_CONNECT) &&
+		(connector->polled & DRM_CONNECTOR_POLL_DISCONNECT);
+}
+
 /**
  * drm_mode_getconnector - get connector configuration
  * @inode: inode from the ioctl
@@ -1292,6 +1337,9 @@ out:
  * Caller? (FIXME)
  *
  * Construct a connector configuration structure to return to the user.
+ * Asking for the mode count probes the connector, unless it was probed
+ * before and no hotplug event or user mode or property change happened
+ * since, in which case the cached mode list is returned.
  *
  * Called by the user via ioctl.
  *
@@ -1311,45 +1359,58 @@ int drm_mode_getconnector(struct drm_device *dev, void *data,
 	int ret = 0;
 	int copied = 0;
 	int i;
-	struct drm_mode_modeinfo u_mode;
+	struct drm_mode_modeinfo *u_modes = NULL;
+	uint32_t prop_ids[DRM_CONNECTOR_MAX_PROPERTY];
+	uint64_t prop_vals[DRM_CONNECTOR_MAX_PROPERTY];
+	uint32_t encoder_ids[DRM_CONNECTOR_MAX_ENCODER];
+	bool copy_modes, copy_props, copy_encoders;
 	struct drm_mode_modeinfo __user *mode_ptr;
 	uint32_t __user *prop_ptr;
 	uint64_t __user *prop_values;
 	uint32_t __user *encoder_ptr;
+	u32 generation;
 
 	if (!drm_core_check_feature(dev, DRIVER_MODESET))
 		return -EINVAL;
 
-	memset(&u_mode, 0, sizeof(struct drm_mode_modeinfo));
-
 	DRM_DEBUG_KMS("[CONNECTOR:%d:?]\n", out_resp->connector_id);
 
+	/*
+	 * Only the probe and a snapshot of the connector are taken under
+	 * the lock, the copies to userspace are done after dropping it.
+	 */
 	mutex_lock(&dev->mode_config.mutex);
 
 	obj = drm_mode_object_find(dev, out_resp->connector_id,
 				   DRM_MODE_OBJECT_CONNECTOR);
 	if (!obj) {
-		ret = -EINVAL;
-		goto out;
+		mutex_unlock(&dev->mode_config.mutex);
+		return -EINVAL;
 	}
 	connector = obj_to_connector(obj);
 
 	for (i = 0; i < DRM_CONNECTOR_MAX_PROPERTY; i++) {
 		if (connector->property_ids[i] != 0) {
+			prop_ids[props_count] = connector->property_ids[i];
+			prop_vals[props_count] = connector->property_values[i];
 			props_count++;
 		}
 	}
 
 	for (i = 0; i < DRM_CONNECTOR_MAX_ENCODER; i++) {
 		if (connector->encoder_ids[i] != 0) {
+			encoder_ids[encoders_count] = connector->encoder_ids[i];
 			encoders_count++;
 		}
 	}
 
-	if (out_resp->count_modes == 0) {
+	if (out_resp->count_modes == 0 && !drm_connector_probe_valid(connector)) {
+		/* read before probing so that a hotplug meanwhile isn't lost */
+		generation = atomic_read(&dev->mode_config.probe_generation);
 		connector->funcs->fill_modes(connector,
 					     dev->mode_config.max_width,
 					     dev->mode_config.max_height);
+		connector->probe_generation = generation;
 	}
 
 	/* delayed so we get modes regardless of pre-fill_modes state */
@@ -1372,62 +1433,58 @@ int drm_mode_getconnector(struct drm_device *dev, void *data,
 	 * This ioctl is called twice, once to determine how much space is
 	 * needed, and the 2nd time to fill it.
 	 */
-	if ((out_resp->count_modes >= mode_count) && mode_count) {
-		copied = 0;
+	copy_modes = out_resp->count_modes >= mode_count && mode_count;
+	copy_props = out_resp->count_props >= props_count && props_count;
+	copy_encoders = out_resp->count_encoders >= encoders_count &&
+		encoders_count;
+
+	if (copy_modes) {
+		u_modes = kcalloc(mode_count, sizeof(*u_modes), GFP_KERNEL);
+		if (!u_modes) {
+			mutex_unlock(&dev->mode_config.mutex);
+			return -ENOMEM;
+		}
+		list_for_each_entry(mode, &connector->modes, head)
+			drm_crtc_convert_to_umode(&u_modes[copied++], mode);
+	}
+
+	mutex_unlock(&dev->mode_config.mutex);
+
+	if (copy_modes) {
 		mode_ptr = (struct drm_mode_modeinfo *)(unsigned long)out_resp->modes_ptr;
-		list_for_each_entry(mode, &connector->modes, head) {
-			drm_crtc_convert_to_umode(&u_mode, mode);
-			if (copy_to_user(mode_ptr + copied,
-					 &u_mode, sizeof(u_mode))) {
-				ret = -EFAULT;
-				goto out;
-			}
-			copied++;
+		if (copy_to_user(mode_ptr, u_modes,
+				 mode_count * sizeof(*u_modes))) {
+			ret = -EFAULT;
+			goto out;
 		}
 	}
 	out_resp->count_modes = mode_count;
 
-	if ((out_resp->count_props >= props_count) && props_count) {
-		copied = 0;
+	if (copy_props) {
 		prop_ptr = (uint32_t *)(unsigned long)(out_resp->props_ptr);
 		prop_values = (uint64_t *)(unsigned long)(out_resp->prop_values_ptr);
-		for (i = 0; i < DRM_CONNECTOR_MAX_PROPERTY; i++) {
-			if (connector->property_ids[i] != 0) {
-				if (put_user(connector->property_ids[i],
-					     prop_ptr + copied)) {
-					ret = -EFAULT;
-					goto out;
-				}
-
-				if (put_user(connector->property_values[i],
-					     prop_values + copied)) {
-					ret = -EFAULT;
-					goto out;
-				}
-				copied++;
-			}
+		if (copy_to_user(prop_ptr, prop_ids,
+				 props_count * sizeof(*prop_ids)) ||
+		    copy_to_user(prop_values, prop_vals,
+				 props_count * sizeof(*prop_vals))) {
+			ret = -EFAULT;
+			goto out;
 		}
 	}
 	out_resp->count_props = props_count;
 
-	if ((out_resp->count_encoders >= encoders_count) && encoders_count) {
-		copied = 0;
+	if (copy_encoders) {
 		encoder_ptr = (uint32_t *)(unsigned long)(out_resp->encoders_ptr);
-		for (i = 0; i < DRM_CONNECTOR_MAX_ENCODER; i++) {
-			if (connector->encoder_ids[i] != 0) {
-				if (put_user(connector->encoder_ids[i],
-					     encoder_ptr + copied)) {
-					ret = -EFAULT;
-					goto out;
-				}
-				copied++;
-			}
+		if (copy_to_user(encoder_ptr, encoder_ids,
+				 encoders_count * sizeof(*encoder_ids))) {
+			ret = -EFAULT;
+			goto out;
 		}
 	}
 	out_resp->count_encoders = encoders_count;
 
 out:
-	mutex_unlock(&dev->mode_config.mutex);
+	kfree(u_modes);
 	return ret;
 }
 
@@ -1940,6 +1997,8 @@ static int drm_mode_attachmode(struct drm_device *dev,
 	int ret = 0;
 
 	list_add_tail(&mode->head, &connector->user_modes);
+	/* user modes only show up in @modes after probing */
+	connector->probe_generation = 0;
 	return ret;
 }
 
@@ -1980,6 +2039,7 @@ static int drm_mode_detachmode(struct drm_device *dev,
 		if (drm_mode_equal(match_mode, mode)) {
 			list_del(&match_mode->head);
 			drm_mode_destroy(dev, match_mode);
+			connector->probe_generation = 0;
 			found = 1;
 			break;
 		}
@@ -2487,8 +2547,12 @@ int drm_mode_connector_property_set_ioctl(struct drm_device *dev,
 		if (connector->funcs->dpms)
 			(*connector->funcs->dpms)(connector, (int) out_resp->value);
 		ret = 0;
-	} else if (connector->funcs->set_property)
+	} else if (connector->funcs->set_property) {
 		ret = connector->funcs->set_property(connector, property, out_resp->value);
+		/* e.g. the TV format changes the modes found by probing */
+		if (!ret)
+			connector->probe_generation = 0;
+	}
 
 	/* store the property value if successful */
 	if (!ret)
@@ -48,6 +48,7 @@ static struct drm_info_list drm_debugfs_list[] = {
 	{"queues", drm_queues_info, 0},
 	{"bufs", drm_bufs_info, 0},
 	{"gem_names", drm_gem_name_info, DRIVER_GEM},
+	{"hash_tables", drm_hashtab_info, 0},
 #if DRM_DEBUG_CODE
 	{"vma", drm_vma_info, 0},
 #endif
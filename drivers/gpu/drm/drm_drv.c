@@ -134,6 +134,9 @@ static struct drm_ioctl_desc drm_ioctls[] = {
 	DRM_IOCTL_DEF(DRM_IOCTL_GEM_FLINK, drm_gem_flink_ioctl, DRM_AUTH|DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_IOCTL_GEM_OPEN, drm_gem_open_ioctl, DRM_AUTH|DRM_UNLOCKED),
 
+	DRM_IOCTL_DEF(DRM_IOCTL_PRIME_HANDLE_TO_FD, drm_prime_handle_to_fd_ioctl, DRM_AUTH|DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_IOCTL_PRIME_FD_TO_HANDLE, drm_prime_fd_to_handle_ioctl, DRM_AUTH|DRM_UNLOCKED),
+
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_GETRESOURCES, drm_mode_getresources, DRM_MASTER|DRM_CONTROL_ALLOW|DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_GETCRTC, drm_mode_getcrtc, DRM_MASTER|DRM_CONTROL_ALLOW|DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_SETCRTC, drm_mode_setcrtc, DRM_MASTER|DRM_CONTROL_ALLOW|DRM_UNLOCKED),
@@ -252,6 +255,11 @@ static int __init drm_core_init(void)
 	drm_global_init();
 	idr_init(&drm_minors_idr);
 
+	ret = drm_prime_init();
+	if (ret)
+		goto err_p0;
+
+	ret = -ENOMEM;
 	if (register_chrdev(DRM_MAJOR, "drm", &drm_stub_fops))
 		goto err_p1;
 
@@ -283,9 +291,10 @@ err_p3:
 	drm_sysfs_destroy();
 err_p2:
 	unregister_chrdev(DRM_MAJOR, "drm");
-
-	idr_destroy(&drm_minors_idr);
 err_p1:
+	drm_prime_exit();
+err_p0:
+	idr_destroy(&drm_minors_idr);
 	return ret;
 }
 
@@ -297,6 +306,8 @@ static void __exit drm_core_exit(void)
 
 	unregister_chrdev(DRM_MAJOR, "drm");
 
+	drm_prime_exit();
+
 	idr_remove_all(&drm_minors_idr);
 	idr_destroy(&drm_minors_idr);
 }
@@ -407,6 +418,9 @@ long drm_ioctl(struct file *filp,
 			asize = drv_size;
 	}
 	else if ((nr >= DRM_COMMAND_END) || (nr < DRM_COMMAND_BASE)) {
+		/* Never implemented, don't hand it to PRIME_FD_TO_HANDLE */
+		if (cmd == DRM_IOCTL_GEM_PRIME_OPEN)
+			goto err_i1;
 		ioctl = &drm_ioctls[nr];
 		cmd = ioctl->cmd;
 		usize = asize = _IOC_SIZE(cmd);
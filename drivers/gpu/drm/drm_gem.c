@@ -102,6 +102,7 @@ drm_gem_init(struct drm_device *dev)
 
 	dev->mm_private = mm;
 
+	rwlock_init(&mm->offset_lock);
 	if (drm_ht_create(&mm->offset_hash, 12)) {
 		kfree(mm);
 		return -ENOMEM;
@@ -200,6 +201,20 @@ free:
 }
 EXPORT_SYMBOL(drm_gem_object_alloc);
 
+static void
+drm_gem_remove_prime_handles(struct drm_gem_object *obj, struct drm_file *filp)
+{
+	if (!drm_core_check_feature(obj->dev, DRIVER_PRIME))
+		return;
+
+	if (obj->import_attach)
+		drm_prime_remove_buf_handle(&filp->prime,
+					    obj->import_attach->dmabuf);
+	if (obj->export_dma_buf)
+		drm_prime_remove_buf_handle(&filp->prime,
+					    obj->export_dma_buf);
+}
+
 /**
  * Removes the mapping from handle to filp for this object.
  */
@@ -232,6 +247,8 @@ drm_gem_handle_delete(struct drm_file *filp, u32 handle)
 	idr_remove(&filp->object_idr, handle);
 	spin_unlock(&filp->table_lock);
 
+	drm_gem_remove_prime_handles(obj, filp);
+
 	if (dev->driver->gem_close_object)
 		dev->driver->gem_close_object(obj, filp);
 	drm_gem_object_handle_unreference_unlocked(obj);
@@ -253,13 +270,21 @@ drm_gem_handle_create(struct drm_file *file_priv,
 	struct drm_device *dev = obj->dev;
 	int ret;
 
+	/*
+	 * Lookups can find the object as soon as it is in the idr, so the
+	 * handle reference must already be held.
+	 */
+	drm_gem_object_handle_reference(obj);
+
 	/*
 	 * Get the user-visible handle using idr.
 	 */
 again:
 	/* ensure there is space available to allocate a handle */
-	if (idr_pre_get(&file_priv->object_idr, GFP_KERNEL) == 0)
+	if (idr_pre_get(&file_priv->object_idr, GFP_KERNEL) == 0) {
+		drm_gem_object_handle_unreference_unlocked(obj);
 		return -ENOMEM;
+	}
 
 	/* do the allocation under our spinlock */
 	spin_lock(&file_priv->table_lock);
@@ -268,10 +293,10 @@ again:
 	if (ret == -EAGAIN)
 		goto again;
 
-	if (ret != 0)
+	if (ret != 0) {
+		drm_gem_object_handle_unreference_unlocked(obj);
 		return ret;
-
-	drm_gem_object_handle_reference(obj);
+	}
 
 	if (dev->driver->gem_open_object) {
 		ret = dev->driver->gem_open_object(obj, file_priv);
@@ -285,30 +310,85 @@ again:
 }
 EXPORT_SYMBOL(drm_gem_handle_create);
 
-/** Returns a reference to the object named by the handle. */
-struct drm_gem_object *
-drm_gem_object_lookup(struct drm_device *dev, struct drm_file *filp,
-		      u32 handle)
+/* Called under rcu_read_lock(), returns a reference or NULL */
+static struct drm_gem_object *
+drm_gem_object_lookup_rcu(struct drm_file *filp, u32 handle)
 {
 	struct drm_gem_object *obj;
 
-	spin_lock(&filp->table_lock);
-
-	/* Check if we currently have a reference on the object */
 	obj = idr_find(&filp->object_idr, handle);
-	if (obj == NULL) {
-		spin_unlock(&filp->table_lock);
+	if (obj == NULL)
 		return NULL;
-	}
 
-	drm_gem_object_reference(obj);
+	/*
+	 * The handle may be closed and the last reference dropped under us.
+	 * The memory of the object is only freed after a grace period, so
+	 * the refcount can still be checked, and a dying object isn't found.
+	 */
+	if (!kref_get_unless_zero(&obj->refcount))
+		return NULL;
 
-	spin_unlock(&filp->table_lock);
+	return obj;
+}
+
+/**
+ * Returns a reference to the object named by the handle.
+ *
+ * Doesn't take any lock other than rcu_read_lock(), so any number of
+ * threads can look up handles of the same file concurrently.
+ */
+struct drm_gem_object *
+drm_gem_object_lookup(struct drm_device *dev, struct drm_file *filp,
+		      u32 handle)
+{
+	struct drm_gem_object *obj;
+
+	rcu_read_lock();
+	obj = drm_gem_object_lookup_rcu(filp, handle);
+	rcu_read_unlock();
 
 	return obj;
 }
 EXPORT_SYMBOL(drm_gem_object_lookup);
 
+/**
+ * drm_gem_object_lookup_array - look up several handles at once
+ * @dev: DRM device
+ * @filp: file the handles belong to
+ * @handles: handles to look up
+ * @count: number of handles
+ * @objs: returns a reference to the object of each handle
+ *
+ * For command submission, which resolves every buffer it uses at once.
+ * Either all handles are found, or none of the references are kept and
+ * -ENOENT is returned.
+ */
+int
+drm_gem_object_lookup_array(struct drm_device *dev, struct drm_file *filp,
+			    const u32 *handles, unsigned int count,
+			    struct drm_gem_object **objs)
+{
+	unsigned int i;
+
+	rcu_read_lock();
+	for (i = 0; i < count; i++) {
+		objs[i] = drm_gem_object_lookup_rcu(filp, handles[i]);
+		if (objs[i] == NULL)
+			break;
+	}
+	rcu_read_unlock();
+
+	if (i == count)
+		return 0;
+
+	while (i--) {
+		drm_gem_object_unreference_unlocked(objs[i]);
+		objs[i] = NULL;
+	}
+	return -ENOENT;
+}
+EXPORT_SYMBOL(drm_gem_object_lookup_array);
+
 /**
  * Releases the handle to an mm object.
  */
@@ -439,6 +519,8 @@ drm_gem_object_release_handle(int id, void *ptr, void *data)
 	struct drm_gem_object *obj = ptr;
 	struct drm_device *dev = obj->dev;
 
+	drm_gem_remove_prime_handles(obj, file_priv);
+
 	if (dev->driver->gem_close_object)
 		dev->driver->gem_close_object(obj, file_priv);
 
@@ -470,6 +552,120 @@ drm_gem_object_release(struct drm_gem_object *obj)
 }
 EXPORT_SYMBOL(drm_gem_object_release);
 
+/**
+ * drm_gem_create_mmap_offset - create a fake mmap offset for an object
+ * @obj: obj in question
+ *
+ * GEM memory mapping works by handing back to userspace a fake mmap offset
+ * it can use in a subsequent mmap(2) call.  The DRM core code then looks
+ * up the object based on the offset and sets up the various memory mapping
+ * structures.
+ *
+ * This routine allocates and attaches a fake offset for @obj. The offset
+ * space has its own lock, so this doesn't need struct_mutex; if @obj
+ * already has an offset it is kept.
+ */
+int
+drm_gem_create_mmap_offset(struct drm_gem_object *obj)
+{
+	struct drm_device *dev = obj->dev;
+	struct drm_gem_mm *mm = dev->mm_private;
+	struct drm_map_list *list = &obj->map_list;
+	struct drm_local_map *map;
+	struct drm_mm_node *node;
+	int ret;
+
+	read_lock(&mm->offset_lock);
+	map = list->map;
+	read_unlock(&mm->offset_lock);
+	if (map)
+		return 0;
+
+	map = kzalloc(sizeof(struct drm_local_map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+
+	map->type = _DRM_GEM;
+	map->size = obj->size;
+	map->handle = obj;
+
+retry_pre_get:
+	ret = drm_mm_pre_get(&mm->offset_manager);
+	if (ret)
+		goto out_free_map;
+
+	write_lock(&mm->offset_lock);
+
+	if (list->map) {
+		/* Somebody else set the object up for mmap'ing */
+		write_unlock(&mm->offset_lock);
+		kfree(map);
+		return 0;
+	}
+
+	/* Get a DRM GEM mmap offset allocated... */
+	node = drm_mm_search_free(&mm->offset_manager, obj->size / PAGE_SIZE,
+				  0, 0);
+	if (!node) {
+		write_unlock(&mm->offset_lock);
+		DRM_ERROR("failed to allocate offset for bo %d\n", obj->name);
+		ret = -ENOSPC;
+		goto out_free_map;
+	}
+
+	node = drm_mm_get_block_atomic(node, obj->size / PAGE_SIZE, 0);
+	if (!node) {
+		write_unlock(&mm->offset_lock);
+		goto retry_pre_get;
+	}
+
+	list->file_offset_node = node;
+	list->hash.key = node->start;
+	ret = drm_ht_insert_item(&mm->offset_hash, &list->hash);
+	if (ret) {
+		drm_mm_put_block(node);
+		write_unlock(&mm->offset_lock);
+		DRM_ERROR("failed to add to map hash\n");
+		goto out_free_map;
+	}
+
+	list->map = map;
+	write_unlock(&mm->offset_lock);
+
+	return 0;
+
+out_free_map:
+	kfree(map);
+
+	return ret;
+}
+EXPORT_SYMBOL(drm_gem_create_mmap_offset);
+
+/**
+ * drm_gem_free_mmap_offset - release a fake mmap offset for an object
+ * @obj: obj in question
+ *
+ * This routine frees fake offsets allocated by drm_gem_create_mmap_offset().
+ */
+void
+drm_gem_free_mmap_offset(struct drm_gem_object *obj)
+{
+	struct drm_device *dev = obj->dev;
+	struct drm_gem_mm *mm = dev->mm_private;
+	struct drm_map_list *list = &obj->map_list;
+	struct drm_local_map *map;
+
+	write_lock(&mm->offset_lock);
+	drm_ht_remove_item(&mm->offset_hash, &list->hash);
+	drm_mm_put_block(list->file_offset_node);
+	map = list->map;
+	list->map = NULL;
+	write_unlock(&mm->offset_lock);
+
+	kfree(map);
+}
+EXPORT_SYMBOL(drm_gem_free_mmap_offset);
+
 /**
  * Called after the last reference to the object has been lost.
  * Must be called holding struct_ mutex
@@ -521,6 +717,17 @@ void drm_gem_object_handle_free(struct drm_gem_object *obj)
 	} else
 		spin_unlock(&dev->object_name_lock);
 
+	/*
+	 * Without handles nobody can export the object again, drop the
+	 * dma-buf. Its release drops its own object reference, which can't
+	 * be the last one either.
+	 */
+	if (obj->export_dma_buf) {
+		struct dma_buf *dma_buf = obj->export_dma_buf;
+
+		obj->export_dma_buf = NULL;
+		dma_buf_put(dma_buf);
+	}
 }
 EXPORT_SYMBOL(drm_gem_object_handle_free);
 
@@ -529,22 +736,14 @@ void drm_gem_vm_open(struct vm_area_struct *vma)
 	struct drm_gem_object *obj = vma->vm_private_data;
 
 	drm_gem_object_reference(obj);
-
-	mutex_lock(&obj->dev->struct_mutex);
-	drm_vm_open_locked(vma);
-	mutex_unlock(&obj->dev->struct_mutex);
 }
 EXPORT_SYMBOL(drm_gem_vm_open);
 
 void drm_gem_vm_close(struct vm_area_struct *vma)
 {
 	struct drm_gem_object *obj = vma->vm_private_data;
-	struct drm_device *dev = obj->dev;
 
-	mutex_lock(&dev->struct_mutex);
-	drm_vm_close_locked(vma);
-	drm_gem_object_unreference(obj);
-	mutex_unlock(&dev->struct_mutex);
+	drm_gem_object_unreference_unlocked(obj);
 }
 EXPORT_SYMBOL(drm_gem_vm_close);
 
@@ -562,6 +761,9 @@ EXPORT_SYMBOL(drm_gem_vm_close);
  * the object), we set up the driver fault handler so that any accesses
  * to the object can be trapped, to perform migration, GTT binding, surface
  * register allocation, or performance monitoring.
+ *
+ * The offset is looked up under the offset space's own lock, without
+ * struct_mutex, so mapping doesn't wait for whatever the driver is doing.
  */
 int drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 {
@@ -573,17 +775,16 @@ int drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct drm_hash_item *hash;
 	int ret = 0;
 
-	mutex_lock(&dev->struct_mutex);
+	read_lock(&mm->offset_lock);
 
 	if (drm_ht_find_item(&mm->offset_hash, vma->vm_pgoff, &hash)) {
-		mutex_unlock(&dev->struct_mutex);
+		read_unlock(&mm->offset_lock);
 		return drm_mmap(filp, vma);
 	}
 
 	map = drm_hash_entry(hash, struct drm_map_list, hash)->map;
-	if (!map ||
-	    ((map->flags & _DRM_RESTRICTED) && !capable(CAP_SYS_ADMIN))) {
-		ret =  -EPERM;
+	if ((map->flags & _DRM_RESTRICTED) && !capable(CAP_SYS_ADMIN)) {
+		ret = -EPERM;
 		goto out_unlock;
 	}
 
@@ -593,30 +794,32 @@ int drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto out_unlock;
 	}
 
-	obj = map->handle;
-	if (!obj->dev->driver->gem_vm_ops) {
+	if (!dev->driver->gem_vm_ops) {
 		ret = -EINVAL;
 		goto out_unlock;
 	}
 
-	vma->vm_flags |= VM_RESERVED | VM_IO | VM_PFNMAP | VM_DONTEXPAND;
-	vma->vm_ops = obj->dev->driver->gem_vm_ops;
-	vma->vm_private_data = map->handle;
-	vma->vm_page_prot =  pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
-
 	/* Take a ref for this mapping of the object, so that the fault
 	 * handler can dereference the mmap offset's pointer to the object.
 	 * This reference is cleaned up by the corresponding vm_close
 	 * (which should happen whether the vma was created by this call, or
 	 * by a vm_open due to mremap or partial unmap or whatever).
+	 * An object that lost its last reference keeps its offset until the
+	 * driver frees it, but can't be mapped anymore.
 	 */
-	drm_gem_object_reference(obj);
+	obj = map->handle;
+	if (!kref_get_unless_zero(&obj->refcount)) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
 
-	vma->vm_file = filp;	/* Needed for drm_vm_open() */
-	drm_vm_open_locked(vma);
+	vma->vm_flags |= VM_RESERVED | VM_IO | VM_PFNMAP | VM_DONTEXPAND;
+	vma->vm_ops = dev->driver->gem_vm_ops;
+	vma->vm_private_data = obj;
+	vma->vm_page_prot =  pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
 
 out_unlock:
-	mutex_unlock(&dev->struct_mutex);
+	read_unlock(&mm->offset_lock);
 
 	return ret;
 }
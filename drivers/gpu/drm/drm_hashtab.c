@@ -36,17 +36,183 @@
 #include "drm_hashtab.h"
 #include <linux/hash.h>
 #include <linux/slab.h>
+#include <linux/rculist.h>
 
-int drm_ht_create(struct drm_open_hash *ht, unsigned int order)
+/* buckets moved from the old to the new table per seqcount write section */
+#define DRM_HT_REHASH_BATCH 64
+
+static struct hlist_head *drm_ht_alloc_table(unsigned int order)
+{
+	unsigned long size = 1UL << order;
+
+	if (size <= PAGE_SIZE / sizeof(struct hlist_head))
+		return kcalloc(size, sizeof(struct hlist_head), GFP_KERNEL);
+	return vzalloc(size * sizeof(struct hlist_head));
+}
+
+static void drm_ht_free_table(struct hlist_head *table, unsigned int order)
+{
+	if ((PAGE_SIZE / sizeof(*table)) >> order)
+		kfree(table);
+	else
+		vfree(table);
+}
+
+/*
+ * The chain a key lives on. Keys whose bucket in the old table has already
+ * been moved are found in the new table. Called with ht->lock held or
+ * inside a seqcount read section.
+ */
+static struct hlist_head *drm_ht_bucket(struct drm_open_hash *ht,
+					unsigned long key)
+{
+	unsigned int hashed_key = hash_long(key, ht->order);
+	struct hlist_head *new_table = rcu_dereference_raw(ht->new_table);
+
+	if (new_table && hashed_key < ht->rehash)
+		return &new_table[hash_long(key, ht->new_order)];
+	return &rcu_dereference_raw(ht->table)[hashed_key];
+}
+
+/*
+ * Keep at most two items per bucket on average, and shrink once less than
+ * one bucket in eight would be used. Called with ht->lock held.
+ */
+static unsigned int drm_ht_target_order(struct drm_open_hash *ht)
+{
+	unsigned long size = 1UL << ht->order;
+	unsigned int order = ht->order;
+
+	if (ht->count > 2 * size && order < ht->max_order)
+		order = min_t(unsigned int, fls_long(ht->count), ht->max_order);
+	else if (ht->count < size / 8 && order > ht->min_order)
+		order = max_t(unsigned int, fls_long(ht->count) + 1,
+			      ht->min_order);
+	return order;
+}
+
+static void drm_ht_check_size(struct drm_open_hash *ht)
 {
-	unsigned int size = 1 << order;
+	if (!ht->new_table && drm_ht_target_order(ht) != ht->order)
+		schedule_work(&ht->resize_work);
+}
+
+/* Sorted insertion into a chain, called with ht->lock held. */
+static int drm_ht_link(struct hlist_head *h_list, struct drm_hash_item *item)
+{
+	struct drm_hash_item *entry;
+	struct hlist_node *list, *parent;
+	unsigned long key = item->key;
+
+	parent = NULL;
+	hlist_for_each_entry(entry, list, h_list, head) {
+		if (entry->key == key)
+			return -EINVAL;
+		if (entry->key > key)
+			break;
+		parent = list;
+	}
+	if (parent) {
+		hlist_add_after_rcu(parent, &item->head);
+	} else {
+		hlist_add_head_rcu(&item->head, h_list);
+	}
+	return 0;
+}
+
+static void drm_ht_rehash_bucket(struct drm_open_hash *ht, unsigned int i)
+{
+	struct drm_hash_item *entry;
+	struct hlist_node *list, *next;
+	struct hlist_head *h_list;
+
+	hlist_for_each_entry_safe(entry, list, next, &ht->table[i], head) {
+		h_list = &ht->new_table[hash_long(entry->key, ht->new_order)];
+		hlist_del_rcu(&entry->head);
+		drm_ht_link(h_list, entry);
+	}
+}
+
+/*
+ * Move the items to a table sized for the current load, a batch of buckets
+ * at a time so that insertions and removals are only held off briefly.
+ * Lookups racing with a move see the seqcount change and retry.
+ */
+static void drm_ht_resize_work(struct work_struct *work)
+{
+	struct drm_open_hash *ht =
+		container_of(work, struct drm_open_hash, resize_work);
+	struct hlist_head *new_table, *old_table;
+	unsigned int order, old_order, end;
+
+	spin_lock(&ht->lock);
+	order = drm_ht_target_order(ht);
+	old_order = ht->order;
+	spin_unlock(&ht->lock);
+	if (order == old_order)
+		return;
+
+	new_table = drm_ht_alloc_table(order);
+	if (!new_table)
+		return;
+
+	spin_lock(&ht->lock);
+	write_seqcount_begin(&ht->seq);
+	ht->new_order = order;
+	ht->rehash = 0;
+	rcu_assign_pointer(ht->new_table, new_table);
+	write_seqcount_end(&ht->seq);
+
+	while (ht->rehash < (1U << old_order)) {
+		end = min(ht->rehash + DRM_HT_REHASH_BATCH, 1U << old_order);
+
+		write_seqcount_begin(&ht->seq);
+		for (; ht->rehash < end; ht->rehash++)
+			drm_ht_rehash_bucket(ht, ht->rehash);
+		write_seqcount_end(&ht->seq);
+
+		spin_unlock(&ht->lock);
+		cond_resched();
+		spin_lock(&ht->lock);
+	}
 
+	old_table = ht->table;
+	write_seqcount_begin(&ht->seq);
+	rcu_assign_pointer(ht->table, new_table);
 	ht->order = order;
-	ht->table = NULL;
-	if (size <= PAGE_SIZE / sizeof(*ht->table))
-		ht->table = kcalloc(size, sizeof(*ht->table), GFP_KERNEL);
+	ht->new_table = NULL;
+	ht->rehash = 0;
+	write_seqcount_end(&ht->seq);
+	if (order > old_order)
+		ht->grows++;
 	else
-		ht->table = vzalloc(size*sizeof(*ht->table));
+		ht->shrinks++;
+	spin_unlock(&ht->lock);
+
+	synchronize_rcu();
+	drm_ht_free_table(old_table, old_order);
+
+	/* the load may have moved on while we were busy */
+	spin_lock(&ht->lock);
+	drm_ht_check_size(ht);
+	spin_unlock(&ht->lock);
+}
+
+int drm_ht_create(struct drm_open_hash *ht, unsigned int order)
+{
+	ht->order = order;
+	ht->min_order = order;
+	ht->max_order = max_t(unsigned int, order, DRM_HT_MAX_ORDER);
+	ht->new_table = NULL;
+	ht->rehash = 0;
+	ht->count = 0;
+	ht->grows = 0;
+	ht->shrinks = 0;
+	spin_lock_init(&ht->lock);
+	seqcount_init(&ht->seq);
+	INIT_WORK(&ht->resize_work, drm_ht_resize_work);
+
+	ht->table = drm_ht_alloc_table(order);
 	if (!ht->table) {
 		DRM_ERROR("Out of memory for hash table\n");
 		return -ENOMEM;
@@ -60,64 +226,73 @@ void drm_ht_verbose_list(struct drm_open_hash *ht, unsigned long key)
 	struct drm_hash_item *entry;
 	struct hlist_head *h_list;
 	struct hlist_node *list;
-	unsigned int hashed_key;
 	int count = 0;
 
-	hashed_key = hash_long(key, ht->order);
-	DRM_DEBUG("Key is 0x%08lx, Hashed key is 0x%08x\n", key, hashed_key);
-	h_list = &ht->table[hashed_key];
-	hlist_for_each(list, h_list) {
-		entry = hlist_entry(list, struct drm_hash_item, head);
+	spin_lock(&ht->lock);
+	h_list = drm_ht_bucket(ht, key);
+	DRM_DEBUG("Key is 0x%08lx, Hashed key is 0x%08x\n", key,
+		  (unsigned int)hash_long(key, ht->order));
+	hlist_for_each_entry(entry, list, h_list, head)
 		DRM_DEBUG("count %d, key: 0x%08lx\n", count++, entry->key);
-	}
+	spin_unlock(&ht->lock);
 }
 
-static struct hlist_node *drm_ht_find_key(struct drm_open_hash *ht,
-					  unsigned long key)
+/* Called with ht->lock held. */
+static struct drm_hash_item *drm_ht_find_key(struct drm_open_hash *ht,
+					     unsigned long key)
 {
 	struct drm_hash_item *entry;
-	struct hlist_head *h_list;
 	struct hlist_node *list;
-	unsigned int hashed_key;
 
-	hashed_key = hash_long(key, ht->order);
-	h_list = &ht->table[hashed_key];
-	hlist_for_each(list, h_list) {
-		entry = hlist_entry(list, struct drm_hash_item, head);
+	hlist_for_each_entry(entry, list, drm_ht_bucket(ht, key), head) {
 		if (entry->key == key)
-			return list;
+			return entry;
 		if (entry->key > key)
 			break;
 	}
 	return NULL;
 }
 
+/*
+ * Lockless lookup. An item found is always the right one since keys don't
+ * change while hashed, but a miss may be due to the item being moved to
+ * the new table under us, in which case the seqcount tells us to retry.
+ */
+static struct drm_hash_item *drm_ht_find_key_rcu(struct drm_open_hash *ht,
+						 unsigned long key)
+{
+	struct drm_hash_item *entry, *found;
+	struct hlist_node *list;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&ht->seq);
+		found = NULL;
+		hlist_for_each_entry_rcu(entry, list,
+					 drm_ht_bucket(ht, key), head) {
+			if (entry->key >= key) {
+				if (entry->key == key)
+					found = entry;
+				break;
+			}
+		}
+	} while (!found && read_seqcount_retry(&ht->seq, seq));
+
+	return found;
+}
 
 int drm_ht_insert_item(struct drm_open_hash *ht, struct drm_hash_item *item)
 {
-	struct drm_hash_item *entry;
-	struct hlist_head *h_list;
-	struct hlist_node *list, *parent;
-	unsigned int hashed_key;
-	unsigned long key = item->key;
+	int ret;
 
-	hashed_key = hash_long(key, ht->order);
-	h_list = &ht->table[hashed_key];
-	parent = NULL;
-	hlist_for_each(list, h_list) {
-		entry = hlist_entry(list, struct drm_hash_item, head);
-		if (entry->key == key)
-			return -EINVAL;
-		if (entry->key > key)
-			break;
-		parent = list;
+	spin_lock(&ht->lock);
+	ret = drm_ht_link(drm_ht_bucket(ht, item->key), item);
+	if (!ret) {
+		ht->count++;
+		drm_ht_check_size(ht);
 	}
-	if (parent) {
-		hlist_add_after(parent, &item->head);
-	} else {
-		hlist_add_head(&item->head, h_list);
-	}
-	return 0;
+	spin_unlock(&ht->lock);
+	return ret;
 }
 EXPORT_SYMBOL(drm_ht_insert_item);
 
@@ -150,47 +325,120 @@ int drm_ht_just_insert_please(struct drm_open_hash *ht, struct drm_hash_item *it
 }
 EXPORT_SYMBOL(drm_ht_just_insert_please);
 
+/*
+ * Either the lock serializing insertions and removals or rcu_read_lock()
+ * must be held. In the latter case the item is only guaranteed to stay
+ * around until rcu_read_unlock().
+ */
 int drm_ht_find_item(struct drm_open_hash *ht, unsigned long key,
 		     struct drm_hash_item **item)
 {
-	struct hlist_node *list;
+	struct drm_hash_item *entry;
 
-	list = drm_ht_find_key(ht, key);
-	if (!list)
+	rcu_read_lock();
+	entry = drm_ht_find_key_rcu(ht, key);
+	rcu_read_unlock();
+	if (!entry)
 		return -EINVAL;
 
-	*item = hlist_entry(list, struct drm_hash_item, head);
+	*item = entry;
 	return 0;
 }
 EXPORT_SYMBOL(drm_ht_find_item);
 
+static void drm_ht_unlink(struct drm_open_hash *ht, struct drm_hash_item *item)
+{
+	hlist_del_init_rcu(&item->head);
+	ht->count--;
+	drm_ht_check_size(ht);
+}
+
 int drm_ht_remove_key(struct drm_open_hash *ht, unsigned long key)
 {
-	struct hlist_node *list;
+	struct drm_hash_item *entry;
 
-	list = drm_ht_find_key(ht, key);
-	if (list) {
-		hlist_del_init(list);
-		return 0;
-	}
-	return -EINVAL;
+	spin_lock(&ht->lock);
+	entry = drm_ht_find_key(ht, key);
+	if (entry)
+		drm_ht_unlink(ht, entry);
+	spin_unlock(&ht->lock);
+
+	return entry ? 0 : -EINVAL;
 }
 
+/*
+ * Users doing lockless lookups must not free or reuse the item until a
+ * grace period has elapsed.
+ */
 int drm_ht_remove_item(struct drm_open_hash *ht, struct drm_hash_item *item)
 {
-	hlist_del_init(&item->head);
+	spin_lock(&ht->lock);
+	if (!hlist_unhashed(&item->head))
+		drm_ht_unlink(ht, item);
+	spin_unlock(&ht->lock);
 	return 0;
 }
 EXPORT_SYMBOL(drm_ht_remove_item);
 
+/* May sleep waiting for a resize in progress. */
 void drm_ht_remove(struct drm_open_hash *ht)
 {
 	if (ht->table) {
-		if ((PAGE_SIZE / sizeof(*ht->table)) >> ht->order)
-			kfree(ht->table);
-		else
-			vfree(ht->table);
+		cancel_work_sync(&ht->resize_work);
+		drm_ht_free_table(ht->table, ht->order);
 		ht->table = NULL;
 	}
 }
 EXPORT_SYMBOL(drm_ht_remove);
+
+/**
+ * drm_ht_get_stats - describe the shape of a hash table
+ * @ht: hash table
+ * @stats: filled in with the number of items and chain lengths
+ *
+ * Walks every chain, so the caller must hold the lock protecting the items
+ * like for a lookup. The numbers are only approximate while a resize is in
+ * progress.
+ */
+void drm_ht_get_stats(struct drm_open_hash *ht, struct drm_ht_stats *stats)
+{
+	struct hlist_head *tables[2];
+	unsigned int orders[2];
+	struct drm_hash_item *entry;
+	struct hlist_node *list;
+	unsigned long len, i;
+	unsigned int seq, t;
+
+	memset(stats, 0, sizeof(*stats));
+
+	rcu_read_lock();
+	do {
+		seq = read_seqcount_begin(&ht->seq);
+		tables[0] = rcu_dereference(ht->table);
+		orders[0] = ht->order;
+		tables[1] = rcu_dereference(ht->new_table);
+		orders[1] = ht->new_order;
+		stats->order = ht->order;
+		stats->items = ht->count;
+		stats->grows = ht->grows;
+		stats->shrinks = ht->shrinks;
+	} while (read_seqcount_retry(&ht->seq, seq));
+	stats->resizing = tables[1] != NULL;
+
+	for (t = 0; t < 2 && tables[t]; t++) {
+		for (i = 0; i < (1UL << orders[t]); i++) {
+			len = 0;
+			hlist_for_each_entry_rcu(entry, list, &tables[t][i],
+						 head)
+				len++;
+			if (!len)
+				continue;
+			stats->used++;
+			stats->max_chain = max(stats->max_chain, len);
+			stats->chains[min_t(unsigned long, fls_long(len) - 1,
+					    DRM_HT_STATS_CHAINS - 1)]++;
+		}
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(drm_ht_get_stats);
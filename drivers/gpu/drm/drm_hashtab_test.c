@@ -0,0 +1,359 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Selftest and benchmark for the resizing open hash tables.
+ * - Fills a small table until it grows, checks every key, empties it
+ *   until it shrinks and checks the survivors
+ * - Runs a lockless reader looking up a stable set of keys while the
+ *   table is grown and shrunk under it; the reader must never miss
+ * - Reports the lookup cost and the longest chain at various sizes for
+ *   a table fixed at the GEM offset hash order and for a resizing one
+ */
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+
+#include "drmP.h"
+#include "drm_hashtab.h"
+
+static unsigned max_items = 1 << 18;
+module_param(max_items, uint, 0444);
+MODULE_PARM_DESC(max_items, "Largest number of items hashed");
+
+static unsigned lookups = 1 << 20;
+module_param(lookups, uint, 0444);
+MODULE_PARM_DESC(lookups, "Lookups timed per table size");
+
+static unsigned rounds = 8;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "Grow and shrink cycles under the reader");
+
+#define HT_PFX "drm_hashtab_test: "
+
+/* the order drm_gem_init() creates the mmap offset hash with */
+#define HT_TEST_FIXED_ORDER 12
+
+static struct drm_hash_item *items;
+
+/* page offsets handed out by drm_mm are dense, so are our keys */
+static unsigned long ht_test_key(unsigned i)
+{
+	return i + 1;
+}
+
+/* wait for resizes, which requeue themselves until the size is right */
+static void ht_test_settle(struct drm_open_hash *ht)
+{
+	do {
+		flush_work_sync(&ht->resize_work);
+	} while (work_pending(&ht->resize_work));
+}
+
+static int ht_test_insert(struct drm_open_hash *ht, unsigned first,
+			  unsigned last)
+{
+	unsigned i;
+	int ret;
+
+	for (i = first; i < last; i++) {
+		items[i].key = ht_test_key(i);
+		ret = drm_ht_insert_item(ht, &items[i]);
+		if (ret) {
+			printk(KERN_ERR HT_PFX "inserting key %lu failed\n",
+			       items[i].key);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static void ht_test_remove(struct drm_open_hash *ht, unsigned first,
+			   unsigned last)
+{
+	unsigned i;
+
+	for (i = first; i < last; i++)
+		drm_ht_remove_item(ht, &items[i]);
+}
+
+static int ht_test_check(struct drm_open_hash *ht, unsigned first,
+			 unsigned last, bool present)
+{
+	struct drm_hash_item *item;
+	unsigned i;
+	int ret;
+
+	for (i = first; i < last; i++) {
+		ret = drm_ht_find_item(ht, ht_test_key(i), &item);
+		if (present && (ret || item != &items[i])) {
+			printk(KERN_ERR HT_PFX "key %lu not found\n",
+			       ht_test_key(i));
+			return -EINVAL;
+		}
+		if (!present && !ret) {
+			printk(KERN_ERR HT_PFX "removed key %lu found\n",
+			       ht_test_key(i));
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int ht_test_resize(void)
+{
+	struct drm_open_hash ht;
+	struct drm_ht_stats stats;
+	unsigned keep = max_items / 64;
+	int ret;
+
+	ret = drm_ht_create(&ht, 4);
+	if (ret)
+		return ret;
+
+	ret = ht_test_insert(&ht, 0, max_items);
+	if (ret)
+		goto out;
+	ht_test_settle(&ht);
+	ret = ht_test_check(&ht, 0, max_items, true);
+	if (ret)
+		goto out;
+	if (drm_ht_insert_item(&ht, &items[0]) != -EINVAL) {
+		printk(KERN_ERR HT_PFX "duplicate key inserted\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	drm_ht_get_stats(&ht, &stats);
+	if (stats.items != max_items || stats.order <= 4 ||
+	    (1UL << stats.order) * 2 < max_items) {
+		printk(KERN_ERR HT_PFX "%lu items in order %u table\n",
+		       stats.items, stats.order);
+		ret = -EINVAL;
+		goto out;
+	}
+	printk(KERN_INFO HT_PFX "grew to order %u, longest chain %lu\n",
+	       stats.order, stats.max_chain);
+
+	ht_test_remove(&ht, keep, max_items);
+	ht_test_settle(&ht);
+	ret = ht_test_check(&ht, 0, keep, true);
+	if (!ret)
+		ret = ht_test_check(&ht, keep, max_items, false);
+	if (ret)
+		goto out;
+
+	drm_ht_get_stats(&ht, &stats);
+	if (stats.items != keep || (1UL << stats.order) > 8 * keep + 16) {
+		printk(KERN_ERR HT_PFX "%lu items in order %u table\n",
+		       stats.items, stats.order);
+		ret = -EINVAL;
+		goto out;
+	}
+	printk(KERN_INFO HT_PFX "shrank to order %u after %u grows, "
+	       "%u shrinks\n", stats.order, stats.grows, stats.shrinks);
+
+	ht_test_remove(&ht, 0, keep);
+out:
+	drm_ht_remove(&ht);
+	return ret;
+}
+
+struct ht_test_reader {
+	struct drm_open_hash *ht;
+	unsigned nkeys;
+	unsigned long lookups;
+	unsigned long misses;
+};
+
+/* looks up the even keys, which stay hashed while the odd ones come and go */
+static int ht_test_reader_fn(void *data)
+{
+	struct ht_test_reader *reader = data;
+	struct drm_hash_item *item;
+	unsigned i = 0;
+
+	while (!kthread_should_stop()) {
+		rcu_read_lock();
+		if (drm_ht_find_item(reader->ht, ht_test_key(2 * i), &item) ||
+		    item != &items[2 * i])
+			reader->misses++;
+		rcu_read_unlock();
+		reader->lookups++;
+		if (++i == reader->nkeys) {
+			i = 0;
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static int ht_test_concurrent(void)
+{
+	struct ht_test_reader reader;
+	struct drm_ht_stats stats;
+	struct task_struct *task;
+	struct drm_open_hash ht;
+	unsigned i, r;
+	int ret;
+
+	ret = drm_ht_create(&ht, 4);
+	if (ret)
+		return ret;
+
+	reader.ht = &ht;
+	reader.nkeys = max_items / 16;
+	reader.lookups = 0;
+	reader.misses = 0;
+	for (i = 0; i < reader.nkeys; i++) {
+		items[2 * i].key = ht_test_key(2 * i);
+		drm_ht_insert_item(&ht, &items[2 * i]);
+	}
+	ht_test_settle(&ht);
+
+	task = kthread_run(ht_test_reader_fn, &reader, "drm_ht_reader");
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		goto out;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		for (i = reader.nkeys; i < max_items / 2; i++) {
+			items[2 * i + 1].key = ht_test_key(2 * i + 1);
+			drm_ht_insert_item(&ht, &items[2 * i + 1]);
+		}
+		ht_test_settle(&ht);
+		for (i = reader.nkeys; i < max_items / 2; i++)
+			drm_ht_remove_item(&ht, &items[2 * i + 1]);
+		ht_test_settle(&ht);
+		/* the reader may still be walking a removed item */
+		synchronize_rcu();
+	}
+
+	kthread_stop(task);
+
+	drm_ht_get_stats(&ht, &stats);
+	printk(KERN_INFO HT_PFX "%lu lockless lookups during %u grows and "
+	       "%u shrinks, %lu missed\n", reader.lookups, stats.grows,
+	       stats.shrinks, reader.misses);
+	if (reader.misses || !stats.grows || !stats.shrinks)
+		ret = -EINVAL;
+
+	for (i = 0; i < reader.nkeys; i++)
+		drm_ht_remove_item(&ht, &items[2 * i]);
+out:
+	drm_ht_remove(&ht);
+	return ret;
+}
+
+static int ht_test_bench_one(unsigned n, bool fixed)
+{
+	struct drm_hash_item *item;
+	struct drm_ht_stats stats;
+	struct drm_open_hash ht;
+	ktime_t start;
+	u64 ns;
+	unsigned i;
+	int ret;
+
+	ret = drm_ht_create(&ht, HT_TEST_FIXED_ORDER);
+	if (ret)
+		return ret;
+	if (fixed)
+		ht.max_order = HT_TEST_FIXED_ORDER;
+
+	ret = ht_test_insert(&ht, 0, n);
+	if (ret)
+		goto out;
+	ht_test_settle(&ht);
+
+	start = ktime_get();
+	for (i = 0; i < lookups && !ret; i++)
+		ret = drm_ht_find_item(&ht,
+				       ht_test_key((i * 2654435761u) % n),
+				       &item);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret) {
+		printk(KERN_ERR HT_PFX "lookup failed\n");
+		goto out_remove;
+	}
+
+	drm_ht_get_stats(&ht, &stats);
+	printk(KERN_INFO HT_PFX "%7u items, %s order %2u: %llu ns/lookup, "
+	       "longest chain %lu\n", n, fixed ? "fixed   " : "resizing",
+	       stats.order, (unsigned long long)div_u64(ns, lookups),
+	       stats.max_chain);
+
+out_remove:
+	ht_test_remove(&ht, 0, n);
+out:
+	drm_ht_remove(&ht);
+	return ret;
+}
+
+static int ht_test_bench(void)
+{
+	unsigned n;
+	int ret = 0;
+
+	for (n = 1 << 10; !ret; n *= 4) {
+		if (n > max_items)
+			n = max_items;
+		ret = ht_test_bench_one(n, true);
+		if (!ret)
+			ret = ht_test_bench_one(n, false);
+		if (n == max_items)
+			break;
+	}
+	return ret;
+}
+
+static int __init drm_hashtab_test_init(void)
+{
+	int ret;
+
+	if (max_items < 1024 || !lookups || !rounds)
+		return -EINVAL;
+
+	items = vzalloc(max_items * sizeof(*items));
+	if (!items)
+		return -ENOMEM;
+
+	ret = ht_test_resize();
+	if (!ret)
+		ret = ht_test_concurrent();
+	if (!ret)
+		ret = ht_test_bench();
+
+	vfree(items);
+	return ret;
+}
+
+static void __exit drm_hashtab_test_exit(void)
+{
+}
+
+module_init(drm_hashtab_test_init);
+module_exit(drm_hashtab_test_exit);
+
+MODULE_DESCRIPTION("Selftest and benchmark for the drm hash tables");
+MODULE_LICENSE("GPL and additional rights");
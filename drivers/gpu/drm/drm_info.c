@@ -259,6 +259,51 @@ int drm_gem_name_info(struct seq_file *m, void *data)
 	return 0;
 }
 
+static void drm_hashtab_one_info(struct seq_file *m, const char *name,
+				 struct drm_ht_stats *stats)
+{
+	unsigned int i;
+
+	seq_printf(m, "%-11s %8lu %8lu %8lu %9lu %5u %7u %c ", name,
+		   stats->items, 1UL << stats->order, stats->used,
+		   stats->max_chain, stats->grows, stats->shrinks,
+		   stats->resizing ? 'y' : 'n');
+	for (i = 0; i < DRM_HT_STATS_CHAINS; i++)
+		seq_printf(m, " %lu", stats->chains[i]);
+	seq_printf(m, "\n");
+}
+
+/**
+ * Called when "/debugfs/dri/.../hash_tables" is read.
+ *
+ * Prints the load and chain lengths of the map and GEM mmap offset hash
+ * tables. The chain columns count chains of 1, 2-3, 4-7, 8-15 and 16 or
+ * more items.
+ */
+int drm_hashtab_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct drm_gem_mm *mm = dev->mm_private;
+	struct drm_ht_stats stats;
+
+	seq_printf(m, "table          items  buckets     used max_chain "
+		   "grows shrinks r  chains\n");
+
+	mutex_lock(&dev->struct_mutex);
+	drm_ht_get_stats(&dev->map_hash, &stats);
+	mutex_unlock(&dev->struct_mutex);
+	drm_hashtab_one_info(m, "maps", &stats);
+
+	if (drm_core_check_feature(dev, DRIVER_GEM) && mm) {
+		read_lock(&mm->offset_lock);
+		drm_ht_get_stats(&mm->offset_hash, &stats);
+		read_unlock(&mm->offset_lock);
+		drm_hashtab_one_info(m, "gem_offsets", &stats);
+	}
+	return 0;
+}
+
 #if DRM_DEBUG_CODE
 
 int drm_vma_info(struct seq_file *m, void *data)
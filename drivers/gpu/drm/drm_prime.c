@@ -0,0 +1,670 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <linux/dma-buf.h>
+#include <linux/workqueue.h>
+#include "drmP.h"
+
+/** @file drm_prime.c
+ *
+ * Sharing GEM objects between devices.
+ *
+ * Flink names only mean something to the drm_device that created them.
+ * PRIME turns a GEM handle into a dma-buf file descriptor instead, which
+ * any driver can import, be it another drm_device or a V4L2 queue. The
+ * importer maps the exporter's pages, nothing is copied.
+ *
+ * An object is exported as at most one dma-buf, cached in
+ * obj->export_dma_buf while the object has handles, and an imported
+ * dma-buf maps to a single handle per file, so handles and fds can be
+ * passed back and forth without creating duplicates. Importing a dma-buf
+ * on the device that exported it returns the original object.
+ *
+ * Drivers either implement gem_prime_export/gem_prime_import themselves
+ * or use drm_gem_prime_export()/drm_gem_prime_import(), which only need
+ * the object's pages as an sg_table and optionally a kernel mapping and
+ * a userspace mmap.
+ *
+ * Imported objects are freed under their device's struct_mutex, but
+ * dropping the last dma-buf reference runs the exporter's release, which
+ * takes the exporter's struct_mutex, and the detach takes the dma-buf
+ * lock that is held around calls into the exporter. So the dma-buf is
+ * unmapped, detached and put from drm_prime_wq once the object is gone.
+ */
+
+struct drm_prime_member {
+	struct list_head entry;
+	struct dma_buf *dma_buf;
+	uint32_t handle;
+};
+
+/* Preallocated on import so that freeing the object can't fail */
+struct drm_prime_release {
+	struct work_struct work;
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+};
+
+static struct workqueue_struct *drm_prime_wq;
+
+static void drm_prime_release_work(struct work_struct *work)
+{
+	struct drm_prime_release *release =
+		container_of(work, struct drm_prime_release, work);
+	struct dma_buf_attachment *attach = release->attach;
+	struct dma_buf *dma_buf = attach->dmabuf;
+
+	if (release->sgt)
+		dma_buf_unmap_attachment(attach, release->sgt,
+					 DMA_BIDIRECTIONAL);
+	dma_buf_detach(dma_buf, attach);
+	/* remove the reference */
+	dma_buf_put(dma_buf);
+	kfree(release);
+}
+
+struct drm_prime_attachment {
+	struct sg_table *sgt;
+	enum dma_data_direction dir;
+};
+
+static int drm_gem_map_attach(struct dma_buf *dma_buf,
+			      struct device *target_dev,
+			      struct dma_buf_attachment *attach)
+{
+	struct drm_prime_attachment *prime_attach;
+
+	prime_attach = kzalloc(sizeof(*prime_attach), GFP_KERNEL);
+	if (!prime_attach)
+		return -ENOMEM;
+
+	prime_attach->dir = DMA_NONE;
+	attach->priv = prime_attach;
+
+	return 0;
+}
+
+static void drm_gem_map_detach(struct dma_buf *dma_buf,
+			       struct dma_buf_attachment *attach)
+{
+	struct drm_prime_attachment *prime_attach = attach->priv;
+	struct sg_table *sgt = prime_attach->sgt;
+
+	if (sgt) {
+		if (prime_attach->dir != DMA_NONE)
+			dma_unmap_sg(attach->dev, sgt->sgl, sgt->nents,
+				     prime_attach->dir);
+		sg_free_table(sgt);
+		kfree(sgt);
+	}
+
+	kfree(prime_attach);
+	attach->priv = NULL;
+}
+
+/*
+ * The mapping is kept until the importer detaches, importers tend to map
+ * once and use the buffer for as long as they hold it.
+ */
+static struct sg_table *drm_gem_map_dma_buf(struct dma_buf_attachment *attach,
+					    enum dma_data_direction dir)
+{
+	struct drm_prime_attachment *prime_attach = attach->priv;
+	struct drm_gem_object *obj = attach->dmabuf->priv;
+	struct drm_device *dev = obj->dev;
+	struct sg_table *sgt;
+
+	if (WARN_ON(dir == DMA_NONE))
+		return ERR_PTR(-EINVAL);
+
+	/* return the cached mapping when possible */
+	if (prime_attach->dir == dir)
+		return prime_attach->sgt;
+
+	/* two mappings with different directions aren't supported */
+	if (WARN_ON(prime_attach->dir != DMA_NONE))
+		return ERR_PTR(-EBUSY);
+
+	mutex_lock(&dev->struct_mutex);
+
+	sgt = dev->driver->gem_prime_get_sg_table(obj);
+	if (!IS_ERR(sgt)) {
+		if (!dma_map_sg(attach->dev, sgt->sgl, sgt->nents, dir)) {
+			sg_free_table(sgt);
+			kfree(sgt);
+			sgt = ERR_PTR(-ENOMEM);
+		} else {
+			prime_attach->sgt = sgt;
+			prime_attach->dir = dir;
+		}
+	}
+
+	mutex_unlock(&dev->struct_mutex);
+	return sgt;
+}
+
+static void drm_gem_unmap_dma_buf(struct dma_buf_attachment *attach,
+				  struct sg_table *sgt,
+				  enum dma_data_direction dir)
+{
+	/* nothing to be done here, see drm_gem_map_detach() */
+}
+
+static void drm_gem_dmabuf_release(struct dma_buf *dma_buf)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+
+	/* drop the reference the export took */
+	drm_gem_object_unreference_unlocked(obj);
+}
+
+static void *drm_gem_dmabuf_vmap(struct dma_buf *dma_buf)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+	struct drm_device *dev = obj->dev;
+
+	if (!dev->driver->gem_prime_vmap)
+		return NULL;
+
+	return dev->driver->gem_prime_vmap(obj);
+}
+
+static void drm_gem_dmabuf_vunmap(struct dma_buf *dma_buf, void *vaddr)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+	struct drm_device *dev = obj->dev;
+
+	if (dev->driver->gem_prime_vunmap)
+		dev->driver->gem_prime_vunmap(obj, vaddr);
+}
+
+static int drm_gem_dmabuf_mmap(struct dma_buf *dma_buf,
+			       struct vm_area_struct *vma)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+	struct drm_device *dev = obj->dev;
+
+	if (!dev->driver->gem_prime_mmap)
+		return -ENOSYS;
+
+	return dev->driver->gem_prime_mmap(obj, vma);
+}
+
+static const struct dma_buf_ops drm_gem_prime_dmabuf_ops = {
+	.attach = drm_gem_map_attach,
+	.detach = drm_gem_map_detach,
+	.map_dma_buf = drm_gem_map_dma_buf,
+	.unmap_dma_buf = drm_gem_unmap_dma_buf,
+	.release = drm_gem_dmabuf_release,
+	.vmap = drm_gem_dmabuf_vmap,
+	.vunmap = drm_gem_dmabuf_vunmap,
+	.mmap = drm_gem_dmabuf_mmap,
+};
+
+/**
+ * drm_gem_prime_export - export a GEM object as a dma-buf
+ * @dev: device the object belongs to
+ * @obj: object to export
+ * @flags: file flags of the dma-buf
+ *
+ * Generic gem_prime_export implementation for drivers providing the
+ * gem_prime_get_sg_table hook. The dma-buf holds a reference on @obj.
+ */
+struct dma_buf *drm_gem_prime_export(struct drm_device *dev,
+				     struct drm_gem_object *obj, int flags)
+{
+	struct dma_buf *dma_buf;
+
+	if (!dev->driver->gem_prime_get_sg_table)
+		return ERR_PTR(-ENOSYS);
+
+	dma_buf = dma_buf_export(obj, &drm_gem_prime_dmabuf_ops, obj->size,
+				 flags | O_RDWR);
+	if (!IS_ERR(dma_buf))
+		drm_gem_object_reference(obj);
+
+	return dma_buf;
+}
+EXPORT_SYMBOL(drm_gem_prime_export);
+
+/**
+ * drm_gem_prime_import - import a dma-buf as a GEM object
+ * @dev: device to import into
+ * @dma_buf: buffer to import
+ *
+ * Generic gem_prime_import implementation for drivers providing the
+ * gem_prime_import_sg_table hook. Returns a new reference to the object.
+ * The object keeps the dma-buf attached and mapped until it is freed,
+ * the driver's gem_free_object must call drm_prime_gem_destroy().
+ */
+struct drm_gem_object *drm_gem_prime_import(struct drm_device *dev,
+					    struct dma_buf *dma_buf)
+{
+	struct dma_buf_attachment *attach;
+	struct drm_prime_release *release;
+	struct sg_table *sgt;
+	struct drm_gem_object *obj;
+	int ret;
+
+	if (dma_buf->ops == &drm_gem_prime_dmabuf_ops) {
+		obj = dma_buf->priv;
+		if (obj->dev == dev) {
+			/*
+			 * Importing a dma-buf exported from our own device
+			 * gives back the object itself.
+			 */
+			drm_gem_object_reference(obj);
+			return obj;
+		}
+	}
+
+	if (!dev->driver->gem_prime_import_sg_table)
+		return ERR_PTR(-EINVAL);
+
+	release = kzalloc(sizeof(*release), GFP_KERNEL);
+	if (!release)
+		return ERR_PTR(-ENOMEM);
+
+	attach = dma_buf_attach(dma_buf, dev->dev);
+	if (IS_ERR(attach)) {
+		ret = PTR_ERR(attach);
+		goto fail_free;
+	}
+
+	get_dma_buf(dma_buf);
+
+	sgt = dma_buf_map_attachment(attach, DMA_BIDIRECTIONAL);
+	if (IS_ERR_OR_NULL(sgt)) {
+		ret = sgt ? PTR_ERR(sgt) : -ENOMEM;
+		goto fail_detach;
+	}
+
+	obj = dev->driver->gem_prime_import_sg_table(dev, dma_buf->size, sgt);
+	if (IS_ERR(obj)) {
+		ret = PTR_ERR(obj);
+		goto fail_unmap;
+	}
+
+	INIT_WORK(&release->work, drm_prime_release_work);
+	release->attach = attach;
+	obj->import_attach = attach;
+	obj->import_release = release;
+
+	return obj;
+
+fail_unmap:
+	dma_buf_unmap_attachment(attach, sgt, DMA_BIDIRECTIONAL);
+fail_detach:
+	dma_buf_detach(dma_buf, attach);
+	dma_buf_put(dma_buf);
+fail_free:
+	kfree(release);
+
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL(drm_gem_prime_import);
+
+/**
+ * drm_gem_prime_handle_to_fd - PRIME export for GEM drivers
+ * @dev: device the handle belongs to
+ * @file_priv: file the handle belongs to
+ * @handle: object to export
+ * @flags: DRM_CLOEXEC or 0
+ * @prime_fd: returned dma-buf file descriptor
+ *
+ * Objects that were imported are exported as the dma-buf they came
+ * from, all others through the driver's gem_prime_export hook, once.
+ */
+int drm_gem_prime_handle_to_fd(struct drm_device *dev,
+		struct drm_file *file_priv, uint32_t handle, uint32_t flags,
+		int *prime_fd)
+{
+	struct drm_gem_object *obj;
+	struct dma_buf *dma_buf;
+	uint32_t exported_handle;
+	int ret = 0;
+
+	obj = drm_gem_object_lookup(dev, file_priv, handle);
+	if (!obj)
+		return -ENOENT;
+
+	mutex_lock(&file_priv->prime.lock);
+
+	if (obj->import_attach) {
+		dma_buf = obj->import_attach->dmabuf;
+		get_dma_buf(dma_buf);
+		goto out_have_dma_buf;
+	}
+
+	mutex_lock(&dev->struct_mutex);
+	if (obj->export_dma_buf) {
+		dma_buf = obj->export_dma_buf;
+		get_dma_buf(dma_buf);
+	} else {
+		dma_buf = dev->driver->gem_prime_export(dev, obj, flags);
+		if (IS_ERR(dma_buf)) {
+			mutex_unlock(&dev->struct_mutex);
+			ret = PTR_ERR(dma_buf);
+			goto out;
+		}
+		/* one reference for the object, one for the fd */
+		obj->export_dma_buf = dma_buf;
+		get_dma_buf(dma_buf);
+	}
+	mutex_unlock(&dev->struct_mutex);
+
+out_have_dma_buf:
+	if (drm_prime_lookup_buf_handle(&file_priv->prime, dma_buf,
+					&exported_handle)) {
+		ret = drm_prime_add_buf_handle(&file_priv->prime, dma_buf,
+					       handle);
+		if (ret) {
+			dma_buf_put(dma_buf);
+			goto out;
+		}
+	}
+
+	ret = dma_buf_fd(dma_buf, flags);
+	if (ret < 0) {
+		dma_buf_put(dma_buf);
+		goto out;
+	}
+
+	*prime_fd = ret;
+	ret = 0;
+out:
+	mutex_unlock(&file_priv->prime.lock);
+	drm_gem_object_unreference_unlocked(obj);
+	return ret;
+}
+EXPORT_SYMBOL(drm_gem_prime_handle_to_fd);
+
+/**
+ * drm_gem_prime_fd_to_handle - PRIME import for GEM drivers
+ * @dev: device to import into
+ * @file_priv: file to create the handle in
+ * @prime_fd: dma-buf file descriptor
+ * @handle: returned handle
+ *
+ * Returns the existing handle if this file imported or exported the
+ * dma-buf before.
+ */
+int drm_gem_prime_fd_to_handle(struct drm_device *dev,
+		struct drm_file *file_priv, int prime_fd, uint32_t *handle)
+{
+	struct dma_buf *dma_buf;
+	struct drm_gem_object *obj;
+	int ret;
+
+	dma_buf = dma_buf_get(prime_fd);
+	if (IS_ERR(dma_buf))
+		return PTR_ERR(dma_buf);
+
+	mutex_lock(&file_priv->prime.lock);
+
+	ret = drm_prime_lookup_buf_handle(&file_priv->prime, dma_buf, handle);
+	if (!ret)
+		goto out_put;
+
+	obj = dev->driver->gem_prime_import(dev, dma_buf);
+	if (IS_ERR(obj)) {
+		ret = PTR_ERR(obj);
+		goto out_put;
+	}
+
+	ret = drm_gem_handle_create(file_priv, obj, handle);
+	drm_gem_object_unreference_unlocked(obj);
+	if (ret)
+		goto out_put;
+
+	ret = drm_prime_add_buf_handle(&file_priv->prime, dma_buf, *handle);
+	if (ret) {
+		/* deleting the handle takes the prime lock */
+		mutex_unlock(&file_priv->prime.lock);
+		drm_gem_handle_delete(file_priv, *handle);
+		dma_buf_put(dma_buf);
+		return ret;
+	}
+
+out_put:
+	mutex_unlock(&file_priv->prime.lock);
+	dma_buf_put(dma_buf);
+	return ret;
+}
+EXPORT_SYMBOL(drm_gem_prime_fd_to_handle);
+
+int drm_prime_handle_to_fd_ioctl(struct drm_device *dev, void *data,
+				 struct drm_file *file_priv)
+{
+	struct drm_prime_handle *args = data;
+	uint32_t flags;
+
+	if (!drm_core_check_feature(dev, DRIVER_PRIME))
+		return -EINVAL;
+
+	if (!dev->driver->prime_handle_to_fd)
+		return -ENOSYS;
+
+	/* check flags are valid */
+	if (args->flags & ~DRM_CLOEXEC)
+		return -EINVAL;
+
+	/* we only want to pass DRM_CLOEXEC which is == O_CLOEXEC */
+	flags = args->flags & DRM_CLOEXEC;
+
+	return dev->driver->prime_handle_to_fd(dev, file_priv,
+			args->handle, flags, &args->fd);
+}
+
+int drm_prime_fd_to_handle_ioctl(struct drm_device *dev, void *data,
+				 struct drm_file *file_priv)
+{
+	struct drm_prime_handle *args = data;
+
+	if (!drm_core_check_feature(dev, DRIVER_PRIME))
+		return -EINVAL;
+
+	if (!dev->driver->prime_fd_to_handle)
+		return -ENOSYS;
+
+	return dev->driver->prime_fd_to_handle(dev, file_priv,
+			args->fd, &args->handle);
+}
+
+/**
+ * drm_prime_pages_to_sg - build an sg_table from an array of pages
+ * @pages: pages backing the object
+ * @nr_pages: number of pages
+ *
+ * For gem_prime_get_sg_table implementations. One entry per page, the
+ * caller frees the table with sg_free_table() and kfree().
+ */
+struct sg_table *drm_prime_pages_to_sg(struct page **pages, int nr_pages)
+{
+	struct sg_table *sg;
+	struct scatterlist *iter;
+	int i, ret;
+
+	sg = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
+	if (!sg)
+		return ERR_PTR(-ENOMEM);
+
+	ret = sg_alloc_table(sg, nr_pages, GFP_KERNEL);
+	if (ret) {
+		kfree(sg);
+		return ERR_PTR(ret);
+	}
+
+	for_each_sg(sg->sgl, iter, nr_pages, i)
+		sg_set_page(iter, pages[i], PAGE_SIZE, 0);
+
+	return sg;
+}
+EXPORT_SYMBOL(drm_prime_pages_to_sg);
+
+/**
+ * drm_prime_sg_to_page_addr_arrays - convert an sg_table into page arrays
+ * @sgt: scatter-gather table of the imported buffer
+ * @pages: optional array of page pointers to fill
+ * @addrs: optional array of dma addresses to fill
+ * @max_pages: size of the arrays
+ *
+ * For gem_prime_import_sg_table implementations.
+ */
+int drm_prime_sg_to_page_addr_arrays(struct sg_table *sgt, struct page **pages,
+				     dma_addr_t *addrs, int max_pages)
+{
+	struct scatterlist *sg;
+	struct page *page;
+	unsigned int len;
+	dma_addr_t addr;
+	int i, index = 0;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		len = sg->length;
+		page = sg_page(sg);
+		addr = sg_dma_address(sg);
+
+		while (len > 0) {
+			if (WARN_ON(index >= max_pages))
+				return -EINVAL;
+			if (pages)
+				pages[index] = page;
+			if (addrs)
+				addrs[index] = addr;
+
+			page = nth_page(page, 1);
+			addr += PAGE_SIZE;
+			len -= min_t(unsigned int, len, PAGE_SIZE);
+			index++;
+		}
+	}
+	return 0;
+}
+EXPORT_SYMBOL(drm_prime_sg_to_page_addr_arrays);
+
+/**
+ * drm_prime_gem_destroy - release the dma-buf behind an imported object
+ * @obj: object created by drm_gem_prime_import()
+ * @sg: sg_table the object was created from
+ *
+ * Called from gem_free_object, under struct_mutex, for objects with an
+ * import_attach. The dma-buf is released later from drm_prime_wq, the
+ * sg_table must stay untouched until then.
+ */
+void drm_prime_gem_destroy(struct drm_gem_object *obj, struct sg_table *sg)
+{
+	struct drm_prime_release *release = obj->import_release;
+
+	release->sgt = sg;
+	obj->import_attach = NULL;
+	obj->import_release = NULL;
+	queue_work(drm_prime_wq, &release->work);
+}
+EXPORT_SYMBOL(drm_prime_gem_destroy);
+
+/**
+ * drm_prime_flush - wait for the release of freed imported objects
+ *
+ * Called before a device goes away, so that no release is left running
+ * into a driver that is being unloaded.
+ */
+void drm_prime_flush(void)
+{
+	flush_workqueue(drm_prime_wq);
+}
+EXPORT_SYMBOL(drm_prime_flush);
+
+int drm_prime_init(void)
+{
+	drm_prime_wq = alloc_workqueue("drm_prime", 0, 0);
+	return drm_prime_wq ? 0 : -ENOMEM;
+}
+
+void drm_prime_exit(void)
+{
+	destroy_workqueue(drm_prime_wq);
+}
+
+void drm_prime_init_file_private(struct drm_prime_file_private *prime)
+{
+	INIT_LIST_HEAD(&prime->head);
+	mutex_init(&prime->lock);
+}
+EXPORT_SYMBOL(drm_prime_init_file_private);
+
+void drm_prime_destroy_file_private(struct drm_prime_file_private *prime)
+{
+	/* by now drm_gem_release should've made sure the list is empty */
+	WARN_ON(!list_empty(&prime->head));
+}
+EXPORT_SYMBOL(drm_prime_destroy_file_private);
+
+/* Called with prime->lock held. The entry holds a dma-buf reference. */
+int drm_prime_add_buf_handle(struct drm_prime_file_private *prime,
+			     struct dma_buf *dma_buf, uint32_t handle)
+{
+	struct drm_prime_member *member;
+
+	member = kmalloc(sizeof(*member), GFP_KERNEL);
+	if (!member)
+		return -ENOMEM;
+
+	get_dma_buf(dma_buf);
+	member->dma_buf = dma_buf;
+	member->handle = handle;
+	list_add(&member->entry, &prime->head);
+	return 0;
+}
+EXPORT_SYMBOL(drm_prime_add_buf_handle);
+
+/* Called with prime->lock held. */
+int drm_prime_lookup_buf_handle(struct drm_prime_file_private *prime,
+				struct dma_buf *dma_buf, uint32_t *handle)
+{
+	struct drm_prime_member *member;
+
+	list_for_each_entry(member, &prime->head, entry) {
+		if (member->dma_buf == dma_buf) {
+			*handle = member->handle;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+EXPORT_SYMBOL(drm_prime_lookup_buf_handle);
+
+void drm_prime_remove_buf_handle(struct drm_prime_file_private *prime,
+				 struct dma_buf *dma_buf)
+{
+	struct drm_prime_member *member, *safe;
+
+	mutex_lock(&prime->lock);
+	list_for_each_entry_safe(member, safe, &prime->head, entry) {
+		if (member->dma_buf == dma_buf) {
+			dma_buf_put(dma_buf);
+			list_del(&member->entry);
+			kfree(member);
+		}
+	}
+	mutex_unlock(&prime->lock);
+}
+EXPORT_SYMBOL(drm_prime_remove_buf_handle);
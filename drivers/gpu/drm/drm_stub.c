@@ -463,6 +463,10 @@ void drm_put_dev(struct drm_device *dev)
 	if (dev->driver->unload)
 		dev->driver->unload(dev);
 
+	/* imported objects freed so far still release their dma-bufs */
+	if (driver->driver_features & DRIVER_GEM)
+		drm_prime_flush();
+
 	if (drm_core_has_AGP(dev) && dev->agp) {
 		kfree(dev->agp);
 		dev->agp = NULL;
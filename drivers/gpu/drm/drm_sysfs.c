@@ -171,6 +171,31 @@ static ssize_t status_show(struct device *device,
 			drm_get_connector_status_name(status));
 }
 
+/*
+ * Writing "detect" makes the next GETCONNECTOR call probe the connector
+ * instead of returning its cached mode list, for changes we don't get a
+ * hotplug event for (e.g. behind a KVM switch).
+ */
+static ssize_t status_store(struct device *device,
+			    struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct drm_connector *connector = to_drm_connector(device);
+	int ret;
+
+	if (!sysfs_streq(buf, "detect"))
+		return -EINVAL;
+
+	ret = mutex_lock_interruptible(&connector->dev->mode_config.mutex);
+	if (ret)
+		return ret;
+
+	connector->probe_generation = 0;
+	mutex_unlock(&connector->dev->mode_config.mutex);
+
+	return count;
+}
+
 static ssize_t dpms_show(struct device *device,
 			   struct device_attribute *attr,
 			   char *buf)
@@ -326,7 +351,7 @@ static ssize_t select_subconnector_show(struct device *device,
 }
 
 static struct device_attribute connector_attrs[] = {
-	__ATTR_RO(status),
+	__ATTR(status, S_IRUGO | S_IWUSR, status_show, status_store),
 	__ATTR_RO(enabled),
 	__ATTR_RO(dpms),
 	__ATTR_RO(modes),
@@ -478,6 +503,7 @@ void drm_sysfs_hotplug_event(struct drm_device *dev)
 
 	DRM_DEBUG("generating hotplug event\n");
 
+	drm_mode_config_invalidate_probes(dev);
 	kobject_uevent_env(&dev->primary->kdev.kobj, KOBJ_CHANGE, envp);
 }
 EXPORT_SYMBOL(drm_sysfs_hotplug_event);
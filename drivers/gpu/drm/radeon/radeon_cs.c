@@ -36,8 +36,11 @@ int radeon_cs_parser_relocs(struct radeon_cs_parser *p)
 {
 	struct drm_device *ddev = p->rdev->ddev;
 	struct radeon_cs_chunk *chunk;
-	unsigned i, j;
+	struct drm_gem_object **gobjs;
+	unsigned i, j, n = 0;
 	bool duplicate;
+	u32 *handles;
+	int ret;
 
 	if (p->chunk_relocs_idx == -1) {
 		return 0;
@@ -53,6 +56,12 @@ int radeon_cs_parser_relocs(struct radeon_cs_parser *p)
 	if (p->relocs == NULL) {
 		return -ENOMEM;
 	}
+	handles = kcalloc(p->nrelocs, sizeof(u32), GFP_KERNEL);
+	gobjs = kcalloc(p->nrelocs, sizeof(void *), GFP_KERNEL);
+	if (handles == NULL || gobjs == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
 	for (i = 0; i < p->nrelocs; i++) {
 		struct drm_radeon_cs_reloc *r;
 
@@ -66,27 +75,40 @@ int radeon_cs_parser_relocs(struct radeon_cs_parser *p)
 			}
 		}
 		if (!duplicate) {
-			p->relocs[i].gobj = drm_gem_object_lookup(ddev,
-								  p->filp,
-								  r->handle);
-			if (p->relocs[i].gobj == NULL) {
-				DRM_ERROR("gem object lookup failed 0x%x\n",
-					  r->handle);
-				return -ENOENT;
-			}
 			p->relocs_ptr[i] = &p->relocs[i];
+			p->relocs[i].handle = r->handle;
+			handles[n++] = r->handle;
+		}
+	}
+
+	/* resolve all buffers at once instead of one lookup per reloc */
+	ret = drm_gem_object_lookup_array(ddev, p->filp, handles, n, gobjs);
+	if (ret) {
+		DRM_ERROR("gem object lookup failed\n");
+		goto out;
+	}
+
+	for (i = 0, n = 0; i < p->nrelocs; i++) {
+		struct drm_radeon_cs_reloc *r;
+
+		r = (struct drm_radeon_cs_reloc *)&chunk->kdata[i*4];
+		if (p->relocs_ptr[i] == &p->relocs[i]) {
+			p->relocs[i].gobj = gobjs[n++];
 			p->relocs[i].robj = gem_to_radeon_bo(p->relocs[i].gobj);
 			p->relocs[i].lobj.bo = p->relocs[i].robj;
 			p->relocs[i].lobj.wdomain = r->write_domain;
 			p->relocs[i].lobj.rdomain = r->read_domains;
 			p->relocs[i].lobj.tv.bo = &p->relocs[i].robj->tbo;
-			p->relocs[i].handle = r->handle;
 			p->relocs[i].flags = r->flags;
 			radeon_bo_list_add_object(&p->relocs[i].lobj,
 						  &p->validated);
 		}
 	}
-	return radeon_bo_list_validate(&p->validated);
+	ret = radeon_bo_list_validate(&p->validated);
+out:
+	kfree(gobjs);
+	kfree(handles);
+	return ret;
 }
 
 int radeon_cs_parser_init(struct radeon_cs_parser *p, void *data)
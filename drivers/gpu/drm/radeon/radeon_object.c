@@ -56,7 +56,7 @@ static void radeon_ttm_bo_destroy(struct ttm_buffer_object *tbo)
 	mutex_unlock(&bo->rdev->gem.mutex);
 	radeon_bo_clear_surface_reg(bo);
 	drm_gem_object_release(&bo->gem_base);
-	kfree(bo);
+	kfree_rcu(bo, gem_base.rcu);
 }
 
 bool radeon_ttm_bo_is_radeon_bo(struct ttm_buffer_object *bo)
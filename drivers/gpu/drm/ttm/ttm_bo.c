@@ -367,6 +367,91 @@ static int ttm_bo_add_ttm(struct ttm_buffer_object *bo, bool zero_alloc)
 	return ret;
 }
 
+int ttm_mem_type_wait_move(struct ttm_bo_device *bdev, uint32_t mem_type,
+			   bool interruptible, bool no_wait)
+{
+	struct ttm_bo_driver *driver = bdev->driver;
+	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
+	void *sync_obj;
+	void *sync_obj_arg;
+	void *tmp_obj = NULL;
+	int ret;
+
+	spin_lock(&bdev->fence_lock);
+	if (likely(man->move == NULL)) {
+		spin_unlock(&bdev->fence_lock);
+		return 0;
+	}
+
+	if (driver->sync_obj_signaled(man->move, man->move_arg)) {
+		tmp_obj = man->move;
+		man->move = NULL;
+		spin_unlock(&bdev->fence_lock);
+		driver->sync_obj_unref(&tmp_obj);
+		return 0;
+	}
+
+	if (no_wait) {
+		spin_unlock(&bdev->fence_lock);
+		return -EBUSY;
+	}
+
+	sync_obj = driver->sync_obj_ref(man->move);
+	sync_obj_arg = man->move_arg;
+	spin_unlock(&bdev->fence_lock);
+
+	ret = driver->sync_obj_wait(sync_obj, sync_obj_arg,
+				    false, interruptible);
+	if (likely(ret == 0)) {
+		spin_lock(&bdev->fence_lock);
+		if (man->move == sync_obj) {
+			tmp_obj = man->move;
+			man->move = NULL;
+		}
+		spin_unlock(&bdev->fence_lock);
+		if (tmp_obj)
+			driver->sync_obj_unref(&tmp_obj);
+	}
+	driver->sync_obj_unref(&sync_obj);
+	return ret;
+}
+EXPORT_SYMBOL(ttm_mem_type_wait_move);
+
+/**
+ * Make a buffer object about to be moved into @mem_type wait for the last
+ * pipelined eviction out of that memory type.
+ *
+ * An idle buffer object going to fixed memory just takes over the sync
+ * object of the eviction, so the CPU only blocks on it when it actually
+ * touches the buffer. Otherwise the space is about to be rebound or the
+ * buffer has its own sync object, so wait here.
+ */
+static int ttm_bo_add_move_fence(struct ttm_buffer_object *bo,
+				 uint32_t mem_type, bool interruptible,
+				 bool no_wait_gpu)
+{
+	struct ttm_bo_device *bdev = bo->bdev;
+	struct ttm_bo_driver *driver = bdev->driver;
+	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
+
+	spin_lock(&bdev->fence_lock);
+	if (likely(man->move == NULL)) {
+		spin_unlock(&bdev->fence_lock);
+		return 0;
+	}
+	if ((man->flags & TTM_MEMTYPE_FLAG_FIXED) && bo->sync_obj == NULL) {
+		bo->sync_obj = driver->sync_obj_ref(man->move);
+		bo->sync_obj_arg = man->move_arg;
+		set_bit(TTM_BO_PRIV_FLAG_MOVING, &bo->priv_flags);
+		spin_unlock(&bdev->fence_lock);
+		return 0;
+	}
+	spin_unlock(&bdev->fence_lock);
+
+	return ttm_mem_type_wait_move(bdev, mem_type, interruptible,
+				      no_wait_gpu);
+}
+
 static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 				  struct ttm_mem_reg *mem,
 				  bool evict, bool interruptible,
@@ -379,6 +464,11 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 	struct ttm_mem_type_manager *new_man = &bdev->man[mem->mem_type];
 	int ret = 0;
 
+	ret = ttm_bo_add_move_fence(bo, mem->mem_type, interruptible,
+				    no_wait_gpu);
+	if (unlikely(ret != 0))
+		return ret;
+
 	if (old_is_pci || new_is_pci ||
 	    ((mem->placement & bo->mem.placement & TTM_PL_MASK_CACHING) == 0)) {
 		ret = ttm_mem_io_lock(old_man, true);
@@ -1345,6 +1435,7 @@ int ttm_bo_clean_mm(struct ttm_bo_device *bdev, unsigned mem_type)
 	ret = 0;
 	if (mem_type > 0) {
 		ttm_bo_force_list_clean(bdev, mem_type, false);
+		(void) ttm_mem_type_wait_move(bdev, mem_type, false, false);
 
 		ret = (*man->func->takedown)(man);
 	}
@@ -1356,6 +1447,7 @@ EXPORT_SYMBOL(ttm_bo_clean_mm);
 int ttm_bo_evict_mm(struct ttm_bo_device *bdev, unsigned mem_type)
 {
 	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
+	int ret;
 
 	if (mem_type == 0 || mem_type >= TTM_NUM_MEM_TYPES) {
 		printk(KERN_ERR TTM_PFX
@@ -1371,7 +1463,11 @@ int ttm_bo_evict_mm(struct ttm_bo_device *bdev, unsigned mem_type)
 		return 0;
 	}
 
-	return ttm_bo_force_list_clean(bdev, mem_type, true);
+	ret = ttm_bo_force_list_clean(bdev, mem_type, true);
+	if (ret)
+		return ret;
+
+	return ttm_mem_type_wait_move(bdev, mem_type, false, false);
 }
 EXPORT_SYMBOL(ttm_bo_evict_mm);
 
@@ -1388,6 +1484,8 @@ int ttm_bo_init_mm(struct ttm_bo_device *bdev, unsigned type,
 	man->use_io_reserve_lru = false;
 	mutex_init(&man->io_reserve_mutex);
 	INIT_LIST_HEAD(&man->io_reserve_lru);
+	man->move = NULL;
+	man->move_arg = NULL;
 
 	ret = bdev->driver->init_mem_type(bdev, type, man);
 	if (ret)
@@ -0,0 +1,519 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Selftest for pipelined buffer evictions.
+ * - A dummy driver with a small fixed "vram" memory type
+ * - Moves are executed by a fake engine that completes them in order,
+ *   each one taking a fixed time
+ * - Buffers are created until vram overflows several times, once with
+ *   synchronous and once with pipelined evictions
+ * - Checks that no buffer can be used before the eviction of the space it
+ *   landed in is done, and reports submission and completion times
+ */
+#include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+
+#include "ttm/ttm_bo_driver.h"
+#include "ttm/ttm_placement.h"
+
+static unsigned vram_pages = 1024;
+module_param(vram_pages, uint, 0444);
+MODULE_PARM_DESC(vram_pages, "Size of the fake vram in pages");
+
+static unsigned bo_pages = 128;
+module_param(bo_pages, uint, 0444);
+MODULE_PARM_DESC(bo_pages, "Buffer object size in pages");
+
+static unsigned nbos = 64;
+module_param(nbos, uint, 0444);
+MODULE_PARM_DESC(nbos, "Number of buffer objects to create");
+
+static unsigned move_us = 500;
+module_param(move_us, uint, 0444);
+MODULE_PARM_DESC(move_us, "Time the fake engine takes per move");
+
+static unsigned cpu_us = 200;
+module_param(cpu_us, uint, 0444);
+MODULE_PARM_DESC(cpu_us, "Simulated cpu work per buffer object");
+
+struct ttm_evict_test_fence {
+	struct kref	kref;
+	u32		seqno;
+	ktime_t		done;
+};
+
+struct ttm_evict_test {
+	struct ttm_bo_device		bdev;
+	bool				pipeline;
+	spinlock_t			engine_lock;
+	u32				seqno;
+	ktime_t				busy_until;
+	/* Fence of the last move out of each vram page. */
+	struct ttm_evict_test_fence	**slots;
+	unsigned long			violations;
+};
+
+static struct drm_global_reference ttm_evict_test_mem_ref;
+static struct ttm_bo_global_ref ttm_evict_test_bo_ref;
+
+static int ttm_evict_test_mem_init(struct drm_global_reference *ref)
+{
+	return ttm_mem_global_init(ref->object);
+}
+
+static void ttm_evict_test_mem_release(struct drm_global_reference *ref)
+{
+	ttm_mem_global_release(ref->object);
+}
+
+/*
+ * Fake engine. Moves complete in submission order, each move_us after the
+ * previous one or after its submission, whatever comes later.
+ */
+
+static struct ttm_evict_test_fence *
+ttm_evict_test_fence_emit(struct ttm_evict_test *t)
+{
+	struct ttm_evict_test_fence *fence;
+	ktime_t now = ktime_get();
+
+	fence = kmalloc(sizeof(*fence), GFP_KERNEL);
+	if (unlikely(fence == NULL))
+		return NULL;
+
+	kref_init(&fence->kref);
+	spin_lock(&t->engine_lock);
+	if (ktime_to_ns(t->busy_until) < ktime_to_ns(now))
+		t->busy_until = now;
+	t->busy_until = ktime_add_us(t->busy_until, move_us);
+	fence->seqno = ++t->seqno;
+	fence->done = t->busy_until;
+	spin_unlock(&t->engine_lock);
+
+	return fence;
+}
+
+static void ttm_evict_test_fence_release(struct kref *kref)
+{
+	kfree(container_of(kref, struct ttm_evict_test_fence, kref));
+}
+
+static bool ttm_evict_test_sync_obj_signaled(void *sync_obj, void *sync_arg)
+{
+	struct ttm_evict_test_fence *fence = sync_obj;
+
+	return ktime_to_ns(ktime_get()) >= ktime_to_ns(fence->done);
+}
+
+static int ttm_evict_test_wait_until(ktime_t done, bool interruptible)
+{
+	while (ktime_to_ns(ktime_get()) < ktime_to_ns(done)) {
+		if (interruptible && signal_pending(current))
+			return -ERESTARTSYS;
+		set_current_state(interruptible ? TASK_INTERRUPTIBLE :
+				  TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout(&done, HRTIMER_MODE_ABS);
+	}
+	return 0;
+}
+
+static int ttm_evict_test_sync_obj_wait(void *sync_obj, void *sync_arg,
+					bool lazy, bool interruptible)
+{
+	struct ttm_evict_test_fence *fence = sync_obj;
+
+	return ttm_evict_test_wait_until(fence->done, interruptible);
+}
+
+static int ttm_evict_test_sync_obj_flush(void *sync_obj, void *sync_arg)
+{
+	return 0;
+}
+
+static void ttm_evict_test_sync_obj_unref(void **sync_obj)
+{
+	struct ttm_evict_test_fence *fence = *sync_obj;
+
+	*sync_obj = NULL;
+	kref_put(&fence->kref, ttm_evict_test_fence_release);
+}
+
+static void *ttm_evict_test_sync_obj_ref(void *sync_obj)
+{
+	struct ttm_evict_test_fence *fence = sync_obj;
+
+	kref_get(&fence->kref);
+	return fence;
+}
+
+/*
+ * Dummy backend. Nothing is ever bound outside of the fake vram.
+ */
+
+static int ttm_evict_test_be_populate(struct ttm_backend *backend,
+				      unsigned long num_pages,
+				      struct page **pages,
+				      struct page *dummy_read_page,
+				      dma_addr_t *dma_addrs)
+{
+	return 0;
+}
+
+static void ttm_evict_test_be_clear(struct ttm_backend *backend)
+{
+}
+
+static int ttm_evict_test_be_bind(struct ttm_backend *backend,
+				  struct ttm_mem_reg *bo_mem)
+{
+	return 0;
+}
+
+static int ttm_evict_test_be_unbind(struct ttm_backend *backend)
+{
+	return 0;
+}
+
+static void ttm_evict_test_be_destroy(struct ttm_backend *backend)
+{
+	kfree(backend);
+}
+
+static struct ttm_backend_func ttm_evict_test_backend_func = {
+	.populate = &ttm_evict_test_be_populate,
+	.clear = &ttm_evict_test_be_clear,
+	.bind = &ttm_evict_test_be_bind,
+	.unbind = &ttm_evict_test_be_unbind,
+	.destroy = &ttm_evict_test_be_destroy,
+};
+
+static struct ttm_backend *
+ttm_evict_test_create_ttm_backend_entry(struct ttm_bo_device *bdev)
+{
+	struct ttm_backend *backend;
+
+	backend = kzalloc(sizeof(*backend), GFP_KERNEL);
+	if (unlikely(backend == NULL))
+		return NULL;
+
+	backend->bdev = bdev;
+	backend->func = &ttm_evict_test_backend_func;
+	return backend;
+}
+
+static int ttm_evict_test_invalidate_caches(struct ttm_bo_device *bdev,
+					    uint32_t flags)
+{
+	return 0;
+}
+
+static int ttm_evict_test_init_mem_type(struct ttm_bo_device *bdev,
+					uint32_t type,
+					struct ttm_mem_type_manager *man)
+{
+	struct ttm_evict_test *t = container_of(bdev, struct ttm_evict_test,
+						bdev);
+
+	switch (type) {
+	case TTM_PL_SYSTEM:
+		man->flags = TTM_MEMTYPE_FLAG_MAPPABLE;
+		man->available_caching = TTM_PL_MASK_CACHING;
+		man->default_caching = TTM_PL_FLAG_CACHED;
+		break;
+	case TTM_PL_VRAM:
+		man->func = &ttm_bo_manager_func;
+		man->gpu_offset = 0;
+		man->flags = TTM_MEMTYPE_FLAG_FIXED;
+		if (t->pipeline)
+			man->flags |= TTM_MEMTYPE_FLAG_PIPELINE_EVICT;
+		man->available_caching = TTM_PL_MASK_CACHING;
+		man->default_caching = TTM_PL_FLAG_CACHED;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static uint32_t ttm_evict_test_system_placement =
+	TTM_PL_FLAG_SYSTEM | TTM_PL_FLAG_CACHED;
+static uint32_t ttm_evict_test_vram_placement =
+	TTM_PL_FLAG_VRAM | TTM_PL_FLAG_CACHED;
+
+static void ttm_evict_test_evict_flags(struct ttm_buffer_object *bo,
+				       struct ttm_placement *placement)
+{
+	placement->fpfn = 0;
+	placement->lpfn = 0;
+	placement->placement = &ttm_evict_test_system_placement;
+	placement->busy_placement = &ttm_evict_test_system_placement;
+	placement->num_placement = 1;
+	placement->num_busy_placement = 1;
+}
+
+static int ttm_evict_test_move(struct ttm_buffer_object *bo,
+			       bool evict, bool interruptible,
+			       bool no_wait_reserve, bool no_wait_gpu,
+			       struct ttm_mem_reg *new_mem)
+{
+	struct ttm_evict_test *t = container_of(bo->bdev, struct ttm_evict_test,
+						bdev);
+	struct ttm_mem_reg *old_mem = &bo->mem;
+	struct ttm_evict_test_fence *fence;
+	unsigned long i;
+	int ret;
+
+	if (old_mem->mem_type == TTM_PL_SYSTEM && bo->ttm == NULL) {
+		*old_mem = *new_mem;
+		new_mem->mm_node = NULL;
+		return 0;
+	}
+
+	fence = ttm_evict_test_fence_emit(t);
+	if (unlikely(fence == NULL))
+		return -ENOMEM;
+
+	if (old_mem->mem_type == TTM_PL_VRAM) {
+		for (i = old_mem->start;
+		     i < old_mem->start + old_mem->num_pages; ++i) {
+			if (t->slots[i])
+				ttm_evict_test_sync_obj_unref((void **)
+							      &t->slots[i]);
+			t->slots[i] = ttm_evict_test_sync_obj_ref(fence);
+		}
+	}
+
+	ret = ttm_bo_move_accel_cleanup(bo, fence, NULL, evict,
+					no_wait_reserve, no_wait_gpu, new_mem);
+	ttm_evict_test_sync_obj_unref((void **)&fence);
+	return ret;
+}
+
+static int ttm_evict_test_verify_access(struct ttm_buffer_object *bo,
+					struct file *filp)
+{
+	return -EPERM;
+}
+
+static struct ttm_bo_driver ttm_evict_test_driver = {
+	.create_ttm_backend_entry = &ttm_evict_test_create_ttm_backend_entry,
+	.invalidate_caches = &ttm_evict_test_invalidate_caches,
+	.init_mem_type = &ttm_evict_test_init_mem_type,
+	.evict_flags = &ttm_evict_test_evict_flags,
+	.move = &ttm_evict_test_move,
+	.verify_access = &ttm_evict_test_verify_access,
+	.sync_obj_signaled = &ttm_evict_test_sync_obj_signaled,
+	.sync_obj_wait = &ttm_evict_test_sync_obj_wait,
+	.sync_obj_flush = &ttm_evict_test_sync_obj_flush,
+	.sync_obj_unref = &ttm_evict_test_sync_obj_unref,
+	.sync_obj_ref = &ttm_evict_test_sync_obj_ref,
+};
+
+/*
+ * Work submitted for a buffer is ordered after its sync object. Any
+ * eviction out of its space that isn't done yet must be ordered before it.
+ */
+static void ttm_evict_test_check_gpu(struct ttm_evict_test *t,
+				     struct ttm_buffer_object *bo)
+{
+	struct ttm_evict_test_fence *fence;
+	u32 seqno = 0;
+	unsigned long i;
+
+	spin_lock(&t->bdev.fence_lock);
+	fence = bo->sync_obj;
+	if (fence)
+		seqno = fence->seqno;
+	spin_unlock(&t->bdev.fence_lock);
+
+	for (i = bo->mem.start; i < bo->mem.start + bo->mem.num_pages; ++i) {
+		fence = t->slots[i];
+		if (fence && fence->seqno > seqno &&
+		    !ttm_evict_test_sync_obj_signaled(fence, NULL)) {
+			t->violations++;
+			return;
+		}
+	}
+}
+
+/*
+ * The cpu waits for the buffer before touching it. Afterwards all
+ * evictions out of its space must be done.
+ */
+static void ttm_evict_test_check_cpu(struct ttm_evict_test *t,
+				     struct ttm_buffer_object *bo)
+{
+	unsigned long i;
+	int ret;
+
+	spin_lock(&t->bdev.fence_lock);
+	ret = ttm_bo_wait(bo, false, false, false);
+	spin_unlock(&t->bdev.fence_lock);
+	if (unlikely(ret != 0)) {
+		t->violations++;
+		return;
+	}
+
+	for (i = bo->mem.start; i < bo->mem.start + bo->mem.num_pages; ++i) {
+		if (t->slots[i] &&
+		    !ttm_evict_test_sync_obj_signaled(t->slots[i], NULL)) {
+			t->violations++;
+			return;
+		}
+	}
+}
+
+static int ttm_evict_test_run(bool pipeline)
+{
+	struct ttm_evict_test *t;
+	struct ttm_buffer_object **bos;
+	struct ttm_placement placement;
+	ktime_t start, start_idle;
+	u64 submit_ns, idle_ns;
+	unsigned i;
+	int ret;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	bos = kcalloc(nbos, sizeof(*bos), GFP_KERNEL);
+	if (unlikely(t == NULL || bos == NULL)) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	t->slots = vzalloc(vram_pages * sizeof(*t->slots));
+	if (unlikely(t->slots == NULL)) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	t->pipeline = pipeline;
+	spin_lock_init(&t->engine_lock);
+	t->busy_until = ktime_get();
+
+	ret = ttm_bo_device_init(&t->bdev, ttm_evict_test_bo_ref.ref.object,
+				 &ttm_evict_test_driver, 0, false);
+	if (unlikely(ret != 0))
+		goto out_free;
+	ret = ttm_bo_init_mm(&t->bdev, TTM_PL_VRAM, vram_pages);
+	if (unlikely(ret != 0))
+		goto out_release;
+
+	memset(&placement, 0, sizeof(placement));
+	placement.placement = &ttm_evict_test_vram_placement;
+	placement.busy_placement = &ttm_evict_test_vram_placement;
+	placement.num_placement = 1;
+	placement.num_busy_placement = 1;
+
+	start = ktime_get();
+	for (i = 0; i < nbos; ++i) {
+		ret = ttm_bo_create(&t->bdev, (unsigned long)bo_pages << PAGE_SHIFT,
+				    ttm_bo_type_device, &placement, 0, 0,
+				    false, NULL, &bos[i]);
+		if (unlikely(ret != 0))
+			break;
+		ttm_evict_test_check_gpu(t, bos[i]);
+		udelay(cpu_us);
+	}
+	submit_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	while (i-- > 0) {
+		if (bos[i]->mem.mem_type == TTM_PL_VRAM)
+			ttm_evict_test_check_cpu(t, bos[i]);
+		ttm_bo_unref(&bos[i]);
+	}
+	spin_lock(&t->engine_lock);
+	start_idle = t->busy_until;
+	spin_unlock(&t->engine_lock);
+	(void) ttm_evict_test_wait_until(start_idle, false);
+	idle_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	printk(KERN_INFO TTM_PFX
+	       "Evict test %s: %u moves, submit %llu us, idle %llu us, "
+	       "%lu violations.\n", pipeline ? "pipelined" : "synchronous",
+	       t->seqno, (unsigned long long)div_u64(submit_ns, NSEC_PER_USEC),
+	       (unsigned long long)div_u64(idle_ns, NSEC_PER_USEC),
+	       t->violations);
+	if (ret == 0 && t->violations)
+		ret = -EINVAL;
+
+	(void) ttm_bo_clean_mm(&t->bdev, TTM_PL_VRAM);
+out_release:
+	ttm_bo_device_release(&t->bdev);
+out_free:
+	if (t && t->slots) {
+		for (i = 0; i < vram_pages; ++i)
+			if (t->slots[i])
+				ttm_evict_test_sync_obj_unref((void **)
+							      &t->slots[i]);
+		vfree(t->slots);
+	}
+	kfree(bos);
+	kfree(t);
+	return ret;
+}
+
+static int __init ttm_evict_test_init(void)
+{
+	struct drm_global_reference *global_ref;
+	int ret;
+
+	global_ref = &ttm_evict_test_mem_ref;
+	global_ref->global_type = DRM_GLOBAL_TTM_MEM;
+	global_ref->size = sizeof(struct ttm_mem_global);
+	global_ref->init = &ttm_evict_test_mem_init;
+	global_ref->release = &ttm_evict_test_mem_release;
+	ret = drm_global_item_ref(global_ref);
+	if (unlikely(ret != 0))
+		return ret;
+
+	ttm_evict_test_bo_ref.mem_glob = ttm_evict_test_mem_ref.object;
+	global_ref = &ttm_evict_test_bo_ref.ref;
+	global_ref->global_type = DRM_GLOBAL_TTM_BO;
+	global_ref->size = sizeof(struct ttm_bo_global);
+	global_ref->init = &ttm_bo_global_init;
+	global_ref->release = &ttm_bo_global_release;
+	ret = drm_global_item_ref(global_ref);
+	if (unlikely(ret != 0))
+		goto out_unref_mem;
+
+	ret = ttm_evict_test_run(false);
+	if (ret == 0)
+		ret = ttm_evict_test_run(true);
+
+	drm_global_item_unref(&ttm_evict_test_bo_ref.ref);
+out_unref_mem:
+	drm_global_item_unref(&ttm_evict_test_mem_ref);
+	return ret;
+}
+
+static void __exit ttm_evict_test_exit(void)
+{
+}
+
+module_init(ttm_evict_test_init);
+module_exit(ttm_evict_test_exit);
+
+MODULE_DESCRIPTION("TTM pipelined eviction selftest");
+MODULE_LICENSE("GPL and additional rights");
@@ -50,6 +50,11 @@ int ttm_bo_move_ttm(struct ttm_buffer_object *bo,
 	struct ttm_mem_reg *old_mem = &bo->mem;
 	int ret;
 
+	ret = ttm_mem_type_wait_move(bo->bdev, new_mem->mem_type, false,
+				     no_wait_gpu);
+	if (unlikely(ret != 0))
+		return ret;
+
 	if (old_mem->mem_type != TTM_PL_SYSTEM) {
 		ttm_tt_unbind(ttm);
 		ttm_bo_free_old_node(bo);
@@ -227,6 +232,30 @@ void ttm_mem_reg_iounmap(struct ttm_bo_device *bdev, struct ttm_mem_reg *mem,
 	ttm_mem_io_unlock(man);
 }
 
+/* Pages copied between two iomem mappings per streaming copy. */
+#define TTM_COPY_BATCH 16
+
+/*
+ * Caching state of the kernel mapping a memory region is copied through.
+ * Cached system memory is mapped with PAGE_KERNEL by ttm_bo_move_memcpy(),
+ * everything else with what ttm_mem_reg_ioremap() or ttm_io_prot() give.
+ */
+static enum ttm_caching_state ttm_mem_reg_cstate(struct ttm_mem_reg *mem)
+{
+	if (!mem->bus.is_iomem && (mem->placement & TTM_PL_FLAG_CACHED))
+		return tt_cached;
+	if (mem->placement & TTM_PL_FLAG_WC)
+		return tt_wc;
+	return tt_uncached;
+}
+
+static pgprot_t ttm_mem_reg_prot(struct ttm_mem_reg *mem)
+{
+	if (ttm_mem_reg_cstate(mem) == tt_cached)
+		return PAGE_KERNEL;
+	return ttm_io_prot(mem->placement, PAGE_KERNEL);
+}
+
 static int ttm_copy_io_page(void *dst, void *src, unsigned long page)
 {
 	uint32_t *dstP =
@@ -240,9 +269,28 @@ static int ttm_copy_io_page(void *dst, void *src, unsigned long page)
 	return 0;
 }
 
+static int ttm_copy_io_pages(void *dst, void *src, unsigned long page,
+			     unsigned long num_pages,
+			     enum ttm_caching_state dst_cstate,
+			     enum ttm_caching_state src_cstate)
+{
+	unsigned long offset = page << PAGE_SHIFT;
+	unsigned long i;
+
+	if (ttm_memcpy_stream(dst + offset, src + offset,
+			      num_pages << PAGE_SHIFT, dst_cstate, src_cstate))
+		return 0;
+
+	for (i = 0; i < num_pages; ++i)
+		ttm_copy_io_page(dst, src, page + i);
+	return 0;
+}
+
 static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 				unsigned long page,
-				pgprot_t prot)
+				pgprot_t prot,
+				enum ttm_caching_state dst_cstate,
+				enum ttm_caching_state src_cstate)
 {
 	struct page *d = ttm_tt_get_page(ttm, page);
 	void *dst;
@@ -263,7 +311,8 @@ static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 	if (!dst)
 		return -ENOMEM;
 
-	memcpy_fromio(dst, src, PAGE_SIZE);
+	if (!ttm_memcpy_stream(dst, src, PAGE_SIZE, dst_cstate, src_cstate))
+		memcpy_fromio(dst, src, PAGE_SIZE);
 
 #ifdef CONFIG_X86
 	kunmap_atomic(dst);
@@ -279,7 +328,9 @@ static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 
 static int ttm_copy_ttm_io_page(struct ttm_tt *ttm, void *dst,
 				unsigned long page,
-				pgprot_t prot)
+				pgprot_t prot,
+				enum ttm_caching_state dst_cstate,
+				enum ttm_caching_state src_cstate)
 {
 	struct page *s = ttm_tt_get_page(ttm, page);
 	void *src;
@@ -299,7 +350,8 @@ static int ttm_copy_ttm_io_page(struct ttm_tt *ttm, void *dst,
 	if (!src)
 		return -ENOMEM;
 
-	memcpy_toio(dst, src, PAGE_SIZE);
+	if (!ttm_memcpy_stream(dst, src, PAGE_SIZE, dst_cstate, src_cstate))
+		memcpy_toio(dst, src, PAGE_SIZE);
 
 #ifdef CONFIG_X86
 	kunmap_atomic(src);
@@ -324,12 +376,22 @@ int ttm_bo_move_memcpy(struct ttm_buffer_object *bo,
 	struct ttm_mem_reg old_copy;
 	void *old_iomap;
 	void *new_iomap;
+	enum ttm_caching_state old_cstate;
+	enum ttm_caching_state new_cstate;
 	int ret;
 	unsigned long i;
 	unsigned long page;
+	unsigned long npages;
 	unsigned long add = 0;
 	int dir;
 
+	/* The CPU copy must not race a pipelined eviction out of the
+	 * destination space. */
+	ret = ttm_mem_type_wait_move(bdev, new_mem->mem_type, false,
+				     no_wait_gpu);
+	if (ret)
+		return ret;
+
 	ret = ttm_mem_reg_ioremap(bdev, old_mem, &old_iomap);
 	if (ret)
 		return ret;
@@ -351,20 +413,32 @@ int ttm_bo_move_memcpy(struct ttm_buffer_object *bo,
 		add = new_mem->num_pages - 1;
 	}
 
-	for (i = 0; i < new_mem->num_pages; ++i) {
+	old_cstate = ttm_mem_reg_cstate(old_mem);
+	new_cstate = ttm_mem_reg_cstate(new_mem);
+
+	for (i = 0; i < new_mem->num_pages; i += npages) {
 		page = i * dir + add;
+		npages = 1;
 		if (old_iomap == NULL) {
-			pgprot_t prot = ttm_io_prot(old_mem->placement,
-						    PAGE_KERNEL);
+			pgprot_t prot = ttm_mem_reg_prot(old_mem);
 			ret = ttm_copy_ttm_io_page(ttm, new_iomap, page,
-						   prot);
+						   prot, new_cstate,
+						   old_cstate);
 		} else if (new_iomap == NULL) {
-			pgprot_t prot = ttm_io_prot(new_mem->placement,
-						    PAGE_KERNEL);
+			pgprot_t prot = ttm_mem_reg_prot(new_mem);
 			ret = ttm_copy_io_ttm_page(ttm, old_iomap, page,
-						   prot);
-		} else
-			ret = ttm_copy_io_page(new_iomap, old_iomap, page);
+						   prot, new_cstate,
+						   old_cstate);
+		} else {
+			/* Both mappings are linear, so forward copies can
+			 * be done in batches. */
+			if (dir > 0)
+				npages = min(new_mem->num_pages - i,
+					     (unsigned long)TTM_COPY_BATCH);
+			ret = ttm_copy_io_pages(new_iomap, old_iomap, page,
+						npages, new_cstate,
+						old_cstate);
+		}
 		if (ret)
 			goto out1;
 	}
@@ -615,10 +689,12 @@ int ttm_bo_move_accel_cleanup(struct ttm_buffer_object *bo,
 	struct ttm_bo_device *bdev = bo->bdev;
 	struct ttm_bo_driver *driver = bdev->driver;
 	struct ttm_mem_type_manager *man = &bdev->man[new_mem->mem_type];
+	struct ttm_mem_type_manager *old_man = &bdev->man[bo->mem.mem_type];
 	struct ttm_mem_reg *old_mem = &bo->mem;
 	int ret;
 	struct ttm_buffer_object *ghost_obj;
 	void *tmp_obj = NULL;
+	void *tmp_move = NULL;
 
 	spin_lock(&bdev->fence_lock);
 	if (bo->sync_obj) {
@@ -627,7 +703,25 @@ int ttm_bo_move_accel_cleanup(struct ttm_buffer_object *bo,
 	}
 	bo->sync_obj = driver->sync_obj_ref(sync_obj);
 	bo->sync_obj_arg = sync_obj_arg;
-	if (evict) {
+	if (evict && (old_man->flags & TTM_MEMTYPE_FLAG_PIPELINE_EVICT) &&
+	    !((man->flags & TTM_MEMTYPE_FLAG_FIXED) && (bo->ttm != NULL))) {
+		/**
+		 * Pipelined eviction: Free the old space right away and
+		 * make whoever gets it next wait for the move instead.
+		 */
+
+		tmp_move = old_man->move;
+		old_man->move = driver->sync_obj_ref(sync_obj);
+		old_man->move_arg = sync_obj_arg;
+		set_bit(TTM_BO_PRIV_FLAG_MOVING, &bo->priv_flags);
+		spin_unlock(&bdev->fence_lock);
+		if (tmp_obj)
+			driver->sync_obj_unref(&tmp_obj);
+		if (tmp_move)
+			driver->sync_obj_unref(&tmp_move);
+
+		ttm_bo_free_old_node(bo);
+	} else if (evict) {
 		ret = ttm_bo_wait(bo, false, false, false);
 		spin_unlock(&bdev->fence_lock);
 		if (tmp_obj)
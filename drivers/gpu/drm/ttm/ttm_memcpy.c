@@ -0,0 +1,144 @@
+/**************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Streaming copies between buffer mappings of different caching states.
+ *
+ * Plain loads from write-combined or uncached memory are issued one at a
+ * time and never fill a cache line, which makes memcpy() from such memory
+ * crawl. SSE4.1 streaming loads (movntdqa) fetch a whole line into a
+ * streaming buffer instead, and non-temporal stores (movntdq) let
+ * destination writes combine without polluting the cache.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include "ttm/ttm_bo_driver.h"
+
+#ifdef CONFIG_X86_64
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+
+#define TTM_STREAM_BLOCK	64
+
+/* Streaming loads, non-temporal stores. */
+static void ttm_stream_copy_ntload_ntstore(void *dst, const void *src,
+					   unsigned long size)
+{
+	for (; size; size -= TTM_STREAM_BLOCK) {
+		asm volatile("movntdqa   (%0), %%xmm0\n"
+			     "movntdqa 16(%0), %%xmm1\n"
+			     "movntdqa 32(%0), %%xmm2\n"
+			     "movntdqa 48(%0), %%xmm3\n"
+			     "movntdq %%xmm0,   (%1)\n"
+			     "movntdq %%xmm1, 16(%1)\n"
+			     "movntdq %%xmm2, 32(%1)\n"
+			     "movntdq %%xmm3, 48(%1)\n"
+			     : : "r" (src), "r" (dst) : "memory");
+		src += TTM_STREAM_BLOCK;
+		dst += TTM_STREAM_BLOCK;
+	}
+}
+
+/* Streaming loads, cached stores. */
+static void ttm_stream_copy_ntload(void *dst, const void *src,
+				   unsigned long size)
+{
+	for (; size; size -= TTM_STREAM_BLOCK) {
+		asm volatile("movntdqa   (%0), %%xmm0\n"
+			     "movntdqa 16(%0), %%xmm1\n"
+			     "movntdqa 32(%0), %%xmm2\n"
+			     "movntdqa 48(%0), %%xmm3\n"
+			     "movdqa %%xmm0,   (%1)\n"
+			     "movdqa %%xmm1, 16(%1)\n"
+			     "movdqa %%xmm2, 32(%1)\n"
+			     "movdqa %%xmm3, 48(%1)\n"
+			     : : "r" (src), "r" (dst) : "memory");
+		src += TTM_STREAM_BLOCK;
+		dst += TTM_STREAM_BLOCK;
+	}
+}
+
+/* Prefetched cached loads, non-temporal stores. */
+static void ttm_stream_copy_ntstore(void *dst, const void *src,
+				    unsigned long size)
+{
+	for (; size; size -= TTM_STREAM_BLOCK) {
+		asm volatile("prefetchnta 256(%0)\n"
+			     "movdqa   (%0), %%xmm0\n"
+			     "movdqa 16(%0), %%xmm1\n"
+			     "movdqa 32(%0), %%xmm2\n"
+			     "movdqa 48(%0), %%xmm3\n"
+			     "movntdq %%xmm0,   (%1)\n"
+			     "movntdq %%xmm1, 16(%1)\n"
+			     "movntdq %%xmm2, 32(%1)\n"
+			     "movntdq %%xmm3, 48(%1)\n"
+			     : : "r" (src), "r" (dst) : "memory");
+		src += TTM_STREAM_BLOCK;
+		dst += TTM_STREAM_BLOCK;
+	}
+}
+
+bool ttm_memcpy_stream(void *dst, const void *src, unsigned long size,
+		       enum ttm_caching_state dst_cstate,
+		       enum ttm_caching_state src_cstate)
+{
+	bool src_cached = (src_cstate == tt_cached);
+	bool dst_cached = (dst_cstate == tt_cached);
+
+	/* memcpy() is as good as it gets between cached mappings. */
+	if (src_cached && dst_cached)
+		return false;
+
+	if (unlikely(!IS_ALIGNED((unsigned long)dst | (unsigned long)src |
+				 size, TTM_STREAM_BLOCK)))
+		return false;
+
+	if (unlikely(!irq_fpu_usable()))
+		return false;
+
+	kernel_fpu_begin();
+	if (!src_cached && cpu_has_xmm4_1) {
+		if (dst_cached)
+			ttm_stream_copy_ntload(dst, src, size);
+		else
+			ttm_stream_copy_ntload_ntstore(dst, src, size);
+	} else {
+		/* Without streaming loads 16 byte loads still beat the
+		 * 32 bit accesses of the fallback paths. */
+		ttm_stream_copy_ntstore(dst, src, size);
+	}
+	asm volatile("sfence" : : : "memory");
+	kernel_fpu_end();
+
+	return true;
+}
+#else
+bool ttm_memcpy_stream(void *dst, const void *src, unsigned long size,
+		       enum ttm_caching_state dst_cstate,
+		       enum ttm_caching_state src_cstate)
+{
+	return false;
+}
+#endif
+EXPORT_SYMBOL(ttm_memcpy_stream);
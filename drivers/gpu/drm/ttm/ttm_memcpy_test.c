@@ -0,0 +1,249 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Benchmark for the buffer move copies.
+ * - Maps system memory buffers cached, write-combined and uncached
+ * - Checks that ttm_memcpy_stream() copies a pattern for every src/dst pair
+ * - Times memcpy() and ttm_memcpy_stream() for every src/dst pair
+ * - Reports throughput in the kernel log
+ */
+#include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+
+#include "ttm/ttm_bo_driver.h"
+#include "ttm/ttm_page_alloc.h"
+
+static unsigned npages = 256;
+module_param(npages, uint, 0444);
+MODULE_PARM_DESC(npages, "Buffer size in pages");
+
+static unsigned loops = 8;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Copies per measurement");
+
+struct ttm_memcpy_test_buf {
+	struct list_head	pages;
+	void			*virtual;
+};
+
+static const char *ttm_memcpy_test_names[] = {
+	[tt_cached] = "cached",
+	[tt_wc] = "wc",
+	[tt_uncached] = "uc",
+};
+
+static struct drm_global_reference ttm_memcpy_test_mem_ref;
+
+static int ttm_memcpy_test_mem_init(struct drm_global_reference *ref)
+{
+	return ttm_mem_global_init(ref->object);
+}
+
+static void ttm_memcpy_test_mem_release(struct drm_global_reference *ref)
+{
+	ttm_mem_global_release(ref->object);
+}
+
+static void ttm_memcpy_test_buf_free(struct ttm_memcpy_test_buf *buf,
+				     enum ttm_caching_state cstate)
+{
+	if (buf->virtual)
+		vunmap(buf->virtual);
+	ttm_put_pages(&buf->pages, npages, 0, cstate, NULL);
+}
+
+static int ttm_memcpy_test_buf_alloc(struct ttm_memcpy_test_buf *buf,
+				     enum ttm_caching_state cstate)
+{
+	struct page **pages;
+	struct page *p;
+	pgprot_t prot = PAGE_KERNEL;
+	unsigned i = 0;
+	int ret;
+
+	INIT_LIST_HEAD(&buf->pages);
+	buf->virtual = NULL;
+
+	ret = ttm_get_pages(&buf->pages, 0, cstate, npages, NULL);
+	if (unlikely(ret != 0))
+		return ret;
+
+	pages = kmalloc(npages * sizeof(*pages), GFP_KERNEL);
+	if (unlikely(pages == NULL)) {
+		ttm_memcpy_test_buf_free(buf, cstate);
+		return -ENOMEM;
+	}
+	list_for_each_entry(p, &buf->pages, lru)
+		pages[i++] = p;
+
+	if (cstate == tt_wc)
+		prot = pgprot_writecombine(prot);
+	else if (cstate == tt_uncached)
+		prot = pgprot_noncached(prot);
+
+	buf->virtual = vmap(pages, npages, 0, prot);
+	kfree(pages);
+	if (unlikely(buf->virtual == NULL)) {
+		ttm_memcpy_test_buf_free(buf, cstate);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static u64 ttm_memcpy_test_rate(u64 ns)
+{
+	u64 bytes = (u64)npages * PAGE_SIZE * loops;
+
+	/* MiB/s */
+	return ns ? div64_u64(bytes * NSEC_PER_SEC, ns) >> 20 : 0;
+}
+
+/* every word differs, so a block copied to the wrong offset is noticed */
+static void ttm_memcpy_test_pattern(struct ttm_memcpy_test_buf *buf, u32 seed)
+{
+	u32 *p = buf->virtual;
+	unsigned long i;
+
+	for (i = 0; i < ((unsigned long)npages << PAGE_SHIFT) / 4; i++)
+		p[i] = (i + seed) * 2654435761u;
+}
+
+static int ttm_memcpy_test_check(struct ttm_memcpy_test_buf *dst,
+				 enum ttm_caching_state dst_cstate,
+				 struct ttm_memcpy_test_buf *src,
+				 enum ttm_caching_state src_cstate)
+{
+	unsigned long size = (unsigned long)npages << PAGE_SHIFT;
+
+	ttm_memcpy_test_pattern(src, dst_cstate * 3 + src_cstate + 1);
+	memset(dst->virtual, 0, size);
+
+	if (!ttm_memcpy_stream(dst->virtual, src->virtual, size,
+			       dst_cstate, src_cstate))
+		return 0;
+
+	if (!memcmp(dst->virtual, src->virtual, size))
+		return 0;
+
+	printk(KERN_ERR TTM_PFX
+	       "%6s -> %6s: stream copy differs from source.\n",
+	       ttm_memcpy_test_names[src_cstate],
+	       ttm_memcpy_test_names[dst_cstate]);
+	return -EIO;
+}
+
+static int ttm_memcpy_test_pair(struct ttm_memcpy_test_buf *dst,
+				enum ttm_caching_state dst_cstate,
+				struct ttm_memcpy_test_buf *src,
+				enum ttm_caching_state src_cstate)
+{
+	unsigned long size = (unsigned long)npages << PAGE_SHIFT;
+	ktime_t start;
+	u64 plain_ns, stream_ns;
+	bool streamed = true;
+	unsigned i;
+	int ret;
+
+	ret = ttm_memcpy_test_check(dst, dst_cstate, src, src_cstate);
+	if (unlikely(ret != 0))
+		return ret;
+
+	start = ktime_get();
+	for (i = 0; i < loops; ++i)
+		memcpy(dst->virtual, src->virtual, size);
+	plain_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < loops && streamed; ++i)
+		streamed = ttm_memcpy_stream(dst->virtual, src->virtual, size,
+					     dst_cstate, src_cstate);
+	stream_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (streamed)
+		printk(KERN_INFO TTM_PFX
+		       "%6s -> %6s: memcpy %6llu MiB/s, stream %6llu MiB/s.\n",
+		       ttm_memcpy_test_names[src_cstate],
+		       ttm_memcpy_test_names[dst_cstate],
+		       (unsigned long long)ttm_memcpy_test_rate(plain_ns),
+		       (unsigned long long)ttm_memcpy_test_rate(stream_ns));
+	else
+		printk(KERN_INFO TTM_PFX
+		       "%6s -> %6s: memcpy %6llu MiB/s, stream n/a.\n",
+		       ttm_memcpy_test_names[src_cstate],
+		       ttm_memcpy_test_names[dst_cstate],
+		       (unsigned long long)ttm_memcpy_test_rate(plain_ns));
+	return 0;
+}
+
+static int __init ttm_memcpy_test_init(void)
+{
+	enum ttm_caching_state cstates[] = { tt_cached, tt_wc, tt_uncached };
+	struct ttm_memcpy_test_buf src[ARRAY_SIZE(cstates)];
+	struct ttm_memcpy_test_buf dst[ARRAY_SIZE(cstates)];
+	unsigned i, j, k;
+	int ret;
+
+	ttm_memcpy_test_mem_ref.global_type = DRM_GLOBAL_TTM_MEM;
+	ttm_memcpy_test_mem_ref.size = sizeof(struct ttm_mem_global);
+	ttm_memcpy_test_mem_ref.init = &ttm_memcpy_test_mem_init;
+	ttm_memcpy_test_mem_ref.release = &ttm_memcpy_test_mem_release;
+	ret = drm_global_item_ref(&ttm_memcpy_test_mem_ref);
+	if (unlikely(ret != 0))
+		return ret;
+
+	for (i = 0; i < ARRAY_SIZE(cstates); ++i) {
+		ret = ttm_memcpy_test_buf_alloc(&src[i], cstates[i]);
+		if (unlikely(ret != 0))
+			goto out_free;
+		ret = ttm_memcpy_test_buf_alloc(&dst[i], cstates[i]);
+		if (unlikely(ret != 0)) {
+			ttm_memcpy_test_buf_free(&src[i], cstates[i]);
+			goto out_free;
+		}
+	}
+
+	/* i stays at the number of allocated buffers for out_free */
+	for (j = 0; j < ARRAY_SIZE(cstates) && ret == 0; ++j)
+		for (k = 0; k < ARRAY_SIZE(cstates) && ret == 0; ++k)
+			ret = ttm_memcpy_test_pair(&dst[k], cstates[k],
+						   &src[j], cstates[j]);
+
+out_free:
+	while (i-- > 0) {
+		ttm_memcpy_test_buf_free(&dst[i], cstates[i]);
+		ttm_memcpy_test_buf_free(&src[i], cstates[i]);
+	}
+	drm_global_item_unref(&ttm_memcpy_test_mem_ref);
+	return ret;
+}
+
+static void __exit ttm_memcpy_test_exit(void)
+{
+}
+
+module_init(ttm_memcpy_test_init);
+module_exit(ttm_memcpy_test_exit);
+
+MODULE_DESCRIPTION("TTM buffer move copy benchmark");
+MODULE_LICENSE("GPL and additional rights");
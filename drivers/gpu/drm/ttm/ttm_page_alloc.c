@@ -29,6 +29,13 @@
  * - Pool collects resently freed pages for reuse
  * - Use page->lru to keep a free list
  * - doesn't track currently in use pages
+ * - Each caching state has a small per-cpu front cache in front of per-node
+ *   backing pools, so single page requests don't touch shared locks and
+ *   pages are handed out from the node of the allocating cpu.
+ * - A background work keeps a reserve of pre-zeroed pages in the node pools
+ *   for TTM_PAGE_FLAG_ZERO_ALLOC requests.
+ * - New pages are allocated in physically contiguous chunks when possible.
+ *   Chunks are split right away so pages can be pooled and freed one by one.
  */
 #include <linux/list.h>
 #include <linux/spinlock.h>
@@ -36,9 +43,13 @@
 #include <linux/mm_types.h>
 #include <linux/module.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 #include <linux/seq_file.h> /* for seq_printf */
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/percpu.h>
+#include <linux/nodemask.h>
+#include <linux/workqueue.h>
 
 #include <linux/atomic.h>
 
@@ -54,9 +65,17 @@
 #define FREE_ALL_PAGES			(~0U)
 /* times are in msecs */
 #define PAGE_FREE_INTERVAL		1000
+/* per-cpu cache is refilled and drained in batches of this many pages */
+#define CPU_CACHE_BATCH			(SMALL_ALLOCATION / 2)
+#define CPU_CACHE_HIGH			(CPU_CACHE_BATCH * 4)
+/* pages zeroed by the background work between lock drops */
+#define ZERO_BATCH			SMALL_ALLOCATION
+/* default chunk is 64KiB, the largest is a pmd sized huge page */
+#define CHUNK_DEFAULT_ORDER		min(4, MAX_ORDER - 1)
+#define CHUNK_MAX_ORDER			min(21 - PAGE_SHIFT, MAX_ORDER - 1)
 
 /**
- * struct ttm_page_pool - Pool to reuse recently allocated uc/wc pages.
+ * struct ttm_page_pool - Per-node pool to reuse recently allocated uc/wc pages.
  *
  * @lock: Protects the shared pool from concurrnet access. Must be used with
  * irqsave/irqrestore variants because pool allocator maybe called from
@@ -65,6 +84,11 @@
  * @list: Pool of free uc/wc pages for fast reuse.
  * @gfp_flags: Flags to pass for alloc_page.
  * @npages: Number of pages in pool.
+ * @zeroed: Reserve of free pages already cleared by the zeroing work.
+ * @nzeroed: Number of pages in the zeroed reserve.
+ * @nid: Node the pages of this pool are allocated from.
+ * @nchunks: Number of contiguous chunks allocated for this pool.
+ * @nchunk_fails: Number of chunk allocations that fell back to single pages.
  */
 struct ttm_page_pool {
 	spinlock_t		lock;
@@ -72,9 +96,55 @@ struct ttm_page_pool {
 	struct list_head	list;
 	gfp_t			gfp_flags;
 	unsigned		npages;
+	struct list_head	zeroed;
+	unsigned		nzeroed;
 	char			*name;
+	int			nid;
 	unsigned long		nfrees;
 	unsigned long		nrefills;
+	atomic_long_t		nchunks;
+	atomic_long_t		nchunk_fails;
+};
+
+/**
+ * struct ttm_page_pool_cpu - Per-cpu front cache of a pool group.
+ *
+ * @lock: Protects the cache. Only taken from other cpus when the cache is
+ * drained by the shrinker or on teardown, so it is normally uncontended.
+ * @list: Free pages already in the caching state of the group.
+ * @npages: Number of pages in the cache.
+ * @zeroed: Cleared pages taken from the zeroed reserve of the node pools.
+ * @nzeroed: Number of pages in @zeroed.
+ * @hits: Pages served from the pools.
+ * @misses: Pages that had to be newly allocated.
+ * @zero_hits: Pages of zeroed requests served from the zeroed reserve.
+ * @zero_misses: Pages of zeroed requests cleared in the allocating context.
+ */
+struct ttm_page_pool_cpu {
+	spinlock_t		lock;
+	struct list_head	list;
+	unsigned		npages;
+	struct list_head	zeroed;
+	unsigned		nzeroed;
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		zero_hits;
+	unsigned long		zero_misses;
+};
+
+/**
+ * struct ttm_pool_group - All pools for one caching state and gfp zone.
+ *
+ * @cpu: Per-cpu front caches, serving small requests without touching the
+ * node pools.
+ * @nodes: Backing pools indexed by node id.
+ * @gfp_flags: Flags to pass for alloc_page.
+ */
+struct ttm_pool_group {
+	struct ttm_page_pool_cpu __percpu	*cpu;
+	struct ttm_page_pool			*nodes;
+	gfp_t					gfp_flags;
+	char					*name;
 };
 
 /**
@@ -87,6 +157,8 @@ struct ttm_pool_opts {
 	unsigned	alloc_size;
 	unsigned	max_size;
 	unsigned	small;
+	unsigned	zero_reserve;
+	unsigned	chunk_order;
 };
 
 #define NUM_POOLS 4
@@ -101,6 +173,9 @@ struct ttm_pool_opts {
  * @work: Work that is used to shrink the pool. Work is only run when there is
  * some pages to free.
  * @small_allocation: Limit in number of pages what is small allocation.
+ * @zero_work: Work that clears free pages into the zeroed reserves.
+ * @last_shrink: Jiffies of the last shrinker run, zeroing backs off for
+ * PAGE_FREE_INTERVAL after it.
  *
  * @pools: All pool objects in use.
  **/
@@ -108,14 +183,16 @@ struct ttm_pool_manager {
 	struct kobject		kobj;
 	struct shrinker		mm_shrink;
 	struct ttm_pool_opts	options;
+	struct delayed_work	zero_work;
+	unsigned long		last_shrink;
 
 	union {
-		struct ttm_page_pool	pools[NUM_POOLS];
+		struct ttm_pool_group	pools[NUM_POOLS];
 		struct {
-			struct ttm_page_pool	wc_pool;
-			struct ttm_page_pool	uc_pool;
-			struct ttm_page_pool	wc_pool_dma32;
-			struct ttm_page_pool	uc_pool_dma32;
+			struct ttm_pool_group	wc_pool;
+			struct ttm_pool_group	uc_pool;
+			struct ttm_pool_group	wc_pool_dma32;
+			struct ttm_pool_group	uc_pool_dma32;
 		} ;
 	};
 };
@@ -132,11 +209,21 @@ static struct attribute ttm_page_pool_alloc_size = {
 	.name = "pool_allocation_size",
 	.mode = S_IRUGO | S_IWUSR
 };
+static struct attribute ttm_page_pool_zero_reserve = {
+	.name = "pool_zeroed_reserve",
+	.mode = S_IRUGO | S_IWUSR
+};
+static struct attribute ttm_page_pool_chunk_size = {
+	.name = "pool_chunk_size",
+	.mode = S_IRUGO | S_IWUSR
+};
 
 static struct attribute *ttm_pool_attrs[] = {
 	&ttm_page_pool_max,
 	&ttm_page_pool_small,
 	&ttm_page_pool_alloc_size,
+	&ttm_page_pool_zero_reserve,
+	&ttm_page_pool_chunk_size,
 	NULL
 };
 
@@ -181,6 +268,13 @@ static ssize_t ttm_pool_store(struct kobject *kobj,
 			       NUM_PAGES_TO_ALLOC*(PAGE_SIZE >> 10));
 		}
 		m->options.alloc_size = val;
+	} else if (attr == &ttm_page_pool_zero_reserve) {
+		m->options.zero_reserve = val;
+		schedule_delayed_work(&m->zero_work, 0);
+	} else if (attr == &ttm_page_pool_chunk_size) {
+		/* Round down to a power of two number of pages. */
+		m->options.chunk_order = val ? min(ilog2(val),
+						   CHUNK_MAX_ORDER) : 0;
 	}
 
 	return size;
@@ -199,6 +293,10 @@ static ssize_t ttm_pool_show(struct kobject *kobj,
 		val = m->options.small;
 	else if (attr == &ttm_page_pool_alloc_size)
 		val = m->options.alloc_size;
+	else if (attr == &ttm_page_pool_zero_reserve)
+		val = m->options.zero_reserve;
+	else if (attr == &ttm_page_pool_chunk_size)
+		val = 1 << m->options.chunk_order;
 
 	val = val * (PAGE_SIZE >> 10);
 
@@ -255,7 +353,7 @@ static int set_pages_array_uc(struct page **pages, int addrinarray)
 
 /**
  * Select the right pool or requested caching state and ttm flags. */
-static struct ttm_page_pool *ttm_get_pool(int flags,
+static struct ttm_pool_group *ttm_get_pool(int flags,
 		enum ttm_caching_state cstate)
 {
 	int pool_index;
@@ -381,13 +479,150 @@ out:
 	return nr_free;
 }
 
+/**
+ * Put pages to the node pools they were allocated from and free the pages
+ * going over the pool limit.
+ *
+ * @pages: list of pages, empty on return.
+ */
+static void ttm_pool_put_node_pages(struct ttm_pool_group *group,
+		struct list_head *pages)
+{
+	unsigned long irq_flags;
+	struct ttm_page_pool *pool;
+	struct page *p, *tmp;
+	struct list_head node_pages;
+	unsigned page_count, max_size;
+	int nid;
+
+	max_size = _manager->options.max_size / num_online_nodes();
+
+	while (!list_empty(pages)) {
+		nid = page_to_nid(list_first_entry(pages, struct page, lru));
+		pool = &group->nodes[nid];
+
+		INIT_LIST_HEAD(&node_pages);
+		page_count = 0;
+		list_for_each_entry_safe(p, tmp, pages, lru) {
+			if (page_to_nid(p) != nid)
+				continue;
+			list_move(&p->lru, &node_pages);
+			++page_count;
+		}
+
+		spin_lock_irqsave(&pool->lock, irq_flags);
+		list_splice(&node_pages, &pool->list);
+		pool->npages += page_count;
+		/* Check that we don't go over the pool limit */
+		page_count = 0;
+		if (pool->npages > max_size) {
+			page_count = pool->npages - max_size;
+			/* free at least NUM_PAGES_TO_ALLOC number of pages
+			 * to reduce calls to set_memory_wb */
+			if (page_count < NUM_PAGES_TO_ALLOC)
+				page_count = NUM_PAGES_TO_ALLOC;
+		}
+		spin_unlock_irqrestore(&pool->lock, irq_flags);
+		if (page_count)
+			ttm_page_pool_free(pool, page_count);
+	}
+}
+
+/**
+ * Put cleared pages back to the zeroed reserves of the node pools they were
+ * allocated from. The zeroing work keeps the reserves at their size.
+ *
+ * @pages: list of pages, empty on return.
+ */
+static void ttm_pool_put_node_zeroed(struct ttm_pool_group *group,
+		struct list_head *pages)
+{
+	unsigned long irq_flags;
+	struct ttm_page_pool *pool;
+	struct page *p, *tmp;
+	struct list_head node_pages;
+	unsigned page_count;
+	int nid;
+
+	while (!list_empty(pages)) {
+		nid = page_to_nid(list_first_entry(pages, struct page, lru));
+		pool = &group->nodes[nid];
+
+		INIT_LIST_HEAD(&node_pages);
+		page_count = 0;
+		list_for_each_entry_safe(p, tmp, pages, lru) {
+			if (page_to_nid(p) != nid)
+				continue;
+			list_move(&p->lru, &node_pages);
+			++page_count;
+		}
+
+		spin_lock_irqsave(&pool->lock, irq_flags);
+		list_splice(&node_pages, &pool->zeroed);
+		pool->nzeroed += page_count;
+		spin_unlock_irqrestore(&pool->lock, irq_flags);
+	}
+}
+
+/**
+ * Move all pages held in the per-cpu caches of a group back to the node
+ * pools so that they can be freed or handed out to other cpus.
+ */
+static void ttm_pool_drain_cpu_caches(struct ttm_pool_group *group)
+{
+	unsigned long irq_flags;
+	struct ttm_page_pool_cpu *cache;
+	struct list_head pages, zeroed;
+	int cpu;
+
+	INIT_LIST_HEAD(&pages);
+	INIT_LIST_HEAD(&zeroed);
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(group->cpu, cpu);
+		spin_lock_irqsave(&cache->lock, irq_flags);
+		list_splice_init(&cache->list, &pages);
+		list_splice_init(&cache->zeroed, &zeroed);
+		cache->npages = 0;
+		cache->nzeroed = 0;
+		spin_unlock_irqrestore(&cache->lock, irq_flags);
+	}
+	ttm_pool_put_node_pages(group, &pages);
+	ttm_pool_put_node_zeroed(group, &zeroed);
+}
+
+/**
+ * Give the zeroed reserve of a pool back to the regular free list so the
+ * pages can be freed. They go to the head of the list as ttm_page_pool_free
+ * frees from the tail.
+ */
+static void ttm_page_pool_release_zeroed(struct ttm_page_pool *pool)
+{
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&pool->lock, irq_flags);
+	list_splice_init(&pool->zeroed, &pool->list);
+	pool->npages += pool->nzeroed;
+	pool->nzeroed = 0;
+	spin_unlock_irqrestore(&pool->lock, irq_flags);
+}
+
 /* Get good estimation how many pages are free in pools */
 static int ttm_pool_get_num_unused_pages(void)
 {
+	struct ttm_pool_group *group;
 	unsigned i;
 	int total = 0;
-	for (i = 0; i < NUM_POOLS; ++i)
-		total += _manager->pools[i].npages;
+	int nid, cpu;
+
+	for (i = 0; i < NUM_POOLS; ++i) {
+		group = &_manager->pools[i];
+		for_each_node(nid)
+			total += group->nodes[nid].npages +
+				 group->nodes[nid].nzeroed;
+		for_each_possible_cpu(cpu)
+			total += per_cpu_ptr(group->cpu, cpu)->npages +
+				 per_cpu_ptr(group->cpu, cpu)->nzeroed;
+	}
 
 	return total;
 }
@@ -401,17 +636,30 @@ static int ttm_pool_mm_shrink(struct shrinker *shrink,
 	static atomic_t start_pool = ATOMIC_INIT(0);
 	unsigned i;
 	unsigned pool_offset = atomic_add_return(1, &start_pool);
-	struct ttm_page_pool *pool;
+	struct ttm_pool_group *group;
 	int shrink_pages = sc->nr_to_scan;
+	int nid;
+
+	if (shrink_pages)
+		_manager->last_shrink = jiffies;
 
 	pool_offset = pool_offset % NUM_POOLS;
 	/* select start pool in round robin fashion */
 	for (i = 0; i < NUM_POOLS; ++i) {
-		unsigned nr_free = shrink_pages;
 		if (shrink_pages == 0)
 			break;
-		pool = &_manager->pools[(i + pool_offset)%NUM_POOLS];
-		shrink_pages = ttm_page_pool_free(pool, nr_free);
+		group = &_manager->pools[(i + pool_offset)%NUM_POOLS];
+		ttm_pool_drain_cpu_caches(group);
+		for_each_node(nid) {
+			struct ttm_page_pool *pool = &group->nodes[nid];
+			unsigned nr_free = shrink_pages;
+			if (shrink_pages == 0)
+				break;
+			/* zeroed pages are only given up if needed */
+			if (nr_free > pool->npages)
+				ttm_page_pool_release_zeroed(pool);
+			shrink_pages = ttm_page_pool_free(pool, nr_free);
+		}
 	}
 	/* return estimated number of unused pages in pool */
 	return ttm_pool_get_num_unused_pages();
@@ -475,16 +723,23 @@ static void ttm_handle_caching_state_failure(struct list_head *pages,
 /**
  * Allocate new pages with correct caching.
  *
+ * Pages are allocated in chunks of up to options.chunk_order from the node of
+ * the pool, falling back to single pages once a chunk can't be had cheaply.
+ * The pages of a chunk are adjacent and in ascending order on the list and
+ * get their caching state changed in the same call.
+ *
  * This function is reentrant if caller updates count depending on number of
  * pages returned in pages array.
  */
 static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
-		int ttm_flags, enum ttm_caching_state cstate, unsigned count)
+		int ttm_flags, enum ttm_caching_state cstate, unsigned count,
+		struct ttm_page_pool *pool)
 {
 	struct page **caching_array;
 	struct page *p;
 	int r = 0;
-	unsigned i, cpages;
+	unsigned i, j, cpages, npages;
+	unsigned order = _manager->options.chunk_order;
 	unsigned max_cpages = min(count,
 			(unsigned)(PAGE_SIZE/sizeof(struct page *)));
 
@@ -497,8 +752,30 @@ static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
 		return -ENOMEM;
 	}
 
-	for (i = 0, cpages = 0; i < count; ++i) {
-		p = alloc_page(gfp_flags);
+	for (i = 0, cpages = 0; i < count; i += npages) {
+		/* Largest chunk that doesn't go over the request. */
+		while (order && (1U << order) > min(count - i, max_cpages))
+			--order;
+		npages = 1U << order;
+
+		p = NULL;
+		if (order) {
+			p = alloc_pages_node(pool->nid, gfp_flags |
+					     __GFP_NORETRY | __GFP_NOWARN,
+					     order);
+			if (p) {
+				split_page(p, order);
+				atomic_long_inc(&pool->nchunks);
+			} else {
+				/* Don't keep trying for the rest of the
+				 * request. */
+				atomic_long_inc(&pool->nchunk_fails);
+				order = 0;
+				npages = 1;
+			}
+		}
+		if (!p)
+			p = alloc_pages_node(pool->nid, gfp_flags, 0);
 
 		if (!p) {
 			printk(KERN_ERR TTM_PFX "Unable to get page %u.\n", i);
@@ -524,22 +801,26 @@ static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
 		if (!PageHighMem(p))
 #endif
 		{
-			caching_array[cpages++] = p;
-			if (cpages == max_cpages) {
-
+			/* Change the caching of a chunk in one go. */
+			if (cpages + npages > max_cpages) {
 				r = ttm_set_pages_caching(caching_array,
 						cstate, cpages);
 				if (r) {
 					ttm_handle_caching_state_failure(pages,
 						ttm_flags, cstate,
 						caching_array, cpages);
+					for (j = 0; j < npages; ++j)
+						__free_page(p + j);
 					goto out;
 				}
 				cpages = 0;
 			}
+			for (j = 0; j < npages; ++j)
+				caching_array[cpages++] = p + j;
 		}
 
-		list_add(&p->lru, pages);
+		for (j = npages; j-- > 0; )
+			list_add(&p[j].lru, pages);
 	}
 
 	if (cpages) {
@@ -591,7 +872,7 @@ static void ttm_page_pool_fill_locked(struct ttm_page_pool *pool,
 
 		INIT_LIST_HEAD(&new_pages);
 		r = ttm_alloc_new_pages(&new_pages, pool->gfp_flags, ttm_flags,
-				cstate,	alloc_size);
+				cstate,	alloc_size, pool);
 		spin_lock_irqsave(&pool->lock, *irq_flags);
 
 		if (!r) {
@@ -660,6 +941,173 @@ out:
 	return count;
 }
 
+/**
+ * Cut up to 'count' pages from the zeroed reserve of the pool.
+ *
+ * @return count of pages still required to fulfill the request.
+ */
+static unsigned ttm_page_pool_get_zeroed(struct ttm_page_pool *pool,
+		struct list_head *pages, unsigned count)
+{
+	unsigned long irq_flags;
+	struct page *p;
+
+	spin_lock_irqsave(&pool->lock, irq_flags);
+	while (count && pool->nzeroed) {
+		p = list_first_entry(&pool->zeroed, struct page, lru);
+		list_move(&p->lru, pages);
+		--pool->nzeroed;
+		--count;
+	}
+	spin_unlock_irqrestore(&pool->lock, irq_flags);
+	return count;
+}
+
+/**
+ * Take pages from the zeroed reserves of a group, local node first.
+ *
+ * @return count of pages still required to fulfill the request.
+ */
+static unsigned ttm_pool_get_node_zeroed(struct ttm_pool_group *group,
+		struct list_head *pages, unsigned count)
+{
+	int local_nid = numa_node_id();
+	int nid;
+
+	count = ttm_page_pool_get_zeroed(&group->nodes[local_nid], pages,
+					 count);
+	for_each_online_node(nid) {
+		if (count == 0)
+			break;
+		if (nid == local_nid || !group->nodes[nid].nzeroed)
+			continue;
+		count = ttm_page_pool_get_zeroed(&group->nodes[nid], pages,
+						 count);
+	}
+	return count;
+}
+
+/**
+ * Take pages from the node pools of a group, starting with the local node.
+ *
+ * @zeroed: Take pages from the zeroed reserves instead of the free lists.
+ *
+ * @return count of pages still required to fulfill the request.
+ */
+static unsigned ttm_pool_get_node_pages(struct ttm_pool_group *group,
+		struct list_head *pages, int ttm_flags,
+		enum ttm_caching_state cstate, unsigned count, bool zeroed)
+{
+	struct ttm_page_pool *pool;
+	int local_nid = numa_node_id();
+	unsigned wanted;
+	int nid;
+
+	if (zeroed) {
+		count = ttm_pool_get_node_zeroed(group, pages, count);
+		goto out_refill;
+	}
+
+	count = ttm_page_pool_get_pages(&group->nodes[local_nid], pages,
+					ttm_flags, cstate, count);
+	/* Pages of a remote node still beat changing the caching state of
+	 * newly allocated ones. */
+	for_each_online_node(nid) {
+		if (count == 0)
+			break;
+		if (nid == local_nid)
+			continue;
+		pool = &group->nodes[nid];
+		if (pool->npages)
+			count = ttm_page_pool_get_pages(pool, pages, ttm_flags,
+							cstate, count);
+	}
+	if (count == 0)
+		return 0;
+
+	/* So do zeroed pages, rather than leave the reserve sitting idle. */
+	wanted = count;
+	count = ttm_pool_get_node_zeroed(group, pages, count);
+	if (count == wanted)
+		return count;
+
+out_refill:
+	/* Have the reserve topped up again. */
+	schedule_delayed_work(&_manager->zero_work, 0);
+
+	return count;
+}
+
+/**
+ * Serve a request from the per-cpu cache, refilling the cache from the node
+ * pools in batches for small requests.
+ *
+ * @zeroed: Only hand out pages from the zeroed reserve.
+ *
+ * @return count of pages still required to fulfill the request.
+ */
+static unsigned ttm_pool_get_cpu_pages(struct ttm_pool_group *group,
+		struct list_head *pages, int ttm_flags,
+		enum ttm_caching_state cstate, unsigned count, bool zeroed)
+{
+	unsigned long irq_flags;
+	struct ttm_page_pool_cpu *cache;
+	struct list_head *cache_list;
+	unsigned *cache_npages;
+	struct list_head refill;
+	struct page *p;
+	unsigned want, got;
+
+	local_irq_save(irq_flags);
+	cache = this_cpu_ptr(group->cpu);
+	spin_lock(&cache->lock);
+	cache_list = zeroed ? &cache->zeroed : &cache->list;
+	cache_npages = zeroed ? &cache->nzeroed : &cache->npages;
+	while (count && *cache_npages) {
+		p = list_first_entry(cache_list, struct page, lru);
+		list_move(&p->lru, pages);
+		--*cache_npages;
+		--count;
+	}
+	spin_unlock_irqrestore(&cache->lock, irq_flags);
+
+	if (count == 0)
+		return 0;
+
+	/* Large requests bypass the cache. */
+	want = count;
+	if (count + CPU_CACHE_BATCH < _manager->options.small)
+		want += CPU_CACHE_BATCH;
+
+	INIT_LIST_HEAD(&refill);
+	got = want - ttm_pool_get_node_pages(group, &refill, ttm_flags,
+					     cstate, want, zeroed);
+
+	while (count && got) {
+		p = list_first_entry(&refill, struct page, lru);
+		list_move(&p->lru, pages);
+		--count;
+		--got;
+	}
+
+	if (got) {
+		/* We may have migrated to another cpu meanwhile which is
+		 * harmless, the pages simply end up in its cache. */
+		local_irq_save(irq_flags);
+		cache = this_cpu_ptr(group->cpu);
+		spin_lock(&cache->lock);
+		if (zeroed) {
+			list_splice(&refill, &cache->zeroed);
+			cache->nzeroed += got;
+		} else {
+			list_splice(&refill, &cache->list);
+			cache->npages += got;
+		}
+		spin_unlock_irqrestore(&cache->lock, irq_flags);
+	}
+	return count;
+}
+
 /*
  * On success pages list will hold count number of correctly
  * cached pages.
@@ -668,9 +1116,11 @@ int ttm_get_pages(struct list_head *pages, int flags,
 		  enum ttm_caching_state cstate, unsigned count,
 		  dma_addr_t *dma_address)
 {
-	struct ttm_page_pool *pool = ttm_get_pool(flags, cstate);
+	struct ttm_pool_group *group = ttm_get_pool(flags, cstate);
 	struct page *p = NULL;
+	struct list_head dirty;
 	gfp_t gfp_flags = GFP_USER;
+	unsigned requested = count, zero_hits = 0;
 	int r;
 
 	/* set zero flag for page allocation if required */
@@ -678,7 +1128,7 @@ int ttm_get_pages(struct list_head *pages, int flags,
 		gfp_flags |= __GFP_ZERO;
 
 	/* No pool for cached pages */
-	if (pool == NULL) {
+	if (group == NULL) {
 		if (flags & TTM_PAGE_FLAG_DMA32)
 			gfp_flags |= GFP_DMA32;
 		else
@@ -700,24 +1150,43 @@ int ttm_get_pages(struct list_head *pages, int flags,
 
 
 	/* combine zero flag to pool flags */
-	gfp_flags |= pool->gfp_flags;
+	gfp_flags |= group->gfp_flags;
+
+	/* Pre-zeroed pages first if the request wants cleared pages */
+	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
+		count = ttm_pool_get_cpu_pages(group, pages, flags, cstate,
+					       count, true);
+		zero_hits = requested - count;
+	}
 
-	/* First we take pages from the pool */
-	count = ttm_page_pool_get_pages(pool, pages, flags, cstate, count);
+	/* Then we take pages from the pool */
+	INIT_LIST_HEAD(&dirty);
+	if (count > 0)
+		count = ttm_pool_get_cpu_pages(group, &dirty, flags, cstate,
+					       count, false);
 
 	/* clear the pages coming from the pool if requested */
 	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
-		list_for_each_entry(p, pages, lru) {
+		list_for_each_entry(p, &dirty, lru) {
 			clear_page(page_address(p));
 		}
 	}
+	list_splice(&dirty, pages);
+
+	this_cpu_add(group->cpu->hits, requested - count);
+	this_cpu_add(group->cpu->misses, count);
+	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
+		this_cpu_add(group->cpu->zero_hits, zero_hits);
+		this_cpu_add(group->cpu->zero_misses, requested - zero_hits);
+	}
 
 	/* If pool didn't have enough pages allocate new one. */
 	if (count > 0) {
 		/* ttm_alloc_new_pages doesn't reference pool so we can run
 		 * multiple requests in parallel.
 		 **/
-		r = ttm_alloc_new_pages(pages, gfp_flags, flags, cstate, count);
+		r = ttm_alloc_new_pages(pages, gfp_flags, flags, cstate, count,
+					&group->nodes[numa_node_id()]);
 		if (r) {
 			/* If there is any pages in the list put them back to
 			 * the pool. */
@@ -732,16 +1201,19 @@ int ttm_get_pages(struct list_head *pages, int flags,
 
 	return 0;
 }
+EXPORT_SYMBOL(ttm_get_pages);
 
 /* Put all pages in pages list to correct pool to wait for reuse */
 void ttm_put_pages(struct list_head *pages, unsigned page_count, int flags,
 		   enum ttm_caching_state cstate, dma_addr_t *dma_address)
 {
 	unsigned long irq_flags;
-	struct ttm_page_pool *pool = ttm_get_pool(flags, cstate);
+	struct ttm_pool_group *group = ttm_get_pool(flags, cstate);
+	struct ttm_page_pool_cpu *cache;
+	struct list_head excess;
 	struct page *p, *tmp;
 
-	if (pool == NULL) {
+	if (group == NULL) {
 		/* No pool for this memory type so free the pages */
 
 		list_for_each_entry_safe(p, tmp, pages, lru) {
@@ -757,61 +1229,207 @@ void ttm_put_pages(struct list_head *pages, unsigned page_count, int flags,
 		}
 	}
 
-	spin_lock_irqsave(&pool->lock, irq_flags);
-	list_splice_init(pages, &pool->list);
-	pool->npages += page_count;
-	/* Check that we don't go over the pool limit */
-	page_count = 0;
-	if (pool->npages > _manager->options.max_size) {
-		page_count = pool->npages - _manager->options.max_size;
-		/* free at least NUM_PAGES_TO_ALLOC number of pages
-		 * to reduce calls to set_memory_wb */
-		if (page_count < NUM_PAGES_TO_ALLOC)
-			page_count = NUM_PAGES_TO_ALLOC;
+	/* Large lists go straight to the node pools. */
+	if (page_count > CPU_CACHE_BATCH) {
+		ttm_pool_put_node_pages(group, pages);
+		schedule_delayed_work(&_manager->zero_work, 0);
+		return;
 	}
-	spin_unlock_irqrestore(&pool->lock, irq_flags);
-	if (page_count)
-		ttm_page_pool_free(pool, page_count);
+
+	INIT_LIST_HEAD(&excess);
+	local_irq_save(irq_flags);
+	cache = this_cpu_ptr(group->cpu);
+	spin_lock(&cache->lock);
+	list_splice_init(pages, &cache->list);
+	cache->npages += page_count;
+	/* Trim the cache back to a batch once it goes over the limit. */
+	if (cache->npages > CPU_CACHE_HIGH) {
+		while (cache->npages > CPU_CACHE_BATCH) {
+			list_move(cache->list.prev, &excess);
+			--cache->npages;
+		}
+	}
+	spin_unlock_irqrestore(&cache->lock, irq_flags);
+
+	if (!list_empty(&excess)) {
+		ttm_pool_put_node_pages(group, &excess);
+		schedule_delayed_work(&_manager->zero_work, 0);
+	}
+}
+EXPORT_SYMBOL(ttm_put_pages);
+
+/**
+ * Clear free pages of the pool into its zeroed reserve until the reserve
+ * holds 'reserve' pages. Pages are cleared in batches with the pool lock
+ * dropped so allocations are not stalled.
+ */
+static void ttm_page_pool_zero(struct ttm_page_pool *pool, unsigned reserve)
+{
+	unsigned long irq_flags;
+	struct list_head pages;
+	struct page *p;
+	unsigned n;
+
+	for (;;) {
+		INIT_LIST_HEAD(&pages);
+		spin_lock_irqsave(&pool->lock, irq_flags);
+		n = 0;
+		while (n < ZERO_BATCH && pool->npages &&
+		       pool->nzeroed + n < reserve) {
+			list_move(pool->list.next, &pages);
+			--pool->npages;
+			++n;
+		}
+		spin_unlock_irqrestore(&pool->lock, irq_flags);
+
+		if (n == 0)
+			break;
+
+		list_for_each_entry(p, &pages, lru)
+			clear_highpage(p);
+
+		spin_lock_irqsave(&pool->lock, irq_flags);
+		list_splice(&pages, &pool->zeroed);
+		pool->nzeroed += n;
+		spin_unlock_irqrestore(&pool->lock, irq_flags);
+
+		cond_resched();
+	}
+}
+
+static void ttm_pool_zero_work(struct work_struct *work)
+{
+	struct ttm_pool_manager *m =
+		container_of(work, struct ttm_pool_manager, zero_work.work);
+	unsigned long delay = msecs_to_jiffies(PAGE_FREE_INTERVAL);
+	unsigned i;
+	int nid;
+
+	/* Don't undo the work of the shrinker right away. */
+	if (time_before(jiffies, m->last_shrink + delay)) {
+		schedule_delayed_work(&m->zero_work, delay);
+		return;
+	}
+
+	for (i = 0; i < NUM_POOLS; ++i)
+		for_each_online_node(nid)
+			ttm_page_pool_zero(&m->pools[i].nodes[nid],
+					   m->options.zero_reserve);
 }
 
 static void ttm_page_pool_init_locked(struct ttm_page_pool *pool, int flags,
-		char *name)
+		char *name, int nid)
 {
 	spin_lock_init(&pool->lock);
 	pool->fill_lock = false;
 	INIT_LIST_HEAD(&pool->list);
+	INIT_LIST_HEAD(&pool->zeroed);
 	pool->npages = pool->nfrees = 0;
+	pool->nzeroed = 0;
+	atomic_long_set(&pool->nchunks, 0);
+	atomic_long_set(&pool->nchunk_fails, 0);
 	pool->gfp_flags = flags;
 	pool->name = name;
+	pool->nid = nid;
+}
+
+static int ttm_pool_group_init(struct ttm_pool_group *group, int flags,
+		char *name)
+{
+	struct ttm_page_pool_cpu *cache;
+	int nid, cpu;
+
+	group->gfp_flags = flags;
+	group->name = name;
+
+	group->nodes = kcalloc(nr_node_ids, sizeof(*group->nodes), GFP_KERNEL);
+	if (unlikely(group->nodes == NULL))
+		return -ENOMEM;
+
+	group->cpu = alloc_percpu(struct ttm_page_pool_cpu);
+	if (unlikely(group->cpu == NULL)) {
+		kfree(group->nodes);
+		group->nodes = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_node(nid)
+		ttm_page_pool_init_locked(&group->nodes[nid], flags, name, nid);
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(group->cpu, cpu);
+		spin_lock_init(&cache->lock);
+		INIT_LIST_HEAD(&cache->list);
+		INIT_LIST_HEAD(&cache->zeroed);
+		cache->npages = cache->nzeroed = 0;
+		cache->hits = cache->misses = 0;
+		cache->zero_hits = cache->zero_misses = 0;
+	}
+	return 0;
+}
+
+static void ttm_pool_group_fini(struct ttm_pool_group *group)
+{
+	int nid;
+
+	if (group->nodes == NULL)
+		return;
+
+	ttm_pool_drain_cpu_caches(group);
+	for_each_node(nid) {
+		ttm_page_pool_release_zeroed(&group->nodes[nid]);
+		ttm_page_pool_free(&group->nodes[nid], FREE_ALL_PAGES);
+	}
+
+	free_percpu(group->cpu);
+	kfree(group->nodes);
+	group->cpu = NULL;
+	group->nodes = NULL;
 }
 
 int ttm_page_alloc_init(struct ttm_mem_global *glob, unsigned max_pages)
 {
 	int ret;
+	int i;
 
 	WARN_ON(_manager);
 
 	printk(KERN_INFO TTM_PFX "Initializing pool allocator.\n");
 
 	_manager = kzalloc(sizeof(*_manager), GFP_KERNEL);
-
-	ttm_page_pool_init_locked(&_manager->wc_pool, GFP_HIGHUSER, "wc");
-
-	ttm_page_pool_init_locked(&_manager->uc_pool, GFP_HIGHUSER, "uc");
-
-	ttm_page_pool_init_locked(&_manager->wc_pool_dma32,
-				  GFP_USER | GFP_DMA32, "wc dma");
-
-	ttm_page_pool_init_locked(&_manager->uc_pool_dma32,
-				  GFP_USER | GFP_DMA32, "uc dma");
+	if (unlikely(_manager == NULL))
+		return -ENOMEM;
 
 	_manager->options.max_size = max_pages;
 	_manager->options.small = SMALL_ALLOCATION;
 	_manager->options.alloc_size = NUM_PAGES_TO_ALLOC;
+	_manager->options.zero_reserve = NUM_PAGES_TO_ALLOC;
+	_manager->options.chunk_order = CHUNK_DEFAULT_ORDER;
+	INIT_DELAYED_WORK(&_manager->zero_work, ttm_pool_zero_work);
+
+	ret = ttm_pool_group_init(&_manager->wc_pool, GFP_HIGHUSER, "wc");
+	if (likely(ret == 0))
+		ret = ttm_pool_group_init(&_manager->uc_pool, GFP_HIGHUSER,
+					  "uc");
+	if (likely(ret == 0))
+		ret = ttm_pool_group_init(&_manager->wc_pool_dma32,
+					  GFP_USER | GFP_DMA32, "wc dma");
+	if (likely(ret == 0))
+		ret = ttm_pool_group_init(&_manager->uc_pool_dma32,
+					  GFP_USER | GFP_DMA32, "uc dma");
+	if (unlikely(ret != 0)) {
+		for (i = 0; i < NUM_POOLS; ++i)
+			ttm_pool_group_fini(&_manager->pools[i]);
+		kfree(_manager);
+		_manager = NULL;
+		return ret;
+	}
 
 	ret = kobject_init_and_add(&_manager->kobj, &ttm_pool_kobj_type,
 				   &glob->kobj, "pool");
 	if (unlikely(ret != 0)) {
+		for (i = 0; i < NUM_POOLS; ++i)
+			ttm_pool_group_fini(&_manager->pools[i]);
 		kobject_put(&_manager->kobj);
 		_manager = NULL;
 		return ret;
@@ -828,9 +1446,10 @@ void ttm_page_alloc_fini(void)
 
 	printk(KERN_INFO TTM_PFX "Finalizing pool allocator.\n");
 	ttm_pool_mm_shrink_fini(_manager);
+	cancel_delayed_work_sync(&_manager->zero_work);
 
 	for (i = 0; i < NUM_POOLS; ++i)
-		ttm_page_pool_free(&_manager->pools[i], FREE_ALL_PAGES);
+		ttm_pool_group_fini(&_manager->pools[i]);
 
 	kobject_put(&_manager->kobj);
 	_manager = NULL;
@@ -838,21 +1457,60 @@ void ttm_page_alloc_fini(void)
 
 int ttm_page_alloc_debugfs(struct seq_file *m, void *data)
 {
+	struct ttm_pool_group *group;
+	struct ttm_page_pool_cpu *cache;
 	struct ttm_page_pool *p;
-	unsigned i;
-	char *h[] = {"pool", "refills", "pages freed", "size"};
+	unsigned i, cached;
+	unsigned long hits, misses, zero_hits, zero_misses;
+	int nid, cpu;
+	char *h[] = {"pool", "node", "refills", "pages freed", "size",
+		     "zeroed", "chunks", "chunk fails"};
+	char *hh[] = {"pool", "cpu cached", "hits", "misses", "hit %",
+		      "zero hits", "zero misses", "zero hit %"};
 	if (!_manager) {
 		seq_printf(m, "No pool allocator running.\n");
 		return 0;
 	}
-	seq_printf(m, "%6s %12s %13s %8s\n",
-			h[0], h[1], h[2], h[3]);
+	seq_printf(m, "%6s %4s %12s %13s %8s %8s %10s %11s\n",
+			h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
 	for (i = 0; i < NUM_POOLS; ++i) {
-		p = &_manager->pools[i];
+		group = &_manager->pools[i];
+
+		for_each_online_node(nid) {
+			p = &group->nodes[nid];
+			seq_printf(m,
+				   "%6s %4d %12ld %13ld %8d %8d %10ld %11ld\n",
+				   p->name, nid, p->nrefills,
+				   p->nfrees, p->npages, p->nzeroed,
+				   atomic_long_read(&p->nchunks),
+				   atomic_long_read(&p->nchunk_fails));
+		}
+	}
+
+	/* the cpu caches are shared by all nodes of a group */
+	seq_printf(m, "\n%6s %10s %12s %12s %6s %12s %12s %10s\n",
+			hh[0], hh[1], hh[2], hh[3], hh[4], hh[5], hh[6], hh[7]);
+	for (i = 0; i < NUM_POOLS; ++i) {
+		group = &_manager->pools[i];
+
+		cached = 0;
+		hits = misses = zero_hits = zero_misses = 0;
+		for_each_possible_cpu(cpu) {
+			cache = per_cpu_ptr(group->cpu, cpu);
+			cached += cache->npages + cache->nzeroed;
+			hits += cache->hits;
+			misses += cache->misses;
+			zero_hits += cache->zero_hits;
+			zero_misses += cache->zero_misses;
+		}
 
-		seq_printf(m, "%6s %12ld %13ld %8d\n",
-				p->name, p->nrefills,
-				p->nfrees, p->npages);
+		seq_printf(m, "%6s %10u %12lu %12lu %6lu %12lu %12lu %10lu\n",
+				group->name, cached, hits, misses,
+				hits + misses ?
+				hits * 100 / (hits + misses) : 0,
+				zero_hits, zero_misses,
+				zero_hits + zero_misses ?
+				zero_hits * 100 / (zero_hits + zero_misses) : 0);
 	}
 	return 0;
 }
@@ -0,0 +1,186 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Stress test for the page pool allocator.
+ * - One thread per online cpu allocates and frees pages in a loop
+ * - All threads are released at the same time to maximize contention
+ * - Reports per cpu and aggregate throughput
+ */
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+
+#include "ttm/ttm_bo_driver.h"
+#include "ttm/ttm_page_alloc.h"
+
+static unsigned iterations = 10000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Allocation rounds per cpu");
+
+static unsigned npages = 1;
+module_param(npages, uint, 0444);
+MODULE_PARM_DESC(npages, "Pages per allocation");
+
+static bool uncached;
+module_param(uncached, bool, 0444);
+MODULE_PARM_DESC(uncached, "Test the uncached instead of the wc pools");
+
+static bool dma32;
+module_param(dma32, bool, 0444);
+MODULE_PARM_DESC(dma32, "Test the dma32 pools");
+
+static bool zero;
+module_param(zero, bool, 0444);
+MODULE_PARM_DESC(zero, "Request cleared pages");
+
+struct ttm_pool_test_worker {
+	struct task_struct	*task;
+	struct completion	done;
+	unsigned long		pages;
+	u64			ns;
+	int			ret;
+};
+
+static DECLARE_COMPLETION(ttm_pool_test_go);
+static struct drm_global_reference ttm_pool_test_mem_ref;
+
+static int ttm_pool_test_mem_init(struct drm_global_reference *ref)
+{
+	return ttm_mem_global_init(ref->object);
+}
+
+static void ttm_pool_test_mem_release(struct drm_global_reference *ref)
+{
+	ttm_mem_global_release(ref->object);
+}
+
+static int ttm_pool_test_thread(void *data)
+{
+	struct ttm_pool_test_worker *w = data;
+	enum ttm_caching_state cstate = uncached ? tt_uncached : tt_wc;
+	int flags = (dma32 ? TTM_PAGE_FLAG_DMA32 : 0) |
+		    (zero ? TTM_PAGE_FLAG_ZERO_ALLOC : 0);
+	struct list_head h;
+	ktime_t start;
+	unsigned i;
+
+	wait_for_completion(&ttm_pool_test_go);
+
+	start = ktime_get();
+	for (i = 0; i < iterations; ++i) {
+		INIT_LIST_HEAD(&h);
+		w->ret = ttm_get_pages(&h, flags, cstate, npages, NULL);
+		if (unlikely(w->ret != 0))
+			break;
+		ttm_put_pages(&h, npages, flags, cstate, NULL);
+		w->pages += npages;
+		cond_resched();
+	}
+	w->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	complete_and_exit(&w->done, 0);
+}
+
+static int __init ttm_pool_test_init(void)
+{
+	struct ttm_pool_test_worker *workers;
+	struct ttm_pool_test_worker *w;
+	unsigned long total = 0;
+	u64 wall = 0;
+	int cpu, ret;
+
+	ttm_pool_test_mem_ref.global_type = DRM_GLOBAL_TTM_MEM;
+	ttm_pool_test_mem_ref.size = sizeof(struct ttm_mem_global);
+	ttm_pool_test_mem_ref.init = &ttm_pool_test_mem_init;
+	ttm_pool_test_mem_ref.release = &ttm_pool_test_mem_release;
+	ret = drm_global_item_ref(&ttm_pool_test_mem_ref);
+	if (unlikely(ret != 0))
+		return ret;
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (unlikely(workers == NULL)) {
+		ret = -ENOMEM;
+		goto out_unref;
+	}
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		w = &workers[cpu];
+		init_completion(&w->done);
+		w->task = kthread_create(ttm_pool_test_thread, w,
+					 "ttm_pool_test/%d", cpu);
+		if (IS_ERR(w->task)) {
+			ret = PTR_ERR(w->task);
+			w->task = NULL;
+			break;
+		}
+		kthread_bind(w->task, cpu);
+		wake_up_process(w->task);
+	}
+
+	complete_all(&ttm_pool_test_go);
+
+	for_each_online_cpu(cpu) {
+		w = &workers[cpu];
+		if (w->task == NULL)
+			continue;
+		wait_for_completion(&w->done);
+		if (w->ret != 0) {
+			printk(KERN_ERR TTM_PFX
+			       "Pool test on cpu %d failed with %d.\n",
+			       cpu, w->ret);
+			ret = w->ret;
+		}
+		total += w->pages;
+		wall = max(wall, w->ns);
+		printk(KERN_INFO TTM_PFX
+		       "Pool test cpu %d: %lu pages in %llu us.\n",
+		       cpu, w->pages, (unsigned long long)
+		       div_u64(w->ns, NSEC_PER_USEC));
+	}
+	put_online_cpus();
+
+	if (wall)
+		printk(KERN_INFO TTM_PFX
+		       "Pool test: %lu pages in %llu us, %llu pages/s.\n",
+		       total, (unsigned long long)div_u64(wall, NSEC_PER_USEC),
+		       (unsigned long long)div64_u64((u64)total * NSEC_PER_SEC,
+						     wall));
+
+	kfree(workers);
+out_unref:
+	drm_global_item_unref(&ttm_pool_test_mem_ref);
+	return ret;
+}
+
+static void __exit ttm_pool_test_exit(void)
+{
+}
+
+module_init(ttm_pool_test_init);
+module_exit(ttm_pool_test_exit);
+
+MODULE_DESCRIPTION("TTM page pool allocator stress test");
+MODULE_LICENSE("GPL and additional rights");
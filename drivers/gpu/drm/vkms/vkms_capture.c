@@ -0,0 +1,1022 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * V4L2 capture of what a vkms crtc scans out
+ *
+ * Every crtc gets a video capture node. A frame is produced at the vblank
+ * after the crtc's framebuffer was flipped, set or marked dirty, stamped
+ * with the vblank time and sequence number, so an idle screen costs
+ * nothing.
+ *
+ * Frames are either copied into the capture buffers or, with
+ * capture_share=1, the capture buffer is remapped to the pages of the
+ * scanout buffer itself. Shared frames are only valid until the client
+ * draws into that framebuffer again, and are copied when the layout of
+ * the scanout buffer doesn't allow sharing or the buffer can't be
+ * remapped right now. Since those pages belong to another client's
+ * framebuffer, capture buffers can then only be mapped read-only.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <media/v4l2-device.h>
+#include <media/v4l2-ioctl.h>
+#include <media/v4l2-fh.h>
+#include <media/videobuf2-core.h>
+#include <media/videobuf2-memops.h>
+#include "vkms_drv.h"
+
+static bool vkms_capture_enable;
+module_param_named(capture, vkms_capture_enable, bool, 0444);
+MODULE_PARM_DESC(capture, "Create a V4L2 capture node for every crtc");
+
+static bool vkms_capture_share;
+module_param_named(capture_share, vkms_capture_share, bool, 0444);
+MODULE_PARM_DESC(capture_share, "Map scanout pages into capture buffers "
+		 "instead of copying");
+
+struct vkms_capture_fmt {
+	const char *name;
+	u32 fourcc;
+	int bpp;
+	int depth;
+};
+
+static const struct vkms_capture_fmt vkms_capture_formats[] = {
+	{ "RGB565 (LE)", V4L2_PIX_FMT_RGB565, 16, 16 },
+	{ "RGB555 (LE)", V4L2_PIX_FMT_RGB555, 16, 15 },
+	{ "BGR24", V4L2_PIX_FMT_BGR24, 24, 24 },
+	{ "BGR32", V4L2_PIX_FMT_BGR32, 32, 24 },
+};
+
+static const struct vkms_capture_fmt *
+vkms_capture_find_fmt(int bpp, int depth)
+{
+	int i;
+
+	/* The alpha channel isn't captured, ARGB comes out as BGR32 too */
+	if (bpp == 32 && depth == 32)
+		depth = 24;
+
+	for (i = 0; i < ARRAY_SIZE(vkms_capture_formats); i++)
+		if (vkms_capture_formats[i].bpp == bpp &&
+		    vkms_capture_formats[i].depth == depth)
+			return &vkms_capture_formats[i];
+	return NULL;
+}
+
+/*
+ * Memory of a capture buffer. Userspace mappings are filled in by the
+ * fault handler from @map, which points either at the buffer's own pages
+ * or at referenced pages of a scanout buffer. Switching between the two
+ * zaps the mapping, which needs the mmap_sem of the mapping process.
+ */
+struct vkms_capture_mem {
+	unsigned long size;
+	unsigned int npages;
+	struct page **own;
+	void *vaddr;		/* kernel mapping of the own pages */
+
+	struct mutex lock;	/* map and shared, against faults */
+	struct page **map;
+	bool shared;
+
+	/* Filled by vkms_capture_fill(), installed by vkms_capture_map() */
+	struct page **next;
+	bool next_shared;
+
+	spinlock_t vma_lock;	/* the single mapping allowed */
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+
+	atomic_t refcount;
+	struct vb2_vmarea_handler handler;
+};
+
+struct vkms_capture_buffer {
+	/* common v4l buffer stuff -- must be first */
+	struct vb2_buffer vb;
+	struct list_head list;
+};
+
+struct vkms_capture {
+	struct v4l2_device v4l2_dev;
+	struct video_device *vfd;
+	struct mutex mutex;		/* serializes fops and ioctls */
+	struct vb2_queue vb_vidq;
+	struct vkms_crtc *vcrtc;
+
+	/* Negotiated format, follows the crtc while not streaming */
+	const struct vkms_capture_fmt *fmt;
+	u32 width;
+	u32 height;
+	u32 bytesperline;
+	u32 sizeimage;
+
+	spinlock_t slock;		/* everything below */
+	struct list_head active;
+	bool streaming;
+	bool dirty;
+	u32 sequence;
+	struct timeval tstamp;
+	struct work_struct work;
+
+	unsigned long frames;
+	unsigned long shared;
+	unsigned long dropped;
+};
+
+static void vkms_capture_mem_put(void *buf_priv)
+{
+	struct vkms_capture_mem *mem = buf_priv;
+	int i;
+
+	if (!atomic_dec_and_test(&mem->refcount))
+		return;
+
+	if (mem->shared)
+		for (i = 0; i < mem->npages; i++)
+			put_page(mem->map[i]);
+	if (mem->vaddr)
+		vunmap(mem->vaddr);
+	for (i = 0; i < mem->npages && mem->own[i]; i++)
+		__free_page(mem->own[i]);
+
+	drm_free_large(mem->next);
+	drm_free_large(mem->map);
+	drm_free_large(mem->own);
+	kfree(mem);
+}
+
+static void *vkms_capture_mem_alloc(void *alloc_ctx, unsigned long size)
+{
+	struct vkms_capture_mem *mem;
+	int i;
+
+	mem = kzalloc(sizeof(*mem), GFP_KERNEL);
+	if (mem == NULL)
+		return NULL;
+
+	mem->size = PAGE_ALIGN(size);
+	mem->npages = mem->size >> PAGE_SHIFT;
+	mutex_init(&mem->lock);
+	spin_lock_init(&mem->vma_lock);
+	atomic_set(&mem->refcount, 1);
+	mem->handler.refcount = &mem->refcount;
+	mem->handler.put = vkms_capture_mem_put;
+	mem->handler.arg = mem;
+
+	mem->own = drm_calloc_large(mem->npages, sizeof(struct page *));
+	mem->map = drm_malloc_ab(mem->npages, sizeof(struct page *));
+	mem->next = drm_malloc_ab(mem->npages, sizeof(struct page *));
+	if (!mem->own || !mem->map || !mem->next)
+		goto err;
+
+	for (i = 0; i < mem->npages; i++) {
+		mem->own[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (mem->own[i] == NULL)
+			goto err;
+	}
+	memcpy(mem->map, mem->own, mem->npages * sizeof(struct page *));
+
+	mem->vaddr = vmap(mem->own, mem->npages, 0, PAGE_KERNEL);
+	if (mem->vaddr == NULL)
+		goto err;
+
+	return mem;
+
+err:
+	vkms_capture_mem_put(mem);
+	return NULL;
+}
+
+static void *vkms_capture_mem_vaddr(void *buf_priv)
+{
+	struct vkms_capture_mem *mem = buf_priv;
+
+	return mem->vaddr;
+}
+
+static unsigned int vkms_capture_mem_num_users(void *buf_priv)
+{
+	struct vkms_capture_mem *mem = buf_priv;
+
+	return atomic_read(&mem->refcount);
+}
+
+static void vkms_capture_vm_open(struct vm_area_struct *vma)
+{
+	struct vkms_capture_mem *mem = container_of(vma->vm_private_data,
+						    struct vkms_capture_mem,
+						    handler);
+
+	atomic_inc(&mem->refcount);
+}
+
+static void vkms_capture_vm_close(struct vm_area_struct *vma)
+{
+	struct vkms_capture_mem *mem = container_of(vma->vm_private_data,
+						    struct vkms_capture_mem,
+						    handler);
+	struct mm_struct *mm = NULL;
+
+	spin_lock(&mem->vma_lock);
+	if (mem->vma == vma) {
+		mm = mem->mm;
+		mem->vma = NULL;
+		mem->mm = NULL;
+	}
+	spin_unlock(&mem->vma_lock);
+
+	if (mm)
+		mmdrop(mm);
+	vkms_capture_mem_put(mem);
+}
+
+static int vkms_capture_vm_fault(struct vm_area_struct *vma,
+				 struct vm_fault *vmf)
+{
+	struct vkms_capture_mem *mem = container_of(vma->vm_private_data,
+						    struct vkms_capture_mem,
+						    handler);
+	unsigned long address = (unsigned long)vmf->virtual_address;
+	pgoff_t page_offset = (address - vma->vm_start) >> PAGE_SHIFT;
+	bool mapped;
+	int ret;
+
+	spin_lock(&mem->vma_lock);
+	mapped = mem->vma == vma;
+	spin_unlock(&mem->vma_lock);
+
+	/* Split vmas can't be zapped as a whole, so they get nothing. */
+	if (!mapped || page_offset >= mem->npages)
+		return VM_FAULT_SIGBUS;
+
+	mutex_lock(&mem->lock);
+	ret = vm_insert_pfn(vma, address, page_to_pfn(mem->map[page_offset]));
+	mutex_unlock(&mem->lock);
+
+	switch (ret) {
+	case 0:
+	case -EBUSY:
+		return VM_FAULT_NOPAGE;
+	case -ENOMEM:
+		return VM_FAULT_OOM;
+	default:
+		return VM_FAULT_SIGBUS;
+	}
+}
+
+static const struct vm_operations_struct vkms_capture_vm_ops = {
+	.open = vkms_capture_vm_open,
+	.close = vkms_capture_vm_close,
+	.fault = vkms_capture_vm_fault,
+};
+
+static int vkms_capture_mem_mmap(void *buf_priv, struct vm_area_struct *vma)
+{
+	struct vkms_capture_mem *mem = buf_priv;
+
+	if (vma->vm_end - vma->vm_start > mem->size)
+		return -EINVAL;
+
+	/* Shared frames are the scanout buffer, which isn't ours to write */
+	if (vkms_capture_share) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	spin_lock(&mem->vma_lock);
+	if (mem->vma) {
+		spin_unlock(&mem->vma_lock);
+		return -EBUSY;
+	}
+	mem->vma = vma;
+	mem->mm = vma->vm_mm;
+	atomic_inc(&mem->mm->mm_count);
+	spin_unlock(&mem->vma_lock);
+
+	vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTCOPY |
+		VM_RESERVED;
+	vma->vm_private_data = &mem->handler;
+	vma->vm_ops = &vkms_capture_vm_ops;
+
+	atomic_inc(&mem->refcount);
+	return 0;
+}
+
+static const struct vb2_mem_ops vkms_capture_memops = {
+	.alloc = vkms_capture_mem_alloc,
+	.put = vkms_capture_mem_put,
+	.vaddr = vkms_capture_mem_vaddr,
+	.mmap = vkms_capture_mem_mmap,
+	.num_users = vkms_capture_mem_num_users,
+};
+
+static void vkms_capture_drop_next(struct vkms_capture_mem *mem)
+{
+	int i;
+
+	if (mem->next_shared)
+		for (i = 0; i < mem->npages; i++)
+			put_page(mem->next[i]);
+	mem->next_shared = false;
+}
+
+/*
+ * Produce the current frame in @mem, either by copying it into the own
+ * pages or by referencing the scanout pages in mem->next. Called with
+ * mode_config.mutex and struct_mutex held.
+ */
+static int vkms_capture_fill(struct vkms_capture *cap,
+			     struct vkms_capture_mem *mem)
+{
+	struct drm_crtc *crtc = &cap->vcrtc->base;
+	struct drm_framebuffer *fb = crtc->fb;
+	struct vkms_gem_object *bo;
+	u32 cpp, row, y;
+	size_t offset;
+	int i, ret;
+
+	if (!crtc->enabled || fb == NULL)
+		return -ENODATA;
+
+	if (vkms_capture_find_fmt(fb->bits_per_pixel, fb->depth) != cap->fmt ||
+	    crtc->hwmode.hdisplay != cap->width ||
+	    crtc->hwmode.vdisplay != cap->height)
+		return -EINVAL;
+
+	bo = to_vkms_fb(fb)->obj;
+	cpp = fb->bits_per_pixel / 8;
+	row = cap->width * cpp;
+	offset = (size_t)crtc->y * fb->pitch + crtc->x * cpp;
+
+	if (vkms_capture_share && !cap->vb_vidq.fileio &&
+	    fb->pitch == cap->bytesperline && !(offset & ~PAGE_MASK) &&
+	    offset + mem->size <= bo->base.size) {
+		ret = vkms_gem_get_pages(bo);
+		if (ret)
+			return ret;
+
+		for (i = 0; i < mem->npages; i++) {
+			mem->next[i] = bo->pages[(offset >> PAGE_SHIFT) + i];
+			get_page(mem->next[i]);
+		}
+		mem->next_shared = true;
+		return 0;
+	}
+
+	if (offset + (size_t)(cap->height - 1) * fb->pitch + row >
+	    bo->base.size)
+		return -EINVAL;
+
+	ret = vkms_gem_vmap(bo);
+	if (ret)
+		return ret;
+
+	for (y = 0; y < cap->height; y++)
+		memcpy(mem->vaddr + y * cap->bytesperline,
+		       bo->vaddr + offset + y * fb->pitch, row);
+	mem->next_shared = false;
+	return 0;
+}
+
+/*
+ * Make the pages chosen by vkms_capture_fill() the ones userspace sees.
+ * Waiting for mmap_sem could deadlock against mmap() of the video node,
+ * so this gives up with -EAGAIN if it's contended.
+ */
+static int vkms_capture_map(struct vkms_capture_mem *mem)
+{
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+	bool old_shared;
+	int i;
+
+	if (!mem->next_shared && !mem->shared)
+		return 0;
+
+	spin_lock(&mem->vma_lock);
+	mm = mem->mm;
+	if (mm && !atomic_inc_not_zero(&mm->mm_users))
+		mm = NULL;
+	spin_unlock(&mem->vma_lock);
+
+	if (mm && !down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		vkms_capture_drop_next(mem);
+		return -EAGAIN;
+	}
+
+	mutex_lock(&mem->lock);
+	swap(mem->map, mem->next);
+	if (!mem->next_shared)
+		memcpy(mem->map, mem->own, mem->npages * sizeof(struct page *));
+	old_shared = mem->shared;
+	mem->shared = mem->next_shared;
+	mem->next_shared = false;
+
+	spin_lock(&mem->vma_lock);
+	vma = mem->vma;
+	spin_unlock(&mem->vma_lock);
+	if (mm && vma)
+		zap_vma_ptes(vma, vma->vm_start, vma->vm_end - vma->vm_start);
+	mutex_unlock(&mem->lock);
+
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+
+	if (old_shared)
+		for (i = 0; i < mem->npages; i++)
+			put_page(mem->next[i]);
+	return 0;
+}
+
+static void vkms_capture_work(struct work_struct *work)
+{
+	struct vkms_capture *cap = container_of(work, struct vkms_capture,
+						work);
+	struct drm_device *dev = cap->vcrtc->base.dev;
+	struct vkms_capture_buffer *buf;
+	struct vkms_capture_mem *mem;
+	struct timeval tstamp;
+	unsigned long flags;
+	u32 sequence;
+	int ret;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	if (!cap->streaming || list_empty(&cap->active)) {
+		if (cap->streaming)
+			cap->dropped++;
+		spin_unlock_irqrestore(&cap->slock, flags);
+		return;
+	}
+	buf = list_first_entry(&cap->active, struct vkms_capture_buffer, list);
+	list_del(&buf->list);
+	sequence = cap->sequence;
+	tstamp = cap->tstamp;
+	spin_unlock_irqrestore(&cap->slock, flags);
+
+	mem = buf->vb.planes[0].mem_priv;
+
+	mutex_lock(&dev->mode_config.mutex);
+	mutex_lock(&dev->struct_mutex);
+	ret = vkms_capture_fill(cap, mem);
+	mutex_unlock(&dev->struct_mutex);
+	mutex_unlock(&dev->mode_config.mutex);
+
+	if (ret == 0)
+		ret = vkms_capture_map(mem);
+
+	if (ret) {
+		DRM_DEBUG_DRIVER("crtc %d: frame %u skipped (%d)\n",
+				 cap->vcrtc->index, sequence, ret);
+		spin_lock_irqsave(&cap->slock, flags);
+		list_add(&buf->list, &cap->active);
+		/* try again at the next vblank */
+		if (ret == -EAGAIN || ret == -ENOMEM)
+			cap->dirty = true;
+		cap->dropped++;
+		spin_unlock_irqrestore(&cap->slock, flags);
+		return;
+	}
+
+	spin_lock_irqsave(&cap->slock, flags);
+	cap->frames++;
+	if (mem->shared)
+		cap->shared++;
+	spin_unlock_irqrestore(&cap->slock, flags);
+
+	buf->vb.v4l2_buf.sequence = sequence;
+	buf->vb.v4l2_buf.timestamp = tstamp;
+	buf->vb.v4l2_buf.field = V4L2_FIELD_NONE;
+	vb2_buffer_done(&buf->vb, VB2_BUF_STATE_DONE);
+}
+
+/* The crtc's framebuffer was flipped, set or drawn to. */
+void vkms_capture_damage(struct vkms_crtc *vcrtc)
+{
+	struct vkms_capture *cap = vcrtc->capture;
+	unsigned long flags;
+
+	if (cap == NULL)
+		return;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	cap->dirty = true;
+	spin_unlock_irqrestore(&cap->slock, flags);
+}
+
+/* Called from the vblank timer, after page flips have completed. */
+void vkms_capture_vblank(struct vkms_crtc *vcrtc)
+{
+	struct vkms_capture *cap = vcrtc->capture;
+	unsigned long flags;
+
+	if (cap == NULL)
+		return;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	if (cap->streaming && cap->dirty) {
+		cap->dirty = false;
+		cap->sequence = drm_vblank_count_and_time(vcrtc->base.dev,
+							  vcrtc->index,
+							  &cap->tstamp);
+		schedule_work(&cap->work);
+	}
+	spin_unlock_irqrestore(&cap->slock, flags);
+}
+
+/*
+ * Follow the crtc's mode and framebuffer format. Called with cap->mutex
+ * held while not streaming.
+ */
+static void vkms_capture_update_fmt(struct vkms_capture *cap)
+{
+	struct drm_crtc *crtc = &cap->vcrtc->base;
+	struct drm_device *dev = crtc->dev;
+	const struct vkms_capture_fmt *fmt = NULL;
+	u32 pitch = 0;
+
+	mutex_lock(&dev->mode_config.mutex);
+	if (crtc->enabled && crtc->fb) {
+		fmt = vkms_capture_find_fmt(crtc->fb->bits_per_pixel,
+					    crtc->fb->depth);
+		pitch = crtc->fb->pitch;
+	}
+	if (fmt) {
+		cap->fmt = fmt;
+		cap->width = crtc->hwmode.hdisplay;
+		cap->height = crtc->hwmode.vdisplay;
+	}
+	mutex_unlock(&dev->mode_config.mutex);
+
+	/* Shared frames keep the layout of the scanout buffer. */
+	cap->bytesperline = cap->width * (cap->fmt->bpp / 8);
+	if (vkms_capture_share && pitch > cap->bytesperline)
+		cap->bytesperline = pitch;
+	cap->sizeimage = cap->bytesperline * cap->height;
+}
+
+/* ------------------------------------------------------------------
+	Videobuf operations
+   ------------------------------------------------------------------*/
+static int queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
+		       unsigned int *nplanes, unsigned long sizes[],
+		       void *alloc_ctxs[])
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vq);
+
+	if (*nbuffers == 0)
+		*nbuffers = 4;
+	*nbuffers = clamp(*nbuffers, 2U, 32U);
+
+	*nplanes = 1;
+	sizes[0] = cap->sizeimage;
+
+	return 0;
+}
+
+static int buffer_prepare(struct vb2_buffer *vb)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vb->vb2_queue);
+
+	if (vb2_plane_size(vb, 0) < cap->sizeimage)
+		return -EINVAL;
+
+	vb2_set_plane_payload(vb, 0, cap->sizeimage);
+	return 0;
+}
+
+static void buffer_queue(struct vb2_buffer *vb)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vb->vb2_queue);
+	struct vkms_capture_buffer *buf =
+		container_of(vb, struct vkms_capture_buffer, vb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	list_add_tail(&buf->list, &cap->active);
+	spin_unlock_irqrestore(&cap->slock, flags);
+}
+
+static int start_streaming(struct vb2_queue *vq)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vq);
+	unsigned long flags;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	cap->streaming = true;
+	/* the first frame is whatever is on screen */
+	cap->dirty = true;
+	spin_unlock_irqrestore(&cap->slock, flags);
+
+	return 0;
+}
+
+static int stop_streaming(struct vb2_queue *vq)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vq);
+	struct vkms_capture_buffer *buf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	cap->streaming = false;
+	spin_unlock_irqrestore(&cap->slock, flags);
+
+	cancel_work_sync(&cap->work);
+
+	/* Release all active buffers */
+	while (!list_empty(&cap->active)) {
+		buf = list_first_entry(&cap->active,
+				       struct vkms_capture_buffer, list);
+		list_del(&buf->list);
+		vb2_buffer_done(&buf->vb, VB2_BUF_STATE_ERROR);
+	}
+
+	return 0;
+}
+
+static void vkms_capture_lock(struct vb2_queue *vq)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vq);
+
+	mutex_lock(&cap->mutex);
+}
+
+static void vkms_capture_unlock(struct vb2_queue *vq)
+{
+	struct vkms_capture *cap = vb2_get_drv_priv(vq);
+
+	mutex_unlock(&cap->mutex);
+}
+
+static struct vb2_ops vkms_capture_qops = {
+	.queue_setup		= queue_setup,
+	.buf_prepare		= buffer_prepare,
+	.buf_queue		= buffer_queue,
+	.start_streaming	= start_streaming,
+	.stop_streaming		= stop_streaming,
+	.wait_prepare		= vkms_capture_unlock,
+	.wait_finish		= vkms_capture_lock,
+};
+
+/* ------------------------------------------------------------------
+	IOCTL vidioc handling
+   ------------------------------------------------------------------*/
+static int vidioc_querycap(struct file *file, void *priv,
+			   struct v4l2_capability *cap)
+{
+	struct vkms_capture *vcap = video_drvdata(file);
+
+	strlcpy(cap->driver, DRIVER_NAME, sizeof(cap->driver));
+	snprintf(cap->card, sizeof(cap->card), "vkms crtc %d",
+		 vcap->vcrtc->index);
+	strlcpy(cap->bus_info, vcap->v4l2_dev.name, sizeof(cap->bus_info));
+	cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING |
+			    V4L2_CAP_READWRITE;
+	return 0;
+}
+
+static int vidioc_enum_fmt_vid_cap(struct file *file, void *priv,
+				   struct v4l2_fmtdesc *f)
+{
+	const struct vkms_capture_fmt *fmt;
+
+	if (f->index >= ARRAY_SIZE(vkms_capture_formats))
+		return -EINVAL;
+
+	fmt = &vkms_capture_formats[f->index];
+	strlcpy(f->description, fmt->name, sizeof(f->description));
+	f->pixelformat = fmt->fourcc;
+	return 0;
+}
+
+static void vkms_capture_fill_fmt(struct vkms_capture *cap,
+				  struct v4l2_format *f)
+{
+	f->fmt.pix.width = cap->width;
+	f->fmt.pix.height = cap->height;
+	f->fmt.pix.field = V4L2_FIELD_NONE;
+	f->fmt.pix.pixelformat = cap->fmt->fourcc;
+	f->fmt.pix.bytesperline = cap->bytesperline;
+	f->fmt.pix.sizeimage = cap->sizeimage;
+	f->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+	f->fmt.pix.priv = 0;
+}
+
+static int vidioc_g_fmt_vid_cap(struct file *file, void *priv,
+				struct v4l2_format *f)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (!vb2_is_streaming(&cap->vb_vidq))
+		vkms_capture_update_fmt(cap);
+	vkms_capture_fill_fmt(cap, f);
+	return 0;
+}
+
+/* The format is whatever the crtc scans out, it can't be changed here. */
+static int vidioc_try_fmt_vid_cap(struct file *file, void *priv,
+				  struct v4l2_format *f)
+{
+	return vidioc_g_fmt_vid_cap(file, priv, f);
+}
+
+static int vidioc_s_fmt_vid_cap(struct file *file, void *priv,
+				struct v4l2_format *f)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (vb2_is_busy(&cap->vb_vidq))
+		return -EBUSY;
+
+	return vidioc_g_fmt_vid_cap(file, priv, f);
+}
+
+static int vidioc_reqbufs(struct file *file, void *priv,
+			  struct v4l2_requestbuffers *p)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (!vb2_is_busy(&cap->vb_vidq))
+		vkms_capture_update_fmt(cap);
+	return vb2_reqbufs(&cap->vb_vidq, p);
+}
+
+static int vidioc_querybuf(struct file *file, void *priv,
+			   struct v4l2_buffer *p)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_querybuf(&cap->vb_vidq, p);
+}
+
+static int vidioc_qbuf(struct file *file, void *priv, struct v4l2_buffer *p)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_qbuf(&cap->vb_vidq, p);
+}
+
+static int vidioc_dqbuf(struct file *file, void *priv, struct v4l2_buffer *p)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_dqbuf(&cap->vb_vidq, p, file->f_flags & O_NONBLOCK);
+}
+
+static int vidioc_streamon(struct file *file, void *priv,
+			   enum v4l2_buf_type i)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_streamon(&cap->vb_vidq, i);
+}
+
+static int vidioc_streamoff(struct file *file, void *priv,
+			    enum v4l2_buf_type i)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_streamoff(&cap->vb_vidq, i);
+}
+
+/* only one input, the crtc */
+static int vidioc_enum_input(struct file *file, void *priv,
+			     struct v4l2_input *inp)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (inp->index != 0)
+		return -EINVAL;
+
+	inp->type = V4L2_INPUT_TYPE_CAMERA;
+	snprintf(inp->name, sizeof(inp->name), "CRTC %d", cap->vcrtc->index);
+	return 0;
+}
+
+static int vidioc_g_input(struct file *file, void *priv, unsigned int *i)
+{
+	*i = 0;
+	return 0;
+}
+
+static int vidioc_s_input(struct file *file, void *priv, unsigned int i)
+{
+	return i ? -EINVAL : 0;
+}
+
+static int vidioc_log_status(struct file *file, void *priv)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+	unsigned long flags;
+
+	spin_lock_irqsave(&cap->slock, flags);
+	v4l2_info(&cap->v4l2_dev, "frames %lu (shared %lu), dropped %lu\n",
+		  cap->frames, cap->shared, cap->dropped);
+	spin_unlock_irqrestore(&cap->slock, flags);
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+	File operations for the device
+   ------------------------------------------------------------------*/
+
+static ssize_t vkms_capture_read(struct file *file, char __user *data,
+				 size_t count, loff_t *ppos)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (!vb2_is_busy(&cap->vb_vidq))
+		vkms_capture_update_fmt(cap);
+	return vb2_read(&cap->vb_vidq, data, count, ppos,
+			file->f_flags & O_NONBLOCK);
+}
+
+static unsigned int vkms_capture_poll(struct file *file,
+				      struct poll_table_struct *wait)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_poll(&cap->vb_vidq, file, wait);
+}
+
+static int vkms_capture_close(struct file *file)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	if (v4l2_fh_is_singular_file(file))
+		vb2_queue_release(&cap->vb_vidq);
+	return v4l2_fh_release(file);
+}
+
+static int vkms_capture_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct vkms_capture *cap = video_drvdata(file);
+
+	return vb2_mmap(&cap->vb_vidq, vma);
+}
+
+static const struct v4l2_file_operations vkms_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v4l2_fh_open,
+	.release	= vkms_capture_close,
+	.read		= vkms_capture_read,
+	.poll		= vkms_capture_poll,
+	.unlocked_ioctl	= video_ioctl2,
+	.mmap		= vkms_capture_mmap,
+};
+
+static const struct v4l2_ioctl_ops vkms_capture_ioctl_ops = {
+	.vidioc_querycap	  = vidioc_querycap,
+	.vidioc_enum_fmt_vid_cap  = vidioc_enum_fmt_vid_cap,
+	.vidioc_g_fmt_vid_cap	  = vidioc_g_fmt_vid_cap,
+	.vidioc_try_fmt_vid_cap   = vidioc_try_fmt_vid_cap,
+	.vidioc_s_fmt_vid_cap	  = vidioc_s_fmt_vid_cap,
+	.vidioc_reqbufs		  = vidioc_reqbufs,
+	.vidioc_querybuf	  = vidioc_querybuf,
+	.vidioc_qbuf		  = vidioc_qbuf,
+	.vidioc_dqbuf		  = vidioc_dqbuf,
+	.vidioc_enum_input	  = vidioc_enum_input,
+	.vidioc_g_input		  = vidioc_g_input,
+	.vidioc_s_input		  = vidioc_s_input,
+	.vidioc_streamon	  = vidioc_streamon,
+	.vidioc_streamoff	  = vidioc_streamoff,
+	.vidioc_log_status	  = vidioc_log_status,
+};
+
+static struct video_device vkms_capture_template = {
+	.name		= "vkms",
+	.fops		= &vkms_capture_fops,
+	.ioctl_ops	= &vkms_capture_ioctl_ops,
+	.release	= video_device_release,
+};
+
+int vkms_capture_init(struct vkms_crtc *vcrtc)
+{
+	struct drm_device *dev = vcrtc->base.dev;
+	struct vkms_capture *cap;
+	struct video_device *vfd;
+	struct vb2_queue *q;
+	int ret;
+
+	if (!vkms_capture_enable)
+		return 0;
+
+	cap = kzalloc(sizeof(*cap), GFP_KERNEL);
+	if (cap == NULL)
+		return -ENOMEM;
+
+	snprintf(cap->v4l2_dev.name, sizeof(cap->v4l2_dev.name),
+		 "%s-crtc%d", DRIVER_NAME, vcrtc->index);
+	ret = v4l2_device_register(dev->dev, &cap->v4l2_dev);
+	if (ret)
+		goto free_cap;
+
+	cap->vcrtc = vcrtc;
+	cap->fmt = vkms_capture_find_fmt(32, 24);
+	cap->width = vcrtc->xres;
+	cap->height = vcrtc->yres;
+	cap->bytesperline = cap->width * 4;
+	cap->sizeimage = cap->bytesperline * cap->height;
+
+	mutex_init(&cap->mutex);
+	spin_lock_init(&cap->slock);
+	INIT_LIST_HEAD(&cap->active);
+	INIT_WORK(&cap->work, vkms_capture_work);
+
+	q = &cap->vb_vidq;
+	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	q->io_modes = VB2_MMAP | VB2_READ;
+	q->drv_priv = cap;
+	q->buf_struct_size = sizeof(struct vkms_capture_buffer);
+	q->ops = &vkms_capture_qops;
+	q->mem_ops = &vkms_capture_memops;
+	vb2_queue_init(q);
+
+	ret = -ENOMEM;
+	vfd = video_device_alloc();
+	if (vfd == NULL)
+		goto unreg_dev;
+
+	*vfd = vkms_capture_template;
+	vfd->v4l2_dev = &cap->v4l2_dev;
+	vfd->lock = &cap->mutex;
+
+	ret = video_register_device(vfd, VFL_TYPE_GRABBER, -1);
+	if (ret < 0)
+		goto rel_vdev;
+
+	video_set_drvdata(vfd, cap);
+	cap->vfd = vfd;
+	vcrtc->capture = cap;
+
+	v4l2_info(&cap->v4l2_dev, "crtc %d captured by %s\n", vcrtc->index,
+		  video_device_node_name(vfd));
+	return 0;
+
+rel_vdev:
+	video_device_release(vfd);
+unreg_dev:
+	v4l2_device_unregister(&cap->v4l2_dev);
+free_cap:
+	kfree(cap);
+	return ret;
+}
+
+/**
+ * vkms_capture_node_name - name of the capture node of a crtc
+ * @vcrtc: the crtc
+ *
+ * For the selftests. Returns NULL if the crtc has no capture node.
+ */
+const char *vkms_capture_node_name(struct vkms_crtc *vcrtc)
+{
+	if (vcrtc->capture == NULL)
+		return NULL;
+
+	return video_device_node_name(vcrtc->capture->vfd);
+}
+EXPORT_SYMBOL_GPL(vkms_capture_node_name);
+
+/*
+ * Open capture nodes pin the module, so nothing can be using the node
+ * any more when the driver unloads.
+ */
+void vkms_capture_fini(struct vkms_crtc *vcrtc)
+{
+	struct vkms_capture *cap = vcrtc->capture;
+
+	if (cap == NULL)
+		return;
+
+	vcrtc->capture = NULL;
+	cancel_work_sync(&cap->work);
+	video_unregister_device(cap->vfd);
+	v4l2_device_unregister(&cap->v4l2_dev);
+	kfree(cap);
+}
@@ -0,0 +1,374 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Selftest for the V4L2 capture of vkms crtcs.
+ * - Needs vkms loaded with capture=1, uses the first crtc of the first
+ *   device and needs its capture node in /dev
+ * - Sets the preferred mode on two framebuffers with different contents
+ *   and reads frames from the capture node, the way read() users do
+ * - Checks that the first frame shows the framebuffer that was set, that
+ *   an idle crtc produces no frames, that a page flip updates crtc->fb
+ *   right away and that the next frame shows the new framebuffer
+ * - Checks that flips on a crtc that is off are refused
+ * - Reports the time from queueing a flip to reading its frame
+ */
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/fcntl.h>
+#include <linux/fs.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include "vkms_drv.h"
+
+static unsigned loops = 20;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Flips timed");
+
+#define CAPTURE_PFX "vkms_capture_test: "
+
+/* frames come at the next vblank, give them a few */
+#define CAPTURE_TEST_TIMEOUT_MS 1000
+
+struct capture_test {
+	struct drm_device *dev;
+	struct vkms_crtc *vcrtc;
+	struct drm_display_mode *mode;
+	struct drm_framebuffer *fb[2];
+	struct file *filp;
+	size_t size;
+	void *frame;
+};
+
+static void capture_test_fill(u32 *p, size_t size, u32 seed)
+{
+	size_t i;
+
+	for (i = 0; i < size / 4; i++)
+		p[i] = (i + seed) * 2654435761u;
+}
+
+static int capture_test_check(const u32 *p, size_t size, u32 seed,
+			      const char *what)
+{
+	size_t i;
+
+	for (i = 0; i < size / 4; i++) {
+		if (p[i] != (u32)((i + seed) * 2654435761u)) {
+			printk(KERN_ERR CAPTURE_PFX "%s: mismatch at word %zu\n",
+			       what, i);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int capture_test_create_fb(struct capture_test *t, int i)
+{
+	struct drm_mode_fb_cmd mode_cmd;
+	struct vkms_gem_object *bo;
+	struct drm_framebuffer *fb;
+	int ret;
+
+	bo = vkms_gem_create(t->dev, PAGE_ALIGN(t->size));
+	if (bo == NULL)
+		return -ENOMEM;
+
+	mutex_lock(&t->dev->struct_mutex);
+	ret = vkms_gem_vmap(bo);
+	mutex_unlock(&t->dev->struct_mutex);
+	if (ret) {
+		drm_gem_object_unreference_unlocked(&bo->base);
+		return ret;
+	}
+	capture_test_fill(bo->vaddr, t->size, i);
+
+	mode_cmd.width = t->mode->hdisplay;
+	mode_cmd.height = t->mode->vdisplay;
+	mode_cmd.pitch = mode_cmd.width * 4;
+	mode_cmd.bpp = 32;
+	mode_cmd.depth = 24;
+
+	mutex_lock(&t->dev->mode_config.mutex);
+	fb = vkms_framebuffer_create(t->dev, &mode_cmd, bo);
+	mutex_unlock(&t->dev->mode_config.mutex);
+	if (IS_ERR(fb))
+		return PTR_ERR(fb);
+
+	t->fb[i] = fb;
+	return 0;
+}
+
+/* Scan out @fb with the preferred mode, or switch the crtc off. */
+static int capture_test_set(struct capture_test *t, struct drm_framebuffer *fb)
+{
+	struct drm_connector *connector = &t->vcrtc->connector;
+	struct drm_mode_set set;
+	int ret;
+
+	memset(&set, 0, sizeof(set));
+	set.crtc = &t->vcrtc->base;
+	if (fb) {
+		set.fb = fb;
+		set.mode = t->mode;
+		set.connectors = &connector;
+		set.num_connectors = 1;
+	}
+
+	mutex_lock(&t->dev->mode_config.mutex);
+	ret = set.crtc->funcs->set_config(&set);
+	mutex_unlock(&t->dev->mode_config.mutex);
+	return ret;
+}
+
+static int capture_test_flip(struct capture_test *t,
+			     struct drm_framebuffer *fb)
+{
+	struct drm_crtc *crtc = &t->vcrtc->base;
+	int ret;
+
+	mutex_lock(&t->dev->mode_config.mutex);
+	ret = crtc->funcs->page_flip(crtc, fb, NULL);
+	if (ret == 0 && crtc->fb != fb) {
+		printk(KERN_ERR CAPTURE_PFX "flip left crtc->fb alone\n");
+		ret = -EINVAL;
+	}
+	mutex_unlock(&t->dev->mode_config.mutex);
+	return ret;
+}
+
+/* wait for the flip to complete, so that the next one isn't refused */
+static int capture_test_wait_flip(struct capture_test *t)
+{
+	unsigned long flags;
+	bool pending;
+	int ms;
+
+	for (ms = 0; ms < CAPTURE_TEST_TIMEOUT_MS; ms++) {
+		spin_lock_irqsave(&t->dev->event_lock, flags);
+		pending = t->vcrtc->flip_pending;
+		spin_unlock_irqrestore(&t->dev->event_lock, flags);
+		if (!pending)
+			return 0;
+		msleep(1);
+	}
+
+	printk(KERN_ERR CAPTURE_PFX "flip never completed\n");
+	return -ETIMEDOUT;
+}
+
+/* Read a frame, as a non-blocking reader polling for it would. */
+static int capture_test_read(struct capture_test *t, bool expect_frame)
+{
+	mm_segment_t old_fs;
+	loff_t pos = 0;
+	ssize_t ret;
+	int ms;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (ms = 0; ms < CAPTURE_TEST_TIMEOUT_MS; ms += 5) {
+		ret = vfs_read(t->filp, (char __user *)t->frame, t->size,
+			       &pos);
+		if (ret != -EAGAIN || !expect_frame)
+			break;
+		msleep(5);
+	}
+	set_fs(old_fs);
+
+	if (!expect_frame) {
+		if (ret == -EAGAIN)
+			return 0;
+		printk(KERN_ERR CAPTURE_PFX "idle crtc produced a frame\n");
+		return -EINVAL;
+	}
+	if (ret < 0) {
+		printk(KERN_ERR CAPTURE_PFX "no frame (%zd)\n", ret);
+		return ret;
+	}
+	if (ret != t->size) {
+		printk(KERN_ERR CAPTURE_PFX "short frame, %zd bytes\n", ret);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int capture_test_frames(struct capture_test *t)
+{
+	ktime_t start;
+	u64 ns;
+	unsigned i;
+	int ret;
+
+	/* the first frame is what is on screen when streaming starts */
+	ret = capture_test_read(t, true);
+	if (!ret)
+		ret = capture_test_check(t->frame, t->size, 0, "first frame");
+	if (ret)
+		return ret;
+
+	/* an idle screen costs nothing, wait a few vblanks for a frame */
+	msleep(100);
+	ret = capture_test_read(t, false);
+	if (ret)
+		return ret;
+
+	ret = capture_test_flip(t, t->fb[1]);
+	if (!ret)
+		ret = capture_test_read(t, true);
+	if (!ret)
+		ret = capture_test_check(t->frame, t->size, 1, "flipped frame");
+	if (!ret)
+		ret = capture_test_wait_flip(t);
+	if (ret)
+		return ret;
+
+	printk(KERN_INFO CAPTURE_PFX "capture of set and flipped "
+	       "framebuffers passed\n");
+
+	ns = 0;
+	for (i = 0; i < loops; i++) {
+		start = ktime_get();
+		ret = capture_test_flip(t, t->fb[i & 1]);
+		if (!ret)
+			ret = capture_test_read(t, true);
+		ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret)
+			return ret;
+		if (*(u32 *)t->frame != (u32)((i & 1) * 2654435761u)) {
+			printk(KERN_ERR CAPTURE_PFX "flip %u captured the "
+			       "wrong framebuffer\n", i);
+			return -EINVAL;
+		}
+		ret = capture_test_wait_flip(t);
+		if (ret)
+			return ret;
+	}
+
+	if (loops)
+		printk(KERN_INFO CAPTURE_PFX "flip to frame: %llu us\n",
+		       (unsigned long long)div_u64(ns, loops * NSEC_PER_USEC));
+	return 0;
+}
+
+static int capture_test_run(struct capture_test *t)
+{
+	struct drm_connector *connector = &t->vcrtc->connector;
+	struct drm_display_mode *mode;
+	char path[32];
+	int i, ret;
+
+	snprintf(path, sizeof(path), "/dev/%s",
+		 vkms_capture_node_name(t->vcrtc));
+
+	mutex_lock(&t->dev->mode_config.mutex);
+	connector->funcs->fill_modes(connector, VKMS_MAX_WIDTH,
+				     VKMS_MAX_HEIGHT);
+	list_for_each_entry(mode, &connector->modes, head)
+		if (mode->type & DRM_MODE_TYPE_PREFERRED)
+			t->mode = mode;
+	mutex_unlock(&t->dev->mode_config.mutex);
+	if (t->mode == NULL) {
+		printk(KERN_ERR CAPTURE_PFX "no preferred mode\n");
+		return -EINVAL;
+	}
+	t->size = (size_t)t->mode->hdisplay * t->mode->vdisplay * 4;
+
+	t->frame = vmalloc(t->size);
+	if (t->frame == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < 2; i++) {
+		ret = capture_test_create_fb(t, i);
+		if (ret)
+			goto out;
+	}
+
+	ret = capture_test_set(t, t->fb[0]);
+	if (ret)
+		goto out;
+
+	t->filp = filp_open(path, O_RDONLY | O_NONBLOCK, 0);
+	if (IS_ERR(t->filp)) {
+		ret = PTR_ERR(t->filp);
+		printk(KERN_ERR CAPTURE_PFX "can't open %s (%d)\n", path, ret);
+		goto out_off;
+	}
+
+	ret = capture_test_frames(t);
+	filp_close(t->filp, NULL);
+	if (ret)
+		goto out_off;
+
+	/* a crtc that is off has no vblank to complete a flip at */
+	ret = capture_test_set(t, NULL);
+	if (ret)
+		goto out;
+	if (capture_test_flip(t, t->fb[0]) != -EINVAL) {
+		printk(KERN_ERR CAPTURE_PFX "flip on a crtc that is off\n");
+		ret = -EINVAL;
+	}
+	goto out;
+
+out_off:
+	capture_test_set(t, NULL);
+out:
+	mutex_lock(&t->dev->mode_config.mutex);
+	for (i = 0; i < 2; i++)
+		if (t->fb[i])
+			t->fb[i]->funcs->destroy(t->fb[i]);
+	mutex_unlock(&t->dev->mode_config.mutex);
+	vfree(t->frame);
+	return ret;
+}
+
+static int __init vkms_capture_test_init(void)
+{
+	struct drm_device *dev = vkms_get_device(0);
+	struct vkms_device *vkms;
+	struct capture_test t;
+
+	if (!dev) {
+		printk(KERN_ERR CAPTURE_PFX "load vkms first\n");
+		return -ENODEV;
+	}
+
+	vkms = dev->dev_private;
+	if (!vkms_capture_node_name(&vkms->crtc[0])) {
+		printk(KERN_ERR CAPTURE_PFX "load vkms with capture=1\n");
+		return -ENODEV;
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.dev = dev;
+	t.vcrtc = &vkms->crtc[0];
+	return capture_test_run(&t);
+}
+
+static void __exit vkms_capture_test_exit(void)
+{
+}
+
+module_init(vkms_capture_test_init);
+module_exit(vkms_capture_test_exit);
+
+MODULE_DESCRIPTION("Selftest for the V4L2 capture of vkms crtcs");
+MODULE_LICENSE("GPL and additional rights");
@@ -0,0 +1,391 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "vkms_drv.h"
+
+/*
+ * Send the flip completion event, if any. Called from the vblank timer
+ * and when a crtc stops scanning out, so that no flip is left hanging.
+ */
+static void vkms_finish_page_flip(struct vkms_crtc *vcrtc)
+{
+	struct drm_device *dev = vcrtc->base.dev;
+	struct drm_pending_vblank_event *e;
+	struct timeval tvbl;
+	unsigned long flags;
+	u64 latency;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	if (!vcrtc->flip_pending) {
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+		return;
+	}
+
+	latency = ktime_to_ns(ktime_sub(ktime_get(), vcrtc->flip_queued));
+	vcrtc->flips++;
+	vcrtc->flip_latency_ns += latency;
+	vcrtc->flip_latency_max_ns = max(vcrtc->flip_latency_max_ns, latency);
+
+	e = vcrtc->flip_event;
+	vcrtc->flip_event = NULL;
+	vcrtc->flip_pending = false;
+	vkms_capture_damage(vcrtc);
+
+	if (e) {
+		e->event.sequence = drm_vblank_count_and_time(dev, vcrtc->index,
+							      &tvbl);
+		e->event.tv_sec = tvbl.tv_sec;
+		e->event.tv_usec = tvbl.tv_usec;
+
+		list_add_tail(&e->base.link, &e->base.file_priv->event_list);
+		wake_up_interruptible(&e->base.file_priv->event_wait);
+	}
+
+	drm_vblank_put(dev, vcrtc->index);
+
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+}
+
+static enum hrtimer_restart vkms_vblank_simulate(struct hrtimer *timer)
+{
+	struct vkms_crtc *vcrtc = container_of(timer, struct vkms_crtc,
+					       vblank_timer);
+
+	atomic_inc(&vcrtc->frame_count);
+	drm_handle_vblank(vcrtc->base.dev, vcrtc->index);
+	vkms_finish_page_flip(vcrtc);
+	vkms_capture_vblank(vcrtc);
+
+	hrtimer_forward_now(timer, vcrtc->period);
+	return HRTIMER_RESTART;
+}
+
+static void vkms_crtc_start(struct vkms_crtc *vcrtc)
+{
+	if (vcrtc->active || !vcrtc->base.enabled)
+		return;
+
+	vcrtc->active = true;
+	hrtimer_start(&vcrtc->vblank_timer, vcrtc->period, HRTIMER_MODE_REL);
+}
+
+void vkms_crtc_stop(struct vkms_crtc *vcrtc)
+{
+	if (!vcrtc->active)
+		return;
+
+	vcrtc->active = false;
+	hrtimer_cancel(&vcrtc->vblank_timer);
+	vkms_finish_page_flip(vcrtc);
+	drm_vblank_off(vcrtc->base.dev, vcrtc->index);
+}
+
+u32 vkms_get_vblank_counter(struct drm_device *dev, int crtc)
+{
+	struct vkms_device *vkms = dev->dev_private;
+
+	return atomic_read(&vkms->crtc[crtc].frame_count);
+}
+
+/*
+ * The timers run whenever a crtc is on, like a real scanout engine, and
+ * a crtc that is off has no vblanks to wait for.
+ */
+int vkms_enable_vblank(struct drm_device *dev, int crtc)
+{
+	struct vkms_device *vkms = dev->dev_private;
+
+	if (!vkms->crtc[crtc].active)
+		return -EINVAL;
+
+	return 0;
+}
+
+void vkms_disable_vblank(struct drm_device *dev, int crtc)
+{
+}
+
+static void vkms_crtc_dpms(struct drm_crtc *crtc, int mode)
+{
+	struct vkms_crtc *vcrtc = to_vkms_crtc(crtc);
+
+	if (mode == DRM_MODE_DPMS_ON)
+		vkms_crtc_start(vcrtc);
+	else
+		vkms_crtc_stop(vcrtc);
+}
+
+static bool vkms_crtc_mode_fixup(struct drm_crtc *crtc,
+				 struct drm_display_mode *mode,
+				 struct drm_display_mode *adjusted_mode)
+{
+	return true;
+}
+
+static int vkms_crtc_mode_set(struct drm_crtc *crtc,
+			      struct drm_display_mode *mode,
+			      struct drm_display_mode *adjusted_mode,
+			      int x, int y, struct drm_framebuffer *old_fb)
+{
+	struct vkms_crtc *vcrtc = to_vkms_crtc(crtc);
+	u64 frame_ns = NSEC_PER_SEC / 60;
+
+	if (adjusted_mode->clock && adjusted_mode->htotal &&
+	    adjusted_mode->vtotal)
+		frame_ns = div_u64((u64)adjusted_mode->htotal *
+				   adjusted_mode->vtotal * 1000000,
+				   adjusted_mode->clock);
+
+	vcrtc->period = ns_to_ktime(frame_ns);
+	vkms_capture_damage(vcrtc);
+	return 0;
+}
+
+/* Scanout always reads crtc->fb at crtc->x/y, nothing to program. */
+static int vkms_crtc_mode_set_base(struct drm_crtc *crtc, int x, int y,
+				   struct drm_framebuffer *old_fb)
+{
+	vkms_capture_damage(to_vkms_crtc(crtc));
+	return 0;
+}
+
+static void vkms_crtc_prepare(struct drm_crtc *crtc)
+{
+	vkms_crtc_dpms(crtc, DRM_MODE_DPMS_OFF);
+}
+
+static void vkms_crtc_commit(struct drm_crtc *crtc)
+{
+	vkms_crtc_dpms(crtc, DRM_MODE_DPMS_ON);
+}
+
+static void vkms_crtc_load_lut(struct drm_crtc *crtc)
+{
+}
+
+static void vkms_crtc_disable(struct drm_crtc *crtc)
+{
+	vkms_crtc_dpms(crtc, DRM_MODE_DPMS_OFF);
+}
+
+static int vkms_crtc_page_flip(struct drm_crtc *crtc,
+			       struct drm_framebuffer *fb,
+			       struct drm_pending_vblank_event *event)
+{
+	struct vkms_crtc *vcrtc = to_vkms_crtc(crtc);
+	struct vkms_gem_object *bo = to_vkms_fb(fb)->obj;
+	struct drm_device *dev = crtc->dev;
+	struct vkms_gem_object *old_bo;
+	unsigned long flags;
+	int ret;
+
+	if (fb->width < crtc->x + crtc->hwmode.hdisplay ||
+	    fb->height < crtc->y + crtc->hwmode.vdisplay)
+		return -EINVAL;
+
+	/* Fails with -EINVAL if the crtc is off, see vkms_enable_vblank() */
+	ret = drm_vblank_get(dev, vcrtc->index);
+	if (ret)
+		return ret;
+
+	/*
+	 * Framebuffers aren't refcounted, so keep the buffer behind the
+	 * flipped one referenced until the next flip replaces it.
+	 */
+	drm_gem_object_reference(&bo->base);
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	if (vcrtc->flip_pending) {
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+		drm_gem_object_unreference_unlocked(&bo->base);
+		drm_vblank_put(dev, vcrtc->index);
+		return -EBUSY;
+	}
+
+	/*
+	 * The core leaves crtc->fb to the driver. Scanout reads it from the
+	 * next vblank on, which also completes the flip.
+	 */
+	crtc->fb = fb;
+	old_bo = vcrtc->flip_bo;
+	vcrtc->flip_bo = bo;
+	vcrtc->flip_pending = true;
+	vcrtc->flip_event = event;
+	vcrtc->flip_queued = ktime_get();
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	if (old_bo)
+		drm_gem_object_unreference_unlocked(&old_bo->base);
+
+	return 0;
+}
+
+static void vkms_crtc_destroy(struct drm_crtc *crtc)
+{
+	struct vkms_crtc *vcrtc = to_vkms_crtc(crtc);
+
+	vkms_crtc_stop(vcrtc);
+	if (vcrtc->flip_bo)
+		drm_gem_object_unreference_unlocked(&vcrtc->flip_bo->base);
+	drm_crtc_cleanup(crtc);
+}
+
+static const struct drm_crtc_helper_funcs vkms_crtc_helper_funcs = {
+	.dpms = vkms_crtc_dpms,
+	.mode_fixup = vkms_crtc_mode_fixup,
+	.mode_set = vkms_crtc_mode_set,
+	.mode_set_base = vkms_crtc_mode_set_base,
+	.prepare = vkms_crtc_prepare,
+	.commit = vkms_crtc_commit,
+	.load_lut = vkms_crtc_load_lut,
+	.disable = vkms_crtc_disable,
+};
+
+static const struct drm_crtc_funcs vkms_crtc_funcs = {
+	.set_config = drm_crtc_helper_set_config,
+	.destroy = vkms_crtc_destroy,
+	.page_flip = vkms_crtc_page_flip,
+};
+
+static void vkms_encoder_dpms(struct drm_encoder *encoder, int mode)
+{
+}
+
+static bool vkms_encoder_mode_fixup(struct drm_encoder *encoder,
+				    struct drm_display_mode *mode,
+				    struct drm_display_mode *adjusted_mode)
+{
+	return true;
+}
+
+static void vkms_encoder_prepare(struct drm_encoder *encoder)
+{
+}
+
+static void vkms_encoder_commit(struct drm_encoder *encoder)
+{
+}
+
+static void vkms_encoder_mode_set(struct drm_encoder *encoder,
+				  struct drm_display_mode *mode,
+				  struct drm_display_mode *adjusted_mode)
+{
+}
+
+static const struct drm_encoder_helper_funcs vkms_encoder_helper_funcs = {
+	.dpms = vkms_encoder_dpms,
+	.mode_fixup = vkms_encoder_mode_fixup,
+	.prepare = vkms_encoder_prepare,
+	.commit = vkms_encoder_commit,
+	.mode_set = vkms_encoder_mode_set,
+};
+
+static const struct drm_encoder_funcs vkms_encoder_funcs = {
+	.destroy = drm_encoder_cleanup,
+};
+
+static enum drm_connector_status
+vkms_connector_detect(struct drm_connector *connector, bool force)
+{
+	return connector_status_connected;
+}
+
+static int vkms_connector_get_modes(struct drm_connector *connector)
+{
+	struct vkms_crtc *vcrtc = container_of(connector, struct vkms_crtc,
+					       connector);
+	struct drm_display_mode *mode;
+	int count;
+
+	count = drm_add_modes_noedid(connector, VKMS_MAX_WIDTH,
+				     VKMS_MAX_HEIGHT);
+
+	list_for_each_entry(mode, &connector->probed_modes, head) {
+		if (mode->hdisplay == vcrtc->xres &&
+		    mode->vdisplay == vcrtc->yres) {
+			mode->type |= DRM_MODE_TYPE_PREFERRED;
+			break;
+		}
+	}
+
+	return count;
+}
+
+static int vkms_connector_mode_valid(struct drm_connector *connector,
+				     struct drm_display_mode *mode)
+{
+	return MODE_OK;
+}
+
+static struct drm_encoder *
+vkms_connector_best_encoder(struct drm_connector *connector)
+{
+	return &container_of(connector, struct vkms_crtc, connector)->encoder;
+}
+
+static void vkms_connector_destroy(struct drm_connector *connector)
+{
+	drm_sysfs_connector_remove(connector);
+	drm_connector_cleanup(connector);
+}
+
+static const struct drm_connector_helper_funcs vkms_connector_helper_funcs = {
+	.get_modes = vkms_connector_get_modes,
+	.mode_valid = vkms_connector_mode_valid,
+	.best_encoder = vkms_connector_best_encoder,
+};
+
+static const struct drm_connector_funcs vkms_connector_funcs = {
+	.dpms = drm_helper_connector_dpms,
+	.detect = vkms_connector_detect,
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = vkms_connector_destroy,
+};
+
+int vkms_crtc_init(struct drm_device *dev, struct vkms_crtc *vcrtc,
+		   int index, int xres, int yres)
+{
+	struct drm_connector *connector = &vcrtc->connector;
+	struct drm_encoder *encoder = &vcrtc->encoder;
+
+	vcrtc->index = index;
+	vcrtc->xres = xres;
+	vcrtc->yres = yres;
+	vcrtc->period = ns_to_ktime(NSEC_PER_SEC / 60);
+	atomic_set(&vcrtc->frame_count, 0);
+	hrtimer_init(&vcrtc->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	vcrtc->vblank_timer.function = vkms_vblank_simulate;
+
+	drm_crtc_init(dev, &vcrtc->base, &vkms_crtc_funcs);
+	drm_crtc_helper_add(&vcrtc->base, &vkms_crtc_helper_funcs);
+
+	drm_encoder_init(dev, encoder, &vkms_encoder_funcs,
+			 DRM_MODE_ENCODER_VIRTUAL);
+	drm_encoder_helper_add(encoder, &vkms_encoder_helper_funcs);
+	encoder->possible_crtcs = 1 << index;
+
+	drm_connector_init(dev, connector, &vkms_connector_funcs,
+			   DRM_MODE_CONNECTOR_VIRTUAL);
+	drm_connector_helper_add(connector, &vkms_connector_helper_funcs);
+	drm_mode_connector_attach_encoder(connector, encoder);
+
+	return drm_sysfs_connector_add(connector);
+}
@@ -0,0 +1,242 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include "vkms_drv.h"
+
+#if defined(CONFIG_DEBUG_FS)
+
+static int vkms_state_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct vkms_device *vkms = dev->dev_private;
+	int i, ret;
+
+	ret = mutex_lock_interruptible(&dev->mode_config.mutex);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < vkms->num_crtcs; i++) {
+		struct vkms_crtc *vcrtc = &vkms->crtc[i];
+		struct drm_crtc *crtc = &vcrtc->base;
+		u64 flips, total, max;
+		unsigned long flags;
+
+		spin_lock_irqsave(&dev->event_lock, flags);
+		flips = vcrtc->flips;
+		total = vcrtc->flip_latency_ns;
+		max = vcrtc->flip_latency_max_ns;
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+
+		seq_printf(m, "crtc %d: %s\n", i,
+			   vcrtc->active ? "active" : "off");
+		if (crtc->enabled)
+			seq_printf(m, "  mode: %dx%d@%d\n",
+				   crtc->hwmode.hdisplay,
+				   crtc->hwmode.vdisplay,
+				   drm_mode_vrefresh(&crtc->hwmode));
+		if (crtc->fb)
+			seq_printf(m, "  fb: %d, %dbpp, depth %d, pitch %d\n",
+				   crtc->fb->base.id,
+				   crtc->fb->bits_per_pixel,
+				   crtc->fb->depth, crtc->fb->pitch);
+		seq_printf(m, "  frames: %u\n",
+			   atomic_read(&vcrtc->frame_count));
+		seq_printf(m, "  flips: %llu, latency avg %llu us, max %llu us\n",
+			   flips,
+			   flips ? div64_u64(total, flips * NSEC_PER_USEC) : 0,
+			   div_u64(max, NSEC_PER_USEC));
+	}
+
+	mutex_unlock(&dev->mode_config.mutex);
+	return 0;
+}
+
+static struct drm_info_list vkms_debugfs_list[] = {
+	{"vkms_state", vkms_state_info, 0},
+};
+#define VKMS_DEBUGFS_ENTRIES ARRAY_SIZE(vkms_debugfs_list)
+
+struct vkms_frame {
+	void *data;
+	size_t size;
+};
+
+/*
+ * Snapshot the visible part of the scanout buffer at open time, with the
+ * rows packed together. Reading the file then returns one whole frame.
+ */
+static int vkms_frame_open(struct inode *inode, struct file *filp)
+{
+	struct vkms_crtc *vcrtc = inode->i_private;
+	struct drm_crtc *crtc = &vcrtc->base;
+	struct drm_device *dev = crtc->dev;
+	struct vkms_framebuffer *vfb;
+	struct vkms_frame *frame;
+	u32 cpp, row, y;
+	int ret;
+
+	frame = kzalloc(sizeof(*frame), GFP_KERNEL);
+	if (frame == NULL)
+		return -ENOMEM;
+
+	mutex_lock(&dev->mode_config.mutex);
+	mutex_lock(&dev->struct_mutex);
+
+	if (!crtc->enabled || crtc->fb == NULL) {
+		ret = -ENODATA;
+		goto unlock;
+	}
+
+	vfb = to_vkms_fb(crtc->fb);
+	ret = vkms_gem_vmap(vfb->obj);
+	if (ret)
+		goto unlock;
+
+	cpp = DIV_ROUND_UP(crtc->fb->bits_per_pixel, 8);
+	row = crtc->hwmode.hdisplay * cpp;
+	frame->size = (size_t)row * crtc->hwmode.vdisplay;
+	frame->data = vmalloc(frame->size);
+	if (frame->data == NULL) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	for (y = 0; y < crtc->hwmode.vdisplay; y++) {
+		size_t offset = (size_t)(crtc->y + y) * crtc->fb->pitch +
+			crtc->x * cpp;
+
+		/* modes larger than the fb read back as black */
+		if (offset + row <= vfb->obj->base.size)
+			memcpy(frame->data + y * row,
+			       vfb->obj->vaddr + offset, row);
+		else
+			memset(frame->data + y * row, 0, row);
+	}
+
+	filp->private_data = frame;
+	ret = 0;
+
+unlock:
+	mutex_unlock(&dev->struct_mutex);
+	mutex_unlock(&dev->mode_config.mutex);
+	if (ret) {
+		vfree(frame->data);
+		kfree(frame);
+	}
+	return ret;
+}
+
+static ssize_t vkms_frame_read(struct file *filp, char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	struct vkms_frame *frame = filp->private_data;
+
+	return simple_read_from_buffer(ubuf, count, ppos, frame->data,
+				       frame->size);
+}
+
+static int vkms_frame_release(struct inode *inode, struct file *filp)
+{
+	struct vkms_frame *frame = filp->private_data;
+
+	vfree(frame->data);
+	kfree(frame);
+	return 0;
+}
+
+static const struct file_operations vkms_frame_fops = {
+	.owner = THIS_MODULE,
+	.open = vkms_frame_open,
+	.read = vkms_frame_read,
+	.release = vkms_frame_release,
+	.llseek = default_llseek,
+};
+
+static int
+drm_add_fake_info_node(struct drm_minor *minor,
+		       struct dentry *ent,
+		       const void *key)
+{
+	struct drm_info_node *node;
+
+	node = kmalloc(sizeof(struct drm_info_node), GFP_KERNEL);
+	if (node == NULL) {
+		debugfs_remove(ent);
+		return -ENOMEM;
+	}
+
+	node->minor = minor;
+	node->dent = ent;
+	node->info_ent = (void *) key;
+	list_add(&node->list, &minor->debugfs_nodes.list);
+
+	return 0;
+}
+
+static int vkms_frame_create(struct dentry *root, struct drm_minor *minor,
+			     struct vkms_crtc *vcrtc)
+{
+	struct dentry *ent;
+	char name[32];
+
+	snprintf(name, sizeof(name), "vkms_crtc%d_frame", vcrtc->index);
+	ent = debugfs_create_file(name, S_IRUSR, root, vcrtc,
+				  &vkms_frame_fops);
+	if (IS_ERR(ent))
+		return PTR_ERR(ent);
+
+	return drm_add_fake_info_node(minor, ent, vcrtc);
+}
+
+int vkms_debugfs_init(struct drm_minor *minor)
+{
+	struct vkms_device *vkms = minor->dev->dev_private;
+	int i, ret;
+
+	for (i = 0; i < vkms->num_crtcs; i++) {
+		ret = vkms_frame_create(minor->debugfs_root, minor,
+					&vkms->crtc[i]);
+		if (ret)
+			return ret;
+	}
+
+	return drm_debugfs_create_files(vkms_debugfs_list,
+					VKMS_DEBUGFS_ENTRIES,
+					minor->debugfs_root, minor);
+}
+
+void vkms_debugfs_cleanup(struct drm_minor *minor)
+{
+	struct vkms_device *vkms = minor->dev->dev_private;
+	int i;
+
+	drm_debugfs_remove_files(vkms_debugfs_list,
+				 VKMS_DEBUGFS_ENTRIES, minor);
+	for (i = 0; i < vkms->num_crtcs; i++)
+		drm_debugfs_remove_files((struct drm_info_list *)
+					 &vkms->crtc[i], 1, minor);
+}
+
+#endif /* CONFIG_DEBUG_FS */
@@ -0,0 +1,278 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * vkms - a KMS driver without hardware
+ *
+ * Exposes a configurable number of crtcs, each with its own encoder and
+ * connector, scanning out of shmem backed dumb buffers. Vblanks and page
+ * flip completion are driven by hrtimers at the refresh rate of the mode,
+ * and the scanned out frames can be captured through debugfs or V4L2.
+ * With fbdev=1 the crtcs also carry an emulated fbdev and its console.
+ * This lets the KMS core, the helpers and the vblank code be exercised
+ * and benchmarked on any machine. Several instances can share buffers
+ * with each other and with other drivers through PRIME.
+ */
+
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include "vkms_drv.h"
+
+static int vkms_num_devices = 1;
+module_param_named(devices, vkms_num_devices, int, 0444);
+MODULE_PARM_DESC(devices, "Number of vkms devices (1-4)");
+
+static int vkms_num_crtcs = 1;
+module_param_named(crtcs, vkms_num_crtcs, int, 0444);
+MODULE_PARM_DESC(crtcs, "Number of crtcs and connectors (1-8)");
+
+static int vkms_xres = 1024;
+module_param_named(xres, vkms_xres, int, 0444);
+MODULE_PARM_DESC(xres, "Width of the preferred mode");
+
+static int vkms_yres = 768;
+module_param_named(yres, vkms_yres, int, 0444);
+MODULE_PARM_DESC(yres, "Height of the preferred mode");
+
+static struct platform_device *vkms_pdev[VKMS_MAX_DEVICES];
+static u64 vkms_dma_mask = DMA_BIT_MASK(64);
+
+static struct drm_mode_config_funcs vkms_mode_funcs = {
+	.fb_create = vkms_fb_create,
+};
+
+static int vkms_driver_unload(struct drm_device *dev)
+{
+	struct vkms_device *vkms = dev->dev_private;
+	int i;
+
+	vkms_fbdev_fini(vkms);
+	for (i = 0; i < vkms->num_crtcs; i++) {
+		vkms_crtc_stop(&vkms->crtc[i]);
+		vkms_capture_fini(&vkms->crtc[i]);
+	}
+
+	dev->irq_enabled = 0;
+	drm_vblank_cleanup(dev);
+	drm_mode_config_cleanup(dev);
+
+	dev->dev_private = NULL;
+	kfree(vkms);
+	return 0;
+}
+
+static int vkms_driver_load(struct drm_device *dev, unsigned long flags)
+{
+	struct vkms_device *vkms;
+	int i, ret;
+
+	vkms = kzalloc(sizeof(*vkms), GFP_KERNEL);
+	if (vkms == NULL)
+		return -ENOMEM;
+
+	vkms->dev = dev;
+	vkms->num_crtcs = clamp(vkms_num_crtcs, 1, VKMS_MAX_CRTCS);
+	dev->dev_private = vkms;
+
+	drm_mode_config_init(dev);
+	dev->mode_config.min_width = 0;
+	dev->mode_config.min_height = 0;
+	dev->mode_config.max_width = VKMS_MAX_WIDTH;
+	dev->mode_config.max_height = VKMS_MAX_HEIGHT;
+	dev->mode_config.funcs = &vkms_mode_funcs;
+
+	for (i = 0; i < vkms->num_crtcs; i++) {
+		ret = vkms_crtc_init(dev, &vkms->crtc[i], i, vkms_xres,
+				     vkms_yres);
+		if (ret)
+			goto out_cleanup;
+	}
+
+	ret = drm_vblank_init(dev, vkms->num_crtcs);
+	if (ret)
+		goto out_cleanup;
+
+	/* There is no interrupt, vblanks come from the crtc timers. */
+	dev->max_vblank_count = 0xffffffff;
+	dev->irq_enabled = 1;
+
+	for (i = 0; i < vkms->num_crtcs; i++) {
+		ret = vkms_capture_init(&vkms->crtc[i]);
+		if (ret)
+			goto out_capture;
+	}
+
+	ret = vkms_fbdev_init(vkms);
+	if (ret)
+		goto out_capture;
+
+	return 0;
+
+out_capture:
+	while (i--)
+		vkms_capture_fini(&vkms->crtc[i]);
+	dev->irq_enabled = 0;
+	drm_vblank_cleanup(dev);
+out_cleanup:
+	drm_mode_config_cleanup(dev);
+	dev->dev_private = NULL;
+	kfree(vkms);
+	return ret;
+}
+
+static void vkms_driver_lastclose(struct drm_device *dev)
+{
+	vkms_fbdev_restore_mode(dev->dev_private);
+}
+
+static struct vm_operations_struct vkms_gem_vm_ops = {
+	.fault = vkms_gem_fault,
+	.open = drm_gem_vm_open,
+	.close = drm_gem_vm_close,
+};
+
+static struct drm_driver vkms_driver = {
+	.driver_features = DRIVER_MODESET | DRIVER_GEM | DRIVER_PRIME,
+	.load = vkms_driver_load,
+	.unload = vkms_driver_unload,
+	.lastclose = vkms_driver_lastclose,
+
+	.get_vblank_counter = vkms_get_vblank_counter,
+	.enable_vblank = vkms_enable_vblank,
+	.disable_vblank = vkms_disable_vblank,
+
+#if defined(CONFIG_DEBUG_FS)
+	.debugfs_init = vkms_debugfs_init,
+	.debugfs_cleanup = vkms_debugfs_cleanup,
+#endif
+	.gem_free_object = vkms_gem_free_object,
+	.gem_vm_ops = &vkms_gem_vm_ops,
+	.dumb_create = vkms_dumb_create,
+	.dumb_map_offset = vkms_dumb_map_offset,
+	.dumb_destroy = vkms_dumb_destroy,
+
+	.prime_handle_to_fd = drm_gem_prime_handle_to_fd,
+	.prime_fd_to_handle = drm_gem_prime_fd_to_handle,
+	.gem_prime_export = drm_gem_prime_export,
+	.gem_prime_import = drm_gem_prime_import,
+	.gem_prime_get_sg_table = vkms_gem_prime_get_sg_table,
+	.gem_prime_import_sg_table = vkms_gem_prime_import_sg_table,
+	.gem_prime_vmap = vkms_gem_prime_vmap,
+	.gem_prime_vunmap = vkms_gem_prime_vunmap,
+	.gem_prime_mmap = vkms_gem_prime_mmap,
+	.fops = {
+		 .owner = THIS_MODULE,
+		 .open = drm_open,
+		 .release = drm_release,
+		 .unlocked_ioctl = drm_ioctl,
+		 .mmap = vkms_gem_mmap,
+		 .poll = drm_poll,
+		 .fasync = drm_fasync,
+		 .read = drm_read,
+#ifdef CONFIG_COMPAT
+		 .compat_ioctl = drm_compat_ioctl,
+#endif
+		 .llseek = noop_llseek,
+	},
+
+	.name = DRIVER_NAME,
+	.desc = DRIVER_DESC,
+	.date = DRIVER_DATE,
+	.major = DRIVER_MAJOR,
+	.minor = DRIVER_MINOR,
+	.patchlevel = DRIVER_PATCHLEVEL,
+};
+
+/**
+ * vkms_get_device - look up a vkms instance
+ * @index: instance number, below the devices parameter
+ *
+ * For the selftests. Returns NULL if there is no such instance.
+ */
+struct drm_device *vkms_get_device(int index)
+{
+	if (index < 0 || index >= VKMS_MAX_DEVICES || !vkms_pdev[index])
+		return NULL;
+
+	return platform_get_drvdata(vkms_pdev[index]);
+}
+EXPORT_SYMBOL_GPL(vkms_get_device);
+
+static void vkms_unregister(void)
+{
+	int i;
+
+	for (i = 0; i < VKMS_MAX_DEVICES && vkms_pdev[i]; i++) {
+		platform_device_unregister(vkms_pdev[i]);
+		vkms_pdev[i] = NULL;
+	}
+}
+
+static int __init vkms_init(void)
+{
+	struct platform_device *pdev;
+	int i, num, ret;
+
+	num = clamp(vkms_num_devices, 1, VKMS_MAX_DEVICES);
+	for (i = 0; i < num; i++) {
+		pdev = platform_device_register_simple(DRIVER_NAME, i, NULL, 0);
+		if (IS_ERR(pdev)) {
+			ret = PTR_ERR(pdev);
+			goto err;
+		}
+		/* Lets importers dma map shared buffers, which are in RAM */
+		pdev->dev.dma_mask = &vkms_dma_mask;
+		pdev->dev.coherent_dma_mask = DMA_BIT_MASK(64);
+		vkms_pdev[i] = pdev;
+
+		/*
+		 * drm_platform_init() sets the driver up and registers the
+		 * first device, all others are added to its device list.
+		 */
+		if (i == 0)
+			ret = drm_platform_init(&vkms_driver, pdev);
+		else
+			ret = drm_get_platform_dev(pdev, &vkms_driver);
+		if (ret)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	if (i > 0)
+		drm_platform_exit(&vkms_driver, vkms_pdev[0]);
+	vkms_unregister();
+	return ret;
+}
+
+static void __exit vkms_exit(void)
+{
+	drm_platform_exit(&vkms_driver, vkms_pdev[0]);
+	vkms_unregister();
+}
+
+module_init(vkms_init);
+module_exit(vkms_exit);
+
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE("GPL and additional rights");
@@ -0,0 +1,170 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _VKMS_DRV_H_
+#define _VKMS_DRV_H_
+
+#include <linux/hrtimer.h>
+#include "drmP.h"
+#include "drm_crtc_helper.h"
+
+#define DRIVER_NAME		"vkms"
+#define DRIVER_DESC		"Virtual KMS"
+#define DRIVER_DATE		"20120601"
+#define DRIVER_MAJOR		1
+#define DRIVER_MINOR		0
+#define DRIVER_PATCHLEVEL	0
+
+#define VKMS_MAX_CRTCS		8
+#define VKMS_MAX_DEVICES	4
+#define VKMS_MAX_WIDTH		8192
+#define VKMS_MAX_HEIGHT		8192
+
+struct vkms_capture;
+struct vkms_fbdev;
+
+struct vkms_gem_object {
+	struct drm_gem_object base;
+	struct page **pages;	/* pinned shmem pages, NULL until used */
+	void *vaddr;		/* kernel mapping for frame capture */
+	struct sg_table *sgt;	/* pages of an imported dma-buf */
+};
+
+#define to_vkms_bo(x) container_of(x, struct vkms_gem_object, base)
+
+struct vkms_framebuffer {
+	struct drm_framebuffer base;
+	struct vkms_gem_object *obj;
+};
+
+#define to_vkms_fb(x) container_of(x, struct vkms_framebuffer, base)
+
+/*
+ * Every crtc drives exactly one encoder and connector. Scanout is simulated
+ * by an hrtimer firing at the refresh rate of the current mode, which
+ * counts frames, reports vblanks and completes page flips.
+ */
+struct vkms_crtc {
+	struct drm_crtc base;
+	struct drm_encoder encoder;
+	struct drm_connector connector;
+	int index;
+	int xres, yres;		/* preferred mode */
+
+	struct hrtimer vblank_timer;
+	ktime_t period;
+	bool active;
+	atomic_t frame_count;
+
+	/* Pending page flip and flip statistics, under dev->event_lock */
+	bool flip_pending;
+	struct drm_pending_vblank_event *flip_event;
+	struct vkms_gem_object *flip_bo;	/* buffer of the last flip */
+	ktime_t flip_queued;
+	u64 flips;
+	u64 flip_latency_ns;
+	u64 flip_latency_max_ns;
+
+	struct vkms_capture *capture;	/* V4L2 capture node, or NULL */
+};
+
+#define to_vkms_crtc(x) container_of(x, struct vkms_crtc, base)
+
+struct vkms_device {
+	struct drm_device *dev;
+	int num_crtcs;
+	struct vkms_crtc crtc[VKMS_MAX_CRTCS];
+	struct vkms_fbdev *fbdev;	/* fbdev emulation, or NULL */
+};
+
+/* vkms_crtc.c */
+extern int vkms_crtc_init(struct drm_device *dev, struct vkms_crtc *vcrtc,
+			  int index, int xres, int yres);
+extern void vkms_crtc_stop(struct vkms_crtc *vcrtc);
+extern u32 vkms_get_vblank_counter(struct drm_device *dev, int crtc);
+extern int vkms_enable_vblank(struct drm_device *dev, int crtc);
+extern void vkms_disable_vblank(struct drm_device *dev, int crtc);
+
+/* vkms_drv.c */
+extern struct drm_device *vkms_get_device(int index);
+
+/* vkms_fbdev.c */
+extern int vkms_fbdev_init(struct vkms_device *vkms);
+extern void vkms_fbdev_fini(struct vkms_device *vkms);
+extern void vkms_fbdev_restore_mode(struct vkms_device *vkms);
+
+/* vkms_gem.c */
+extern struct vkms_gem_object *vkms_gem_create(struct drm_device *dev,
+					       size_t size);
+extern void vkms_gem_free_object(struct drm_gem_object *obj);
+extern int vkms_gem_get_pages(struct vkms_gem_object *bo);
+extern int vkms_gem_vmap(struct vkms_gem_object *bo);
+extern int vkms_gem_fault(struct vm_area_struct *vma, struct vm_fault *vmf);
+extern int vkms_gem_mmap(struct file *filp, struct vm_area_struct *vma);
+extern int vkms_dumb_create(struct drm_file *file_priv,
+			    struct drm_device *dev,
+			    struct drm_mode_create_dumb *args);
+extern int vkms_dumb_map_offset(struct drm_file *file_priv,
+				struct drm_device *dev, uint32_t handle,
+				uint64_t *offset);
+extern int vkms_dumb_destroy(struct drm_file *file_priv,
+			     struct drm_device *dev, uint32_t handle);
+extern struct drm_framebuffer *
+vkms_framebuffer_create(struct drm_device *dev,
+			struct drm_mode_fb_cmd *mode_cmd,
+			struct vkms_gem_object *bo);
+extern struct drm_framebuffer *
+vkms_fb_create(struct drm_device *dev, struct drm_file *file_priv,
+	       struct drm_mode_fb_cmd *mode_cmd);
+extern void vkms_fb_damage(struct drm_framebuffer *fb);
+extern struct sg_table *vkms_gem_prime_get_sg_table(struct drm_gem_object *obj);
+extern struct drm_gem_object *
+vkms_gem_prime_import_sg_table(struct drm_device *dev, size_t size,
+			       struct sg_table *sgt);
+extern void *vkms_gem_prime_vmap(struct drm_gem_object *obj);
+extern void vkms_gem_prime_vunmap(struct drm_gem_object *obj, void *vaddr);
+extern int vkms_gem_prime_mmap(struct drm_gem_object *obj,
+			       struct vm_area_struct *vma);
+
+/* vkms_capture.c */
+#ifdef CONFIG_DRM_VKMS_CAPTURE
+extern int vkms_capture_init(struct vkms_crtc *vcrtc);
+extern void vkms_capture_fini(struct vkms_crtc *vcrtc);
+extern void vkms_capture_damage(struct vkms_crtc *vcrtc);
+extern void vkms_capture_vblank(struct vkms_crtc *vcrtc);
+extern const char *vkms_capture_node_name(struct vkms_crtc *vcrtc);
+#else
+static inline int vkms_capture_init(struct vkms_crtc *vcrtc)
+{
+	return 0;
+}
+static inline void vkms_capture_fini(struct vkms_crtc *vcrtc) {}
+static inline void vkms_capture_damage(struct vkms_crtc *vcrtc) {}
+static inline void vkms_capture_vblank(struct vkms_crtc *vcrtc) {}
+#endif
+
+/* vkms_debugfs.c */
+#if defined(CONFIG_DEBUG_FS)
+extern int vkms_debugfs_init(struct drm_minor *minor);
+extern void vkms_debugfs_cleanup(struct drm_minor *minor);
+#endif
+
+#endif
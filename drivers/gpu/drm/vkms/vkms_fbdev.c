@@ -0,0 +1,258 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * fbdev emulation through the drm_fb_helper, so that the helper and fbcon
+ * on top of it can be exercised without hardware. The console buffer is
+ * an ordinary vkms object drawn with the sys_* routines; its damage is
+ * reported to the capture nodes like that of a dirtied framebuffer. The
+ * buffer isn't physically contiguous, so /dev/fbN can't be mmapped.
+ */
+
+#include <linux/module.h>
+#include <linux/fb.h>
+#include "vkms_drv.h"
+#include "drm_fb_helper.h"
+
+static bool vkms_fbdev_enable;
+module_param_named(fbdev, vkms_fbdev_enable, bool, 0444);
+MODULE_PARM_DESC(fbdev, "Emulate an fbdev device on the crtcs");
+
+struct vkms_fbdev {
+	struct drm_fb_helper helper;
+};
+
+static void vkms_fbdev_damage(struct fb_info *info, u32 x, u32 y,
+			      u32 width, u32 height)
+{
+	struct drm_fb_helper *helper = info->par;
+
+	vkms_fb_damage(helper->fb);
+}
+
+static void vkms_fbdev_fillrect(struct fb_info *info,
+				const struct fb_fillrect *rect)
+{
+	sys_fillrect(info, rect);
+	if (!fb_damage_batch(info, rect->dx, rect->dy, rect->width,
+			     rect->height))
+		vkms_fbdev_damage(info, rect->dx, rect->dy, rect->width,
+				  rect->height);
+}
+
+static void vkms_fbdev_copyarea(struct fb_info *info,
+				const struct fb_copyarea *area)
+{
+	sys_copyarea(info, area);
+	if (!fb_damage_batch(info, area->dx, area->dy, area->width,
+			     area->height))
+		vkms_fbdev_damage(info, area->dx, area->dy, area->width,
+				  area->height);
+}
+
+static void vkms_fbdev_imageblit(struct fb_info *info,
+				 const struct fb_image *image)
+{
+	sys_imageblit(info, image);
+	if (!fb_damage_batch(info, image->dx, image->dy, image->width,
+			     image->height))
+		vkms_fbdev_damage(info, image->dx, image->dy, image->width,
+				  image->height);
+}
+
+static struct fb_ops vkms_fbdev_ops = {
+	.owner = THIS_MODULE,
+	.fb_check_var = drm_fb_helper_check_var,
+	.fb_set_par = drm_fb_helper_set_par,
+	.fb_fillrect = vkms_fbdev_fillrect,
+	.fb_copyarea = vkms_fbdev_copyarea,
+	.fb_imageblit = vkms_fbdev_imageblit,
+	.fb_damage = vkms_fbdev_damage,
+	.fb_pan_display = drm_fb_helper_pan_display,
+	.fb_blank = drm_fb_helper_blank,
+	.fb_setcmap = drm_fb_helper_setcmap,
+	.fb_debug_enter = drm_fb_helper_debug_enter,
+	.fb_debug_leave = drm_fb_helper_debug_leave,
+};
+
+static int vkms_fbdev_create(struct vkms_fbdev *fbdev,
+			     struct drm_fb_helper_surface_size *sizes)
+{
+	struct drm_device *dev = fbdev->helper.dev;
+	struct drm_framebuffer *fb;
+	struct drm_mode_fb_cmd mode_cmd;
+	struct vkms_gem_object *bo;
+	struct fb_info *info;
+	size_t size;
+	int ret;
+
+	mode_cmd.width = sizes->surface_width;
+	mode_cmd.height = sizes->surface_height;
+	mode_cmd.bpp = sizes->surface_bpp;
+	mode_cmd.depth = sizes->surface_depth;
+	mode_cmd.pitch = mode_cmd.width * DIV_ROUND_UP(mode_cmd.bpp, 8);
+	size = PAGE_ALIGN((size_t)mode_cmd.pitch * mode_cmd.height);
+
+	bo = vkms_gem_create(dev, size);
+	if (bo == NULL)
+		return -ENOMEM;
+
+	mutex_lock(&dev->struct_mutex);
+	ret = vkms_gem_vmap(bo);
+	mutex_unlock(&dev->struct_mutex);
+	if (ret) {
+		drm_gem_object_unreference_unlocked(&bo->base);
+		return ret;
+	}
+
+	/* The framebuffer owns the reference to bo from here on */
+	fb = vkms_framebuffer_create(dev, &mode_cmd, bo);
+	if (IS_ERR(fb))
+		return PTR_ERR(fb);
+
+	info = framebuffer_alloc(0, dev->dev);
+	if (info == NULL) {
+		ret = -ENOMEM;
+		goto err_fb;
+	}
+
+	ret = fb_alloc_cmap(&info->cmap, 256, 0);
+	if (ret)
+		goto err_info;
+
+	info->par = &fbdev->helper;
+	info->flags = FBINFO_DEFAULT | FBINFO_VIRTFB |
+		FBINFO_CAN_FORCE_OUTPUT;
+	info->fbops = &vkms_fbdev_ops;
+	strcpy(info->fix.id, "vkmsdrmfb");
+	drm_fb_helper_fill_fix(info, fb->pitch, fb->depth);
+	drm_fb_helper_fill_var(info, &fbdev->helper, sizes->fb_width,
+			       sizes->fb_height);
+	info->screen_base = bo->vaddr;
+	info->screen_size = size;
+
+	fbdev->helper.fb = fb;
+	fbdev->helper.fbdev = info;
+	return 0;
+
+err_info:
+	framebuffer_release(info);
+err_fb:
+	fb->funcs->destroy(fb);
+	return ret;
+}
+
+static int vkms_fbdev_probe(struct drm_fb_helper *helper,
+			    struct drm_fb_helper_surface_size *sizes)
+{
+	struct vkms_fbdev *fbdev = container_of(helper, struct vkms_fbdev,
+						helper);
+	int ret;
+
+	if (helper->fb)
+		return 0;
+
+	ret = vkms_fbdev_create(fbdev, sizes);
+	if (ret)
+		return ret;
+
+	/* Tells the helper to register the new fb_info */
+	return 1;
+}
+
+static struct drm_fb_helper_funcs vkms_fb_helper_funcs = {
+	.fb_probe = vkms_fbdev_probe,
+};
+
+/**
+ * vkms_fbdev_init - set up fbdev emulation if the fbdev parameter is set
+ * @vkms: the device, with all crtcs and connectors created
+ */
+int vkms_fbdev_init(struct vkms_device *vkms)
+{
+	struct vkms_fbdev *fbdev;
+	int ret;
+
+	if (!vkms_fbdev_enable)
+		return 0;
+
+	fbdev = kzalloc(sizeof(*fbdev), GFP_KERNEL);
+	if (fbdev == NULL)
+		return -ENOMEM;
+
+	fbdev->helper.funcs = &vkms_fb_helper_funcs;
+	ret = drm_fb_helper_init(vkms->dev, &fbdev->helper, vkms->num_crtcs,
+				 vkms->num_crtcs);
+	if (ret) {
+		kfree(fbdev);
+		return ret;
+	}
+
+	drm_fb_helper_single_add_all_connectors(&fbdev->helper);
+	vkms->fbdev = fbdev;
+
+	/* Returns true if the fb_info couldn't be set up or registered */
+	if (drm_fb_helper_initial_config(&fbdev->helper, 32)) {
+		vkms_fbdev_fini(vkms);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void vkms_fbdev_fini(struct vkms_device *vkms)
+{
+	struct vkms_fbdev *fbdev = vkms->fbdev;
+	struct fb_info *info;
+
+	if (fbdev == NULL)
+		return;
+
+	info = fbdev->helper.fbdev;
+	if (info) {
+		/* The helper lists the fb_info once it is registered */
+		if (!list_empty(&fbdev->helper.kernel_fb_list))
+			unregister_framebuffer(info);
+		fb_dealloc_cmap(&info->cmap);
+		framebuffer_release(info);
+	}
+
+	drm_fb_helper_fini(&fbdev->helper);
+	if (fbdev->helper.fb)
+		fbdev->helper.fb->funcs->destroy(fbdev->helper.fb);
+
+	vkms->fbdev = NULL;
+	kfree(fbdev);
+}
+
+/* Give the crtcs back to the console once the last client is gone. */
+void vkms_fbdev_restore_mode(struct vkms_device *vkms)
+{
+	struct drm_device *dev = vkms->dev;
+
+	if (vkms->fbdev == NULL)
+		return;
+
+	mutex_lock(&dev->mode_config.mutex);
+	if (drm_fb_helper_restore_fbdev_mode(&vkms->fbdev->helper))
+		DRM_DEBUG("failed to restore crtc mode\n");
+	mutex_unlock(&dev->mode_config.mutex);
+}
@@ -0,0 +1,454 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <linux/shmem_fs.h>
+#include <linux/vmalloc.h>
+#include "vkms_drv.h"
+
+struct vkms_gem_object *vkms_gem_create(struct drm_device *dev, size_t size)
+{
+	struct vkms_gem_object *bo;
+
+	bo = kzalloc(sizeof(*bo), GFP_KERNEL);
+	if (bo == NULL)
+		return NULL;
+
+	if (drm_gem_object_init(dev, &bo->base, size) != 0) {
+		kfree(bo);
+		return NULL;
+	}
+
+	return bo;
+}
+EXPORT_SYMBOL_GPL(vkms_gem_create);
+
+/*
+ * Pin the shmem pages backing @bo. They stay until the object is freed,
+ * which keeps faults and frame capture cheap. Called with struct_mutex
+ * held.
+ */
+int vkms_gem_get_pages(struct vkms_gem_object *bo)
+{
+	struct address_space *mapping;
+	struct page **pages;
+	int i, npages;
+
+	if (bo->pages)
+		return 0;
+
+	npages = bo->base.size >> PAGE_SHIFT;
+	pages = drm_malloc_ab(npages, sizeof(struct page *));
+	if (pages == NULL)
+		return -ENOMEM;
+
+	mapping = bo->base.filp->f_path.dentry->d_inode->i_mapping;
+	for (i = 0; i < npages; i++) {
+		struct page *page = shmem_read_mapping_page(mapping, i);
+
+		if (IS_ERR(page)) {
+			while (i--)
+				page_cache_release(pages[i]);
+			drm_free_large(pages);
+			return PTR_ERR(page);
+		}
+		pages[i] = page;
+	}
+
+	bo->pages = pages;
+	return 0;
+}
+
+static void vkms_gem_put_pages(struct vkms_gem_object *bo)
+{
+	int i, npages = bo->base.size >> PAGE_SHIFT;
+
+	if (bo->pages == NULL)
+		return;
+
+	/* Imported pages belong to the exporter */
+	if (bo->base.import_attach)
+		goto out;
+
+	for (i = 0; i < npages; i++) {
+		set_page_dirty(bo->pages[i]);
+		mark_page_accessed(bo->pages[i]);
+		page_cache_release(bo->pages[i]);
+	}
+
+out:
+	drm_free_large(bo->pages);
+	bo->pages = NULL;
+}
+
+/* Map @bo into the kernel, called with struct_mutex held. */
+int vkms_gem_vmap(struct vkms_gem_object *bo)
+{
+	int ret;
+
+	if (bo->vaddr)
+		return 0;
+
+	ret = vkms_gem_get_pages(bo);
+	if (ret)
+		return ret;
+
+	bo->vaddr = vmap(bo->pages, bo->base.size >> PAGE_SHIFT, 0,
+			 PAGE_KERNEL);
+	if (bo->vaddr == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void vkms_gem_free_object(struct drm_gem_object *obj)
+{
+	struct vkms_gem_object *bo = to_vkms_bo(obj);
+
+	if (bo->vaddr)
+		vunmap(bo->vaddr);
+	vkms_gem_put_pages(bo);
+
+	if (obj->map_list.map)
+		drm_gem_free_mmap_offset(obj);
+
+	if (obj->import_attach)
+		drm_prime_gem_destroy(obj, bo->sgt);
+
+	drm_gem_object_release(obj);
+	kfree_rcu(bo, base.rcu);
+}
+
+int vkms_gem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct vkms_gem_object *bo = to_vkms_bo(vma->vm_private_data);
+	struct drm_device *dev = bo->base.dev;
+	pgoff_t page_offset;
+	int ret;
+
+	/* We don't use vmf->pgoff since that has the fake offset */
+	page_offset = ((unsigned long)vmf->virtual_address - vma->vm_start) >>
+		PAGE_SHIFT;
+
+	ret = mutex_lock_interruptible(&dev->struct_mutex);
+	if (ret)
+		goto out;
+
+	ret = vkms_gem_get_pages(bo);
+	if (ret == 0)
+		ret = vm_insert_page(vma, (unsigned long)vmf->virtual_address,
+				     bo->pages[page_offset]);
+
+	mutex_unlock(&dev->struct_mutex);
+out:
+	switch (ret) {
+	case 0:
+	case -EBUSY:
+	case -ERESTARTSYS:
+	case -EINTR:
+		return VM_FAULT_NOPAGE;
+	case -ENOMEM:
+		return VM_FAULT_OOM;
+	default:
+		return VM_FAULT_SIGBUS;
+	}
+}
+
+/*
+ * The buffers live in ordinary cached memory, so map them as such and let
+ * the fault handler insert the shmem pages themselves.
+ */
+int vkms_gem_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct drm_file *priv = filp->private_data;
+	int ret;
+
+	ret = drm_gem_mmap(filp, vma);
+	if (ret || vma->vm_ops != priv->minor->dev->driver->gem_vm_ops)
+		return ret;
+
+	vma->vm_flags &= ~VM_PFNMAP;
+	vma->vm_flags |= VM_MIXEDMAP;
+	vma->vm_page_prot = vm_get_page_prot(vma->vm_flags);
+
+	return 0;
+}
+
+int vkms_dumb_create(struct drm_file *file_priv, struct drm_device *dev,
+		     struct drm_mode_create_dumb *args)
+{
+	struct vkms_gem_object *bo;
+	int ret;
+
+	args->pitch = args->width * DIV_ROUND_UP(args->bpp, 8);
+	args->size = PAGE_ALIGN((u64)args->pitch * args->height);
+	if (args->size == 0)
+		return -EINVAL;
+
+	bo = vkms_gem_create(dev, args->size);
+	if (bo == NULL)
+		return -ENOMEM;
+
+	ret = drm_gem_handle_create(file_priv, &bo->base, &args->handle);
+	/* drop reference from allocate - handle holds it now */
+	drm_gem_object_unreference_unlocked(&bo->base);
+
+	return ret;
+}
+
+int vkms_dumb_map_offset(struct drm_file *file_priv, struct drm_device *dev,
+			 uint32_t handle, uint64_t *offset)
+{
+	struct drm_gem_object *obj;
+	int ret;
+
+	obj = drm_gem_object_lookup(dev, file_priv, handle);
+	if (obj == NULL)
+		return -ENOENT;
+
+	/* Returns at once if the object already has an offset */
+	ret = drm_gem_create_mmap_offset(obj);
+	if (ret == 0)
+		*offset = (u64)obj->map_list.hash.key << PAGE_SHIFT;
+
+	drm_gem_object_unreference_unlocked(obj);
+	return ret;
+}
+
+int vkms_dumb_destroy(struct drm_file *file_priv, struct drm_device *dev,
+		      uint32_t handle)
+{
+	return drm_gem_handle_delete(file_priv, handle);
+}
+
+static void vkms_fb_destroy(struct drm_framebuffer *fb)
+{
+	struct vkms_framebuffer *vfb = to_vkms_fb(fb);
+
+	drm_framebuffer_cleanup(fb);
+	drm_gem_object_unreference_unlocked(&vfb->obj->base);
+	kfree(vfb);
+}
+
+static int vkms_fb_create_handle(struct drm_framebuffer *fb,
+				 struct drm_file *file_priv,
+				 unsigned int *handle)
+{
+	struct vkms_framebuffer *vfb = to_vkms_fb(fb);
+
+	return drm_gem_handle_create(file_priv, &vfb->obj->base, handle);
+}
+
+/* Note that the crtcs scanning out of @fb show new contents. */
+void vkms_fb_damage(struct drm_framebuffer *fb)
+{
+	struct vkms_device *vkms = fb->dev->dev_private;
+	int i;
+
+	for (i = 0; i < vkms->num_crtcs; i++)
+		if (vkms->crtc[i].base.fb == fb)
+			vkms_capture_damage(&vkms->crtc[i]);
+}
+
+static int vkms_fb_dirty(struct drm_framebuffer *fb,
+			 struct drm_file *file_priv, unsigned flags,
+			 unsigned color, struct drm_clip_rect *clips,
+			 unsigned num_clips)
+{
+	vkms_fb_damage(fb);
+	return 0;
+}
+
+static const struct drm_framebuffer_funcs vkms_fb_funcs = {
+	.destroy = vkms_fb_destroy,
+	.create_handle = vkms_fb_create_handle,
+	.dirty = vkms_fb_dirty,
+};
+
+/*
+ * Wrap @bo in a framebuffer, which takes over the caller's reference to
+ * @bo, also when it fails.
+ */
+struct drm_framebuffer *
+vkms_framebuffer_create(struct drm_device *dev,
+			struct drm_mode_fb_cmd *mode_cmd,
+			struct vkms_gem_object *bo)
+{
+	struct vkms_framebuffer *vfb;
+	int ret;
+
+	if (mode_cmd->pitch < mode_cmd->width * DIV_ROUND_UP(mode_cmd->bpp, 8) ||
+	    (u64)mode_cmd->pitch * mode_cmd->height > bo->base.size) {
+		ret = -EINVAL;
+		goto err_unref;
+	}
+
+	vfb = kzalloc(sizeof(*vfb), GFP_KERNEL);
+	if (vfb == NULL) {
+		ret = -ENOMEM;
+		goto err_unref;
+	}
+
+	ret = drm_framebuffer_init(dev, &vfb->base, &vkms_fb_funcs);
+	if (ret) {
+		kfree(vfb);
+		goto err_unref;
+	}
+
+	drm_helper_mode_fill_fb_struct(&vfb->base, mode_cmd);
+	vfb->obj = bo;
+	return &vfb->base;
+
+err_unref:
+	drm_gem_object_unreference_unlocked(&bo->base);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(vkms_framebuffer_create);
+
+struct drm_framebuffer *
+vkms_fb_create(struct drm_device *dev, struct drm_file *file_priv,
+	       struct drm_mode_fb_cmd *mode_cmd)
+{
+	struct drm_gem_object *obj;
+
+	obj = drm_gem_object_lookup(dev, file_priv, mode_cmd->handle);
+	if (obj == NULL)
+		return ERR_PTR(-ENOENT);
+
+	return vkms_framebuffer_create(dev, mode_cmd, to_vkms_bo(obj));
+}
+
+/*
+ * Buffer sharing goes through the generic PRIME helpers. Exported objects
+ * hand out their pinned shmem pages, imported ones are built on the pages
+ * of the exporter, so a buffer rendered elsewhere can be scanned out and
+ * captured here without a copy.
+ */
+struct sg_table *vkms_gem_prime_get_sg_table(struct drm_gem_object *obj)
+{
+	struct vkms_gem_object *bo = to_vkms_bo(obj);
+	int ret;
+
+	ret = vkms_gem_get_pages(bo);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return drm_prime_pages_to_sg(bo->pages, obj->size >> PAGE_SHIFT);
+}
+
+struct drm_gem_object *
+vkms_gem_prime_import_sg_table(struct drm_device *dev, size_t size,
+			       struct sg_table *sgt)
+{
+	struct vkms_gem_object *bo;
+	int npages = size >> PAGE_SHIFT;
+	int ret;
+
+	bo = kzalloc(sizeof(*bo), GFP_KERNEL);
+	if (bo == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	ret = drm_gem_private_object_init(dev, &bo->base, size);
+	if (ret)
+		goto err_free;
+
+	bo->pages = drm_malloc_ab(npages, sizeof(struct page *));
+	if (bo->pages == NULL) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = drm_prime_sg_to_page_addr_arrays(sgt, bo->pages, NULL, npages);
+	if (ret) {
+		drm_free_large(bo->pages);
+		goto err_free;
+	}
+
+	bo->sgt = sgt;
+	return &bo->base;
+
+err_free:
+	kfree(bo);
+	return ERR_PTR(ret);
+}
+
+void *vkms_gem_prime_vmap(struct drm_gem_object *obj)
+{
+	struct vkms_gem_object *bo = to_vkms_bo(obj);
+	int ret;
+
+	mutex_lock(&obj->dev->struct_mutex);
+	ret = vkms_gem_vmap(bo);
+	mutex_unlock(&obj->dev->struct_mutex);
+
+	return ret ? ERR_PTR(ret) : bo->vaddr;
+}
+
+void vkms_gem_prime_vunmap(struct drm_gem_object *obj, void *vaddr)
+{
+	/* The mapping is kept for frame capture until the object goes away */
+}
+
+static void vkms_prime_vm_open(struct vm_area_struct *vma)
+{
+	drm_gem_object_reference(vma->vm_private_data);
+}
+
+static void vkms_prime_vm_close(struct vm_area_struct *vma)
+{
+	drm_gem_object_unreference_unlocked(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct vkms_prime_vm_ops = {
+	.open = vkms_prime_vm_open,
+	.close = vkms_prime_vm_close,
+};
+
+/*
+ * mmap of the dma-buf itself. The pages are pinned anyway, so they are
+ * all inserted up front instead of through the GEM fault handler, which
+ * expects the fake offset of the DRM node in vm_pgoff.
+ */
+int vkms_gem_prime_mmap(struct drm_gem_object *obj, struct vm_area_struct *vma)
+{
+	struct vkms_gem_object *bo = to_vkms_bo(obj);
+	unsigned long addr;
+	pgoff_t pgoff;
+	int ret;
+
+	mutex_lock(&obj->dev->struct_mutex);
+	ret = vkms_gem_get_pages(bo);
+	mutex_unlock(&obj->dev->struct_mutex);
+	if (ret)
+		return ret;
+
+	for (addr = vma->vm_start, pgoff = vma->vm_pgoff; addr < vma->vm_end;
+	     addr += PAGE_SIZE, pgoff++) {
+		ret = vm_insert_page(vma, addr, bo->pages[pgoff]);
+		if (ret)
+			return ret;
+	}
+
+	vma->vm_ops = &vkms_prime_vm_ops;
+	vma->vm_private_data = obj;
+	drm_gem_object_reference(obj);
+
+	return 0;
+}
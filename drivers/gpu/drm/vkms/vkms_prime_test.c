@@ -0,0 +1,302 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Selftest for PRIME buffer sharing between two vkms instances.
+ * - Needs vkms loaded with devices=2
+ * - A buffer created on the first device is exported as a dma-buf, passed
+ *   through a file descriptor and imported on the second device
+ * - Checks that both objects are backed by the same pages, that writes
+ *   through either mapping are seen by the other, that importing on the
+ *   exporter gives back the original object and that the imported object
+ *   outlives the exporter's references
+ * - Reports the time to share a buffer against the time to copy it
+ */
+#include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/syscalls.h>
+#include <linux/fcntl.h>
+#include <linux/dma-buf.h>
+#include "vkms_drv.h"
+
+static unsigned npages = 2025;	/* one 1920x1080 XRGB8888 frame */
+module_param(npages, uint, 0444);
+MODULE_PARM_DESC(npages, "Buffer size in pages");
+
+static unsigned loops = 100;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Shares and copies timed");
+
+#define PRIME_PFX "vkms_prime_test: "
+
+static void prime_test_fill(u32 *p, size_t size, u32 seed)
+{
+	size_t i;
+
+	for (i = 0; i < size / 4; i++)
+		p[i] = (i + seed) * 2654435761u;
+}
+
+static int prime_test_check(const u32 *p, size_t size, u32 seed,
+			    const char *what)
+{
+	size_t i;
+
+	for (i = 0; i < size / 4; i++) {
+		if (p[i] != (u32)((i + seed) * 2654435761u)) {
+			printk(KERN_ERR PRIME_PFX "%s: mismatch at word %zu\n",
+			       what, i);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static void prime_test_report(const char *what, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	printk(KERN_INFO PRIME_PFX "%s: %llu us/op\n", what,
+	       (unsigned long long)div_u64(ns, loops * NSEC_PER_USEC));
+}
+
+/*
+ * Hand the dma-buf to "userspace" and take it back, the way a compositor
+ * passes it between two DRM nodes. Returns a new reference to the buffer.
+ */
+static struct dma_buf *prime_test_pass_fd(struct dma_buf *dma_buf)
+{
+	struct dma_buf *ret;
+	int fd;
+
+	get_dma_buf(dma_buf);
+	fd = dma_buf_fd(dma_buf, O_CLOEXEC);
+	if (fd < 0) {
+		dma_buf_put(dma_buf);
+		return ERR_PTR(fd);
+	}
+
+	ret = dma_buf_get(fd);
+	sys_close(fd);
+
+	return ret;
+}
+
+/* export, pass through an fd, import and map: what sharing a frame costs */
+static int prime_test_share(struct drm_device *src, struct drm_device *dst,
+			    struct drm_gem_object *obj)
+{
+	struct drm_gem_object *imported;
+	struct dma_buf *dma_buf, *passed;
+	void *vaddr;
+	int ret = 0;
+
+	dma_buf = src->driver->gem_prime_export(src, obj, 0);
+	if (IS_ERR(dma_buf))
+		return PTR_ERR(dma_buf);
+
+	passed = prime_test_pass_fd(dma_buf);
+	dma_buf_put(dma_buf);
+	if (IS_ERR(passed))
+		return PTR_ERR(passed);
+
+	imported = dst->driver->gem_prime_import(dst, passed);
+	dma_buf_put(passed);
+	if (IS_ERR(imported))
+		return PTR_ERR(imported);
+
+	vaddr = dst->driver->gem_prime_vmap(imported);
+	if (IS_ERR_OR_NULL(vaddr))
+		ret = vaddr ? PTR_ERR(vaddr) : -ENOMEM;
+
+	drm_gem_object_unreference_unlocked(imported);
+	return ret;
+}
+
+static int prime_test_run(struct drm_device *a, struct drm_device *b)
+{
+	size_t size = (size_t)npages << PAGE_SHIFT;
+	struct vkms_gem_object *bo_a, *bo_b, *copy;
+	struct drm_gem_object *obj;
+	struct dma_buf *dma_buf, *passed;
+	unsigned int i;
+	ktime_t start;
+	void *vaddr;
+	int ret;
+
+	bo_a = vkms_gem_create(a, size);
+	if (!bo_a)
+		return -ENOMEM;
+
+	mutex_lock(&a->struct_mutex);
+	ret = vkms_gem_vmap(bo_a);
+	mutex_unlock(&a->struct_mutex);
+	if (ret)
+		goto out_a;
+	prime_test_fill(bo_a->vaddr, size, 0);
+
+	dma_buf = a->driver->gem_prime_export(a, &bo_a->base, 0);
+	if (IS_ERR(dma_buf)) {
+		ret = PTR_ERR(dma_buf);
+		goto out_a;
+	}
+
+	passed = prime_test_pass_fd(dma_buf);
+	if (IS_ERR(passed)) {
+		ret = PTR_ERR(passed);
+		goto out_dma_buf;
+	}
+	if (passed != dma_buf) {
+		printk(KERN_ERR PRIME_PFX "fd gave back another buffer\n");
+		dma_buf_put(passed);
+		ret = -EINVAL;
+		goto out_dma_buf;
+	}
+	dma_buf_put(passed);
+
+	/* importing on the exporter must not create a second object */
+	obj = a->driver->gem_prime_import(a, dma_buf);
+	if (IS_ERR(obj)) {
+		ret = PTR_ERR(obj);
+		goto out_dma_buf;
+	}
+	drm_gem_object_unreference_unlocked(obj);
+	if (obj != &bo_a->base) {
+		printk(KERN_ERR PRIME_PFX "self import created a new object\n");
+		ret = -EINVAL;
+		goto out_dma_buf;
+	}
+
+	obj = b->driver->gem_prime_import(b, dma_buf);
+	if (IS_ERR(obj)) {
+		ret = PTR_ERR(obj);
+		goto out_dma_buf;
+	}
+	bo_b = to_vkms_bo(obj);
+
+	for (i = 0; i < npages; i++) {
+		if (bo_b->pages[i] != bo_a->pages[i]) {
+			printk(KERN_ERR PRIME_PFX "page %u was not shared\n",
+			       i);
+			ret = -EINVAL;
+			goto out_b;
+		}
+	}
+
+	vaddr = b->driver->gem_prime_vmap(obj);
+	if (IS_ERR_OR_NULL(vaddr)) {
+		ret = vaddr ? PTR_ERR(vaddr) : -ENOMEM;
+		goto out_b;
+	}
+	ret = prime_test_check(vaddr, size, 0, "importer read");
+	if (ret)
+		goto out_b;
+
+	prime_test_fill(vaddr, size, 1);
+	ret = prime_test_check(bo_a->vaddr, size, 1, "exporter read");
+	if (ret)
+		goto out_b;
+
+	/* kernel users of the dma-buf see the exporter's memory as well */
+	vaddr = dma_buf_vmap(dma_buf);
+	if (!vaddr) {
+		printk(KERN_ERR PRIME_PFX "dma_buf_vmap failed\n");
+		ret = -ENOMEM;
+		goto out_b;
+	}
+	ret = prime_test_check(vaddr, size, 1, "dma_buf_vmap read");
+	dma_buf_vunmap(dma_buf, vaddr);
+	if (ret)
+		goto out_b;
+
+	/* the import keeps the exported object alive on its own */
+	dma_buf_put(dma_buf);
+	dma_buf = NULL;
+	drm_gem_object_unreference_unlocked(&bo_a->base);
+	bo_a = NULL;
+	ret = prime_test_check(bo_b->vaddr, size, 1, "read after export put");
+	if (ret)
+		goto out_b;
+
+	printk(KERN_INFO PRIME_PFX "sharing %u pages passed\n", npages);
+
+	/* now compare handing over a frame with copying it */
+	copy = vkms_gem_create(b, size);
+	if (!copy) {
+		ret = -ENOMEM;
+		goto out_b;
+	}
+	mutex_lock(&b->struct_mutex);
+	ret = vkms_gem_vmap(copy);
+	mutex_unlock(&b->struct_mutex);
+	if (ret)
+		goto out_copy;
+
+	start = ktime_get();
+	for (i = 0; i < loops && !ret; i++)
+		ret = prime_test_share(b, a, obj);
+	if (!ret)
+		prime_test_report("share", start);
+
+	start = ktime_get();
+	for (i = 0; i < loops && !ret; i++)
+		memcpy(copy->vaddr, bo_b->vaddr, size);
+	if (!ret)
+		prime_test_report("copy", start);
+
+out_copy:
+	drm_gem_object_unreference_unlocked(&copy->base);
+out_b:
+	drm_gem_object_unreference_unlocked(obj);
+out_dma_buf:
+	if (dma_buf)
+		dma_buf_put(dma_buf);
+out_a:
+	if (bo_a)
+		drm_gem_object_unreference_unlocked(&bo_a->base);
+	return ret;
+}
+
+static int __init vkms_prime_test_init(void)
+{
+	struct drm_device *a = vkms_get_device(0);
+	struct drm_device *b = vkms_get_device(1);
+
+	if (!a || !b) {
+		printk(KERN_ERR PRIME_PFX "load vkms with devices=2\n");
+		return -ENODEV;
+	}
+
+	if (!npages || !loops)
+		return -EINVAL;
+
+	return prime_test_run(a, b);
+}
+
+static void __exit vkms_prime_test_exit(void)
+{
+}
+
+module_init(vkms_prime_test_init);
+module_exit(vkms_prime_test_exit);
+
+MODULE_DESCRIPTION("Selftest for PRIME sharing between vkms instances");
+MODULE_LICENSE("GPL and additional rights");
@@ -0,0 +1,1205 @@
+/*
+ * Software color space conversion and scaling mem2mem device.
+ *
+ * Converts between RGB565, XRGB8888, YUYV and NV12 and scales with a
+ * bilinear filter, on the cpu. Frames are converted to XRGB8888 lines,
+ * filtered vertically (with SSE2 where available) and horizontally, and
+ * converted to the destination format. The lines of a frame are split into
+ * stripes that run on several cpus, and with slots > 1 jobs of different
+ * instances run at the same time.
+ *
+ * The time each job took is reported through read-only controls.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version
+ */
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/hardirq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <asm/byteorder.h>
+
+#include <media/v4l2-mem2mem.h>
+#include <media/v4l2-device.h>
+#include <media/v4l2-ioctl.h>
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-fh.h>
+#include <media/videobuf2-vmalloc.h>
+
+#ifdef CONFIG_X86
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+#endif
+
+#define SWCONV_NAME		"m2m-swconv"
+
+MODULE_DESCRIPTION("Software color conversion and scaling mem2mem device");
+MODULE_LICENSE("GPL");
+
+#define MIN_W 16
+#define MIN_H 16
+#define MAX_W 4096
+#define MAX_H 4096
+
+/* Frames are split into at most this many stripes of at least 16 lines */
+#define SWCONV_MAX_STRIPES	16
+
+/* In bytes, per queue */
+#define SWCONV_VID_MEM_LIMIT	(64 * 1024 * 1024)
+
+static unsigned int slots = 1;
+module_param(slots, uint, 0444);
+MODULE_PARM_DESC(slots, "jobs of different instances run at the same time, "
+		 "0 is all online cpus");
+
+static unsigned int threads;
+module_param(threads, uint, 0644);
+MODULE_PARM_DESC(threads, "cpus working on the stripes of one frame, "
+		 "0 is all online cpus");
+
+static bool nosimd;
+module_param(nosimd, bool, 0644);
+MODULE_PARM_DESC(nosimd, "don't use SIMD instructions");
+
+static unsigned int debug;
+module_param(debug, uint, 0644);
+MODULE_PARM_DESC(debug, "activates debug info");
+
+#define dprintk(dev, fmt, arg...) \
+	v4l2_dbg(1, debug, &dev->v4l2_dev, "%s: " fmt, __func__, ## arg)
+
+struct swconv_fmt {
+	char	*name;
+	u32	fourcc;
+	int	depth;		/* bits per pixel, all planes together */
+};
+
+static struct swconv_fmt formats[] = {
+	{
+		.name	= "RGB565 (LE)",
+		.fourcc	= V4L2_PIX_FMT_RGB565,
+		.depth	= 16,
+	},
+	{
+		.name	= "XRGB8888 (BGR32)",
+		.fourcc	= V4L2_PIX_FMT_BGR32,
+		.depth	= 32,
+	},
+	{
+		.name	= "4:2:2, packed, YUYV",
+		.fourcc	= V4L2_PIX_FMT_YUYV,
+		.depth	= 16,
+	},
+	{
+		.name	= "4:2:0, planar, Y/CbCr",
+		.fourcc	= V4L2_PIX_FMT_NV12,
+		.depth	= 12,
+	},
+};
+
+static struct swconv_fmt *find_format(u32 fourcc)
+{
+	unsigned int k;
+
+	for (k = 0; k < ARRAY_SIZE(formats); k++)
+		if (formats[k].fourcc == fourcc)
+			return &formats[k];
+
+	return NULL;
+}
+
+/* Per-queue, per-instance format */
+struct swconv_q_data {
+	unsigned int		width;
+	unsigned int		height;
+	unsigned int		bytesperline;
+	unsigned int		sizeimage;
+	struct swconv_fmt	*fmt;
+};
+
+struct swconv_dev {
+	struct v4l2_device	v4l2_dev;
+	struct video_device	*vfd;
+	struct mutex		dev_mutex;
+
+	/* Runs the jobs, one per slot at a time */
+	struct workqueue_struct	*workq;
+
+	struct v4l2_m2m_dev	*m2m_dev;
+};
+
+struct swconv_ctx;
+
+/* A band of destination lines converted by one cpu */
+struct swconv_stripe {
+	struct work_struct	work;
+	struct swconv_ctx	*ctx;
+	unsigned int		first;
+	unsigned int		count;
+
+	/* XRGB8888 lines: two source lines, their blend, two output lines */
+	u32			*src_line[2];
+	int			src_y[2];
+	u32			*vline;
+	u32			*hline[2];
+};
+
+struct swconv_ctx {
+	struct v4l2_fh		fh;
+	struct swconv_dev	*dev;
+
+	struct v4l2_ctrl_handler hdl;
+	struct v4l2_ctrl	*job_time;
+	struct v4l2_ctrl	*avg_time;
+
+	/* Source and destination formats */
+	struct swconv_q_data	q_data[2];
+
+	/* The buffers of the frame being converted */
+	const u8		*src;
+	u8			*dst;
+
+	/* Horizontal filter: source pixel << 8 | weight of the next one */
+	u32			*xmap;
+	void			*scratch;
+	size_t			scratch_size;
+
+	struct swconv_stripe	stripe[SWCONV_MAX_STRIPES];
+
+	/* Job timing, in microseconds */
+	u32			last_us;
+	u32			avg_us;
+
+	int			aborting;
+	struct work_struct	work;
+
+	struct v4l2_m2m_ctx	*m2m_ctx;
+};
+
+enum {
+	SWCONV_SRC = 0,
+	SWCONV_DST = 1,
+};
+
+static inline struct swconv_ctx *file2ctx(struct file *file)
+{
+	return container_of(file->private_data, struct swconv_ctx, fh);
+}
+
+static struct swconv_q_data *get_q_data(struct swconv_ctx *ctx,
+					enum v4l2_buf_type type)
+{
+	if (V4L2_TYPE_IS_OUTPUT(type))
+		return &ctx->q_data[SWCONV_SRC];
+	return &ctx->q_data[SWCONV_DST];
+}
+
+/*
+ * Pixel conversion, BT.601 limited range
+ */
+
+static inline u8 clamp_u8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline u32 yuv_to_xrgb(int y, int u, int v)
+{
+	int c = 298 * (y - 16) + 128, d = u - 128, e = v - 128;
+
+	return clamp_u8((c + 409 * e) >> 8) << 16 |
+	       clamp_u8((c - 100 * d - 208 * e) >> 8) << 8 |
+	       clamp_u8((c + 516 * d) >> 8);
+}
+
+#define XRGB_R(p)	(((p) >> 16) & 0xff)
+#define XRGB_G(p)	(((p) >> 8) & 0xff)
+#define XRGB_B(p)	((p) & 0xff)
+
+static inline u8 xrgb_to_y(int r, int g, int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline u8 xrgb_to_u(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline u8 xrgb_to_v(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+/* Convert source line @y to XRGB8888, the last pixel is repeated once */
+static void swconv_unpack(struct swconv_ctx *ctx, u32 *out, unsigned int y)
+{
+	struct swconv_q_data *q = &ctx->q_data[SWCONV_SRC];
+	const u8 *in = ctx->src + y * q->bytesperline;
+	const u8 *uv;
+	unsigned int x, w = q->width;
+	u16 p;
+
+	switch (q->fmt->fourcc) {
+	case V4L2_PIX_FMT_RGB565:
+		for (x = 0; x < w; x++) {
+			p = le16_to_cpu(((__le16 *)in)[x]);
+			out[x] = (p & 0xf800) << 8 | (p & 0xe000) << 3 |
+				 (p & 0x07e0) << 5 | (p & 0x0600) >> 1 |
+				 (p & 0x001f) << 3 | (p & 0x001c) >> 2;
+		}
+		break;
+	case V4L2_PIX_FMT_BGR32:
+		for (x = 0; x < w; x++)
+			out[x] = le32_to_cpu(((__le32 *)in)[x]) & 0xffffff;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		for (x = 0; x < w; x += 2, in += 4) {
+			out[x] = yuv_to_xrgb(in[0], in[1], in[3]);
+			out[x + 1] = yuv_to_xrgb(in[2], in[1], in[3]);
+		}
+		break;
+	case V4L2_PIX_FMT_NV12:
+		uv = ctx->src + q->bytesperline * q->height +
+			y / 2 * q->bytesperline;
+		for (x = 0; x < w; x += 2) {
+			out[x] = yuv_to_xrgb(in[x], uv[x], uv[x + 1]);
+			out[x + 1] = yuv_to_xrgb(in[x + 1], uv[x], uv[x + 1]);
+		}
+		break;
+	}
+
+	out[w] = out[w - 1];
+}
+
+/*
+ * Convert XRGB8888 destination line @y to the destination format. NV12
+ * chroma is written with the second line of every pair, from @prev and
+ * @line.
+ */
+static void swconv_pack(struct swconv_ctx *ctx, const u32 *line,
+			const u32 *prev, unsigned int y)
+{
+	struct swconv_q_data *q = &ctx->q_data[SWCONV_DST];
+	u8 *out = ctx->dst + y * q->bytesperline;
+	unsigned int x, w = q->width;
+	int r, g, b;
+	u32 p;
+	u8 *uv;
+
+	switch (q->fmt->fourcc) {
+	case V4L2_PIX_FMT_RGB565:
+		for (x = 0; x < w; x++) {
+			p = line[x];
+			((__le16 *)out)[x] = cpu_to_le16(
+				(p >> 8 & 0xf800) | (p >> 5 & 0x07e0) |
+				(p >> 3 & 0x001f));
+		}
+		break;
+	case V4L2_PIX_FMT_BGR32:
+		for (x = 0; x < w; x++)
+			((__le32 *)out)[x] = cpu_to_le32(line[x]);
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		for (x = 0; x < w; x += 2, out += 4) {
+			r = XRGB_R(line[x]) + XRGB_R(line[x + 1]);
+			g = XRGB_G(line[x]) + XRGB_G(line[x + 1]);
+			b = XRGB_B(line[x]) + XRGB_B(line[x + 1]);
+			out[0] = xrgb_to_y(XRGB_R(line[x]), XRGB_G(line[x]),
+					   XRGB_B(line[x]));
+			out[1] = xrgb_to_u(r / 2, g / 2, b / 2);
+			out[2] = xrgb_to_y(XRGB_R(line[x + 1]),
+					   XRGB_G(line[x + 1]),
+					   XRGB_B(line[x + 1]));
+			out[3] = xrgb_to_v(r / 2, g / 2, b / 2);
+		}
+		break;
+	case V4L2_PIX_FMT_NV12:
+		for (x = 0; x < w; x++)
+			out[x] = xrgb_to_y(XRGB_R(line[x]), XRGB_G(line[x]),
+					   XRGB_B(line[x]));
+		if (!(y & 1))
+			break;
+		uv = ctx->dst + q->bytesperline * q->height +
+			y / 2 * q->bytesperline;
+		for (x = 0; x < w; x += 2) {
+			r = XRGB_R(line[x]) + XRGB_R(line[x + 1]) +
+			    XRGB_R(prev[x]) + XRGB_R(prev[x + 1]);
+			g = XRGB_G(line[x]) + XRGB_G(line[x + 1]) +
+			    XRGB_G(prev[x]) + XRGB_G(prev[x + 1]);
+			b = XRGB_B(line[x]) + XRGB_B(line[x + 1]) +
+			    XRGB_B(prev[x]) + XRGB_B(prev[x + 1]);
+			uv[x] = xrgb_to_u(r / 4, g / 4, b / 4);
+			uv[x + 1] = xrgb_to_v(r / 4, g / 4, b / 4);
+		}
+		break;
+	}
+}
+
+/*
+ * Bilinear filter
+ */
+
+static inline u32 swconv_blend_pixel(u32 a, u32 b, unsigned int w)
+{
+	u32 rb, g;
+
+	rb = ((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w) >> 8;
+	g = ((a & 0x00ff00) * (256 - w) + (b & 0x00ff00) * w) >> 8;
+	return (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+#ifdef CONFIG_X86
+
+/*
+ * dst = (a * (256 - w) + b * w) / 256 for every byte of 4 * @n pixels. The
+ * products of 8 bit channels and weights up to 256 fit 16 bit lanes.
+ */
+static inline void swconv_blend_sse2(u32 *dst, const u32 *a, const u32 *b,
+				     unsigned int n, unsigned int w)
+{
+	asm volatile("movd %[w], %%xmm6\n"
+		     "pshuflw $0, %%xmm6, %%xmm6\n"
+		     "punpcklqdq %%xmm6, %%xmm6\n"
+		     "movd %[iw], %%xmm5\n"
+		     "pshuflw $0, %%xmm5, %%xmm5\n"
+		     "punpcklqdq %%xmm5, %%xmm5\n"
+		     "pxor %%xmm7, %%xmm7\n"
+		     "1:\n"
+		     "movdqu (%[a]), %%xmm0\n"
+		     "movdqu (%[b]), %%xmm2\n"
+		     "movdqa %%xmm0, %%xmm1\n"
+		     "movdqa %%xmm2, %%xmm3\n"
+		     "punpcklbw %%xmm7, %%xmm0\n"
+		     "punpckhbw %%xmm7, %%xmm1\n"
+		     "punpcklbw %%xmm7, %%xmm2\n"
+		     "punpckhbw %%xmm7, %%xmm3\n"
+		     "pmullw %%xmm5, %%xmm0\n"
+		     "pmullw %%xmm5, %%xmm1\n"
+		     "pmullw %%xmm6, %%xmm2\n"
+		     "pmullw %%xmm6, %%xmm3\n"
+		     "paddw %%xmm2, %%xmm0\n"
+		     "paddw %%xmm3, %%xmm1\n"
+		     "psrlw $8, %%xmm0\n"
+		     "psrlw $8, %%xmm1\n"
+		     "packuswb %%xmm1, %%xmm0\n"
+		     "movdqu %%xmm0, (%[d])\n"
+		     "add $16, %[a]\n"
+		     "add $16, %[b]\n"
+		     "add $16, %[d]\n"
+		     "sub $1, %[n]\n"
+		     "jnz 1b\n"
+		     : [a] "+r" (a), [b] "+r" (b), [d] "+r" (dst), [n] "+r" (n)
+		     : [w] "r" (w), [iw] "r" (256 - w)
+		     : "memory", "cc");
+}
+
+static unsigned int swconv_blend_simd(u32 *dst, const u32 *a, const u32 *b,
+				      unsigned int n, unsigned int w)
+{
+	if (nosimd || n < 4 || !cpu_has_xmm2 || !irq_fpu_usable())
+		return 0;
+
+	kernel_fpu_begin();
+	swconv_blend_sse2(dst, a, b, n / 4, w);
+	kernel_fpu_end();
+
+	return n & ~3;
+}
+
+#else
+
+static unsigned int swconv_blend_simd(u32 *dst, const u32 *a, const u32 *b,
+				      unsigned int n, unsigned int w)
+{
+	return 0;
+}
+
+#endif
+
+/* Blend @n pixels of lines @a and @b, @w/256 of the way towards @b */
+static void swconv_blend_line(u32 *dst, const u32 *a, const u32 *b,
+			      unsigned int n, unsigned int w)
+{
+	unsigned int x;
+
+	for (x = swconv_blend_simd(dst, a, b, n, w); x < n; x++)
+		dst[x] = swconv_blend_pixel(a[x], b[x], w);
+}
+
+/*
+ * Position of destination pixel @i of @dst_len in a line of @src_len, with
+ * pixel centers lined up, as integer << 8 | fraction in 1/256.
+ */
+static u32 swconv_map(unsigned int i, unsigned int src_len,
+		      unsigned int dst_len)
+{
+	s64 pos;
+
+	pos = div_u64((u64)(2 * i + 1) * src_len << 15, dst_len) - (1 << 15);
+	if (pos < 0)
+		return 0;
+	if (pos >> 16 >= src_len - 1)
+		return (src_len - 1) << 8;
+	return pos >> 8;
+}
+
+/* Source line @y in XRGB8888, converted at most once per stripe */
+static const u32 *swconv_src_line(struct swconv_stripe *s, int y)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (s->src_y[i] == y)
+			return s->src_line[i];
+
+	/* Replace the line that isn't the one just above */
+	i = s->src_y[0] == y - 1 ? 1 : 0;
+	swconv_unpack(s->ctx, s->src_line[i], y);
+	s->src_y[i] = y;
+	return s->src_line[i];
+}
+
+static void swconv_convert_stripe(struct swconv_stripe *s)
+{
+	struct swconv_ctx *ctx = s->ctx;
+	struct swconv_q_data *sq = &ctx->q_data[SWCONV_SRC];
+	struct swconv_q_data *dq = &ctx->q_data[SWCONV_DST];
+	const u32 *l0, *l1, *v;
+	unsigned int x, y, pos, fy;
+	u32 *h;
+
+	s->src_y[0] = s->src_y[1] = -1;
+
+	for (y = s->first; y < s->first + s->count; y++) {
+		pos = swconv_map(y, sq->height, dq->height);
+		fy = pos & 0xff;
+
+		l0 = swconv_src_line(s, pos >> 8);
+		if (fy) {
+			l1 = swconv_src_line(s, (pos >> 8) + 1);
+			swconv_blend_line(s->vline, l0, l1, sq->width + 1,
+					  fy);
+			v = s->vline;
+		} else {
+			v = l0;
+		}
+
+		h = s->hline[y & 1];
+		if (sq->width == dq->width) {
+			memcpy(h, v, dq->width * sizeof(*h));
+		} else {
+			for (x = 0; x < dq->width; x++) {
+				pos = ctx->xmap[x];
+				h[x] = swconv_blend_pixel(v[pos >> 8],
+							  v[(pos >> 8) + 1],
+							  pos & 0xff);
+			}
+		}
+
+		swconv_pack(ctx, h, s->hline[!(y & 1)], y);
+	}
+}
+
+/* Same format and size on both sides */
+static void swconv_copy_stripe(struct swconv_stripe *s)
+{
+	struct swconv_ctx *ctx = s->ctx;
+	struct swconv_q_data *q = &ctx->q_data[SWCONV_DST];
+	size_t offset = s->first * q->bytesperline;
+
+	memcpy(ctx->dst + offset, ctx->src + offset,
+	       s->count * q->bytesperline);
+
+	/* NV12 chroma, a line for every two */
+	if (q->fmt->fourcc == V4L2_PIX_FMT_NV12) {
+		offset = q->bytesperline * (q->height + s->first / 2);
+		memcpy(ctx->dst + offset, ctx->src + offset,
+		       s->count / 2 * q->bytesperline);
+	}
+}
+
+static void swconv_run_stripe(struct swconv_stripe *s)
+{
+	struct swconv_ctx *ctx = s->ctx;
+
+	if (ctx->xmap)
+		swconv_convert_stripe(s);
+	else
+		swconv_copy_stripe(s);
+}
+
+static void swconv_stripe_work(struct work_struct *work)
+{
+	swconv_run_stripe(container_of(work, struct swconv_stripe, work));
+}
+
+/*
+ * Lay out the lines of every stripe and the horizontal filter map in
+ * ctx->scratch, growing it if needed.
+ */
+static int swconv_setup_scratch(struct swconv_ctx *ctx, unsigned int n)
+{
+	unsigned int sw = ctx->q_data[SWCONV_SRC].width;
+	unsigned int dw = ctx->q_data[SWCONV_DST].width;
+	size_t per_stripe = (3 * (sw + 1) + 2 * dw) * sizeof(u32);
+	size_t size = dw * sizeof(u32) + n * per_stripe;
+	unsigned int i, x;
+	u32 *p;
+
+	if (size > ctx->scratch_size) {
+		vfree(ctx->scratch);
+		ctx->scratch = vmalloc(size);
+		ctx->scratch_size = ctx->scratch ? size : 0;
+		if (!ctx->scratch)
+			return -ENOMEM;
+	}
+
+	p = ctx->scratch;
+	ctx->xmap = p;
+	for (x = 0; x < dw; x++)
+		ctx->xmap[x] = swconv_map(x, sw, dw);
+	p += dw;
+
+	for (i = 0; i < n; i++) {
+		struct swconv_stripe *s = &ctx->stripe[i];
+
+		s->src_line[0] = p;
+		s->src_line[1] = p + sw + 1;
+		s->vline = p + 2 * (sw + 1);
+		p += 3 * (sw + 1);
+		s->hline[0] = p;
+		s->hline[1] = p + dw;
+		p += 2 * dw;
+	}
+
+	return 0;
+}
+
+static int swconv_process(struct swconv_ctx *ctx, struct vb2_buffer *src_vb,
+			  struct vb2_buffer *dst_vb)
+{
+	struct swconv_q_data *sq = &ctx->q_data[SWCONV_SRC];
+	struct swconv_q_data *dq = &ctx->q_data[SWCONV_DST];
+	unsigned int n = threads ? threads : num_online_cpus();
+	unsigned int chunk, i;
+	int ret;
+
+	ctx->src = vb2_plane_vaddr(src_vb, 0);
+	ctx->dst = vb2_plane_vaddr(dst_vb, 0);
+	if (!ctx->src || !ctx->dst) {
+		v4l2_err(&ctx->dev->v4l2_dev,
+			 "Acquiring kernel pointers to buffers failed\n");
+		return -EFAULT;
+	}
+
+	/* Stripes start on even lines, for NV12 chroma */
+	n = clamp(min(n, dq->height / 16), 1U,
+		  (unsigned int)SWCONV_MAX_STRIPES);
+	chunk = ALIGN(DIV_ROUND_UP(dq->height, n), 2);
+	n = DIV_ROUND_UP(dq->height, chunk);
+
+	if (sq->fmt == dq->fmt && sq->width == dq->width &&
+	    sq->height == dq->height) {
+		ctx->xmap = NULL;
+	} else {
+		ret = swconv_setup_scratch(ctx, n);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct swconv_stripe *s = &ctx->stripe[i];
+
+		s->first = i * chunk;
+		s->count = min(chunk, dq->height - s->first);
+		if (i)
+			queue_work(system_unbound_wq, &s->work);
+	}
+
+	swconv_run_stripe(&ctx->stripe[0]);
+	for (i = 1; i < n; i++)
+		flush_work(&ctx->stripe[i].work);
+
+	return 0;
+}
+
+/*
+ * mem2mem callbacks
+ */
+
+static void swconv_job_work(struct work_struct *work)
+{
+	struct swconv_ctx *ctx = container_of(work, struct swconv_ctx, work);
+	struct swconv_dev *dev = ctx->dev;
+	struct vb2_buffer *src_vb, *dst_vb;
+	enum vb2_buffer_state state;
+	unsigned int n;
+	ktime_t start;
+
+	for (n = v4l2_m2m_batch_size(ctx->m2m_ctx, VIDEO_MAX_FRAME);
+	     n && !ctx->aborting; n--) {
+		src_vb = v4l2_m2m_src_buf_remove(ctx->m2m_ctx);
+		dst_vb = v4l2_m2m_dst_buf_remove(ctx->m2m_ctx);
+
+		start = ktime_get();
+		state = swconv_process(ctx, src_vb, dst_vb) ?
+			VB2_BUF_STATE_ERROR : VB2_BUF_STATE_DONE;
+		ctx->last_us = ktime_us_delta(ktime_get(), start);
+		ctx->avg_us = ctx->avg_us ?
+			(ctx->avg_us * 7 + ctx->last_us) / 8 : ctx->last_us;
+
+		dst_vb->v4l2_buf.timestamp = src_vb->v4l2_buf.timestamp;
+		v4l2_m2m_buf_done(src_vb, state);
+		v4l2_m2m_buf_done(dst_vb, state);
+	}
+
+	dprintk(dev, "job done in %u us\n", ctx->last_us);
+	v4l2_m2m_job_finish(dev->m2m_dev, ctx->m2m_ctx);
+}
+
+static void device_run(void *priv)
+{
+	struct swconv_ctx *ctx = priv;
+
+	queue_work(ctx->dev->workq, &ctx->work);
+}
+
+static void job_abort(void *priv)
+{
+	struct swconv_ctx *ctx = priv;
+
+	/* Stops after the frame being converted */
+	ctx->aborting = 1;
+}
+
+static void swconv_lock(void *priv)
+{
+	struct swconv_ctx *ctx = priv;
+
+	mutex_lock(&ctx->dev->dev_mutex);
+}
+
+static void swconv_unlock(void *priv)
+{
+	struct swconv_ctx *ctx = priv;
+
+	mutex_unlock(&ctx->dev->dev_mutex);
+}
+
+static struct v4l2_m2m_ops m2m_ops = {
+	.device_run	= device_run,
+	.job_abort	= job_abort,
+	.lock		= swconv_lock,
+	.unlock		= swconv_unlock,
+};
+
+/*
+ * video ioctls
+ */
+static int vidioc_querycap(struct file *file, void *priv,
+			   struct v4l2_capability *cap)
+{
+	strlcpy(cap->driver, SWCONV_NAME, sizeof(cap->driver));
+	strlcpy(cap->card, SWCONV_NAME, sizeof(cap->card));
+	cap->bus_info[0] = 0;
+	cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_OUTPUT
+			  | V4L2_CAP_STREAMING;
+	return 0;
+}
+
+static int vidioc_enum_fmt(struct file *file, void *priv,
+			   struct v4l2_fmtdesc *f)
+{
+	struct swconv_fmt *fmt;
+
+	if (f->index >= ARRAY_SIZE(formats))
+		return -EINVAL;
+
+	fmt = &formats[f->index];
+	strlcpy(f->description, fmt->name, sizeof(f->description));
+	f->pixelformat = fmt->fourcc;
+	return 0;
+}
+
+static void swconv_fill_pix(struct v4l2_pix_format *pix,
+			    struct swconv_fmt *fmt)
+{
+	if (fmt->fourcc == V4L2_PIX_FMT_NV12)
+		pix->bytesperline = pix->width;
+	else
+		pix->bytesperline = pix->width * fmt->depth / 8;
+	pix->sizeimage = pix->width * pix->height * fmt->depth / 8;
+}
+
+static int vidioc_g_fmt(struct file *file, void *priv, struct v4l2_format *f)
+{
+	struct swconv_ctx *ctx = file2ctx(file);
+	struct swconv_q_data *q_data = get_q_data(ctx, f->type);
+
+	f->fmt.pix.width	= q_data->width;
+	f->fmt.pix.height	= q_data->height;
+	f->fmt.pix.field	= V4L2_FIELD_NONE;
+	f->fmt.pix.pixelformat	= q_data->fmt->fourcc;
+	f->fmt.pix.bytesperline	= q_data->bytesperline;
+	f->fmt.pix.sizeimage	= q_data->sizeimage;
+	f->fmt.pix.colorspace	= V4L2_COLORSPACE_SMPTE170M;
+	return 0;
+}
+
+static int vidioc_try_fmt(struct file *file, void *priv, struct v4l2_format *f)
+{
+	struct swconv_ctx *ctx = file2ctx(file);
+	struct swconv_fmt *fmt;
+
+	fmt = find_format(f->fmt.pix.pixelformat);
+	if (!fmt) {
+		dprintk(ctx->dev, "Fourcc format (0x%08x) invalid.\n",
+			f->fmt.pix.pixelformat);
+		return -EINVAL;
+	}
+
+	if (f->fmt.pix.field == V4L2_FIELD_ANY)
+		f->fmt.pix.field = V4L2_FIELD_NONE;
+	else if (f->fmt.pix.field != V4L2_FIELD_NONE)
+		return -EINVAL;
+
+	/* Even sizes, for 4:2:2 and 4:2:0 chroma */
+	v4l_bound_align_image(&f->fmt.pix.width, MIN_W, MAX_W, 1,
+			      &f->fmt.pix.height, MIN_H, MAX_H, 1, 0);
+	swconv_fill_pix(&f->fmt.pix, fmt);
+	f->fmt.pix.colorspace = V4L2_COLORSPACE_SMPTE170M;
+	return 0;
+}
+
+static int vidioc_s_fmt(struct file *file, void *priv, struct v4l2_format *f)
+{
+	struct swconv_ctx *ctx = file2ctx(file);
+	struct swconv_q_data *q_data;
+	struct vb2_queue *vq;
+	int ret;
+
+	ret = vidioc_try_fmt(file, priv, f);
+	if (ret)
+		return ret;
+
+	vq = v4l2_m2m_get_vq(ctx->m2m_ctx, f->type);
+	if (vb2_is_busy(vq)) {
+		v4l2_err(&ctx->dev->v4l2_dev, "%s queue busy\n", __func__);
+		return -EBUSY;
+	}
+
+	q_data = get_q_data(ctx, f->type);
+	q_data->fmt		= find_format(f->fmt.pix.pixelformat);
+	q_data->width		= f->fmt.pix.width;
+	q_data->height		= f->fmt.pix.height;
+	q_data->bytesperline	= f->fmt.pix.bytesperline;
+	q_data->sizeimage	= f->fmt.pix.sizeimage;
+
+	dprintk(ctx->dev, "Setting format for type %d, wxh: %dx%d, fmt: %08x\n",
+		f->type, q_data->width, q_data->height, q_data->fmt->fourcc);
+	return 0;
+}
+
+static int vidioc_reqbufs(struct file *file, void *priv,
+			  struct v4l2_requestbuffers *reqbufs)
+{
+	return v4l2_m2m_reqbufs(file, file2ctx(file)->m2m_ctx, reqbufs);
+}
+
+static int vidioc_querybuf(struct file *file, void *priv,
+			   struct v4l2_buffer *buf)
+{
+	return v4l2_m2m_querybuf(file, file2ctx(file)->m2m_ctx, buf);
+}
+
+static int vidioc_qbuf(struct file *file, void *priv, struct v4l2_buffer *buf)
+{
+	return v4l2_m2m_qbuf(file, file2ctx(file)->m2m_ctx, buf);
+}
+
+static int vidioc_dqbuf(struct file *file, void *priv, struct v4l2_buffer *buf)
+{
+	return v4l2_m2m_dqbuf(file, file2ctx(file)->m2m_ctx, buf);
+}
+
+static int vidioc_streamon(struct file *file, void *priv,
+			   enum v4l2_buf_type type)
+{
+	return v4l2_m2m_streamon(file, file2ctx(file)->m2m_ctx, type);
+}
+
+static int vidioc_streamoff(struct file *file, void *priv,
+			    enum v4l2_buf_type type)
+{
+	return v4l2_m2m_streamoff(file, file2ctx(file)->m2m_ctx, type);
+}
+
+static const struct v4l2_ioctl_ops swconv_ioctl_ops = {
+	.vidioc_querycap	= vidioc_querycap,
+
+	.vidioc_enum_fmt_vid_cap = vidioc_enum_fmt,
+	.vidioc_g_fmt_vid_cap	= vidioc_g_fmt,
+	.vidioc_try_fmt_vid_cap	= vidioc_try_fmt,
+	.vidioc_s_fmt_vid_cap	= vidioc_s_fmt,
+
+	.vidioc_enum_fmt_vid_out = vidioc_enum_fmt,
+	.vidioc_g_fmt_vid_out	= vidioc_g_fmt,
+	.vidioc_try_fmt_vid_out	= vidioc_try_fmt,
+	.vidioc_s_fmt_vid_out	= vidioc_s_fmt,
+
+	.vidioc_reqbufs		= vidioc_reqbufs,
+	.vidioc_querybuf	= vidioc_querybuf,
+	.vidioc_qbuf		= vidioc_qbuf,
+	.vidioc_dqbuf		= vidioc_dqbuf,
+	.vidioc_streamon	= vidioc_streamon,
+	.vidioc_streamoff	= vidioc_streamoff,
+};
+
+/*
+ * Controls
+ */
+
+static int swconv_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct swconv_ctx *ctx =
+		container_of(ctrl->handler, struct swconv_ctx, hdl);
+
+	if (ctrl == ctx->job_time)
+		ctrl->val = ctx->last_us;
+	else if (ctrl == ctx->avg_time)
+		ctrl->val = ctx->avg_us;
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops swconv_ctrl_ops = {
+	.g_volatile_ctrl = swconv_g_volatile_ctrl,
+};
+
+#define SWCONV_CID_CUSTOM_BASE	(V4L2_CID_USER_BASE | 0xf000)
+
+static const struct v4l2_ctrl_config swconv_ctrl_job_time = {
+	.ops = &swconv_ctrl_ops,
+	.id = SWCONV_CID_CUSTOM_BASE + 0,
+	.name = "Last Job Time (us)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0x7fffffff,
+	.step = 1,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.is_volatile = 1,
+};
+
+static const struct v4l2_ctrl_config swconv_ctrl_avg_time = {
+	.ops = &swconv_ctrl_ops,
+	.id = SWCONV_CID_CUSTOM_BASE + 1,
+	.name = "Average Job Time (us)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0x7fffffff,
+	.step = 1,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.is_volatile = 1,
+};
+
+/*
+ * Queue operations
+ */
+
+static int swconv_queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
+			      unsigned int *nplanes, unsigned long sizes[],
+			      void *alloc_ctxs[])
+{
+	struct swconv_ctx *ctx = vb2_get_drv_priv(vq);
+	struct swconv_q_data *q_data = get_q_data(ctx, vq->type);
+	unsigned int size = q_data->sizeimage;
+
+	if (*nbuffers == 0)
+		*nbuffers = VIDEO_MAX_FRAME;
+	while (*nbuffers > 1 && size * *nbuffers > SWCONV_VID_MEM_LIMIT)
+		(*nbuffers)--;
+
+	*nplanes = 1;
+	sizes[0] = size;
+
+	dprintk(ctx->dev, "get %d buffer(s) of size %d each.\n",
+		*nbuffers, size);
+	return 0;
+}
+
+static int swconv_buf_prepare(struct vb2_buffer *vb)
+{
+	struct swconv_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+	struct swconv_q_data *q_data = get_q_data(ctx, vb->vb2_queue->type);
+
+	if (vb2_plane_size(vb, 0) < q_data->sizeimage) {
+		dprintk(ctx->dev, "data will not fit into plane (%lu < %u)\n",
+			vb2_plane_size(vb, 0), q_data->sizeimage);
+		return -EINVAL;
+	}
+
+	vb2_set_plane_payload(vb, 0, q_data->sizeimage);
+	return 0;
+}
+
+static void swconv_buf_queue(struct vb2_buffer *vb)
+{
+	struct swconv_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+
+	v4l2_m2m_buf_queue(ctx->m2m_ctx, vb);
+}
+
+static void swconv_wait_prepare(struct vb2_queue *q)
+{
+	swconv_unlock(vb2_get_drv_priv(q));
+}
+
+static void swconv_wait_finish(struct vb2_queue *q)
+{
+	swconv_lock(vb2_get_drv_priv(q));
+}
+
+static struct vb2_ops swconv_qops = {
+	.queue_setup	= swconv_queue_setup,
+	.buf_prepare	= swconv_buf_prepare,
+	.buf_queue	= swconv_buf_queue,
+	.wait_prepare	= swconv_wait_prepare,
+	.wait_finish	= swconv_wait_finish,
+};
+
+static int queue_init(void *priv, struct vb2_queue *src_vq,
+		      struct vb2_queue *dst_vq)
+{
+	struct swconv_ctx *ctx = priv;
+	int ret;
+
+	memset(src_vq, 0, sizeof(*src_vq));
+	src_vq->type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	src_vq->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF;
+	src_vq->drv_priv = ctx;
+	src_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	src_vq->ops = &swconv_qops;
+	src_vq->mem_ops = &vb2_vmalloc_memops;
+
+	ret = vb2_queue_init(src_vq);
+	if (ret)
+		return ret;
+
+	memset(dst_vq, 0, sizeof(*dst_vq));
+	dst_vq->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	dst_vq->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF;
+	dst_vq->drv_priv = ctx;
+	dst_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	dst_vq->ops = &swconv_qops;
+	dst_vq->mem_ops = &vb2_vmalloc_memops;
+
+	return vb2_queue_init(dst_vq);
+}
+
+/*
+ * File operations
+ */
+
+static int swconv_open(struct file *file)
+{
+	struct swconv_dev *dev = video_drvdata(file);
+	struct v4l2_pix_format pix = {
+		.width = 640,
+		.height = 480,
+	};
+	struct swconv_ctx *ctx;
+	int ret, i;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	v4l2_fh_init(&ctx->fh, video_devdata(file));
+	file->private_data = &ctx->fh;
+	ctx->dev = dev;
+	INIT_WORK(&ctx->work, swconv_job_work);
+	for (i = 0; i < SWCONV_MAX_STRIPES; i++) {
+		INIT_WORK(&ctx->stripe[i].work, swconv_stripe_work);
+		ctx->stripe[i].ctx = ctx;
+	}
+
+	swconv_fill_pix(&pix, &formats[0]);
+	for (i = 0; i < 2; i++) {
+		ctx->q_data[i].fmt = &formats[0];
+		ctx->q_data[i].width = pix.width;
+		ctx->q_data[i].height = pix.height;
+		ctx->q_data[i].bytesperline = pix.bytesperline;
+		ctx->q_data[i].sizeimage = pix.sizeimage;
+	}
+
+	v4l2_ctrl_handler_init(&ctx->hdl, 2);
+	ctx->job_time = v4l2_ctrl_new_custom(&ctx->hdl, &swconv_ctrl_job_time,
+					     NULL);
+	ctx->avg_time = v4l2_ctrl_new_custom(&ctx->hdl, &swconv_ctrl_avg_time,
+					     NULL);
+	if (ctx->hdl.error) {
+		ret = ctx->hdl.error;
+		goto free_hdl;
+	}
+	ctx->fh.ctrl_handler = &ctx->hdl;
+
+	ctx->m2m_ctx = v4l2_m2m_ctx_init(dev->m2m_dev, ctx, &queue_init);
+	if (IS_ERR(ctx->m2m_ctx)) {
+		ret = PTR_ERR(ctx->m2m_ctx);
+		goto free_hdl;
+	}
+
+	v4l2_fh_add(&ctx->fh);
+	dprintk(dev, "Created instance %p, m2m_ctx: %p\n", ctx, ctx->m2m_ctx);
+	return 0;
+
+free_hdl:
+	v4l2_ctrl_handler_free(&ctx->hdl);
+	v4l2_fh_exit(&ctx->fh);
+	kfree(ctx);
+	return ret;
+}
+
+static int swconv_release(struct file *file)
+{
+	struct swconv_dev *dev = video_drvdata(file);
+	struct swconv_ctx *ctx = file2ctx(file);
+
+	dprintk(dev, "Releasing instance %p\n", ctx);
+
+	v4l2_fh_del(&ctx->fh);
+	v4l2_fh_exit(&ctx->fh);
+	v4l2_m2m_ctx_release(ctx->m2m_ctx);
+	/* The last job is over, but its work may not have returned */
+	cancel_work_sync(&ctx->work);
+	v4l2_ctrl_handler_free(&ctx->hdl);
+	vfree(ctx->scratch);
+	kfree(ctx);
+	return 0;
+}
+
+static unsigned int swconv_poll(struct file *file,
+				struct poll_table_struct *wait)
+{
+	return v4l2_m2m_poll(file, file2ctx(file)->m2m_ctx, wait);
+}
+
+static int swconv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return v4l2_m2m_mmap(file, file2ctx(file)->m2m_ctx, vma);
+}
+
+static const struct v4l2_file_operations swconv_fops = {
+	.owner		= THIS_MODULE,
+	.open		= swconv_open,
+	.release	= swconv_release,
+	.poll		= swconv_poll,
+	.unlocked_ioctl	= video_ioctl2,
+	.mmap		= swconv_mmap,
+};
+
+static struct video_device swconv_videodev = {
+	.name		= SWCONV_NAME,
+	.fops		= &swconv_fops,
+	.ioctl_ops	= &swconv_ioctl_ops,
+	.minor		= -1,
+	.release	= video_device_release,
+};
+
+/*
+ * Initialization and module stuff
+ */
+
+static struct swconv_dev *swconv_dev;
+
+static int __init swconv_init(void)
+{
+	struct swconv_dev *dev;
+	struct video_device *vfd;
+	int ret;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+
+	strlcpy(dev->v4l2_dev.name, SWCONV_NAME, sizeof(dev->v4l2_dev.name));
+	ret = v4l2_device_register(NULL, &dev->v4l2_dev);
+	if (ret)
+		goto free_dev;
+
+	mutex_init(&dev->dev_mutex);
+
+	if (!slots)
+		slots = num_online_cpus();
+	dev->workq = alloc_workqueue(SWCONV_NAME, WQ_UNBOUND, slots);
+	if (!dev->workq) {
+		ret = -ENOMEM;
+		goto unreg_dev;
+	}
+
+	dev->m2m_dev = v4l2_m2m_init(&m2m_ops);
+	if (IS_ERR(dev->m2m_dev)) {
+		v4l2_err(&dev->v4l2_dev, "Failed to init mem2mem device\n");
+		ret = PTR_ERR(dev->m2m_dev);
+		goto free_wq;
+	}
+	v4l2_m2m_set_slots(dev->m2m_dev, slots);
+
+	vfd = video_device_alloc();
+	if (!vfd) {
+		v4l2_err(&dev->v4l2_dev, "Failed to allocate video device\n");
+		ret = -ENOMEM;
+		goto rel_m2m;
+	}
+
+	*vfd = swconv_videodev;
+	vfd->lock = &dev->dev_mutex;
+	vfd->v4l2_dev = &dev->v4l2_dev;
+
+	ret = video_register_device(vfd, VFL_TYPE_GRABBER, -1);
+	if (ret) {
+		v4l2_err(&dev->v4l2_dev, "Failed to register video device\n");
+		goto rel_vdev;
+	}
+
+	video_set_drvdata(vfd, dev);
+	dev->vfd = vfd;
+	swconv_dev = dev;
+	v4l2_info(&dev->v4l2_dev, "Device registered as %s\n",
+		  video_device_node_name(vfd));
+	return 0;
+
+rel_vdev:
+	video_device_release(vfd);
+rel_m2m:
+	v4l2_m2m_release(dev->m2m_dev);
+free_wq:
+	destroy_workqueue(dev->workq);
+unreg_dev:
+	v4l2_device_unregister(&dev->v4l2_dev);
+free_dev:
+	kfree(dev);
+	return ret;
+}
+
+static void __exit swconv_exit(void)
+{
+	struct swconv_dev *dev = swconv_dev;
+
+	v4l2_info(&dev->v4l2_dev, "Removing " SWCONV_NAME "\n");
+	video_unregister_device(dev->vfd);
+	v4l2_m2m_release(dev->m2m_dev);
+	destroy_workqueue(dev->workq);
+	v4l2_device_unregister(&dev->v4l2_dev);
+	kfree(dev);
+}
+
+module_init(swconv_init);
+module_exit(swconv_exit);
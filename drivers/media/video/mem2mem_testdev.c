@@ -5,7 +5,9 @@
  * It simulates a device that uses memory buffers for both source and
  * destination, processes the data and issues an "irq" (simulated by a timer).
  * The device is capable of multi-instance, multi-buffer-per-transaction
- * operation (via the mem2mem framework).
+ * operation (via the mem2mem framework). The processing is done on the cpu,
+ * and with slots > 1 jobs of several instances run on different cpus, so
+ * it can be used to measure how the framework scales.
  *
  * Copyright (c) 2009-2010 Samsung Electronics Co., Ltd.
  * Pawel Osciak, <pawel@osciak.com>
@@ -22,6 +24,7 @@
 #include <linux/timer.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include <linux/platform_device.h>
 #include <media/v4l2-mem2mem.h>
@@ -38,8 +41,8 @@ MODULE_VERSION("0.1.1");
 
 #define MIN_W 32
 #define MIN_H 32
-#define MAX_W 640
-#define MAX_H 480
+#define MAX_W 1920
+#define MAX_H 1080
 #define DIM_ALIGN_MASK 0x08 /* 8-alignment for dimensions */
 
 /* Flags that indicate a format can be used for capture/output */
@@ -63,6 +66,10 @@ MODULE_VERSION("0.1.1");
 #define dprintk(dev, fmt, arg...) \
 	v4l2_dbg(1, 1, &dev->v4l2_dev, "%s: " fmt, __func__, ## arg)
 
+static unsigned int slots = 1;
+module_param(slots, uint, 0444);
+MODULE_PARM_DESC(slots, "Transactions of different instances processed "
+		 "at the same time, 0 is all online cpus");
 
 void m2mtest_dev_release(struct device *dev)
 {}
@@ -134,7 +141,7 @@ static struct v4l2_queryctrl m2mtest_ctrls[] = {
 		.id		= V4L2_CID_TRANS_TIME_MSEC,
 		.type		= V4L2_CTRL_TYPE_INTEGER,
 		.name		= "Transaction time (msec)",
-		.minimum	= 1,
+		.minimum	= 0,
 		.maximum	= 10000,
 		.step		= 100,
 		.default_value	= 1000,
@@ -178,7 +185,8 @@ struct m2mtest_dev {
 	struct mutex		dev_mutex;
 	spinlock_t		irqlock;
 
-	struct timer_list	timer;
+	/* Processes the transactions, one per slot at a time */
+	struct workqueue_struct	*workq;
 
 	struct v4l2_m2m_dev	*m2m_dev;
 };
@@ -186,10 +194,13 @@ struct m2mtest_dev {
 struct m2mtest_ctx {
 	struct m2mtest_dev	*dev;
 
-	/* Processed buffers in this transaction */
-	u8			num_processed;
+	/* Buffers taken by the running transaction */
+	struct vb2_buffer	*src_vb[MEM2MEM_DEF_NUM_BUFS];
+	struct vb2_buffer	*dst_vb[MEM2MEM_DEF_NUM_BUFS];
+	enum vb2_buffer_state	state[MEM2MEM_DEF_NUM_BUFS];
+	unsigned int		num_processed;
 
-	/* Transaction length (i.e. how many buffers per transaction) */
+	/* Transaction length (i.e. at most how many buffers per transaction) */
 	u32			translen;
 	/* Transaction time (i.e. simulated processing time) in milliseconds */
 	u32			transtime;
@@ -197,6 +208,9 @@ struct m2mtest_ctx {
 	/* Abort requested by m2m */
 	int			aborting;
 
+	struct work_struct	work;
+	struct timer_list	timer;
+
 	struct v4l2_m2m_ctx	*m2m_ctx;
 };
 
@@ -265,32 +279,10 @@ static int device_process(struct m2mtest_ctx *ctx,
 	return 0;
 }
 
-static void schedule_irq(struct m2mtest_dev *dev, int msec_timeout)
-{
-	dprintk(dev, "Scheduling a simulated irq\n");
-	mod_timer(&dev->timer, jiffies + msecs_to_jiffies(msec_timeout));
-}
-
 /*
  * mem2mem callbacks
  */
 
-/**
- * job_ready() - check whether an instance is ready to be scheduled to run
- */
-static int job_ready(void *priv)
-{
-	struct m2mtest_ctx *ctx = priv;
-
-	if (v4l2_m2m_num_src_bufs_ready(ctx->m2m_ctx) < ctx->translen
-	    || v4l2_m2m_num_dst_bufs_ready(ctx->m2m_ctx) < ctx->translen) {
-		dprintk(ctx->dev, "Not enough buffers available\n");
-		return 0;
-	}
-
-	return 1;
-}
-
 static void job_abort(void *priv)
 {
 	struct m2mtest_ctx *ctx = priv;
@@ -318,55 +310,73 @@ static void m2mtest_unlock(void *priv)
  *
  * This simulates all the immediate preparations required before starting
  * a device. This will be called by the framework when it decides to schedule
- * a particular instance.
+ * a particular instance, possibly while transactions of other instances are
+ * still being processed.
  */
 static void device_run(void *priv)
 {
 	struct m2mtest_ctx *ctx = priv;
-	struct m2mtest_dev *dev = ctx->dev;
-	struct vb2_buffer *src_buf, *dst_buf;
-
-	src_buf = v4l2_m2m_next_src_buf(ctx->m2m_ctx);
-	dst_buf = v4l2_m2m_next_dst_buf(ctx->m2m_ctx);
-
-	device_process(ctx, src_buf, dst_buf);
 
-	/* Run a timer, which simulates a hardware irq  */
-	schedule_irq(dev, ctx->transtime);
+	queue_work(ctx->dev->workq, &ctx->work);
 }
 
-static void device_isr(unsigned long priv)
+/*
+ * Hand back the buffers of the transaction and yield the device. This is
+ * the "irq" that ends a transaction.
+ */
+static void device_finish(struct m2mtest_ctx *ctx)
 {
-	struct m2mtest_dev *m2mtest_dev = (struct m2mtest_dev *)priv;
-	struct m2mtest_ctx *curr_ctx;
-	struct vb2_buffer *src_vb, *dst_vb;
+	struct m2mtest_dev *dev = ctx->dev;
 	unsigned long flags;
+	unsigned int i;
 
-	curr_ctx = v4l2_m2m_get_curr_priv(m2mtest_dev->m2m_dev);
+	dprintk(dev, "Finishing transaction of %u buffers\n",
+		ctx->num_processed);
 
-	if (NULL == curr_ctx) {
-		printk(KERN_ERR
-			"Instance released before the end of transaction\n");
-		return;
+	spin_lock_irqsave(&dev->irqlock, flags);
+	for (i = 0; i < ctx->num_processed; i++) {
+		v4l2_m2m_buf_done(ctx->src_vb[i], ctx->state[i]);
+		v4l2_m2m_buf_done(ctx->dst_vb[i], ctx->state[i]);
 	}
+	spin_unlock_irqrestore(&dev->irqlock, flags);
 
-	src_vb = v4l2_m2m_src_buf_remove(curr_ctx->m2m_ctx);
-	dst_vb = v4l2_m2m_dst_buf_remove(curr_ctx->m2m_ctx);
+	ctx->num_processed = 0;
+	v4l2_m2m_job_finish(dev->m2m_dev, ctx->m2m_ctx);
+}
 
-	curr_ctx->num_processed++;
+static void device_isr(unsigned long priv)
+{
+	device_finish((struct m2mtest_ctx *)priv);
+}
 
-	spin_lock_irqsave(&m2mtest_dev->irqlock, flags);
-	v4l2_m2m_buf_done(src_vb, VB2_BUF_STATE_DONE);
-	v4l2_m2m_buf_done(dst_vb, VB2_BUF_STATE_DONE);
-	spin_unlock_irqrestore(&m2mtest_dev->irqlock, flags);
+/*
+ * The "hardware": processes all buffer pairs that are ready, up to the
+ * transaction length, in one go.
+ */
+static void device_work(struct work_struct *work)
+{
+	struct m2mtest_ctx *ctx = container_of(work, struct m2mtest_ctx, work);
+	unsigned int i, n;
+
+	n = v4l2_m2m_batch_size(ctx->m2m_ctx, ctx->translen);
+
+	for (i = 0; i < n && !ctx->aborting; i++) {
+		ctx->src_vb[i] = v4l2_m2m_src_buf_remove(ctx->m2m_ctx);
+		ctx->dst_vb[i] = v4l2_m2m_dst_buf_remove(ctx->m2m_ctx);
+		if (device_process(ctx, ctx->src_vb[i], ctx->dst_vb[i]))
+			ctx->state[i] = VB2_BUF_STATE_ERROR;
+		else
+			ctx->state[i] = VB2_BUF_STATE_DONE;
+		ctx->num_processed++;
+	}
 
-	if (curr_ctx->num_processed == curr_ctx->translen
-	    || curr_ctx->aborting) {
-		dprintk(curr_ctx->dev, "Finishing transaction\n");
-		curr_ctx->num_processed = 0;
-		v4l2_m2m_job_finish(m2mtest_dev->m2m_dev, curr_ctx->m2m_ctx);
+	/* Run a timer, which simulates a hardware irq */
+	if (ctx->transtime && !ctx->aborting) {
+		dprintk(ctx->dev, "Scheduling a simulated irq\n");
+		mod_timer(&ctx->timer,
+			  jiffies + msecs_to_jiffies(ctx->transtime));
 	} else {
-		device_run(curr_ctx);
+		device_finish(ctx);
 	}
 }
 
@@ -844,6 +854,8 @@ static int m2mtest_open(struct file *file)
 	ctx->translen = MEM2MEM_DEF_TRANSLEN;
 	ctx->transtime = MEM2MEM_DEF_TRANSTIME;
 	ctx->num_processed = 0;
+	INIT_WORK(&ctx->work, device_work);
+	setup_timer(&ctx->timer, device_isr, (unsigned long)ctx);
 
 	ctx->m2m_ctx = v4l2_m2m_ctx_init(dev->m2m_dev, ctx, &queue_init);
 
@@ -869,6 +881,9 @@ static int m2mtest_release(struct file *file)
 	dprintk(dev, "Releasing instance %p\n", ctx);
 
 	v4l2_m2m_ctx_release(ctx->m2m_ctx);
+	/* The transaction is over, but its handlers may not have returned */
+	del_timer_sync(&ctx->timer);
+	cancel_work_sync(&ctx->work);
 	kfree(ctx);
 
 	atomic_dec(&dev->num_inst);
@@ -910,7 +925,6 @@ static struct video_device m2mtest_videodev = {
 
 static struct v4l2_m2m_ops m2m_ops = {
 	.device_run	= device_run,
-	.job_ready	= job_ready,
 	.job_abort	= job_abort,
 	.lock		= m2mtest_lock,
 	.unlock		= m2mtest_unlock,
@@ -957,15 +971,23 @@ static int m2mtest_probe(struct platform_device *pdev)
 	v4l2_info(&dev->v4l2_dev, MEM2MEM_TEST_MODULE_NAME
 			"Device registered as /dev/video%d\n", vfd->num);
 
-	setup_timer(&dev->timer, device_isr, (long)dev);
 	platform_set_drvdata(pdev, dev);
 
+	if (!slots)
+		slots = num_online_cpus();
+	dev->workq = alloc_workqueue(MEM2MEM_NAME, WQ_UNBOUND, slots);
+	if (!dev->workq) {
+		ret = -ENOMEM;
+		goto err_m2m;
+	}
+
 	dev->m2m_dev = v4l2_m2m_init(&m2m_ops);
 	if (IS_ERR(dev->m2m_dev)) {
 		v4l2_err(&dev->v4l2_dev, "Failed to init mem2mem device\n");
 		ret = PTR_ERR(dev->m2m_dev);
-		goto err_m2m;
+		goto err_wq;
 	}
+	v4l2_m2m_set_slots(dev->m2m_dev, slots);
 
 	q_data[V4L2_M2M_SRC].fmt = &formats[0];
 	q_data[V4L2_M2M_DST].fmt = &formats[0];
@@ -973,6 +995,8 @@ static int m2mtest_probe(struct platform_device *pdev)
 	return 0;
 
 	v4l2_m2m_release(dev->m2m_dev);
+err_wq:
+	destroy_workqueue(dev->workq);
 err_m2m:
 	video_unregister_device(dev->vfd);
 rel_vdev:
@@ -992,7 +1016,7 @@ static int m2mtest_remove(struct platform_device *pdev)
 
 	v4l2_info(&dev->v4l2_dev, "Removing " MEM2MEM_TEST_MODULE_NAME);
 	v4l2_m2m_release(dev->m2m_dev);
-	del_timer_sync(&dev->timer);
+	destroy_workqueue(dev->workq);
 	video_unregister_device(dev->vfd);
 	v4l2_device_unregister(&dev->v4l2_dev);
 	kfree(dev);
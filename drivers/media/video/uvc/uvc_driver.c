@@ -48,6 +48,8 @@ unsigned int uvc_no_drop_param;
 static unsigned int uvc_quirks_param = -1;
 unsigned int uvc_trace_param;
 unsigned int uvc_timeout_param = UVC_CTRL_STREAMING_TIMEOUT;
+unsigned int uvc_zero_copy_param = 1;
+struct workqueue_struct *uvc_workqueue;
 
 /* ------------------------------------------------------------------------
  * Video formats
@@ -2017,6 +2019,8 @@ module_param_named(trace, uvc_trace_param, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(trace, "Trace level bitmask");
 module_param_named(timeout, uvc_timeout_param, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(timeout, "Streaming control requests timeout");
+module_param_named(zerocopy, uvc_zero_copy_param, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(zerocopy, "Transfer bulk video data directly to buffers");
 
 /* ------------------------------------------------------------------------
  * Driver initialization and cleanup
@@ -2385,15 +2389,26 @@ static int __init uvc_init(void)
 {
 	int result;
 
+	/* Completed video URBs are decoded here, one work item per stream. */
+	uvc_workqueue = alloc_workqueue("uvcvideo",
+					WQ_NON_REENTRANT | WQ_HIGHPRI, 0);
+	if (uvc_workqueue == NULL)
+		return -ENOMEM;
+
 	result = usb_register(&uvc_driver.driver);
-	if (result == 0)
-		printk(KERN_INFO DRIVER_DESC " (" DRIVER_VERSION ")\n");
-	return result;
+	if (result < 0) {
+		destroy_workqueue(uvc_workqueue);
+		return result;
+	}
+
+	printk(KERN_INFO DRIVER_DESC " (" DRIVER_VERSION ")\n");
+	return 0;
 }
 
 static void __exit uvc_cleanup(void)
 {
 	usb_deregister(&uvc_driver.driver);
+	destroy_workqueue(uvc_workqueue);
 }
 
 module_init(uvc_init);
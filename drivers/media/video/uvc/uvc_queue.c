@@ -76,6 +76,14 @@
  *    process waiting on the buffer might restart the dequeue operation
  *    immediately.
  *
+ * 3. Bulk URBs transfer directly into a buffer that is complete.
+ *
+ *    URBs are submitted ahead of the data they will carry, so a URB set up to
+ *    transfer into a buffer can still be in flight when the frame ends. The
+ *    buffer is then removed from the irq queue but kept in the
+ *    UVC_BUF_STATE_READY state until the last such URB has been processed
+ *    and uvc_queue_release_buffer() marks it as done.
+ *
  */
 
 void uvc_queue_init(struct uvc_video_queue *queue, enum v4l2_buf_type type,
@@ -604,6 +612,46 @@ void uvc_queue_cancel(struct uvc_video_queue *queue, int disconnect)
 	spin_unlock_irqrestore(&queue->irqlock, flags);
 }
 
+/*
+ * Return the buffer being filled, or NULL if the irq queue is empty.
+ */
+struct uvc_buffer *uvc_queue_get_current_buffer(struct uvc_video_queue *queue)
+{
+	struct uvc_buffer *buf = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->irqlock, flags);
+	if (!list_empty(&queue->irqqueue))
+		buf = list_first_entry(&queue->irqqueue, struct uvc_buffer,
+				       queue);
+	spin_unlock_irqrestore(&queue->irqlock, flags);
+
+	return buf;
+}
+
+/*
+ * Drop the reference held by a direct URB on a buffer, and mark the buffer as
+ * done if it has been completed while the URB was in flight.
+ */
+void uvc_queue_release_buffer(struct uvc_video_queue *queue,
+		struct uvc_buffer *buf)
+{
+	unsigned long flags;
+
+	if (--buf->pending)
+		return;
+
+	spin_lock_irqsave(&queue->irqlock, flags);
+	if (buf->state != UVC_BUF_STATE_READY) {
+		spin_unlock_irqrestore(&queue->irqlock, flags);
+		return;
+	}
+	buf->state = UVC_BUF_STATE_DONE;
+	spin_unlock_irqrestore(&queue->irqlock, flags);
+
+	wake_up(&buf->wait);
+}
+
 struct uvc_buffer *uvc_queue_next_buffer(struct uvc_video_queue *queue,
 		struct uvc_buffer *buf)
 {
@@ -620,7 +668,13 @@ struct uvc_buffer *uvc_queue_next_buffer(struct uvc_video_queue *queue,
 	spin_lock_irqsave(&queue->irqlock, flags);
 	list_del(&buf->queue);
 	buf->error = 0;
-	buf->state = UVC_BUF_STATE_DONE;
+	/* Direct URBs still in flight, uvc_queue_release_buffer() will mark
+	 * the buffer as done.
+	 */
+	if (buf->pending)
+		buf->state = UVC_BUF_STATE_READY;
+	else
+		buf->state = UVC_BUF_STATE_DONE;
 	if (!list_empty(&queue->irqqueue))
 		nextbuf = list_first_entry(&queue->irqqueue, struct uvc_buffer,
 					   queue);
@@ -628,7 +682,8 @@ struct uvc_buffer *uvc_queue_next_buffer(struct uvc_video_queue *queue,
 		nextbuf = NULL;
 	spin_unlock_irqrestore(&queue->irqlock, flags);
 
-	wake_up(&buf->wait);
+	if (!buf->pending)
+		wake_up(&buf->wait);
 	return nextbuf;
 }
 
@@ -12,10 +12,12 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/highmem.h>
 #include <linux/list.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/usb.h>
+#include <linux/usb/hcd.h>
 #include <linux/videodev2.h>
 #include <linux/vmalloc.h>
 #include <linux/wait.h>
@@ -390,7 +392,8 @@ int uvc_commit_video(struct uvc_streaming *stream,
  * payload if no other error code is appropriate.
  *
  * uvc_video_decode_data is called for every URB with URB data. It copies the
- * data to the video buffer.
+ * data to the video buffer, unless a direct bulk transfer already put it in
+ * place.
  *
  * uvc_video_decode_end is called with header data at the end of a bulk or
  * isochronous payload. It performs any additional header data processing and
@@ -512,11 +515,15 @@ static void uvc_video_decode_data(struct uvc_streaming *stream,
 	if (len <= 0)
 		return;
 
-	/* Copy the video data to the buffer. */
+	/* Copy the video data to the buffer. Direct bulk transfers that landed
+	 * past the end of the data (after a payload header or a short URB)
+	 * are moved down, possibly overlapping.
+	 */
 	maxlen = buf->buf.length - buf->buf.bytesused;
 	mem = queue->mem + buf->buf.m.offset + buf->buf.bytesused;
 	nbytes = min((unsigned int)len, maxlen);
-	memcpy(mem, data, nbytes);
+	if (mem != data)
+		memmove(mem, data, nbytes);
 	buf->buf.bytesused += nbytes;
 
 	/* Complete the current frame if the buffer size was exceeded. */
@@ -637,13 +644,20 @@ static void uvc_video_decode_isoc(struct urb *urb, struct uvc_streaming *stream,
 static void uvc_video_decode_bulk(struct urb *urb, struct uvc_streaming *stream,
 	struct uvc_buffer *buf)
 {
+	struct uvc_urb *uvc_urb = urb->context;
 	u8 *mem;
 	int len, ret;
 
 	if (urb->actual_length == 0)
 		return;
 
-	mem = urb->transfer_buffer;
+	if (uvc_urb->buf != NULL) {
+		mem = stream->queue.mem + uvc_urb->buf->buf.m.offset
+		    + uvc_urb->offset;
+		invalidate_kernel_vmap_range(mem, urb->actual_length);
+	} else {
+		mem = urb->transfer_buffer;
+	}
 	len = urb->actual_length;
 	stream->bulk.payload_size += len;
 
@@ -741,14 +755,147 @@ static void uvc_video_encode_bulk(struct urb *urb, struct uvc_streaming *stream,
 	urb->transfer_buffer_length = stream->urb_size - len;
 }
 
-static void uvc_video_complete(struct urb *urb)
+/*
+ * Set a bulk URB up for its next transfer.
+ *
+ * The URB transfers directly into the current video buffer, at the offset
+ * its data will have there if all URBs in flight are full and carry no
+ * payload header. URBs predicted to start a payload, that would overlap the
+ * previous direct transfer, overflow the buffer or break the alignment the
+ * host controller needs for scatter-gather use the bounce buffer instead.
+ *
+ * A wrong prediction only costs a copy: the data lands at or past the
+ * offset it belongs to, and uvc_video_decode_data() moves it down. The
+ * buffer stays allocated to the driver until the URB has been processed.
+ */
+static void uvc_video_prepare_urb(struct uvc_streaming *stream,
+	struct uvc_urb *uvc_urb)
 {
-	struct uvc_streaming *stream = urb->context;
 	struct uvc_video_queue *queue = &stream->queue;
-	struct uvc_buffer *buf = NULL;
+	struct urb *urb = uvc_urb->urb;
+	unsigned int i = uvc_urb - stream->uvc_urb;
+	unsigned int size = stream->urb_size;
+	unsigned int offset, payload, len, chunk, n;
+	struct uvc_buffer *buf;
+	u8 *mem;
+
+	buf = uvc_queue_get_current_buffer(queue);
+	if (buf == NULL || buf->state != UVC_BUF_STATE_ACTIVE)
+		goto bounce;
+
+	offset = buf->buf.bytesused + stream->bulk.inflight;
+	payload = stream->bulk.payload_size + stream->bulk.inflight;
+	if (payload == 0 || payload >= stream->bulk.max_payload_size ||
+	    offset + size > buf->buf.length || offset % stream->bulk.direct)
+		goto bounce;
+
+	if (stream->bulk.direct_buf != NULL &&
+	    (stream->bulk.direct_buf != buf ||
+	     offset < stream->bulk.direct_end))
+		goto bounce;
+
+	mem = queue->mem + buf->buf.m.offset + offset;
+	sg_init_table(uvc_urb->sg, DIV_ROUND_UP(size, PAGE_SIZE) + 1);
+	for (n = 0, len = 0; len < size; ++n, len += chunk) {
+		chunk = min_t(unsigned int, size - len,
+			      PAGE_SIZE - offset_in_page(mem + len));
+		sg_set_page(&uvc_urb->sg[n], vmalloc_to_page(mem + len),
+			    chunk, offset_in_page(mem + len));
+	}
+	sg_mark_end(&uvc_urb->sg[n - 1]);
+	flush_kernel_vmap_range(mem, size);
+
+	urb->transfer_buffer = NULL;
+	urb->transfer_flags &= ~URB_NO_TRANSFER_DMA_MAP;
+	urb->sg = uvc_urb->sg;
+	urb->num_sgs = n;
+
+	uvc_urb->buf = buf;
+	uvc_urb->offset = offset;
+	buf->pending++;
+	stream->bulk.ndirect++;
+	stream->bulk.direct_buf = buf;
+	stream->bulk.direct_end = offset + size;
+	return;
+
+bounce:
+	urb->transfer_buffer = stream->urb_buffer[i];
+	urb->transfer_dma = stream->urb_dma[i];
+	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	urb->sg = NULL;
+	urb->num_sgs = 0;
+}
+
+static void uvc_video_release_urb(struct uvc_streaming *stream,
+	struct uvc_urb *uvc_urb)
+{
+	if (uvc_urb->buf == NULL)
+		return;
+
+	uvc_queue_release_buffer(&stream->queue, uvc_urb->buf);
+	uvc_urb->buf = NULL;
+
+	if (--stream->bulk.ndirect == 0) {
+		stream->bulk.direct_buf = NULL;
+		stream->bulk.direct_end = 0;
+	}
+}
+
+/*
+ * Stream worker. Decodes completed URBs in completion order and resubmits
+ * them, keeping the payload copies out of interrupt context.
+ */
+static void uvc_video_work(struct work_struct *work)
+{
+	struct uvc_streaming *stream =
+		container_of(work, struct uvc_streaming, work);
+	struct uvc_urb *uvc_urb;
+	struct uvc_buffer *buf;
 	unsigned long flags;
 	int ret;
 
+	while (1) {
+		spin_lock_irqsave(&stream->urb_lock, flags);
+		if (list_empty(&stream->urb_done)) {
+			spin_unlock_irqrestore(&stream->urb_lock, flags);
+			break;
+		}
+		uvc_urb = list_first_entry(&stream->urb_done, struct uvc_urb,
+					   list);
+		list_del(&uvc_urb->list);
+		spin_unlock_irqrestore(&stream->urb_lock, flags);
+
+		stream->bulk.inflight -= uvc_urb->length;
+
+		buf = uvc_queue_get_current_buffer(&stream->queue);
+		stream->decode(uvc_urb->urb, stream, buf);
+		uvc_video_release_urb(stream, uvc_urb);
+
+		if (stream->bulk.direct)
+			uvc_video_prepare_urb(stream, uvc_urb);
+
+		uvc_urb->length = uvc_urb->urb->transfer_buffer_length;
+		stream->bulk.inflight += uvc_urb->length;
+
+		/* URBs are poisoned when the stream is stopped. */
+		ret = usb_submit_urb(uvc_urb->urb, GFP_KERNEL);
+		if (ret < 0) {
+			stream->bulk.inflight -= uvc_urb->length;
+			uvc_video_release_urb(stream, uvc_urb);
+			if (ret != -EPERM)
+				uvc_printk(KERN_ERR, "Failed to resubmit "
+					"video URB (%d).\n", ret);
+		}
+	}
+}
+
+static void uvc_video_complete(struct urb *urb)
+{
+	struct uvc_urb *uvc_urb = urb->context;
+	struct uvc_streaming *stream = uvc_urb->stream;
+	struct uvc_video_queue *queue = &stream->queue;
+	unsigned long flags;
+
 	switch (urb->status) {
 	case 0:
 		break;
@@ -767,18 +914,11 @@ static void uvc_video_complete(struct urb *urb)
 		return;
 	}
 
-	spin_lock_irqsave(&queue->irqlock, flags);
-	if (!list_empty(&queue->irqqueue))
-		buf = list_first_entry(&queue->irqqueue, struct uvc_buffer,
-				       queue);
-	spin_unlock_irqrestore(&queue->irqlock, flags);
-
-	stream->decode(urb, stream, buf);
+	spin_lock_irqsave(&stream->urb_lock, flags);
+	list_add_tail(&uvc_urb->list, &stream->urb_done);
+	spin_unlock_irqrestore(&stream->urb_lock, flags);
 
-	if ((ret = usb_submit_urb(urb, GFP_ATOMIC)) < 0) {
-		uvc_printk(KERN_ERR, "Failed to resubmit video URB (%d).\n",
-			ret);
-	}
+	queue_work(uvc_workqueue, &stream->work);
 }
 
 /*
@@ -861,16 +1001,32 @@ static void uvc_uninit_video(struct uvc_streaming *stream, int free_buffers)
 	struct urb *urb;
 	unsigned int i;
 
+	/* Poison the URBs so that the worker can't resubmit them, then wait
+	 * for it and drop the completed URBs it hasn't processed.
+	 */
+	for (i = 0; i < UVC_URBS; ++i) {
+		if (stream->urb[i] != NULL)
+			usb_poison_urb(stream->urb[i]);
+	}
+
+	cancel_work_sync(&stream->work);
+	INIT_LIST_HEAD(&stream->urb_done);
+
 	for (i = 0; i < UVC_URBS; ++i) {
 		urb = stream->urb[i];
 		if (urb == NULL)
 			continue;
 
-		usb_kill_urb(urb);
+		uvc_video_release_urb(stream, &stream->uvc_urb[i]);
+		kfree(stream->uvc_urb[i].sg);
+		stream->uvc_urb[i].sg = NULL;
 		usb_free_urb(urb);
 		stream->urb[i] = NULL;
 	}
 
+	stream->bulk.direct = 0;
+	stream->bulk.inflight = 0;
+
 	if (free_buffers)
 		uvc_free_urb_buffers(stream);
 }
@@ -905,7 +1061,7 @@ static int uvc_init_video_isoc(struct uvc_streaming *stream,
 		}
 
 		urb->dev = stream->dev->udev;
-		urb->context = stream;
+		urb->context = &stream->uvc_urb[i];
 		urb->pipe = usb_rcvisocpipe(stream->dev->udev,
 				ep->desc.bEndpointAddress);
 		urb->transfer_flags = URB_ISO_ASAP | URB_NO_TRANSFER_DMA_MAP;
@@ -922,6 +1078,7 @@ static int uvc_init_video_isoc(struct uvc_streaming *stream,
 		}
 
 		stream->urb[i] = urb;
+		stream->uvc_urb[i].urb = urb;
 	}
 
 	return 0;
@@ -959,6 +1116,23 @@ static int uvc_init_video_bulk(struct uvc_streaming *stream,
 	if (stream->type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
 		size = 0;
 
+	/* Transfer directly into the video buffers when the host controller
+	 * supports scatter-gather. EHCI splits transfers at scatterlist
+	 * boundaries, which must then fall on packet boundaries; xHCI has no
+	 * such constraint.
+	 */
+	if (uvc_zero_copy_param &&
+	    stream->type == V4L2_BUF_TYPE_VIDEO_CAPTURE &&
+	    stream->dev->udev->bus->sg_tablesize >=
+	    DIV_ROUND_UP(size, PAGE_SIZE) + 1) {
+		struct usb_hcd *hcd = bus_to_hcd(stream->dev->udev->bus);
+
+		if ((hcd->driver->flags & HCD_MASK) == HCD_USB3)
+			stream->bulk.direct = 1;
+		else if (PAGE_SIZE % psize == 0)
+			stream->bulk.direct = psize;
+	}
+
 	for (i = 0; i < UVC_URBS; ++i) {
 		urb = usb_alloc_urb(0, gfp_flags);
 		if (urb == NULL) {
@@ -968,13 +1142,28 @@ static int uvc_init_video_bulk(struct uvc_streaming *stream,
 
 		usb_fill_bulk_urb(urb, stream->dev->udev, pipe,
 			stream->urb_buffer[i], size, uvc_video_complete,
-			stream);
+			&stream->uvc_urb[i]);
 		urb->transfer_flags = URB_NO_TRANSFER_DMA_MAP;
 		urb->transfer_dma = stream->urb_dma[i];
 
 		stream->urb[i] = urb;
+		stream->uvc_urb[i].urb = urb;
+
+		if (!stream->bulk.direct)
+			continue;
+
+		stream->uvc_urb[i].sg = kmalloc((DIV_ROUND_UP(size, PAGE_SIZE)
+			+ 1) * sizeof(struct scatterlist), gfp_flags);
+		if (stream->uvc_urb[i].sg == NULL) {
+			uvc_uninit_video(stream, 1);
+			return -ENOMEM;
+		}
 	}
 
+	if (stream->bulk.direct)
+		uvc_trace(UVC_TRACE_VIDEO, "Transferring directly to video "
+			"buffers (%u bytes alignment).\n", stream->bulk.direct);
+
 	return 0;
 }
 
@@ -985,6 +1174,7 @@ static int uvc_init_video(struct uvc_streaming *stream, gfp_t gfp_flags)
 {
 	struct usb_interface *intf = stream->intf;
 	struct usb_host_endpoint *ep;
+	struct urb *urb;
 	unsigned int i;
 	int ret;
 
@@ -993,6 +1183,8 @@ static int uvc_init_video(struct uvc_streaming *stream, gfp_t gfp_flags)
 	stream->bulk.header_size = 0;
 	stream->bulk.skip_payload = 0;
 	stream->bulk.payload_size = 0;
+	stream->bulk.direct = 0;
+	stream->bulk.inflight = 0;
 
 	if (intf->num_altsetting > 1) {
 		struct usb_host_endpoint *best_ep = NULL;
@@ -1060,6 +1252,15 @@ static int uvc_init_video(struct uvc_streaming *stream, gfp_t gfp_flags)
 	if (ret < 0)
 		return ret;
 
+	/* Account for all URBs before submitting any, the worker might start
+	 * processing completed URBs right away.
+	 */
+	for (i = 0; i < UVC_URBS; ++i) {
+		urb = stream->urb[i];
+		stream->uvc_urb[i].length = urb->transfer_buffer_length;
+		stream->bulk.inflight += urb->transfer_buffer_length;
+	}
+
 	/* Submit the URBs. */
 	for (i = 0; i < UVC_URBS; ++i) {
 		ret = usb_submit_urb(stream->urb[i], gfp_flags);
@@ -1155,6 +1356,12 @@ int uvc_video_init(struct uvc_streaming *stream)
 
 	atomic_set(&stream->active, 0);
 
+	for (i = 0; i < UVC_URBS; ++i)
+		stream->uvc_urb[i].stream = stream;
+	INIT_LIST_HEAD(&stream->urb_done);
+	spin_lock_init(&stream->urb_lock);
+	INIT_WORK(&stream->work, uvc_video_work);
+
 	/* Initialize the video buffers queue. */
 	uvc_queue_init(&stream->queue, stream->type, !uvc_no_drop_param);
 
@@ -98,9 +98,11 @@ struct uvc_xu_control {
 #ifdef __KERNEL__
 
 #include <linux/poll.h>
+#include <linux/scatterlist.h>
 #include <linux/usb.h>
 #include <linux/usb/video.h>
 #include <linux/uvcvideo.h>
+#include <linux/workqueue.h>
 #include <media/media-device.h>
 #include <media/v4l2-device.h>
 
@@ -414,6 +416,11 @@ struct uvc_buffer {
 	wait_queue_head_t wait;
 	enum uvc_buffer_state state;
 	unsigned int error;
+
+	/* Direct bulk URBs still writing to the buffer. Touched by the stream
+	 * worker only.
+	 */
+	unsigned int pending;
 };
 
 #define UVC_QUEUE_STREAMING		(1 << 0)
@@ -437,6 +444,23 @@ struct uvc_video_queue {
 	struct list_head irqqueue;
 };
 
+/*
+ * Per-URB context. Completed URBs are queued on the stream done list and
+ * decoded by the stream worker. Bulk URBs can transfer directly into a video
+ * buffer through a scatter-gather list, buf and offset then tell where the
+ * data landed.
+ */
+struct uvc_urb {
+	struct urb *urb;
+	struct uvc_streaming *stream;
+	struct list_head list;
+
+	struct uvc_buffer *buf;
+	unsigned int offset;
+	unsigned int length;
+	struct scatterlist *sg;
+};
+
 struct uvc_video_chain {
 	struct uvc_device *dev;
 	struct list_head list;
@@ -485,6 +509,16 @@ struct uvc_streaming {
 		int skip_payload;
 		__u32 payload_size;
 		__u32 max_payload_size;
+
+		/* Zero-copy state: the alignment direct transfers need (0
+		 * when disabled), bytes in flight, and the buffer and end
+		 * offset of the last direct transfer.
+		 */
+		unsigned int direct;
+		unsigned int inflight;
+		unsigned int ndirect;
+		struct uvc_buffer *direct_buf;
+		unsigned int direct_end;
 	} bulk;
 
 	struct urb *urb[UVC_URBS];
@@ -492,6 +526,11 @@ struct uvc_streaming {
 	dma_addr_t urb_dma[UVC_URBS];
 	unsigned int urb_size;
 
+	struct uvc_urb uvc_urb[UVC_URBS];
+	struct list_head urb_done;
+	spinlock_t urb_lock;		/* protects urb_done */
+	struct work_struct work;
+
 	__u32 sequence;
 	__u8 last_fid;
 };
@@ -573,6 +612,8 @@ extern unsigned int uvc_clock_param;
 extern unsigned int uvc_no_drop_param;
 extern unsigned int uvc_trace_param;
 extern unsigned int uvc_timeout_param;
+extern unsigned int uvc_zero_copy_param;
+extern struct workqueue_struct *uvc_workqueue;
 
 #define uvc_trace(flag, msg...) \
 	do { \
@@ -612,6 +653,10 @@ extern int uvc_dequeue_buffer(struct uvc_video_queue *queue,
 		struct v4l2_buffer *v4l2_buf, int nonblocking);
 extern int uvc_queue_enable(struct uvc_video_queue *queue, int enable);
 extern void uvc_queue_cancel(struct uvc_video_queue *queue, int disconnect);
+extern struct uvc_buffer *uvc_queue_get_current_buffer(
+		struct uvc_video_queue *queue);
+extern void uvc_queue_release_buffer(struct uvc_video_queue *queue,
+		struct uvc_buffer *buf);
 extern struct uvc_buffer *uvc_queue_next_buffer(struct uvc_video_queue *queue,
 		struct uvc_buffer *buf);
 extern int uvc_queue_mmap(struct uvc_video_queue *queue,
@@ -25,6 +25,8 @@
 #include <linux/init.h>
 #include <linux/kmod.h>
 #include <linux/slab.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 
@@ -291,6 +293,76 @@ static ssize_t v4l2_write(struct file *filp, const char __user *buf,
 	return ret;
 }
 
+static ssize_t v4l2_splice_read(struct file *filp, loff_t *ppos,
+		struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+	struct video_device *vdev = video_devdata(filp);
+	int ret = -ENODEV;
+
+	/* Goes through v4l2_read(), which takes the lock */
+	if (!vdev->fops->splice_read)
+		return default_file_splice_read(filp, ppos, pipe, len, flags);
+	if (vdev->lock && mutex_lock_interruptible(vdev->lock))
+		return -ERESTARTSYS;
+	if (video_is_registered(vdev))
+		ret = vdev->fops->splice_read(filp, ppos, pipe, len, flags);
+	if (vdev->lock)
+		mutex_unlock(vdev->lock);
+	return ret;
+}
+
+static int v4l2_pipe_to_write(struct pipe_inode_info *pipe,
+		struct pipe_buffer *buf, struct splice_desc *sd)
+{
+	struct video_device *vdev = video_devdata(sd->u.file);
+	mm_segment_t old_fs;
+	loff_t pos = sd->pos;
+	void *data;
+	int ret;
+
+	ret = buf->ops->confirm(pipe, buf);
+	if (ret)
+		return ret;
+
+	data = buf->ops->map(pipe, buf, 0);
+	old_fs = get_fs();
+	set_fs(get_ds());
+	ret = vdev->fops->write(sd->u.file,
+			(const char __user __force *)data + buf->offset,
+			sd->len, &pos);
+	set_fs(old_fs);
+	buf->ops->unmap(pipe, buf, data);
+
+	return ret;
+}
+
+static ssize_t v4l2_splice_write(struct pipe_inode_info *pipe,
+		struct file *filp, loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct video_device *vdev = video_devdata(filp);
+	int ret = -ENODEV;
+
+	if (!vdev->fops->splice_write && !vdev->fops->write)
+		return -EINVAL;
+	/*
+	 * The lock is taken before the pipe is locked, like splice_read
+	 * does, also when falling back to the driver's write().
+	 */
+	if (vdev->lock && mutex_lock_interruptible(vdev->lock))
+		return -ERESTARTSYS;
+	if (!video_is_registered(vdev))
+		goto out;
+	if (vdev->fops->splice_write)
+		ret = vdev->fops->splice_write(pipe, filp, ppos, len, flags);
+	else
+		ret = splice_from_pipe(pipe, filp, ppos, len, flags,
+				       v4l2_pipe_to_write);
+out:
+	if (vdev->lock)
+		mutex_unlock(vdev->lock);
+	return ret;
+}
+
 static unsigned int v4l2_poll(struct file *filp, struct poll_table_struct *poll)
 {
 	struct video_device *vdev = video_devdata(filp);
@@ -451,6 +523,8 @@ static const struct file_operations v4l2_fops = {
 	.owner = THIS_MODULE,
 	.read = v4l2_read,
 	.write = v4l2_write,
+	.splice_read = v4l2_splice_read,
+	.splice_write = v4l2_splice_write,
 	.open = v4l2_open,
 	.get_unmapped_area = v4l2_get_unmapped_area,
 	.mmap = v4l2_mmap,
@@ -38,6 +38,8 @@ module_param(debug, bool, 0644);
 #define TRANS_QUEUED		(1 << 0)
 /* Instance is currently running in hardware */
 #define TRANS_RUNNING		(1 << 1)
+/* Instance is being released and may not be queued again */
+#define TRANS_ABORT		(1 << 2)
 
 
 /* Offset base for buffers on the destination queue - used to distinguish
@@ -48,15 +50,19 @@ module_param(debug, bool, 0644);
 
 /**
  * struct v4l2_m2m_dev - per-device context
- * @curr_ctx:		currently running instance
- * @job_queue:		instances queued to run
- * @job_spinlock:	protects job_queue
+ * @job_queue:		instances queued to run, oldest first
+ * @run_list:		instances currently running, oldest first
+ * @num_running:	number of instances on @run_list
+ * @slots:		how many instances may run at the same time
+ * @job_spinlock:	protects all of the above and the job_flags of
+ *			every instance
  * @m2m_ops:		driver callbacks
  */
 struct v4l2_m2m_dev {
-	struct v4l2_m2m_ctx	*curr_ctx;
-
 	struct list_head	job_queue;
+	struct list_head	run_list;
+	unsigned int		num_running;
+	unsigned int		slots;
 	spinlock_t		job_spinlock;
 
 	struct v4l2_m2m_ops	*m2m_ops;
@@ -136,6 +142,10 @@ EXPORT_SYMBOL_GPL(v4l2_m2m_buf_remove);
 /**
  * v4l2_m2m_get_curr_priv() - return driver private data for the currently
  * running instance or NULL if no instance is running
+ *
+ * On devices with more than one job slot this is the instance that has been
+ * running the longest. Such drivers should rather keep track of the instance
+ * behind each of their jobs themselves.
  */
 void *v4l2_m2m_get_curr_priv(struct v4l2_m2m_dev *m2m_dev)
 {
@@ -143,8 +153,9 @@ void *v4l2_m2m_get_curr_priv(struct v4l2_m2m_dev *m2m_dev)
 	void *ret = NULL;
 
 	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
-	if (m2m_dev->curr_ctx)
-		ret = m2m_dev->curr_ctx->priv;
+	if (!list_empty(&m2m_dev->run_list))
+		ret = list_first_entry(&m2m_dev->run_list,
+				       struct v4l2_m2m_ctx, queue)->priv;
 	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 
 	return ret;
@@ -152,58 +163,47 @@ void *v4l2_m2m_get_curr_priv(struct v4l2_m2m_dev *m2m_dev)
 EXPORT_SYMBOL(v4l2_m2m_get_curr_priv);
 
 /**
- * v4l2_m2m_try_run() - select next job to perform and run it if possible
+ * v4l2_m2m_try_run() - select next jobs to perform and run them if possible
  *
- * Get next transaction (if present) from the waiting jobs list and run it.
+ * Start transactions from the waiting jobs list until either all job slots
+ * are busy or no job is left. An instance has at most one job queued or
+ * running and goes to the back of the list when it is queued again, so
+ * instances take turns in the order they became ready.
  */
 static void v4l2_m2m_try_run(struct v4l2_m2m_dev *m2m_dev)
 {
+	struct v4l2_m2m_ctx *m2m_ctx;
 	unsigned long flags;
 
 	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
-	if (NULL != m2m_dev->curr_ctx) {
-		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
-		dprintk("Another instance is running, won't run now\n");
-		return;
-	}
+	while (m2m_dev->num_running < m2m_dev->slots) {
+		if (list_empty(&m2m_dev->job_queue)) {
+			dprintk("No job pending\n");
+			break;
+		}
 
-	if (list_empty(&m2m_dev->job_queue)) {
+		m2m_ctx = list_first_entry(&m2m_dev->job_queue,
+					   struct v4l2_m2m_ctx, queue);
+		list_move_tail(&m2m_ctx->queue, &m2m_dev->run_list);
+		m2m_ctx->job_flags |= TRANS_RUNNING;
+		m2m_dev->num_running++;
 		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
-		dprintk("No job pending\n");
-		return;
-	}
 
-	m2m_dev->curr_ctx = list_entry(m2m_dev->job_queue.next,
-				   struct v4l2_m2m_ctx, queue);
-	m2m_dev->curr_ctx->job_flags |= TRANS_RUNNING;
-	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
+		m2m_dev->m2m_ops->device_run(m2m_ctx->priv);
 
-	m2m_dev->m2m_ops->device_run(m2m_dev->curr_ctx->priv);
+		spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
+	}
+	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 }
 
-/**
- * v4l2_m2m_try_schedule() - check whether an instance is ready to be added to
- * the pending job queue and add it if so.
- * @m2m_ctx:	m2m context assigned to the instance to be checked
- *
- * There are three basic requirements an instance has to meet to be able to run:
- * 1) at least one source buffer has to be queued,
- * 2) at least one destination buffer has to be queued,
- * 3) streaming has to be on.
- *
- * There may also be additional, custom requirements. In such case the driver
- * should supply a custom callback (job_ready in v4l2_m2m_ops) that should
- * return 1 if the instance is ready.
- * An example of the above could be an instance that requires more than one
- * src/dst buffer per transaction.
+/*
+ * Queue @m2m_ctx for the device if it has a job ready. Must be called with
+ * job_spinlock held.
  */
-static void v4l2_m2m_try_schedule(struct v4l2_m2m_ctx *m2m_ctx)
+static void __v4l2_m2m_try_queue(struct v4l2_m2m_dev *m2m_dev,
+				 struct v4l2_m2m_ctx *m2m_ctx)
 {
-	struct v4l2_m2m_dev *m2m_dev;
-	unsigned long flags_job, flags;
-
-	m2m_dev = m2m_ctx->m2m_dev;
-	dprintk("Trying to schedule a job for m2m_ctx: %p\n", m2m_ctx);
+	unsigned long flags;
 
 	if (!m2m_ctx->out_q_ctx.q.streaming
 	    || !m2m_ctx->cap_q_ctx.q.streaming) {
@@ -211,23 +211,19 @@ static void v4l2_m2m_try_schedule(struct v4l2_m2m_ctx *m2m_ctx)
 		return;
 	}
 
-	spin_lock_irqsave(&m2m_dev->job_spinlock, flags_job);
-	if (m2m_ctx->job_flags & TRANS_QUEUED) {
-		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags_job);
-		dprintk("On job queue already\n");
+	if (m2m_ctx->job_flags & (TRANS_QUEUED | TRANS_ABORT)) {
+		dprintk("On job queue already or being released\n");
 		return;
 	}
 
 	spin_lock_irqsave(&m2m_ctx->out_q_ctx.rdy_spinlock, flags);
 	if (list_empty(&m2m_ctx->out_q_ctx.rdy_queue)) {
 		spin_unlock_irqrestore(&m2m_ctx->out_q_ctx.rdy_spinlock, flags);
-		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags_job);
 		dprintk("No input buffers available\n");
 		return;
 	}
 	if (list_empty(&m2m_ctx->cap_q_ctx.rdy_queue)) {
 		spin_unlock_irqrestore(&m2m_ctx->out_q_ctx.rdy_spinlock, flags);
-		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags_job);
 		dprintk("No output buffers available\n");
 		return;
 	}
@@ -235,15 +231,41 @@ static void v4l2_m2m_try_schedule(struct v4l2_m2m_ctx *m2m_ctx)
 
 	if (m2m_dev->m2m_ops->job_ready
 		&& (!m2m_dev->m2m_ops->job_ready(m2m_ctx->priv))) {
-		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags_job);
 		dprintk("Driver not ready\n");
 		return;
 	}
 
 	list_add_tail(&m2m_ctx->queue, &m2m_dev->job_queue);
 	m2m_ctx->job_flags |= TRANS_QUEUED;
+}
 
-	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags_job);
+/**
+ * v4l2_m2m_try_schedule() - check whether an instance is ready to be added to
+ * the pending job queue and add it if so.
+ * @m2m_ctx:	m2m context assigned to the instance to be checked
+ *
+ * There are three basic requirements an instance has to meet to be able to run:
+ * 1) at least one source buffer has to be queued,
+ * 2) at least one destination buffer has to be queued,
+ * 3) streaming has to be on.
+ *
+ * There may also be additional, custom requirements. In such case the driver
+ * should supply a custom callback (job_ready in v4l2_m2m_ops) that should
+ * return 1 if the instance is ready.
+ * An example of the above could be an instance that requires more than one
+ * src/dst buffer per transaction.
+ */
+static void v4l2_m2m_try_schedule(struct v4l2_m2m_ctx *m2m_ctx)
+{
+	struct v4l2_m2m_dev *m2m_dev;
+	unsigned long flags;
+
+	m2m_dev = m2m_ctx->m2m_dev;
+	dprintk("Trying to schedule a job for m2m_ctx: %p\n", m2m_ctx);
+
+	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
+	__v4l2_m2m_try_queue(m2m_dev, m2m_ctx);
+	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 
 	v4l2_m2m_try_run(m2m_dev);
 }
@@ -266,23 +288,27 @@ void v4l2_m2m_job_finish(struct v4l2_m2m_dev *m2m_dev,
 	unsigned long flags;
 
 	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
-	if (!m2m_dev->curr_ctx || m2m_dev->curr_ctx != m2m_ctx) {
+	if (!(m2m_ctx->job_flags & TRANS_RUNNING)) {
 		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 		dprintk("Called by an instance not currently running\n");
 		return;
 	}
 
-	list_del(&m2m_dev->curr_ctx->queue);
-	m2m_dev->curr_ctx->job_flags &= ~(TRANS_QUEUED | TRANS_RUNNING);
-	wake_up(&m2m_dev->curr_ctx->finished);
-	m2m_dev->curr_ctx = NULL;
-
-	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
+	list_del(&m2m_ctx->queue);
+	m2m_ctx->job_flags &= ~(TRANS_QUEUED | TRANS_RUNNING);
+	m2m_dev->num_running--;
 
 	/* This instance might have more buffers ready, but since we do not
 	 * allow more than one job on the job_queue per instance, each has
-	 * to be scheduled separately after the previous one finishes. */
-	v4l2_m2m_try_schedule(m2m_ctx);
+	 * to be scheduled separately after the previous one finishes. It
+	 * goes behind the instances that are already waiting.
+	 * The instance may be freed as soon as it is woken up, so this is
+	 * the last time it is touched. */
+	__v4l2_m2m_try_queue(m2m_dev, m2m_ctx);
+	wake_up(&m2m_ctx->finished);
+
+	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
+
 	v4l2_m2m_try_run(m2m_dev);
 }
 EXPORT_SYMBOL(v4l2_m2m_job_finish);
@@ -502,15 +528,39 @@ struct v4l2_m2m_dev *v4l2_m2m_init(struct v4l2_m2m_ops *m2m_ops)
 	if (!m2m_dev)
 		return ERR_PTR(-ENOMEM);
 
-	m2m_dev->curr_ctx = NULL;
 	m2m_dev->m2m_ops = m2m_ops;
+	m2m_dev->slots = 1;
 	INIT_LIST_HEAD(&m2m_dev->job_queue);
+	INIT_LIST_HEAD(&m2m_dev->run_list);
 	spin_lock_init(&m2m_dev->job_spinlock);
 
 	return m2m_dev;
 }
 EXPORT_SYMBOL_GPL(v4l2_m2m_init);
 
+/**
+ * v4l2_m2m_set_slots() - set how many jobs may run at the same time
+ * @slots:	number of jobs, at least 1
+ *
+ * By default a device runs one job at a time. Devices with several
+ * processing units, or drivers that do the work on the cpu, can run jobs
+ * of different instances concurrently. device_run() is then called again
+ * before earlier jobs have finished, and the driver has to tell the jobs
+ * apart by the instance passed to it. An instance never has more than one
+ * job running.
+ */
+void v4l2_m2m_set_slots(struct v4l2_m2m_dev *m2m_dev, unsigned int slots)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
+	m2m_dev->slots = max(slots, 1U);
+	spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
+
+	v4l2_m2m_try_run(m2m_dev);
+}
+EXPORT_SYMBOL_GPL(v4l2_m2m_set_slots);
+
 /**
  * v4l2_m2m_release() - cleans up and frees a m2m_dev structure
  *
@@ -582,11 +632,15 @@ void v4l2_m2m_ctx_release(struct v4l2_m2m_ctx *m2m_ctx)
 	m2m_dev = m2m_ctx->m2m_dev;
 
 	spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
+	m2m_ctx->job_flags |= TRANS_ABORT;
 	if (m2m_ctx->job_flags & TRANS_RUNNING) {
 		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 		m2m_dev->m2m_ops->job_abort(m2m_ctx->priv);
 		dprintk("m2m_ctx %p running, will wait to complete", m2m_ctx);
 		wait_event(m2m_ctx->finished, !(m2m_ctx->job_flags & TRANS_RUNNING));
+		/* v4l2_m2m_job_finish() wakes us up with the lock held */
+		spin_lock_irqsave(&m2m_dev->job_spinlock, flags);
+		spin_unlock_irqrestore(&m2m_dev->job_spinlock, flags);
 	} else if (m2m_ctx->job_flags & TRANS_QUEUED) {
 		list_del(&m2m_ctx->queue);
 		m2m_ctx->job_flags &= ~(TRANS_QUEUED | TRANS_RUNNING);
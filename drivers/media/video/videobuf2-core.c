@@ -11,6 +11,7 @@
  * the Free Software Foundation.
  */
 
+#include <linux/dma-buf.h>
 #include <linux/err.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -18,6 +19,11 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/kref.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include <media/videobuf2-core.h>
 
@@ -106,6 +112,35 @@ static void __vb2_buf_userptr_put(struct vb2_buffer *vb)
 	}
 }
 
+/**
+ * __vb2_plane_dmabuf_put() - release the dma_buf attached to a DMABUF plane
+ */
+static void __vb2_plane_dmabuf_put(struct vb2_queue *q, struct vb2_plane *p)
+{
+	if (!p->mem_priv)
+		return;
+
+	if (p->dbuf_mapped)
+		call_memop(q, 0, unmap_dmabuf, p->mem_priv);
+
+	call_memop(q, 0, detach_dmabuf, p->mem_priv);
+	dma_buf_put(p->dbuf);
+	memset(p, 0, sizeof(*p));
+}
+
+/**
+ * __vb2_buf_dmabuf_put() - release shared memory associated with
+ * a DMABUF buffer
+ */
+static void __vb2_buf_dmabuf_put(struct vb2_buffer *vb)
+{
+	struct vb2_queue *q = vb->vb2_queue;
+	unsigned int plane;
+
+	for (plane = 0; plane < vb->num_planes; ++plane)
+		__vb2_plane_dmabuf_put(q, &vb->planes[plane]);
+}
+
 /**
  * __setup_offsets() - setup unique offsets ("cookies") for every plane in
  * every buffer on the queue
@@ -217,9 +252,11 @@ static void __vb2_free_mem(struct vb2_queue *q)
 		if (!vb)
 			continue;
 
-		/* Free MMAP buffers or release USERPTR buffers */
+		/* Free MMAP buffers or release USERPTR and DMABUF buffers */
 		if (q->memory == V4L2_MEMORY_MMAP)
 			__vb2_buf_mem_free(vb);
+		else if (q->memory == V4L2_MEMORY_DMABUF)
+			__vb2_buf_dmabuf_put(vb);
 		else
 			__vb2_buf_userptr_put(vb);
 	}
@@ -314,6 +351,8 @@ static int __fill_v4l2_buffer(struct vb2_buffer *vb, struct v4l2_buffer *b)
 			b->m.offset = vb->v4l2_planes[0].m.mem_offset;
 		else if (q->memory == V4L2_MEMORY_USERPTR)
 			b->m.userptr = vb->v4l2_planes[0].m.userptr;
+		else if (q->memory == V4L2_MEMORY_DMABUF)
+			b->m.fd = vb->v4l2_planes[0].m.fd;
 	}
 
 	/*
@@ -388,6 +427,20 @@ static int __verify_userptr_ops(struct vb2_queue *q)
 	return 0;
 }
 
+/**
+ * __verify_dmabuf_ops() - verify that all memory operations required for
+ * DMABUF queue type have been provided
+ */
+static int __verify_dmabuf_ops(struct vb2_queue *q)
+{
+	if (!(q->io_modes & VB2_DMABUF) || !q->mem_ops->attach_dmabuf ||
+	    !q->mem_ops->detach_dmabuf || !q->mem_ops->map_dmabuf ||
+	    !q->mem_ops->unmap_dmabuf)
+		return -EINVAL;
+
+	return 0;
+}
+
 /**
  * __verify_mmap_ops() - verify that all memory operations required for
  * MMAP queue type have been provided
@@ -463,7 +516,8 @@ int vb2_reqbufs(struct vb2_queue *q, struct v4l2_requestbuffers *req)
 	}
 
 	if (req->memory != V4L2_MEMORY_MMAP
-			&& req->memory != V4L2_MEMORY_USERPTR) {
+			&& req->memory != V4L2_MEMORY_USERPTR
+			&& req->memory != V4L2_MEMORY_DMABUF) {
 		dprintk(1, "reqbufs: unsupported memory type\n");
 		return -EINVAL;
 	}
@@ -492,6 +546,11 @@ int vb2_reqbufs(struct vb2_queue *q, struct v4l2_requestbuffers *req)
 		return -EINVAL;
 	}
 
+	if (req->memory == V4L2_MEMORY_DMABUF && __verify_dmabuf_ops(q)) {
+		dprintk(1, "reqbufs: DMABUF for current setup unsupported\n");
+		return -EINVAL;
+	}
+
 	if (req->count == 0 || q->num_buffers != 0 || q->memory != req->memory) {
 		/*
 		 * We already have buffers allocated, so first check if they
@@ -695,6 +754,14 @@ static int __fill_vb2_buffer(struct vb2_buffer *vb, struct v4l2_buffer *b,
 					b->m.planes[plane].length;
 			}
 		}
+		if (b->memory == V4L2_MEMORY_DMABUF) {
+			for (plane = 0; plane < vb->num_planes; ++plane) {
+				v4l2_planes[plane].m.fd =
+					b->m.planes[plane].m.fd;
+				v4l2_planes[plane].length =
+					b->m.planes[plane].length;
+			}
+		}
 	} else {
 		/*
 		 * Single-planar buffers do not use planes array,
@@ -709,6 +776,11 @@ static int __fill_vb2_buffer(struct vb2_buffer *vb, struct v4l2_buffer *b,
 			v4l2_planes[0].m.userptr = b->m.userptr;
 			v4l2_planes[0].length = b->length;
 		}
+
+		if (b->memory == V4L2_MEMORY_DMABUF) {
+			v4l2_planes[0].m.fd = b->m.fd;
+			v4l2_planes[0].length = b->length;
+		}
 	}
 
 	vb->v4l2_buf.field = b->field;
@@ -758,10 +830,10 @@ static int __qbuf_userptr(struct vb2_buffer *vb, struct v4l2_buffer *b)
 							planes[plane].m.userptr,
 							planes[plane].length,
 							write);
-			if (IS_ERR(mem_priv)) {
+			if (IS_ERR_OR_NULL(mem_priv)) {
 				dprintk(1, "qbuf: failed acquiring userspace "
 						"memory for plane %d\n", plane);
-				ret = PTR_ERR(mem_priv);
+				ret = mem_priv ? PTR_ERR(mem_priv) : -EINVAL;
 				goto err;
 			}
 			vb->planes[plane].mem_priv = mem_priv;
@@ -787,16 +859,135 @@ static int __qbuf_userptr(struct vb2_buffer *vb, struct v4l2_buffer *b)
 
 	return 0;
 err:
-	/* In case of errors, release planes that were already acquired */
+	/*
+	 * In case of errors, release planes that were already acquired and
+	 * forget their addresses, so that they are not skipped as verified
+	 * the next time.
+	 */
+	if (plane < vb->num_planes) {
+		vb->v4l2_planes[plane].m.userptr = 0;
+		vb->v4l2_planes[plane].length = 0;
+	}
 	for (; plane > 0; --plane) {
-		call_memop(q, plane, put_userptr,
-				vb->planes[plane - 1].mem_priv);
+		if (vb->planes[plane - 1].mem_priv)
+			call_memop(q, plane, put_userptr,
+					vb->planes[plane - 1].mem_priv);
 		vb->planes[plane - 1].mem_priv = NULL;
+		vb->v4l2_planes[plane - 1].m.userptr = 0;
+		vb->v4l2_planes[plane - 1].length = 0;
 	}
 
 	return ret;
 }
 
+/**
+ * __qbuf_dmabuf() - handle qbuf of a DMABUF buffer
+ *
+ * The dma_buf stays attached and mapped while the buffer keeps being queued
+ * with the same file, so steady state streaming costs one fd lookup per plane.
+ */
+static int __qbuf_dmabuf(struct vb2_buffer *vb, struct v4l2_buffer *b)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct vb2_queue *q = vb->vb2_queue;
+	void *mem_priv;
+	unsigned int plane;
+	int ret;
+	int write = !V4L2_TYPE_IS_OUTPUT(q->type);
+	bool reacquired = false;
+
+	/* Verify and copy relevant information provided by the userspace */
+	ret = __fill_vb2_buffer(vb, b, planes);
+	if (ret)
+		return ret;
+
+	for (plane = 0; plane < vb->num_planes; ++plane) {
+		struct dma_buf *dbuf = dma_buf_get(planes[plane].m.fd);
+
+		if (IS_ERR(dbuf)) {
+			dprintk(1, "qbuf: invalid dmabuf fd for plane %d\n",
+				plane);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		/* Use the full buffer if userspace did not give a length */
+		if (planes[plane].length == 0)
+			planes[plane].length = dbuf->size;
+
+		if (planes[plane].length > dbuf->size) {
+			dprintk(1, "qbuf: dmabuf for plane %d too small\n",
+				plane);
+			dma_buf_put(dbuf);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		/* Skip the plane if the same buffer is already attached */
+		if (dbuf == vb->planes[plane].dbuf &&
+		    vb->v4l2_planes[plane].length == planes[plane].length) {
+			dma_buf_put(dbuf);
+			continue;
+		}
+
+		dprintk(3, "qbuf: buffer for plane %d changed\n", plane);
+
+		reacquired = true;
+		__vb2_plane_dmabuf_put(q, &vb->planes[plane]);
+
+		mem_priv = call_memop(q, plane, attach_dmabuf,
+				      q->alloc_ctx[plane], dbuf,
+				      planes[plane].length, write);
+		if (IS_ERR_OR_NULL(mem_priv)) {
+			dprintk(1, "qbuf: failed attaching dmabuf for "
+				"plane %d\n", plane);
+			ret = mem_priv ? PTR_ERR(mem_priv) : -EINVAL;
+			dma_buf_put(dbuf);
+			goto err;
+		}
+
+		vb->planes[plane].dbuf = dbuf;
+		vb->planes[plane].mem_priv = mem_priv;
+
+		ret = call_memop(q, plane, map_dmabuf, mem_priv);
+		if (ret) {
+			dprintk(1, "qbuf: failed mapping dmabuf for "
+				"plane %d\n", plane);
+			goto err;
+		}
+		vb->planes[plane].dbuf_mapped = 1;
+	}
+
+	/*
+	 * Call driver-specific initialization on the newly acquired buffer,
+	 * if provided.
+	 */
+	if (reacquired) {
+		ret = call_qop(q, buf_init, vb);
+		if (ret) {
+			dprintk(1, "qbuf: buffer initialization failed\n");
+			plane = vb->num_planes;
+			goto err;
+		}
+	}
+
+	/*
+	 * Now that everything is in order, copy relevant information
+	 * provided by userspace.
+	 */
+	for (plane = 0; plane < vb->num_planes; ++plane)
+		vb->v4l2_planes[plane] = planes[plane];
+
+	return 0;
+err:
+	/* Drop every plane, so that nothing is skipped as attached next time */
+	__vb2_buf_dmabuf_put(vb);
+	for (plane = 0; plane < vb->num_planes; ++plane)
+		vb->v4l2_planes[plane].length = 0;
+
+	return ret;
+}
+
 /**
  * __qbuf_mmap() - handle qbuf of an MMAP buffer
  */
@@ -875,6 +1066,8 @@ int vb2_qbuf(struct vb2_queue *q, struct v4l2_buffer *b)
 		ret = __qbuf_mmap(vb, b);
 	else if (q->memory == V4L2_MEMORY_USERPTR)
 		ret = __qbuf_userptr(vb, b);
+	else if (q->memory == V4L2_MEMORY_DMABUF)
+		ret = __qbuf_dmabuf(vb, b);
 	else {
 		WARN(1, "Invalid queue type\n");
 		return -EINVAL;
@@ -1477,6 +1670,9 @@ struct vb2_fileio_buf {
 	unsigned int size;
 	unsigned int pos;
 	unsigned int queued:1;
+	unsigned int deferred:1;
+	atomic_t piped;
+	struct vb2_fileio_data *fileio;
 };
 
 /**
@@ -1486,8 +1682,14 @@ struct vb2_fileio_buf {
  * write) calls on top of streaming API. For proper operation it required
  * this structure to save the driver state between each call of the read
  * or write function.
+ *
+ * Buffers spliced to a pipe stay out of the driver's hands until the pipe
+ * has released all their pages. The pipe buffers hold a reference to this
+ * structure, so it can outlive the emulator.
  */
 struct vb2_fileio_data {
+	struct kref kref;
+	wait_queue_head_t wait;
 	struct v4l2_requestbuffers req;
 	struct v4l2_buffer b;
 	struct vb2_fileio_buf bufs[VIDEO_MAX_FRAME];
@@ -1539,6 +1741,8 @@ static int __vb2_init_fileio(struct vb2_queue *q, int read)
 	if (fileio == NULL)
 		return -ENOMEM;
 
+	kref_init(&fileio->kref);
+	init_waitqueue_head(&fileio->wait);
 	fileio->flags = q->io_flags;
 
 	/*
@@ -1570,6 +1774,7 @@ static int __vb2_init_fileio(struct vb2_queue *q, int read)
 		if (fileio->bufs[i].vaddr == NULL)
 			goto err_reqbufs;
 		fileio->bufs[i].size = vb2_plane_size(q->bufs[i], 0);
+		fileio->bufs[i].fileio = fileio;
 	}
 
 	/*
@@ -1611,6 +1816,11 @@ err_kfree:
 	return ret;
 }
 
+static void __vb2_fileio_free(struct kref *kref)
+{
+	kfree(container_of(kref, struct vb2_fileio_data, kref));
+}
+
 /**
  * __vb2_cleanup_fileio() - free resourced used by file io emulator
  * @q:		videobuf2 queue
@@ -1626,15 +1836,147 @@ static int __vb2_cleanup_fileio(struct vb2_queue *q)
 		 */
 		q->fileio = NULL;
 
+		/*
+		 * Pages still in a pipe keep their own reference and outlive
+		 * the buffers.
+		 */
 		vb2_streamoff(q, q->type);
 		fileio->req.count = 0;
 		vb2_reqbufs(q, &fileio->req);
-		kfree(fileio);
+		kref_put(&fileio->kref, __vb2_fileio_free);
 		dprintk(3, "file io emulator closed\n");
 	}
 	return 0;
 }
 
+/**
+ * __vb2_fileio_queue() - give a file io buffer back to the driver
+ * @q:		videobuf2 queue
+ * @fileio:	file io emulator context
+ * @index:	buffer to queue, with buf->pos bytes of data for OUTPUT queues
+ */
+static int __vb2_fileio_queue(struct vb2_queue *q,
+			      struct vb2_fileio_data *fileio, int index)
+{
+	struct vb2_fileio_buf *buf = &fileio->bufs[index];
+	int ret;
+
+	memset(&fileio->b, 0, sizeof(fileio->b));
+	fileio->b.type = q->type;
+	fileio->b.memory = q->memory;
+	fileio->b.index = index;
+	fileio->b.bytesused = buf->pos;
+	ret = vb2_qbuf(q, &fileio->b);
+	dprintk(5, "file io: vb2_dbuf result: %d\n", ret);
+	if (ret)
+		return ret;
+
+	/*
+	 * Buffer has been queued, update the status
+	 */
+	buf->pos = 0;
+	buf->queued = 1;
+	buf->deferred = 0;
+	buf->size = q->bufs[0]->v4l2_planes[0].length;
+	fileio->q_count += 1;
+	return 0;
+}
+
+/**
+ * __vb2_fileio_requeue() - queue deferred buffers no longer in a pipe
+ * @q:		videobuf2 queue
+ * @fileio:	file io emulator context
+ *
+ * Buffers are queued in the order they were read, so that the driver keeps
+ * returning them in index order. Stops at the first buffer still in a pipe,
+ * the ones read after it have to wait for it.
+ */
+static int __vb2_fileio_requeue(struct vb2_queue *q,
+				struct vb2_fileio_data *fileio)
+{
+	struct vb2_fileio_buf *buf;
+	unsigned int i, index;
+	int ret;
+
+	for (i = 0; i < q->num_buffers; i++) {
+		index = (fileio->index + i) % q->num_buffers;
+		buf = &fileio->bufs[index];
+		if (!buf->deferred)
+			continue;
+		if (atomic_read(&buf->piped))
+			break;
+
+		ret = __vb2_fileio_queue(q, fileio, index);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * __vb2_fileio_get_buf() - make the current file io buffer available
+ * @q:		videobuf2 queue
+ * @fileio:	file io emulator context
+ * @nonblock:	mode selector (1 means blocking calls, 0 means nonblocking)
+ *
+ * Waits for a pipe to release the buffer if it has been spliced, and
+ * dequeues it from the driver if it is queued.
+ */
+static int __vb2_fileio_get_buf(struct vb2_queue *q,
+				struct vb2_fileio_data *fileio, int nonblock)
+{
+	int index = fileio->index;
+	struct vb2_fileio_buf *buf = &fileio->bufs[index];
+	int ret;
+
+	if (buf->deferred && atomic_read(&buf->piped)) {
+		if (nonblock)
+			return -EAGAIN;
+
+		dprintk(3, "file io: waiting for buffer %d to leave the pipe\n",
+			index);
+		call_qop(q, wait_prepare, q);
+		ret = wait_event_interruptible(fileio->wait,
+					       !atomic_read(&buf->piped));
+		call_qop(q, wait_finish, q);
+		if (ret)
+			return ret;
+	}
+
+	ret = __vb2_fileio_requeue(q, fileio);
+	if (ret)
+		return ret;
+
+	/*
+	 * Check if we need to dequeue the buffer.
+	 */
+	if (buf->queued) {
+		struct vb2_buffer *vb;
+
+		/*
+		 * Call vb2_dqbuf to get buffer back.
+		 */
+		memset(&fileio->b, 0, sizeof(fileio->b));
+		fileio->b.type = q->type;
+		fileio->b.memory = q->memory;
+		fileio->b.index = index;
+		ret = vb2_dqbuf(q, &fileio->b, nonblock);
+		dprintk(5, "file io: vb2_dqbuf result: %d\n", ret);
+		if (ret)
+			return ret;
+		fileio->dq_count += 1;
+
+		/*
+		 * Get number of bytes filled by the driver
+		 */
+		vb = q->bufs[index];
+		buf->size = vb2_get_plane_payload(vb, 0);
+		buf->queued = 0;
+	}
+
+	return 0;
+}
+
 /**
  * __vb2_perform_fileio() - perform a single file io (read or write) operation
  * @q:		videobuf2 queue
@@ -1678,32 +2020,9 @@ static size_t __vb2_perform_fileio(struct vb2_queue *q, char __user *data, size_
 	index = fileio->index;
 	buf = &fileio->bufs[index];
 
-	/*
-	 * Check if we need to dequeue the buffer.
-	 */
-	if (buf->queued) {
-		struct vb2_buffer *vb;
-
-		/*
-		 * Call vb2_dqbuf to get buffer back.
-		 */
-		memset(&fileio->b, 0, sizeof(fileio->b));
-		fileio->b.type = q->type;
-		fileio->b.memory = q->memory;
-		fileio->b.index = index;
-		ret = vb2_dqbuf(q, &fileio->b, nonblock);
-		dprintk(5, "file io: vb2_dqbuf result: %d\n", ret);
-		if (ret)
-			goto end;
-		fileio->dq_count += 1;
-
-		/*
-		 * Get number of bytes filled by the driver
-		 */
-		vb = q->bufs[index];
-		buf->size = vb2_get_plane_payload(vb, 0);
-		buf->queued = 0;
-	}
+	ret = __vb2_fileio_get_buf(q, fileio, nonblock);
+	if (ret)
+		goto end;
 
 	/*
 	 * Limit count on last few bytes of the buffer.
@@ -1753,31 +2072,29 @@ static size_t __vb2_perform_fileio(struct vb2_queue *q, char __user *data, size_
 		}
 
 		/*
-		 * Call vb2_qbuf and give buffer to the driver.
+		 * Call vb2_qbuf and give buffer to the driver. Captured
+		 * buffers go through the deferred list, behind any buffer
+		 * still in a pipe.
 		 */
-		memset(&fileio->b, 0, sizeof(fileio->b));
-		fileio->b.type = q->type;
-		fileio->b.memory = q->memory;
-		fileio->b.index = index;
-		fileio->b.bytesused = buf->pos;
-		ret = vb2_qbuf(q, &fileio->b);
-		dprintk(5, "file io: vb2_dbuf result: %d\n", ret);
-		if (ret)
-			goto end;
-
-		/*
-		 * Buffer has been queued, update the status
-		 */
-		buf->pos = 0;
-		buf->queued = 1;
-		buf->size = q->bufs[0]->v4l2_planes[0].length;
-		fileio->q_count += 1;
+		if (read) {
+			buf->deferred = 1;
+		} else {
+			ret = __vb2_fileio_queue(q, fileio, index);
+			if (ret)
+				goto end;
+		}
 
 		/*
 		 * Switch to the next buffer
 		 */
 		fileio->index = (index + 1) % q->num_buffers;
 
+		if (read) {
+			ret = __vb2_fileio_requeue(q, fileio);
+			if (ret)
+				goto end;
+		}
+
 		/*
 		 * Start streaming if required.
 		 */
@@ -1815,6 +2132,286 @@ size_t vb2_write(struct vb2_queue *q, char __user *data, size_t count,
 }
 EXPORT_SYMBOL_GPL(vb2_write);
 
+/*
+ * Pipe buffers referencing the pages of a file io buffer. Each one holds a
+ * page reference, counts in buf->piped and holds a reference to the file io
+ * context. The pages can't be stolen, the driver gets them back.
+ */
+static void vb2_pipe_buf_release(struct pipe_inode_info *pipe,
+				 struct pipe_buffer *pbuf)
+{
+	struct vb2_fileio_buf *buf = (struct vb2_fileio_buf *)pbuf->private;
+	struct vb2_fileio_data *fileio = buf->fileio;
+
+	put_page(pbuf->page);
+	if (atomic_dec_and_test(&buf->piped))
+		wake_up_interruptible(&fileio->wait);
+	kref_put(&fileio->kref, __vb2_fileio_free);
+}
+
+static void vb2_pipe_buf_get(struct pipe_inode_info *pipe,
+			     struct pipe_buffer *pbuf)
+{
+	struct vb2_fileio_buf *buf = (struct vb2_fileio_buf *)pbuf->private;
+
+	get_page(pbuf->page);
+	atomic_inc(&buf->piped);
+	kref_get(&buf->fileio->kref);
+}
+
+static int vb2_pipe_buf_steal(struct pipe_inode_info *pipe,
+			      struct pipe_buffer *pbuf)
+{
+	return 1;
+}
+
+static const struct pipe_buf_operations vb2_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = vb2_pipe_buf_release,
+	.steal = vb2_pipe_buf_steal,
+	.get = vb2_pipe_buf_get,
+};
+
+static void vb2_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+	struct pipe_buffer pbuf = {
+		.page = spd->pages[i],
+		.private = spd->partial[i].private,
+	};
+
+	vb2_pipe_buf_release(NULL, &pbuf);
+}
+
+/**
+ * vb2_splice_read() - implements splice_read file operation
+ * @q:		videobuf2 queue
+ * @ppos:	file handle position tracking pointer
+ * @pipe:	pipe to splice to
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Moves the data of the current file io buffer into @pipe by page
+ * reference, without copying it. The buffer is given back to the driver
+ * once the pipe has released all its pages. Requires buffer memory mapped
+ * from individual pages to kernel space, as videobuf2-vmalloc and
+ * videobuf2-dma-sg provide.
+ */
+ssize_t vb2_splice_read(struct vb2_queue *q, loff_t *ppos,
+			struct pipe_inode_info *pipe, size_t len,
+			unsigned int flags)
+{
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &vb2_pipe_buf_ops,
+		.spd_release = vb2_spd_release,
+	};
+	struct vb2_fileio_data *fileio;
+	struct vb2_fileio_buf *buf;
+	unsigned int offset, chunk;
+	ssize_t ret;
+	void *addr;
+	int index;
+
+	if (V4L2_TYPE_IS_OUTPUT(q->type) || !(q->io_modes & VB2_READ))
+		return -EINVAL;
+
+	dprintk(3, "file io: splice, offset %ld, count %zd\n", (long)*ppos,
+		len);
+
+	if (!q->fileio) {
+		ret = __vb2_init_fileio(q, 1);
+		dprintk(3, "file io: vb2_init_fileio result: %zd\n", ret);
+		if (ret)
+			return ret;
+	}
+	fileio = q->fileio;
+
+	/*
+	 * Pages of buffers in kernel memory can't be shared with a pipe.
+	 */
+	if (!is_vmalloc_addr(fileio->bufs[0].vaddr))
+		return -EINVAL;
+
+	if (splice_grow_spd(pipe, &spd))
+		return -ENOMEM;
+
+	/*
+	 * Hack fileio context to enable direct calls to vb2 ioctl interface.
+	 */
+	q->fileio = NULL;
+
+	for (;;) {
+		index = fileio->index;
+		buf = &fileio->bufs[index];
+
+		ret = __vb2_fileio_get_buf(q, fileio,
+					   flags & SPLICE_F_NONBLOCK);
+		if (ret)
+			goto end;
+		if (buf->pos < buf->size)
+			break;
+
+		/*
+		 * Splicing nothing would read as end of file. Give a buffer
+		 * without payload back to the driver and wait for the next.
+		 */
+		if ((fileio->flags & VB2_FILEIO_READ_ONCE) &&
+		    fileio->dq_count == 1) {
+			dprintk(3, "file io: read limit reached\n");
+			q->fileio = fileio;
+			__vb2_cleanup_fileio(q);
+			goto out;
+		}
+
+		dprintk(3, "file io: buffer %d is empty, requeueing\n", index);
+		buf->deferred = 1;
+		fileio->index = (index + 1) % q->num_buffers;
+		ret = __vb2_fileio_requeue(q, fileio);
+		if (ret)
+			goto end;
+	}
+
+	len = min_t(size_t, len, buf->size - buf->pos);
+	for (offset = buf->pos, spd.nr_pages = 0;
+	     len && spd.nr_pages < pipe->buffers; spd.nr_pages++) {
+		addr = buf->vaddr + offset;
+		chunk = min_t(size_t, len, PAGE_SIZE - offset_in_page(addr));
+
+		spd.pages[spd.nr_pages] = vmalloc_to_page(addr);
+		spd.partial[spd.nr_pages].offset = offset_in_page(addr);
+		spd.partial[spd.nr_pages].len = chunk;
+		spd.partial[spd.nr_pages].private = (unsigned long)buf;
+
+		get_page(spd.pages[spd.nr_pages]);
+		atomic_inc(&buf->piped);
+		kref_get(&fileio->kref);
+		offset += chunk;
+		len -= chunk;
+	}
+
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret <= 0)
+		goto end;
+
+	buf->pos += ret;
+	*ppos += ret;
+
+	/*
+	 * Switch to the next buffer once this one has been spliced entirely.
+	 * It is queued again when the pipe releases it.
+	 */
+	if (buf->pos == buf->size) {
+		if ((fileio->flags & VB2_FILEIO_READ_ONCE) &&
+		    fileio->dq_count == 1) {
+			dprintk(3, "file io: read limit reached\n");
+			q->fileio = fileio;
+			__vb2_cleanup_fileio(q);
+			goto out;
+		}
+
+		buf->deferred = 1;
+		fileio->index = (index + 1) % q->num_buffers;
+
+		/*
+		 * Errors show up again when the buffer is needed, the data
+		 * has been spliced already.
+		 */
+		if (__vb2_fileio_requeue(q, fileio))
+			dprintk(1, "file io: failed to requeue buffers\n");
+	}
+end:
+	q->fileio = fileio;
+out:
+	splice_shrink_spd(pipe, &spd);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(vb2_splice_read);
+
+static int vb2_pipe_to_buf(struct pipe_inode_info *pipe,
+			   struct pipe_buffer *pbuf, struct splice_desc *sd)
+{
+	struct vb2_queue *q = sd->u.data;
+	mm_segment_t old_fs;
+	loff_t pos = sd->pos;
+	void *data;
+	int ret;
+
+	ret = pbuf->ops->confirm(pipe, pbuf);
+	if (ret)
+		return ret;
+
+	data = pbuf->ops->map(pipe, pbuf, 0);
+	old_fs = get_fs();
+	set_fs(get_ds());
+	ret = __vb2_perform_fileio(q, (char __user __force *)data + pbuf->offset,
+				   sd->len, &pos, 1, 0);
+	set_fs(old_fs);
+	pbuf->ops->unmap(pipe, pbuf, data);
+
+	return ret;
+}
+
+/**
+ * vb2_splice_write() - implements splice_write file operation
+ * @q:		videobuf2 queue
+ * @pipe:	pipe to splice from
+ * @ppos:	file handle position tracking pointer
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Copies data from @pipe straight into the current file io buffer, without
+ * going through a userspace buffer. Splices at most up to the end of the
+ * buffer, which is dequeued before the pipe is locked.
+ */
+ssize_t vb2_splice_write(struct vb2_queue *q, struct pipe_inode_info *pipe,
+			 loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct splice_desc sd = {
+		.flags = flags,
+		.pos = *ppos,
+		.u.data = q,
+	};
+	struct vb2_fileio_data *fileio;
+	struct vb2_fileio_buf *buf;
+	ssize_t ret;
+
+	if (!V4L2_TYPE_IS_OUTPUT(q->type) || !(q->io_modes & VB2_WRITE))
+		return -EINVAL;
+
+	if (!q->fileio) {
+		ret = __vb2_init_fileio(q, 0);
+		dprintk(3, "file io: vb2_init_fileio result: %zd\n", ret);
+		if (ret)
+			return ret;
+	}
+	fileio = q->fileio;
+
+	q->fileio = NULL;
+	ret = __vb2_fileio_get_buf(q, fileio, flags & SPLICE_F_NONBLOCK);
+	q->fileio = fileio;
+	if (ret)
+		return ret;
+
+	buf = &fileio->bufs[fileio->index];
+	sd.total_len = min_t(size_t, len, buf->size - buf->pos);
+
+	pipe_lock(pipe);
+	ret = __splice_from_pipe(pipe, &sd, vb2_pipe_to_buf);
+	pipe_unlock(pipe);
+
+	if (ret > 0)
+		*ppos += ret;
+	return ret;
+}
+EXPORT_SYMBOL_GPL(vb2_splice_write);
+
 MODULE_DESCRIPTION("Driver helper framework for Video for Linux 2");
 MODULE_AUTHOR("Pawel Osciak <pawel@osciak.com>, Marek Szyprowski");
 MODULE_LICENSE("GPL");
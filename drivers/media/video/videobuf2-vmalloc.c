@@ -10,19 +10,35 @@
  * the Free Software Foundation.
  */
 
+#include <linux/dma-buf.h>
 #include <linux/module.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 
 #include <media/videobuf2-core.h>
 #include <media/videobuf2-memops.h>
 
+static int debug;
+module_param(debug, int, 0644);
+
+#define dprintk(level, fmt, arg...)					\
+	do {								\
+		if (debug >= level)					\
+			printk(KERN_DEBUG "vb2-vmalloc: " fmt, ## arg);	\
+	} while (0)
+
 struct vb2_vmalloc_buf {
 	void				*vaddr;
+	struct page			**pages;
+	unsigned int			n_pages;
+	unsigned int			offset;
+	int				write;
 	unsigned long			size;
 	atomic_t			refcount;
 	struct vb2_vmarea_handler	handler;
+	struct dma_buf			*dbuf;
 };
 
 static void vb2_vmalloc_put(void *buf_priv);
@@ -66,6 +82,87 @@ static void vb2_vmalloc_put(void *buf_priv)
 	}
 }
 
+/*
+ * The user pages stay pinned and mapped for as long as the buffer is
+ * queued with the same address and length, the core only calls
+ * put_userptr once either changes. They are mapped here rather than on
+ * the first vb2_vmalloc_vaddr() call, which may come from several
+ * contexts at once and from ones that can't sleep.
+ */
+static void *vb2_vmalloc_get_userptr(void *alloc_ctx, unsigned long vaddr,
+				     unsigned long size, int write)
+{
+	struct vb2_vmalloc_buf *buf;
+	unsigned long first, last;
+	void *kvaddr;
+	int n_pages, ret;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+
+	buf->write = write;
+	buf->size = size;
+	buf->offset = vaddr & ~PAGE_MASK;
+
+	first = vaddr >> PAGE_SHIFT;
+	last = (vaddr + size - 1) >> PAGE_SHIFT;
+	buf->n_pages = last - first + 1;
+
+	buf->pages = kmalloc(buf->n_pages * sizeof(struct page *), GFP_KERNEL);
+	if (!buf->pages) {
+		kfree(buf);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	down_read(&current->mm->mmap_sem);
+	n_pages = get_user_pages(current, current->mm, vaddr & PAGE_MASK,
+				 buf->n_pages, write, 0, buf->pages, NULL);
+	up_read(&current->mm->mmap_sem);
+
+	if (n_pages != buf->n_pages) {
+		dprintk(1, "get_user_pages requested/got: %u/%d\n",
+			buf->n_pages, n_pages);
+		ret = -EFAULT;
+		goto fail_put;
+	}
+
+	kvaddr = vm_map_ram(buf->pages, buf->n_pages, -1, PAGE_KERNEL);
+	if (!kvaddr) {
+		printk(KERN_ERR "Mapping of %u user pages failed\n",
+		       buf->n_pages);
+		ret = -ENOMEM;
+		goto fail_put;
+	}
+	buf->vaddr = kvaddr + buf->offset;
+
+	return buf;
+
+fail_put:
+	while (--n_pages >= 0)
+		put_page(buf->pages[n_pages]);
+	kfree(buf->pages);
+	kfree(buf);
+	return ERR_PTR(ret);
+}
+
+static void vb2_vmalloc_put_userptr(void *buf_priv)
+{
+	struct vb2_vmalloc_buf *buf = buf_priv;
+	unsigned int i;
+
+	vm_unmap_ram(buf->vaddr - buf->offset, buf->n_pages);
+
+	for (i = 0; i < buf->n_pages; i++) {
+		if (buf->write)
+			set_page_dirty_lock(buf->pages[i]);
+		put_page(buf->pages[i]);
+	}
+
+	kfree(buf->pages);
+	kfree(buf);
+}
+
 static void *vb2_vmalloc_vaddr(void *buf_priv)
 {
 	struct vb2_vmalloc_buf *buf = buf_priv;
@@ -80,6 +177,58 @@ static void *vb2_vmalloc_vaddr(void *buf_priv)
 	return buf->vaddr;
 }
 
+/*
+ * A shared buffer is accessed through the exporter's kernel mapping, so the
+ * driver sees the same vaddr it would for its own vmalloc memory and nothing
+ * gets copied. Devices that need DMA addresses want an allocator built on
+ * dma_buf_map_attachment() instead.
+ */
+static void *vb2_vmalloc_attach_dmabuf(void *alloc_ctx, struct dma_buf *dbuf,
+				       unsigned long size, int write)
+{
+	struct vb2_vmalloc_buf *buf;
+
+	if (dbuf->size < size)
+		return ERR_PTR(-EFAULT);
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+
+	buf->dbuf = dbuf;
+	buf->write = write;
+	buf->size = size;
+
+	return buf;
+}
+
+static void vb2_vmalloc_detach_dmabuf(void *buf_priv)
+{
+	struct vb2_vmalloc_buf *buf = buf_priv;
+
+	if (buf->vaddr)
+		dma_buf_vunmap(buf->dbuf, buf->vaddr);
+
+	kfree(buf);
+}
+
+static int vb2_vmalloc_map_dmabuf(void *buf_priv)
+{
+	struct vb2_vmalloc_buf *buf = buf_priv;
+
+	buf->vaddr = dma_buf_vmap(buf->dbuf);
+
+	return buf->vaddr ? 0 : -EFAULT;
+}
+
+static void vb2_vmalloc_unmap_dmabuf(void *buf_priv)
+{
+	struct vb2_vmalloc_buf *buf = buf_priv;
+
+	dma_buf_vunmap(buf->dbuf, buf->vaddr);
+	buf->vaddr = NULL;
+}
+
 static unsigned int vb2_vmalloc_num_users(void *buf_priv)
 {
 	struct vb2_vmalloc_buf *buf = buf_priv;
@@ -121,6 +270,12 @@ static int vb2_vmalloc_mmap(void *buf_priv, struct vm_area_struct *vma)
 const struct vb2_mem_ops vb2_vmalloc_memops = {
 	.alloc		= vb2_vmalloc_alloc,
 	.put		= vb2_vmalloc_put,
+	.get_userptr	= vb2_vmalloc_get_userptr,
+	.put_userptr	= vb2_vmalloc_put_userptr,
+	.attach_dmabuf	= vb2_vmalloc_attach_dmabuf,
+	.detach_dmabuf	= vb2_vmalloc_detach_dmabuf,
+	.map_dmabuf	= vb2_vmalloc_map_dmabuf,
+	.unmap_dmabuf	= vb2_vmalloc_unmap_dmabuf,
 	.vaddr		= vb2_vmalloc_vaddr,
 	.mmap		= vb2_vmalloc_mmap,
 	.num_users	= vb2_vmalloc_num_users,
@@ -26,6 +26,9 @@
 #include <linux/videodev2.h>
 #include <linux/kthread.h>
 #include <linux/freezer.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
 #include <media/videobuf2-vmalloc.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-ioctl.h>
@@ -36,13 +39,16 @@
 
 #define VIVI_MODULE_NAME "vivi"
 
-/* Wake up at about 30 fps */
-#define WAKE_NUMERATOR 30
-#define WAKE_DENOMINATOR 1001
-#define BUFFER_TIMEOUT     msecs_to_jiffies(500)  /* 0.5 seconds */
+#define MAX_WIDTH 8192
+#define MAX_HEIGHT 4320
+#define MAX_FPS 1000
 
-#define MAX_WIDTH 1920
-#define MAX_HEIGHT 1200
+/* Frames are copied in at most this many stripes of at least 16 lines */
+#define MAX_STRIPES 16
+
+/* Rows covered by the text overlay */
+#define TEXT_TOP	16
+#define TEXT_ROWS	(8 * 16)
 
 #define VIVI_VERSION "0.8.1"
 
@@ -67,6 +73,33 @@ static unsigned int vid_limit = 16;
 module_param(vid_limit, uint, 0644);
 MODULE_PARM_DESC(vid_limit, "capture memory limit in megabytes");
 
+static unsigned int threads = 1;
+module_param(threads, uint, 0644);
+MODULE_PARM_DESC(threads, "cpus generating a frame in parallel stripes, "
+		 "0 is all online cpus");
+
+static bool static_pattern;
+module_param(static_pattern, bool, 0644);
+MODULE_PARM_DESC(static_pattern, "reuse a prebuilt frame and only redraw "
+		 "the text overlay");
+
+static unsigned int def_width = 640;
+module_param_named(width, def_width, uint, 0444);
+MODULE_PARM_DESC(width, "initial frame width");
+
+static unsigned int def_height = 480;
+module_param_named(height, def_height, uint, 0444);
+MODULE_PARM_DESC(height, "initial frame height");
+
+static unsigned int def_fps = 30;
+module_param_named(fps, def_fps, uint, 0444);
+MODULE_PARM_DESC(fps, "initial frame rate, up to 1000");
+
+static bool multiplanar;
+module_param(multiplanar, bool, 0444);
+MODULE_PARM_DESC(multiplanar, "use multi-planar buffers, adds the NV12M "
+		 "and YUV420M formats");
+
 /* Global font descriptor */
 static const u8 *font8x16;
 
@@ -80,7 +113,19 @@ static const u8 *font8x16;
 struct vivi_fmt {
 	char  *name;
 	u32   fourcc;          /* v4l2 format id */
-	int   depth;
+	int   depth;           /* bits per pixel, all planes together */
+	int   planes;          /* 1 packed, 2 Y + CbCr, 3 Y + Cb + Cr */
+	bool  mplane;          /* every plane in its own buffer plane */
+};
+
+/* one color plane of a frame */
+struct vivi_plane {
+	unsigned int	twopix;		/* bytes for two pixels in a row */
+	unsigned int	vsub;		/* vertical subsampling */
+	unsigned int	pitch;
+	unsigned int	lines;
+	unsigned int	offset;		/* in a contiguous frame */
+	u8		*line;		/* two lines of bars, for the motion */
 };
 
 static struct vivi_fmt formats[] = {
@@ -114,16 +159,50 @@ static struct vivi_fmt formats[] = {
 		.fourcc   = V4L2_PIX_FMT_RGB555X, /* arrrrrgg gggbbbbb */
 		.depth    = 16,
 	},
+	{
+		.name     = "RGB32",
+		.fourcc   = V4L2_PIX_FMT_RGB32, /* rrrrrrrr gggggggg bbbbbbbb 0 */
+		.depth    = 32,
+	},
+	{
+		.name     = "4:2:0, planar, Y/CbCr",
+		.fourcc   = V4L2_PIX_FMT_NV12,
+		.depth    = 12,
+		.planes   = 2,
+	},
+	{
+		.name     = "4:2:0, planar, YUV",
+		.fourcc   = V4L2_PIX_FMT_YUV420,
+		.depth    = 12,
+		.planes   = 3,
+	},
+	{
+		.name     = "4:2:0, multi-planar, Y/CbCr",
+		.fourcc   = V4L2_PIX_FMT_NV12M,
+		.depth    = 12,
+		.planes   = 2,
+		.mplane   = true,
+	},
+	{
+		.name     = "4:2:0, multi-planar, YUV",
+		.fourcc   = V4L2_PIX_FMT_YUV420M,
+		.depth    = 12,
+		.planes   = 3,
+		.mplane   = true,
+	},
 };
 
-static struct vivi_fmt *get_format(struct v4l2_format *f)
+#define VIVI_MAX_PLANES 3
+
+/* Formats with a buffer plane per color plane need a multi-planar queue */
+static struct vivi_fmt *get_format(u32 fourcc)
 {
 	struct vivi_fmt *fmt;
 	unsigned int k;
 
 	for (k = 0; k < ARRAY_SIZE(formats); k++) {
 		fmt = &formats[k];
-		if (fmt->fourcc == f->fmt.pix.pixelformat)
+		if (fmt->fourcc == fourcc && (multiplanar || !fmt->mplane))
 			break;
 	}
 
@@ -133,12 +212,58 @@ static struct vivi_fmt *get_format(struct v4l2_format *f)
 	return &formats[k];
 }
 
+static int vivi_planes(struct vivi_fmt *fmt)
+{
+	return fmt->planes ? fmt->planes : 1;
+}
+
+/*
+ * Lay out the color planes of a @width x @height frame, one after the other
+ * as in a contiguous buffer. Returns the size of the frame.
+ */
+static unsigned int vivi_layout(struct vivi_fmt *fmt, unsigned int width,
+				unsigned int height, struct vivi_plane *plane)
+{
+	unsigned int p, offset = 0;
+
+	for (p = 0; p < vivi_planes(fmt); p++) {
+		struct vivi_plane *pl = &plane[p];
+
+		if (!fmt->planes)
+			pl->twopix = fmt->depth / 4;
+		else if (p == 0 || fmt->planes == 2)
+			pl->twopix = 2;
+		else
+			pl->twopix = 1;
+		pl->vsub = p ? 2 : 1;
+		pl->pitch = width / 2 * pl->twopix;
+		pl->lines = height / pl->vsub;
+		pl->offset = offset;
+		offset += pl->pitch * pl->lines;
+	}
+
+	return offset;
+}
+
 /* buffer for one video frame */
 struct vivi_buffer {
 	/* common v4l buffer stuff -- must be first */
 	struct vb2_buffer	vb;
 	struct list_head	list;
 	struct vivi_fmt        *fmt;
+	/* pattern the buffer holds outside the text, 0 if none */
+	unsigned int		pattern_gen;
+};
+
+/* a band of lines copied by one cpu */
+struct vivi_stripe {
+	struct work_struct	work;
+	void			*dst;
+	const u8		*src;
+	unsigned int		src_pitch;	/* 0 repeats the same line */
+	unsigned int		pitch;
+	unsigned int		first;
+	unsigned int		count;
 };
 
 struct vivi_dmaqueue {
@@ -147,9 +272,11 @@ struct vivi_dmaqueue {
 	/* thread for generating video stream*/
 	struct task_struct         *kthread;
 	wait_queue_head_t          wq;
-	/* Counters to control fps rate */
-	int                        frame;
-	int                        ini_jiffies;
+	/* Frames are due at start + frame * period */
+	ktime_t                    start;
+	ktime_t                    real_offset;	/* wall clock - monotonic */
+	u64                        period_ns;
+	u64                        frame;
 };
 
 static LIST_HEAD(vivi_devlist);
@@ -177,6 +304,9 @@ struct vivi_dev {
 	struct v4l2_ctrl	   *menu;
 	struct v4l2_ctrl	   *string;
 	struct v4l2_ctrl	   *bitmask;
+	struct v4l2_ctrl	   *frame_rate;
+	struct v4l2_ctrl	   *gen_time;
+	struct v4l2_ctrl	   *dropped;
 
 	spinlock_t                 slock;
 	struct mutex		   mutex;
@@ -187,8 +317,6 @@ struct vivi_dev {
 	struct vivi_dmaqueue       vidq;
 
 	/* Several counters */
-	unsigned 		   ms;
-	unsigned long              jiffies;
 	unsigned		   button_pressed;
 
 	int			   mv_count;	/* Controls bars movement */
@@ -199,12 +327,28 @@ struct vivi_dev {
 	/* video capture */
 	struct vivi_fmt            *fmt;
 	unsigned int               width, height;
+	struct vivi_plane	   plane[VIVI_MAX_PLANES];
+	unsigned int		   frame_size;
+	u8			   *lines;	/* backs plane[].line */
+	struct v4l2_fract	   timeperframe;
 	struct vb2_queue	   vb_vidq;
 	enum v4l2_field		   field;
 	unsigned int		   field_count;
+	unsigned int		   dropped_frames;
 
 	u8 			   bars[9][3];
-	u8 			   line[MAX_WIDTH * 4];
+
+	/* frame generation */
+	struct vivi_stripe	   stripe[MAX_STRIPES];
+	u8			   *pattern;	/* static_pattern frame */
+	int			   pattern_input;
+	unsigned int		   pattern_gen;
+
+	/* statistics, reported through read-only controls */
+	ktime_t			   fps_start;
+	unsigned int		   fps_frames;
+	u32			   fps_mhz;
+	u32			   gen_time_us;
 };
 
 /* ------------------------------------------------------------------
@@ -283,6 +427,10 @@ static void precalculate_bars(struct vivi_dev *dev)
 		switch (dev->fmt->fourcc) {
 		case V4L2_PIX_FMT_YUYV:
 		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YUV420M:
 			is_yuv = 1;
 			break;
 		case V4L2_PIX_FMT_RGB565:
@@ -316,7 +464,8 @@ static void precalculate_bars(struct vivi_dev *dev)
 #define TSTAMP_INPUT_X	10
 #define TSTAMP_MIN_X	(54 + TSTAMP_INPUT_X)
 
-static void gen_twopix(struct vivi_dev *dev, u8 *buf, int colorpos)
+/* Writes plane[@plane].twopix bytes */
+static void gen_twopix(struct vivi_dev *dev, int plane, u8 *buf, int colorpos)
 {
 	u8 r_y, g_u, b_v;
 	int color;
@@ -326,6 +475,33 @@ static void gen_twopix(struct vivi_dev *dev, u8 *buf, int colorpos)
 	g_u = dev->bars[colorpos][1]; /* G or precalculated U */
 	b_v = dev->bars[colorpos][2]; /* B or precalculated V */
 
+	switch (dev->fmt->fourcc) {
+	case V4L2_PIX_FMT_RGB32:
+		buf[0] = buf[4] = r_y;
+		buf[1] = buf[5] = g_u;
+		buf[2] = buf[6] = b_v;
+		buf[3] = buf[7] = 0;
+		return;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV12M:
+		if (plane) {
+			buf[0] = g_u;
+			buf[1] = b_v;
+		} else {
+			buf[0] = buf[1] = r_y;
+		}
+		return;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YUV420M:
+		if (plane == 2)
+			buf[0] = b_v;
+		else if (plane == 1)
+			buf[0] = g_u;
+		else
+			buf[0] = buf[1] = r_y;
+		return;
+	}
+
 	for (color = 0; color < 4; color++) {
 		p = buf + color;
 
@@ -412,19 +588,26 @@ static void gen_twopix(struct vivi_dev *dev, u8 *buf, int colorpos)
 
 static void precalculate_line(struct vivi_dev *dev)
 {
-	int w;
+	int p, w;
+
+	for (p = 0; p < vivi_planes(dev->fmt); p++) {
+		struct vivi_plane *pl = &dev->plane[p];
 
-	for (w = 0; w < dev->width * 2; w += 2) {
-		int colorpos = (w / (dev->width / 8) % 8);
+		for (w = 0; w < dev->width * 2; w += 2) {
+			int colorpos = (w / (dev->width / 8) % 8);
 
-		gen_twopix(dev, dev->line + w * 2, colorpos);
+			gen_twopix(dev, p, pl->line + w / 2 * pl->twopix,
+				   colorpos);
+		}
 	}
 }
 
-static void gen_text(struct vivi_dev *dev, char *basep,
+static void gen_text(struct vivi_dev *dev, u8 **base,
 					int y, int x, char *text)
 {
-	int line;
+	struct vivi_plane *pl = &dev->plane[0];
+	unsigned int pixel = pl->twopix / 2;
+	int line, p, i;
 
 	/* Checks if it is possible to show string */
 	if (y + 16 >= dev->height || x + strlen(text) * 8 >= dev->width)
@@ -433,46 +616,182 @@ static void gen_text(struct vivi_dev *dev, char *basep,
 	/* Print stream time */
 	for (line = y; line < y + 16; line++) {
 		int j = 0;
-		char *pos = basep + line * dev->width * 2 + x * 2;
+		u8 *pos = base[0] + line * pl->pitch + x * pixel;
 		char *s;
 
 		for (s = text; *s; s++) {
 			u8 chr = font8x16[*s * 16 + line - y];
-			int i;
 
 			for (i = 0; i < 7; i++, j++) {
 				/* Draw white font on black background */
 				if (chr & (1 << (7 - i)))
-					gen_twopix(dev, pos + j * 2, WHITE);
+					gen_twopix(dev, 0, pos + j * pixel, WHITE);
 				else
-					gen_twopix(dev, pos + j * 2, TEXT_BLACK);
+					gen_twopix(dev, 0, pos + j * pixel, TEXT_BLACK);
 			}
 		}
 	}
+
+	/* Neither color has chroma, so the text box is flat in those planes */
+	for (p = 1; p < vivi_planes(dev->fmt); p++) {
+		pl = &dev->plane[p];
+		for (line = y / 2; line < (y + 16) / 2; line++) {
+			u8 *pos = base[p] + line * pl->pitch + x / 2 * pl->twopix;
+
+			for (i = 0; i < strlen(text) * 7; i += 2)
+				gen_twopix(dev, p, pos + i / 2 * pl->twopix,
+					   TEXT_BLACK);
+		}
+	}
+}
+
+static void vivi_copy_stripe(struct vivi_stripe *s)
+{
+	unsigned int h;
+
+	for (h = s->first; h < s->first + s->count; h++)
+		memcpy(s->dst + h * s->pitch, s->src + h * s->src_pitch,
+		       s->pitch);
+}
+
+static void vivi_stripe_work(struct work_struct *work)
+{
+	vivi_copy_stripe(container_of(work, struct vivi_stripe, work));
+}
+
+/*
+ * Copy @count lines starting at @first from @src to @dst. Large copies are
+ * split into stripes that other cpus work on while this thread does the
+ * first one.
+ */
+static void vivi_copy_lines(struct vivi_dev *dev, void *dst,
+			    unsigned int pitch, const u8 *src,
+			    unsigned int src_pitch, unsigned int first,
+			    unsigned int count)
+{
+	unsigned int n = threads ? threads : num_online_cpus();
+	unsigned int chunk, i;
+
+	n = clamp(min(n, count / 16), 1U, (unsigned int)MAX_STRIPES);
+	chunk = DIV_ROUND_UP(count, n);
+	n = DIV_ROUND_UP(count, chunk);
+
+	for (i = 0; i < n; i++) {
+		struct vivi_stripe *s = &dev->stripe[i];
+
+		s->dst = dst;
+		s->src = src;
+		s->src_pitch = src_pitch;
+		s->pitch = pitch;
+		s->first = first + i * chunk;
+		s->count = min(chunk, count - i * chunk);
+		if (i)
+			queue_work(system_unbound_wq, &s->work);
+	}
+
+	vivi_copy_stripe(&dev->stripe[0]);
+	for (i = 1; i < n; i++)
+		flush_work(&dev->stripe[i].work);
+}
+
+/*
+ * Copy frame lines @first to @first + @count into every plane of @dst,
+ * from the static frame @pattern or, without one, from the moving bars.
+ */
+static void vivi_copy_frame(struct vivi_dev *dev, u8 **dst, const u8 *pattern,
+			    unsigned int first, unsigned int count)
+{
+	int p;
+
+	for (p = 0; p < vivi_planes(dev->fmt); p++) {
+		struct vivi_plane *pl = &dev->plane[p];
+
+		if (pattern)
+			vivi_copy_lines(dev, dst[p], pl->pitch,
+					pattern + pl->offset, pl->pitch,
+					first / pl->vsub, count / pl->vsub);
+		else
+			vivi_copy_lines(dev, dst[p], pl->pitch,
+					pl->line + (dev->mv_count % dev->width) /
+					2 * pl->twopix, 0,
+					first / pl->vsub, count / pl->vsub);
+	}
+}
+
+/* Rebuild the static frame if the bars it shows changed. */
+static void vivi_update_pattern(struct vivi_dev *dev)
+{
+	u8 *dst[VIVI_MAX_PLANES];
+	int p;
+
+	if (dev->pattern_input == dev->input)
+		return;
+
+	for (p = 0; p < vivi_planes(dev->fmt); p++)
+		dst[p] = dev->pattern + dev->plane[p].offset;
+	vivi_copy_frame(dev, dst, NULL, 0, dev->height);
+	dev->pattern_input = dev->input;
+	if (++dev->pattern_gen == 0)
+		dev->pattern_gen = 1;
+}
+
+static void vivi_update_stats(struct vivi_dev *dev, ktime_t start)
+{
+	ktime_t now = ktime_get();
+	s64 window = ktime_us_delta(now, dev->fps_start);
+
+	dev->gen_time_us = ktime_us_delta(now, start);
+	dev->fps_frames++;
+
+	if (window >= USEC_PER_SEC) {
+		dev->fps_mhz = div64_s64((s64)dev->fps_frames * USEC_PER_SEC *
+					 1000, window);
+		dev->fps_frames = 0;
+		dev->fps_start = now;
+	}
 }
 
 static void vivi_fillbuff(struct vivi_dev *dev, struct vivi_buffer *buf)
 {
-	int wmax = dev->width;
+	struct vivi_dmaqueue *dma_q = &dev->vidq;
 	int hmax = dev->height;
-	struct timeval ts;
-	void *vbuf = vb2_plane_vaddr(&buf->vb, 0);
+	u8 *vbuf[VIVI_MAX_PLANES];
+	ktime_t start = ktime_get();
+	u64 elapsed = dma_q->frame * dma_q->period_ns;
 	unsigned ms;
 	char str[100];
-	int h, line = 1;
+	int line = 1;
+	int p;
 	s32 gain;
 
-	if (!vbuf)
-		return;
-
-	for (h = 0; h < hmax; h++)
-		memcpy(vbuf + h * wmax * 2, dev->line + (dev->mv_count % wmax) * 2, wmax * 2);
+	for (p = 0; p < vivi_planes(dev->fmt); p++) {
+		if (dev->fmt->mplane)
+			vbuf[p] = vb2_plane_vaddr(&buf->vb, p);
+		else
+			vbuf[p] = vb2_plane_vaddr(&buf->vb, 0);
+		if (!vbuf[p])
+			return;
+		if (!dev->fmt->mplane)
+			vbuf[p] += dev->plane[p].offset;
+	}
 
-	/* Updates stream time */
+	if (static_pattern && dev->pattern) {
+		vivi_update_pattern(dev);
+		if (buf->pattern_gen != dev->pattern_gen) {
+			vivi_copy_frame(dev, vbuf, dev->pattern, 0, hmax);
+			buf->pattern_gen = dev->pattern_gen;
+		} else if (hmax > TEXT_TOP) {
+			/* Only the text overlay differs from the last frame */
+			vivi_copy_frame(dev, vbuf, dev->pattern, TEXT_TOP,
+					min(hmax - TEXT_TOP, TEXT_ROWS));
+		}
+	} else {
+		vivi_copy_frame(dev, vbuf, NULL, 0, hmax);
+		buf->pattern_gen = 0;
+	}
 
-	dev->ms += jiffies_to_msecs(jiffies - dev->jiffies);
-	dev->jiffies = jiffies;
-	ms = dev->ms;
+	/* Stream time is the time the frame was due */
+	ms = div_u64(elapsed, NSEC_PER_MSEC);
 	snprintf(str, sizeof(str), " %02d:%02d:%02d:%03d ",
 			(ms / (60 * 60 * 1000)) % 24,
 			(ms / (60 * 1000)) % 60,
@@ -516,8 +835,11 @@ static void vivi_fillbuff(struct vivi_dev *dev, struct vivi_buffer *buf)
 	buf->vb.v4l2_buf.field = dev->field;
 	dev->field_count++;
 	buf->vb.v4l2_buf.sequence = dev->field_count >> 1;
-	do_gettimeofday(&ts);
-	buf->vb.v4l2_buf.timestamp = ts;
+	buf->vb.v4l2_buf.timestamp = ktime_to_timeval(
+		ktime_add_ns(ktime_add(dma_q->start, dma_q->real_offset),
+			     elapsed));
+
+	vivi_update_stats(dev, start);
 }
 
 static void vivi_thread_tick(struct vivi_dev *dev)
@@ -539,8 +861,6 @@ static void vivi_thread_tick(struct vivi_dev *dev)
 	list_del(&buf->list);
 	spin_unlock_irqrestore(&dev->slock, flags);
 
-	do_gettimeofday(&buf->vb.v4l2_buf.timestamp);
-
 	/* Fill buffer */
 	vivi_fillbuff(dev, buf);
 	dprintk(dev, 1, "filled buffer %p\n", buf);
@@ -549,13 +869,12 @@ static void vivi_thread_tick(struct vivi_dev *dev)
 	dprintk(dev, 2, "[%p/%d] done\n", buf, buf->vb.v4l2_buf.index);
 }
 
-#define frames_to_ms(frames)					\
-	((frames * WAKE_NUMERATOR * 1000) / WAKE_DENOMINATOR)
-
 static void vivi_sleep(struct vivi_dev *dev)
 {
 	struct vivi_dmaqueue *dma_q = &dev->vidq;
-	int timeout;
+	ktime_t due;
+	s64 late;
+	u64 missed;
 	DECLARE_WAITQUEUE(wait, current);
 
 	dprintk(dev, 1, "%s dma_q=0x%08lx\n", __func__,
@@ -565,12 +884,26 @@ static void vivi_sleep(struct vivi_dev *dev)
 	if (kthread_should_stop())
 		goto stop_task;
 
-	/* Calculate time to wake up */
-	timeout = msecs_to_jiffies(frames_to_ms(1));
-
 	vivi_thread_tick(dev);
 
-	schedule_timeout_interruptible(timeout);
+	/*
+	 * Frames are due at fixed points in time, so a late wakeup doesn't
+	 * shift the ones after it. Frames whose time has already passed are
+	 * dropped, as a sensor would, and leave a gap in the sequence.
+	 */
+	dma_q->frame++;
+	late = ktime_to_ns(ktime_sub(ktime_get(), dma_q->start)) -
+		(s64)(dma_q->frame * dma_q->period_ns);
+	if (late >= 0) {
+		missed = div64_u64(late, dma_q->period_ns) + 1;
+		dma_q->frame += missed;
+		dev->field_count += missed;
+		dev->dropped_frames += missed;
+	}
+
+	due = ktime_add_ns(dma_q->start, dma_q->frame * dma_q->period_ns);
+	set_current_state(TASK_INTERRUPTIBLE);
+	schedule_hrtimeout(&due, HRTIMER_MODE_ABS);
 
 stop_task:
 	remove_wait_queue(&dma_q->wq, &wait);
@@ -602,16 +935,30 @@ static int vivi_start_generating(struct vivi_dev *dev)
 	dprintk(dev, 1, "%s\n", __func__);
 
 	/* Resets frame counters */
-	dev->ms = 0;
 	dev->mv_count = 0;
-	dev->jiffies = jiffies;
+	dev->dropped_frames = 0;
+	dev->fps_start = ktime_get();
+	dev->fps_frames = 0;
+	dev->fps_mhz = 0;
+	dev->gen_time_us = 0;
+
+	/* Without memory for the static frame, every frame is generated */
+	if (static_pattern) {
+		dev->pattern = vmalloc(dev->frame_size);
+		dev->pattern_input = -1;
+	}
 
 	dma_q->frame = 0;
-	dma_q->ini_jiffies = jiffies;
+	dma_q->period_ns = div_u64((u64)dev->timeperframe.numerator *
+				   NSEC_PER_SEC, dev->timeperframe.denominator);
+	dma_q->start = ktime_get();
+	dma_q->real_offset = ktime_sub(ktime_get_real(), dma_q->start);
 	dma_q->kthread = kthread_run(vivi_thread, dev, dev->v4l2_dev.name);
 
 	if (IS_ERR(dma_q->kthread)) {
 		v4l2_err(&dev->v4l2_dev, "kernel_thread() failed\n");
+		vfree(dev->pattern);
+		dev->pattern = NULL;
 		return PTR_ERR(dma_q->kthread);
 	}
 	/* Wakes thread */
@@ -633,6 +980,9 @@ static void vivi_stop_generating(struct vivi_dev *dev)
 		dma_q->kthread = NULL;
 	}
 
+	vfree(dev->pattern);
+	dev->pattern = NULL;
+
 	/*
 	 * Typical driver might need to wait here until dma engine stops.
 	 * In this case we can abort imiedetly, so it's just a noop.
@@ -655,19 +1005,24 @@ static int queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
 				void *alloc_ctxs[])
 {
 	struct vivi_dev *dev = vb2_get_drv_priv(vq);
-	unsigned long size;
-
-	size = dev->width * dev->height * 2;
+	unsigned long size = dev->frame_size;
+	int p;
 
 	if (0 == *nbuffers)
 		*nbuffers = 32;
 
-	while (size * *nbuffers > vid_limit * 1024 * 1024)
+	/* Large frames still get double buffering */
+	while (*nbuffers > 2 && size * *nbuffers > vid_limit * 1024 * 1024)
 		(*nbuffers)--;
 
-	*nplanes = 1;
-
-	sizes[0] = size;
+	if (dev->fmt->mplane) {
+		*nplanes = vivi_planes(dev->fmt);
+		for (p = 0; p < *nplanes; p++)
+			sizes[p] = dev->plane[p].pitch * dev->plane[p].lines;
+	} else {
+		*nplanes = 1;
+		sizes[0] = size;
+	}
 
 	/*
 	 * videobuf2-vmalloc allocator is context-less so no need to set
@@ -683,9 +1038,13 @@ static int queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
 static int buffer_init(struct vb2_buffer *vb)
 {
 	struct vivi_dev *dev = vb2_get_drv_priv(vb->vb2_queue);
+	struct vivi_buffer *buf = container_of(vb, struct vivi_buffer, vb);
 
 	BUG_ON(NULL == dev->fmt);
 
+	/* New memory, or USERPTR memory we know nothing about */
+	buf->pattern_gen = 0;
+
 	/*
 	 * This callback is called once per buffer, after its allocation.
 	 *
@@ -706,6 +1065,7 @@ static int buffer_prepare(struct vb2_buffer *vb)
 	struct vivi_dev *dev = vb2_get_drv_priv(vb->vb2_queue);
 	struct vivi_buffer *buf = container_of(vb, struct vivi_buffer, vb);
 	unsigned long size;
+	int p, nplanes = dev->fmt->mplane ? vivi_planes(dev->fmt) : 1;
 
 	dprintk(dev, 1, "%s, field=%d\n", __func__, vb->v4l2_buf.field);
 
@@ -721,14 +1081,20 @@ static int buffer_prepare(struct vb2_buffer *vb)
 	    dev->height < 32 || dev->height > MAX_HEIGHT)
 		return -EINVAL;
 
-	size = dev->width * dev->height * 2;
-	if (vb2_plane_size(vb, 0) < size) {
-		dprintk(dev, 1, "%s data will not fit into plane (%lu < %lu)\n",
-				__func__, vb2_plane_size(vb, 0), size);
-		return -EINVAL;
-	}
+	for (p = 0; p < nplanes; p++) {
+		if (dev->fmt->mplane)
+			size = dev->plane[p].pitch * dev->plane[p].lines;
+		else
+			size = dev->frame_size;
+		if (vb2_plane_size(vb, p) < size) {
+			dprintk(dev, 1, "%s data will not fit into plane %d "
+				"(%lu < %lu)\n", __func__, p,
+				vb2_plane_size(vb, p), size);
+			return -EINVAL;
+		}
 
-	vb2_set_plane_payload(&buf->vb, 0, size);
+		vb2_set_plane_payload(&buf->vb, p, size);
+	}
 
 	buf->fmt = dev->fmt;
 
@@ -819,39 +1185,141 @@ static int vidioc_querycap(struct file *file, void  *priv,
 	strcpy(cap->driver, "vivi");
 	strcpy(cap->card, "vivi");
 	strlcpy(cap->bus_info, dev->v4l2_dev.name, sizeof(cap->bus_info));
-	cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING | \
-			    V4L2_CAP_READWRITE;
+	if (multiplanar)
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+				    V4L2_CAP_STREAMING;
+	else
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE |
+				    V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
 	return 0;
 }
 
 static int vidioc_enum_fmt_vid_cap(struct file *file, void  *priv,
 					struct v4l2_fmtdesc *f)
 {
-	struct vivi_fmt *fmt;
+	struct vivi_dev *dev = video_drvdata(file);
+	struct vivi_fmt *fmt = NULL;
+	unsigned int k, n = 0;
 
-	if (f->index >= ARRAY_SIZE(formats))
+	if (f->type != dev->vb_vidq.type)
 		return -EINVAL;
 
-	fmt = &formats[f->index];
+	for (k = 0; k < ARRAY_SIZE(formats); k++) {
+		if (formats[k].mplane && !multiplanar)
+			continue;
+		if (n++ == f->index) {
+			fmt = &formats[k];
+			break;
+		}
+	}
+	if (!fmt)
+		return -EINVAL;
 
 	strlcpy(f->description, fmt->name, sizeof(f->description));
 	f->pixelformat = fmt->fourcc;
 	return 0;
 }
 
+static struct vivi_fmt *vivi_try_fmt(struct vivi_dev *dev, u32 pixelformat,
+				     u32 *width, u32 *height,
+				     enum v4l2_field *field)
+{
+	struct vivi_fmt *fmt;
+
+	fmt = get_format(pixelformat);
+	if (!fmt) {
+		dprintk(dev, 1, "Fourcc format (0x%08x) invalid.\n",
+			pixelformat);
+		return NULL;
+	}
+
+	if (*field == V4L2_FIELD_ANY) {
+		*field = V4L2_FIELD_INTERLACED;
+	} else if (V4L2_FIELD_INTERLACED != *field) {
+		dprintk(dev, 1, "Field type invalid.\n");
+		return NULL;
+	}
+
+	/* 4:2:0 chroma covers two lines */
+	v4l_bound_align_image(width, 48, MAX_WIDTH, 2,
+			      height, 32, MAX_HEIGHT, fmt->planes ? 1 : 0, 0);
+	return fmt;
+}
+
+static void vivi_fill_pix(struct vivi_fmt *fmt, struct v4l2_pix_format *pix)
+{
+	struct vivi_plane plane[VIVI_MAX_PLANES];
+
+	pix->sizeimage = vivi_layout(fmt, pix->width, pix->height, plane);
+	pix->bytesperline = plane[0].pitch;
+}
+
+static void vivi_fill_pix_mp(struct vivi_fmt *fmt,
+			     struct v4l2_pix_format_mplane *mp)
+{
+	struct vivi_plane plane[VIVI_MAX_PLANES];
+	unsigned int size;
+	int p;
+
+	size = vivi_layout(fmt, mp->width, mp->height, plane);
+	mp->num_planes = fmt->mplane ? vivi_planes(fmt) : 1;
+	for (p = 0; p < mp->num_planes; p++) {
+		mp->plane_fmt[p].bytesperline = plane[p].pitch;
+		mp->plane_fmt[p].sizeimage = fmt->mplane ?
+			plane[p].pitch * plane[p].lines : size;
+		memset(mp->plane_fmt[p].reserved, 0,
+		       sizeof(mp->plane_fmt[p].reserved));
+	}
+}
+
+/* Switch to @fmt at @width x @height, the queue must be idle */
+static int vivi_set_fmt(struct vivi_dev *dev, struct vivi_fmt *fmt,
+			unsigned int width, unsigned int height)
+{
+	struct vivi_plane plane[VIVI_MAX_PLANES];
+	unsigned int frame_size, size = 0;
+	u8 *lines;
+	int p;
+
+	frame_size = vivi_layout(fmt, width, height, plane);
+	for (p = 0; p < vivi_planes(fmt); p++)
+		size += width * plane[p].twopix;
+
+	lines = vmalloc(size);
+	if (!lines)
+		return -ENOMEM;
+
+	for (p = 0, size = 0; p < vivi_planes(fmt); p++) {
+		plane[p].line = lines + size;
+		size += width * plane[p].twopix;
+	}
+
+	vfree(dev->lines);
+	dev->lines = lines;
+	memcpy(dev->plane, plane, sizeof(plane));
+	dev->frame_size = frame_size;
+	dev->fmt = fmt;
+	dev->width = width;
+	dev->height = height;
+
+	precalculate_bars(dev);
+	precalculate_line(dev);
+	return 0;
+}
+
 static int vidioc_g_fmt_vid_cap(struct file *file, void *priv,
 					struct v4l2_format *f)
 {
 	struct vivi_dev *dev = video_drvdata(file);
 
+	if (f->type != dev->vb_vidq.type)
+		return -EINVAL;
+
 	f->fmt.pix.width        = dev->width;
 	f->fmt.pix.height       = dev->height;
 	f->fmt.pix.field        = dev->field;
 	f->fmt.pix.pixelformat  = dev->fmt->fourcc;
-	f->fmt.pix.bytesperline =
-		(f->fmt.pix.width * dev->fmt->depth) >> 3;
-	f->fmt.pix.sizeimage =
-		f->fmt.pix.height * f->fmt.pix.bytesperline;
+	vivi_fill_pix(dev->fmt, &f->fmt.pix);
 	return 0;
 }
 
@@ -859,32 +1327,18 @@ static int vidioc_try_fmt_vid_cap(struct file *file, void *priv,
 			struct v4l2_format *f)
 {
 	struct vivi_dev *dev = video_drvdata(file);
+	struct v4l2_pix_format *pix = &f->fmt.pix;
 	struct vivi_fmt *fmt;
-	enum v4l2_field field;
 
-	fmt = get_format(f);
-	if (!fmt) {
-		dprintk(dev, 1, "Fourcc format (0x%08x) invalid.\n",
-			f->fmt.pix.pixelformat);
+	if (f->type != dev->vb_vidq.type)
 		return -EINVAL;
-	}
 
-	field = f->fmt.pix.field;
-
-	if (field == V4L2_FIELD_ANY) {
-		field = V4L2_FIELD_INTERLACED;
-	} else if (V4L2_FIELD_INTERLACED != field) {
-		dprintk(dev, 1, "Field type invalid.\n");
+	fmt = vivi_try_fmt(dev, pix->pixelformat, &pix->width, &pix->height,
+			   &pix->field);
+	if (!fmt)
 		return -EINVAL;
-	}
 
-	f->fmt.pix.field = field;
-	v4l_bound_align_image(&f->fmt.pix.width, 48, MAX_WIDTH, 2,
-			      &f->fmt.pix.height, 32, MAX_HEIGHT, 0, 0);
-	f->fmt.pix.bytesperline =
-		(f->fmt.pix.width * fmt->depth) >> 3;
-	f->fmt.pix.sizeimage =
-		f->fmt.pix.height * f->fmt.pix.bytesperline;
+	vivi_fill_pix(fmt, pix);
 	return 0;
 }
 
@@ -893,8 +1347,9 @@ static int vidioc_s_fmt_vid_cap(struct file *file, void *priv,
 {
 	struct vivi_dev *dev = video_drvdata(file);
 	struct vb2_queue *q = &dev->vb_vidq;
+	int ret;
 
-	int ret = vidioc_try_fmt_vid_cap(file, priv, f);
+	ret = vidioc_try_fmt_vid_cap(file, priv, f);
 	if (ret < 0)
 		return ret;
 
@@ -903,14 +1358,166 @@ static int vidioc_s_fmt_vid_cap(struct file *file, void *priv,
 		return -EBUSY;
 	}
 
-	dev->fmt = get_format(f);
-	dev->width = f->fmt.pix.width;
-	dev->height = f->fmt.pix.height;
+	ret = vivi_set_fmt(dev, get_format(f->fmt.pix.pixelformat),
+			   f->fmt.pix.width, f->fmt.pix.height);
+	if (ret)
+		return ret;
 	dev->field = f->fmt.pix.field;
 
 	return 0;
 }
 
+static int vidioc_g_fmt_vid_cap_mplane(struct file *file, void *priv,
+				       struct v4l2_format *f)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+	struct v4l2_pix_format_mplane *mp = &f->fmt.pix_mp;
+
+	if (f->type != dev->vb_vidq.type)
+		return -EINVAL;
+
+	mp->width = dev->width;
+	mp->height = dev->height;
+	mp->field = dev->field;
+	mp->pixelformat = dev->fmt->fourcc;
+	vivi_fill_pix_mp(dev->fmt, mp);
+	return 0;
+}
+
+static int vidioc_try_fmt_vid_cap_mplane(struct file *file, void *priv,
+					 struct v4l2_format *f)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+	struct v4l2_pix_format_mplane *mp = &f->fmt.pix_mp;
+	u32 width = mp->width, height = mp->height;
+	enum v4l2_field field = mp->field;
+	struct vivi_fmt *fmt;
+
+	if (f->type != dev->vb_vidq.type)
+		return -EINVAL;
+
+	/* pix_mp is packed, don't take the address of its members */
+	fmt = vivi_try_fmt(dev, mp->pixelformat, &width, &height, &field);
+	if (!fmt)
+		return -EINVAL;
+
+	mp->width = width;
+	mp->height = height;
+	mp->field = field;
+
+	vivi_fill_pix_mp(fmt, mp);
+	return 0;
+}
+
+static int vidioc_s_fmt_vid_cap_mplane(struct file *file, void *priv,
+				       struct v4l2_format *f)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+	struct vb2_queue *q = &dev->vb_vidq;
+	int ret;
+
+	ret = vidioc_try_fmt_vid_cap_mplane(file, priv, f);
+	if (ret < 0)
+		return ret;
+
+	if (vb2_is_streaming(q)) {
+		dprintk(dev, 1, "%s device busy\n", __func__);
+		return -EBUSY;
+	}
+
+	ret = vivi_set_fmt(dev, get_format(f->fmt.pix_mp.pixelformat),
+			   f->fmt.pix_mp.width, f->fmt.pix_mp.height);
+	if (ret)
+		return ret;
+	dev->field = f->fmt.pix_mp.field;
+
+	return 0;
+}
+
+static int vidioc_enum_framesizes(struct file *file, void *priv,
+				  struct v4l2_frmsizeenum *fsize)
+{
+	struct vivi_fmt *fmt = get_format(fsize->pixel_format);
+
+	if (!fmt || fsize->index)
+		return -EINVAL;
+
+	fsize->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+	fsize->stepwise.min_width = 48;
+	fsize->stepwise.max_width = MAX_WIDTH;
+	fsize->stepwise.step_width = 4;
+	fsize->stepwise.min_height = 32;
+	fsize->stepwise.max_height = MAX_HEIGHT;
+	fsize->stepwise.step_height = fmt->planes ? 2 : 1;
+	return 0;
+}
+
+static int vidioc_enum_frameintervals(struct file *file, void *priv,
+				      struct v4l2_frmivalenum *fival)
+{
+	if (!get_format(fival->pixel_format) || fival->index)
+		return -EINVAL;
+
+	fival->type = V4L2_FRMIVAL_TYPE_CONTINUOUS;
+	fival->stepwise.min.numerator = 1;
+	fival->stepwise.min.denominator = MAX_FPS;
+	fival->stepwise.max.numerator = 1;
+	fival->stepwise.max.denominator = 1;
+	fival->stepwise.step.numerator = 1;
+	fival->stepwise.step.denominator = 1;
+	return 0;
+}
+
+/* Between 1 and MAX_FPS frames per second, zeroes keep the current rate */
+static void vivi_set_timeperframe(struct vivi_dev *dev, u32 num, u32 den)
+{
+	if (!num || !den)
+		return;
+
+	if ((u64)num * MAX_FPS < den) {
+		num = 1;
+		den = MAX_FPS;
+	} else if (num > den) {
+		num = 1;
+		den = 1;
+	}
+
+	dev->timeperframe.numerator = num;
+	dev->timeperframe.denominator = den;
+}
+
+static int vidioc_g_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *parm)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+
+	if (parm->type != dev->vb_vidq.type)
+		return -EINVAL;
+
+	memset(&parm->parm.capture, 0, sizeof(parm->parm.capture));
+	parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+	parm->parm.capture.timeperframe = dev->timeperframe;
+	return 0;
+}
+
+static int vidioc_s_parm(struct file *file, void *priv,
+			 struct v4l2_streamparm *parm)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+	struct v4l2_fract *tpf = &parm->parm.capture.timeperframe;
+
+	if (parm->type != dev->vb_vidq.type)
+		return -EINVAL;
+
+	if (vb2_is_streaming(&dev->vb_vidq)) {
+		dprintk(dev, 1, "%s device busy\n", __func__);
+		return -EBUSY;
+	}
+
+	vivi_set_timeperframe(dev, tpf->numerator, tpf->denominator);
+	return vidioc_g_parm(file, priv, parm);
+}
+
 static int vidioc_reqbufs(struct file *file, void *priv,
 			  struct v4l2_requestbuffers *p)
 {
@@ -1009,6 +1616,12 @@ static int vivi_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
 
 	if (ctrl == dev->autogain)
 		dev->gain->val = jiffies & 0xff;
+	else if (ctrl == dev->frame_rate)
+		ctrl->val = dev->fps_mhz;
+	else if (ctrl == dev->gen_time)
+		ctrl->val = dev->gen_time_us;
+	else if (ctrl == dev->dropped)
+		ctrl->val = dev->dropped_frames;
 	return 0;
 }
 
@@ -1035,6 +1648,16 @@ vivi_read(struct file *file, char __user *data, size_t count, loff_t *ppos)
 		       file->f_flags & O_NONBLOCK);
 }
 
+static ssize_t
+vivi_splice_read(struct file *file, loff_t *ppos, struct pipe_inode_info *pipe,
+		 size_t len, unsigned int flags)
+{
+	struct vivi_dev *dev = video_drvdata(file);
+
+	dprintk(dev, 1, "splice_read called\n");
+	return vb2_splice_read(&dev->vb_vidq, ppos, pipe, len, flags);
+}
+
 static unsigned int
 vivi_poll(struct file *file, struct poll_table_struct *wait)
 {
@@ -1165,11 +1788,48 @@ static const struct v4l2_ctrl_config vivi_ctrl_bitmask = {
 	.step = 0,
 };
 
+static const struct v4l2_ctrl_config vivi_ctrl_frame_rate = {
+	.ops = &vivi_ctrl_ops,
+	.id = VIVI_CID_CUSTOM_BASE + 7,
+	.name = "Frame Rate (mHz)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0x7fffffff,
+	.step = 1,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.is_volatile = 1,
+};
+
+static const struct v4l2_ctrl_config vivi_ctrl_gen_time = {
+	.ops = &vivi_ctrl_ops,
+	.id = VIVI_CID_CUSTOM_BASE + 8,
+	.name = "Frame Generation Time (us)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0x7fffffff,
+	.step = 1,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.is_volatile = 1,
+};
+
+static const struct v4l2_ctrl_config vivi_ctrl_dropped = {
+	.ops = &vivi_ctrl_ops,
+	.id = VIVI_CID_CUSTOM_BASE + 9,
+	.name = "Dropped Frames",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0x7fffffff,
+	.step = 1,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.is_volatile = 1,
+};
+
 static const struct v4l2_file_operations vivi_fops = {
 	.owner		= THIS_MODULE,
 	.open           = v4l2_fh_open,
 	.release        = vivi_close,
 	.read           = vivi_read,
+	.splice_read    = vivi_splice_read,
 	.poll		= vivi_poll,
 	.unlocked_ioctl = video_ioctl2, /* V4L2 ioctl handler */
 	.mmap           = vivi_mmap,
@@ -1181,6 +1841,14 @@ static const struct v4l2_ioctl_ops vivi_ioctl_ops = {
 	.vidioc_g_fmt_vid_cap     = vidioc_g_fmt_vid_cap,
 	.vidioc_try_fmt_vid_cap   = vidioc_try_fmt_vid_cap,
 	.vidioc_s_fmt_vid_cap     = vidioc_s_fmt_vid_cap,
+	.vidioc_enum_fmt_vid_cap_mplane = vidioc_enum_fmt_vid_cap,
+	.vidioc_g_fmt_vid_cap_mplane    = vidioc_g_fmt_vid_cap_mplane,
+	.vidioc_try_fmt_vid_cap_mplane  = vidioc_try_fmt_vid_cap_mplane,
+	.vidioc_s_fmt_vid_cap_mplane    = vidioc_s_fmt_vid_cap_mplane,
+	.vidioc_enum_framesizes   = vidioc_enum_framesizes,
+	.vidioc_enum_frameintervals = vidioc_enum_frameintervals,
+	.vidioc_g_parm        = vidioc_g_parm,
+	.vidioc_s_parm        = vidioc_s_parm,
 	.vidioc_reqbufs       = vidioc_reqbufs,
 	.vidioc_querybuf      = vidioc_querybuf,
 	.vidioc_qbuf          = vidioc_qbuf,
@@ -1224,6 +1892,7 @@ static int vivi_release(void)
 		video_unregister_device(dev->vfd);
 		v4l2_device_unregister(&dev->v4l2_dev);
 		v4l2_ctrl_handler_free(&dev->ctrl_handler);
+		vfree(dev->lines);
 		kfree(dev);
 	}
 
@@ -1236,7 +1905,10 @@ static int __init vivi_create_instance(int inst)
 	struct video_device *vfd;
 	struct v4l2_ctrl_handler *hdl;
 	struct vb2_queue *q;
-	int ret;
+	struct vivi_fmt *fmt;
+	u32 width = def_width, height = def_height;
+	enum v4l2_field field = V4L2_FIELD_ANY;
+	int ret, i;
 
 	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
 	if (!dev)
@@ -1248,11 +1920,16 @@ static int __init vivi_create_instance(int inst)
 	if (ret)
 		goto free_dev;
 
-	dev->fmt = &formats[0];
-	dev->width = 640;
-	dev->height = 480;
+	fmt = vivi_try_fmt(dev, formats[0].fourcc, &width, &height, &field);
+	ret = vivi_set_fmt(dev, fmt, width, height);
+	if (ret)
+		goto unreg_dev;
+	dev->timeperframe.numerator = 1;
+	dev->timeperframe.denominator = 30;
+	vivi_set_timeperframe(dev, 1, def_fps);
+
 	hdl = &dev->ctrl_handler;
-	v4l2_ctrl_handler_init(hdl, 11);
+	v4l2_ctrl_handler_init(hdl, 14);
 	dev->volume = v4l2_ctrl_new_std(hdl, &vivi_ctrl_ops,
 			V4L2_CID_AUDIO_VOLUME, 0, 255, 1, 200);
 	dev->brightness = v4l2_ctrl_new_std(hdl, &vivi_ctrl_ops,
@@ -1274,6 +1951,9 @@ static int __init vivi_create_instance(int inst)
 	dev->menu = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_menu, NULL);
 	dev->string = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_string, NULL);
 	dev->bitmask = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_bitmask, NULL);
+	dev->frame_rate = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_frame_rate, NULL);
+	dev->gen_time = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_gen_time, NULL);
+	dev->dropped = v4l2_ctrl_new_custom(hdl, &vivi_ctrl_dropped, NULL);
 	if (hdl->error) {
 		ret = hdl->error;
 		goto unreg_dev;
@@ -1284,11 +1964,20 @@ static int __init vivi_create_instance(int inst)
 	/* initialize locks */
 	spin_lock_init(&dev->slock);
 
+	for (i = 0; i < MAX_STRIPES; i++)
+		INIT_WORK(&dev->stripe[i].work, vivi_stripe_work);
+
 	/* initialize queue */
 	q = &dev->vb_vidq;
 	memset(q, 0, sizeof(dev->vb_vidq));
-	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_READ;
+	/* read() can't return frames split over several buffer planes */
+	if (multiplanar) {
+		q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF;
+	} else {
+		q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
+	}
 	q->drv_priv = dev;
 	q->buf_struct_size = sizeof(struct vivi_buffer);
 	q->ops = &vivi_video_qops;
@@ -1338,8 +2027,9 @@ static int __init vivi_create_instance(int inst)
 rel_vdev:
 	video_device_release(vfd);
 unreg_dev:
-	v4l2_ctrl_handler_free(hdl);
+	v4l2_ctrl_handler_free(&dev->ctrl_handler);
 	v4l2_device_unregister(&dev->v4l2_dev);
+	vfree(dev->lines);
 free_dev:
 	kfree(dev);
 	return ret;
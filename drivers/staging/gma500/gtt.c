@@ -329,7 +329,8 @@ void psb_gtt_free_range(struct drm_device *dev, struct gtt_range *gt)
 	}
 	WARN_ON(gt->in_gart && !gt->stolen);
 	release_resource(&gt->resource);
-	kfree(gt);
+	/* Handle lookups may still be looking at the GEM object */
+	kfree_rcu(gt, gem.rcu);
 }
 
 void psb_gtt_alloc(struct drm_device *dev)
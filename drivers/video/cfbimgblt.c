@@ -34,6 +34,7 @@
 #include <linux/fb.h>
 #include <asm/types.h>
 #include "fb_draw.h"
+#include "fb_expand.h"
 
 #define DEBUG
 
@@ -262,6 +263,45 @@ static inline void fast_imageblit(const struct fb_image *image, struct fb_info *
 	}
 }	
 	
+/*
+ * simd_imageblit - monochrome color expansion with the SIMD kernels
+ *
+ * Only if:  bits_per_pixel == 16 or 32, fb_expand_usable() and between
+ *           fb_expand_begin() and fb_expand_end()
+ *
+ * Handles any destination pixel and width. Trailing pixels of a row that
+ * don't fill a source byte are written one at a time.
+ */
+static void simd_imageblit(const struct fb_image *image, struct fb_info *p,
+			   u8 __iomem *dst1, u32 fgcolor, u32 bgcolor)
+{
+	u32 bpp = p->var.bits_per_pixel, spitch = (image->width + 7)/8;
+	u32 width = image->width, full = width/8;
+	const u8 *src = image->data;
+	struct fb_expand e;
+	u32 i, j, color;
+
+	fb_expand_init(&e, bpp, fgcolor, bgcolor);
+
+	for (i = image->height; i--; ) {
+		if (bpp == 16)
+			fb_expand_row16((void __force *)dst1, src, full, &e);
+		else
+			fb_expand_row32((void __force *)dst1, src, full, &e);
+
+		for (j = full * 8; j < width; j++) {
+			color = (src[j/8] & (0x80 >> (j & 7))) ?
+				fgcolor : bgcolor;
+			if (bpp == 16)
+				fb_writew(color, dst1 + j * 2);
+			else
+				fb_writel(color, dst1 + j * 4);
+		}
+		dst1 += p->fix.line_length;
+		src += spitch;
+	}
+}
+
 void cfb_imageblit(struct fb_info *p, const struct fb_image *image)
 {
 	u32 fgcolor, bgcolor, start_index, bitstart, pitch_index = 0;
@@ -294,7 +334,13 @@ void cfb_imageblit(struct fb_info *p, const struct fb_image *image)
 			bgcolor = image->bg_color;
 		}	
 		
-		if (32 % bpp == 0 && !start_index && !pitch_index && 
+		if (fb_expand_usable(p, bpp) && width >= 8 &&
+		    fb_expand_begin()) {
+			simd_imageblit(image, p, p->screen_base +
+				       dy * p->fix.line_length + dx * (bpp/8),
+				       fgcolor, bgcolor);
+			fb_expand_end();
+		} else if (32 % bpp == 0 && !start_index && !pitch_index &&
 		    ((width & (32/bpp-1)) == 0) &&
 		    bpp >= 8 && bpp <= 32) 			
 			fast_imageblit(image, p, dst1, fgcolor, bgcolor);
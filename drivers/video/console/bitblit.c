@@ -154,6 +154,13 @@ static void bit_putcs(struct vc_data *vc, struct fb_info *info,
 	u32 attribute = get_attribute(info, scr_readw(s));
 	u8 *dst, *buf = NULL;
 
+	cnt = fbcon_glyph_cache_putcs(vc, info, s, count, yy, xx, fg, bg);
+	if (cnt == count)
+		return;
+	count -= cnt;
+	s += cnt;
+	xx += cnt;
+
 	image.fg_color = fg;
 	image.bg_color = bg;
 	image.dx = xx * vc->vc_font.width;
@@ -366,6 +366,75 @@ static void fbcon_update_softback(struct vc_data *vc)
 		softback_top = 0;
 }
 
+/*
+ * Damage batching: drivers implementing fb_damage() collect the damage of
+ * fbcon's drawing in info->damage. It is pushed to the display in one go
+ * whenever a console update ends, which is marked by the VT layer placing
+ * or hiding the cursor. Drawing that isn't followed by a cursor update,
+ * e.g. scrollback or a hidden cursor, is flushed shortly after by
+ * damage_work.
+ */
+#define FBCON_DAMAGE_DELAY	(HZ / 50)
+
+static void fbcon_damage_flush(struct fb_info *info)
+{
+	struct fb_damage *d = &info->damage;
+
+	if (!(info->flags & FBINFO_MISC_DAMAGE_BATCH) || d->x1 == d->x2)
+		return;
+
+	info->fbops->fb_damage(info, d->x1, d->y1, d->x2 - d->x1,
+			       d->y2 - d->y1);
+	memset(d, 0, sizeof(*d));
+}
+
+static void fbcon_damage_work(struct work_struct *work)
+{
+	struct fbcon_ops *ops = container_of(to_delayed_work(work),
+					     struct fbcon_ops, damage_work);
+
+	/* Don't wait behind drawing, and don't deadlock with release. */
+	if (!console_trylock()) {
+		schedule_delayed_work(&ops->damage_work, FBCON_DAMAGE_DELAY);
+		return;
+	}
+	fbcon_damage_flush(ops->info);
+	console_unlock();
+}
+
+static void fbcon_damage_init(struct fb_info *info)
+{
+	struct fbcon_ops *ops = info->fbcon_par;
+
+	if (info->fbops->fb_damage) {
+		memset(&info->damage, 0, sizeof(info->damage));
+		ops->info = info;
+		INIT_DELAYED_WORK(&ops->damage_work, fbcon_damage_work);
+		info->flags |= FBINFO_MISC_DAMAGE_BATCH;
+	}
+}
+
+/* Make sure the damage of the drawing that follows gets flushed. */
+static void fbcon_damage_defer(struct fb_info *info)
+{
+	struct fbcon_ops *ops = info->fbcon_par;
+
+	if (info->flags & FBINFO_MISC_DAMAGE_BATCH)
+		schedule_delayed_work(&ops->damage_work, FBCON_DAMAGE_DELAY);
+}
+
+static void fbcon_damage_release(struct fb_info *info)
+{
+	struct fbcon_ops *ops = info->fbcon_par;
+
+	if (!(info->flags & FBINFO_MISC_DAMAGE_BATCH))
+		return;
+
+	fbcon_damage_flush(info);
+	info->flags &= ~FBINFO_MISC_DAMAGE_BATCH;
+	cancel_delayed_work_sync(&ops->damage_work);
+}
+
 static void fb_flashcursor(struct work_struct *work)
 {
 	struct fb_info *info = container_of(work, struct fb_info, queue);
@@ -390,6 +459,7 @@ static void fb_flashcursor(struct work_struct *work)
 		CM_ERASE : CM_DRAW;
 	ops->cursor(vc, info, mode, softback_lines, get_color(vc, info, c, 1),
 		    get_color(vc, info, c, 0));
+	fbcon_damage_flush(info);
 	console_unlock();
 }
 
@@ -709,6 +779,7 @@ static int con2fb_acquire_newinfo(struct vc_data *vc, struct fb_info *info,
 
 	if (!err) {
 		info->fbcon_par = ops;
+		fbcon_damage_init(info);
 
 		if (vc)
 			set_blitting_type(vc, info);
@@ -744,6 +815,8 @@ static int con2fb_release_oldinfo(struct vc_data *vc, struct fb_info *oldinfo,
 		kfree(ops->cursor_state.mask);
 		kfree(ops->cursor_data);
 		kfree(ops->fontbuffer);
+		fbcon_glyph_cache_free(ops);
+		fbcon_damage_release(oldinfo);
 		kfree(oldinfo->fbcon_par);
 		oldinfo->fbcon_par = NULL;
 		module_put(oldinfo->fbops->owner);
@@ -955,6 +1028,7 @@ static const char *fbcon_startup(void)
 	ops->graphics = 1;
 	ops->cur_rotate = -1;
 	info->fbcon_par = ops;
+	fbcon_damage_init(info);
 	p->con_rotate = initial_rotation;
 	set_blitting_type(vc, info);
 
@@ -1236,6 +1310,8 @@ static void fbcon_clear(struct vc_data *vc, int sy, int sx, int height,
 	if (!height || !width)
 		return;
 
+	fbcon_damage_defer(info);
+
 	if (sy < vc->vc_top && vc->vc_top == logo_lines)
 		vc->vc_top = 0;
 
@@ -1258,10 +1334,13 @@ static void fbcon_putcs(struct vc_data *vc, const unsigned short *s,
 	struct display *p = &fb_display[vc->vc_num];
 	struct fbcon_ops *ops = info->fbcon_par;
 
-	if (!fbcon_is_inactive(vc, info))
-		ops->putcs(vc, info, s, count, real_y(p, ypos), xpos,
-			   get_color(vc, info, scr_readw(s), 1),
-			   get_color(vc, info, scr_readw(s), 0));
+	if (fbcon_is_inactive(vc, info))
+		return;
+
+	fbcon_damage_defer(info);
+	ops->putcs(vc, info, s, count, real_y(p, ypos), xpos,
+		   get_color(vc, info, scr_readw(s), 1),
+		   get_color(vc, info, scr_readw(s), 0));
 }
 
 static void fbcon_putc(struct vc_data *vc, int c, int ypos, int xpos)
@@ -1288,9 +1367,14 @@ static void fbcon_cursor(struct vc_data *vc, int mode)
 	int y;
  	int c = scr_readw((u16 *) vc->vc_pos);
 
-	if (fbcon_is_inactive(vc, info) || vc->vc_deccm != 1)
+	if (fbcon_is_inactive(vc, info))
 		return;
 
+	if (vc->vc_deccm != 1) {
+		fbcon_damage_flush(info);
+		return;
+	}
+
 	if (vc->vc_cursor_type & 0x10)
 		fbcon_del_cursor_timer(info);
 	else
@@ -1309,6 +1393,7 @@ static void fbcon_cursor(struct vc_data *vc, int mode)
 	ops->cursor(vc, info, mode, y, get_color(vc, info, c, 1),
 		    get_color(vc, info, c, 0));
 	vbl_cursor_cnt = CURSOR_DRAW_DELAY;
+	fbcon_damage_flush(info);
 }
 
 static int scrollback_phys_max = 0;
@@ -1784,6 +1869,7 @@ static int fbcon_scroll(struct vc_data *vc, int t, int b, int dir,
 	if (fbcon_is_inactive(vc, info))
 		return -EINVAL;
 
+	fbcon_damage_defer(info);
 	fbcon_cursor(vc, CM_ERASE);
 
 	/*
@@ -1990,6 +2076,8 @@ static void fbcon_bmove(struct vc_data *vc, int sy, int sx, int dy, int dx,
 	if (!width || !height)
 		return;
 
+	fbcon_damage_defer(info);
+
 	/*  Split blits that cross physical y_wrap case.
 	 *  Pathological case involves 4 blits, better to use recursive
 	 *  code rather than unrolled case
@@ -2057,7 +2145,15 @@ static void updatescrollmode(struct display *p,
 	int yres = FBCON_SWAP(ops->rotate, info->var.yres, info->var.xres);
 	int vyres = FBCON_SWAP(ops->rotate, info->var.yres_virtual,
 				   info->var.xres_virtual);
-	int good_pan = (cap & FBINFO_HWACCEL_YPAN) &&
+	/*
+	 * Virtual framebuffers batching their damage can pan by only updating
+	 * an offset, which beats redrawing or moving the whole screen and
+	 * sending all of it to the display on every scroll.
+	 */
+	int virt_pan = (cap & FBINFO_VIRTFB) &&
+		(cap & FBINFO_MISC_DAMAGE_BATCH) &&
+		info->fbops->fb_pan_display;
+	int good_pan = ((cap & FBINFO_HWACCEL_YPAN) || virt_pan) &&
 		divides(ypan, vc->vc_font.height) && vyres > yres;
 	int good_wrap = (cap & FBINFO_HWACCEL_YWRAP) &&
 		divides(ywrap, vc->vc_font.height) &&
@@ -2339,6 +2435,7 @@ static int fbcon_blank(struct vc_data *vc, int blank, int mode_switch)
 	else
 		fbcon_add_cursor_timer(info);
 
+	fbcon_damage_flush(info);
 	return 0;
 }
 
@@ -2438,6 +2535,8 @@ static int fbcon_do_set_font(struct vc_data *vc, int w, int h,
 	else
 		cnt = 256;
 	vc->vc_font.data = (void *)(p->fontdata = data);
+	/* The old font data may be freed and its address reused. */
+	fbcon_glyph_cache_flush(ops);
 	if ((p->userfont = userfont))
 		REFCOUNT(data)++;
 	vc->vc_font.width = w;
@@ -2750,6 +2849,8 @@ static int fbcon_scrolldelta(struct vc_data *vc, int lines)
 	struct display *disp = &fb_display[fg_console];
 	int offset, limit, scrollback_old;
 
+	fbcon_damage_defer(info);
+
 	if (softback_top) {
 		if (vc->vc_num != fg_console)
 			return 0;
@@ -3534,6 +3635,8 @@ static void fbcon_exit(void)
 
 				fbcon_del_cursor_timer(info);
 				kfree(ops->cursor_src);
+				fbcon_glyph_cache_free(ops);
+				fbcon_damage_release(info);
 				kfree(info->fbcon_par);
 				info->fbcon_par = NULL;
 			}
@@ -84,6 +84,9 @@ struct fbcon_ops {
 	u8    *cursor_src;
 	u32    cursor_size;
 	u32    fd_size;
+	struct fbcon_glyph_cache *glyph_cache;
+	struct fb_info *info;		/* for damage_work */
+	struct delayed_work damage_work; /* flushes damage left batched */
 };
     /*
      *  Attribute Decoding
@@ -218,6 +221,11 @@ extern void fbcon_set_tileops(struct vc_data *vc, struct fb_info *info);
 #endif
 extern void fbcon_set_bitops(struct fbcon_ops *ops);
 extern int  soft_cursor(struct fb_info *info, struct fb_cursor *cursor);
+extern int  fbcon_glyph_cache_putcs(struct vc_data *vc, struct fb_info *info,
+				    const unsigned short *s, int count,
+				    int yy, int xx, int fg, int bg);
+extern void fbcon_glyph_cache_flush(struct fbcon_ops *ops);
+extern void fbcon_glyph_cache_free(struct fbcon_ops *ops);
 
 #define FBCON_ATTRIBUTE_UNDERLINE 1
 #define FBCON_ATTRIBUTE_REVERSE   2
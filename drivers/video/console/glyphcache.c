@@ -0,0 +1,280 @@
+/*
+ * linux/drivers/video/console/glyphcache.c
+ *
+ * Cache of glyphs expanded to the pixel format of the framebuffer
+ *
+ * Drawing a glyph through fb_imageblit() means rebuilding its 1 bpp image
+ * and expanding it to the framebuffer depth on every draw. Framebuffers in
+ * system RAM that let fbcon draw into them directly (FBINFO_DIRECT_DRAW)
+ * get the expanded glyph from this cache instead, and it is copied into
+ * place one row at a time. The damage is reported through fb_damage().
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License.  See the file COPYING in the main directory of this
+ * archive for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/fb.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/vt_kern.h>
+#include <linux/console.h>
+
+#include "fbcon.h"
+
+#define FBCON_GLYPH_HASH_ORDER	8
+#define FBCON_GLYPH_HASH_SIZE	(1 << FBCON_GLYPH_HASH_ORDER)
+
+static unsigned int size = 512;
+module_param(size, uint, 0644);
+MODULE_PARM_DESC(size, "Glyph cache size per framebuffer in KiB "
+		 "(0 = disabled)");
+
+/* Everything that changes the pixels of a glyph. */
+struct fbcon_glyph_key {
+	const u8 *font;
+	u32 fg;
+	u32 bg;
+	u16 index;
+	u8 bpp;
+	u8 width;
+	u8 height;
+};
+
+struct fbcon_glyph {
+	struct hlist_node node;
+	struct list_head lru;
+	struct fbcon_glyph_key key;
+	size_t size;
+	u8 data[0];
+};
+
+struct fbcon_glyph_cache {
+	struct hlist_head hash[FBCON_GLYPH_HASH_SIZE];
+	struct list_head lru;
+	size_t size;
+};
+
+static inline u32 fbcon_glyph_hash(const struct fbcon_glyph_key *key)
+{
+	return jhash(key, sizeof(*key), 0) & (FBCON_GLYPH_HASH_SIZE - 1);
+}
+
+static void fbcon_glyph_evict(struct fbcon_glyph_cache *cache)
+{
+	struct fbcon_glyph *glyph;
+
+	glyph = list_entry(cache->lru.prev, struct fbcon_glyph, lru);
+	list_del(&glyph->lru);
+	hlist_del(&glyph->node);
+	cache->size -= glyph->size;
+	kfree(glyph);
+}
+
+static void fbcon_glyph_expand(struct fbcon_glyph *glyph, const u8 *src)
+{
+	const struct fbcon_glyph_key *key = &glyph->key;
+	u32 spitch = DIV_ROUND_UP(key->width, 8);
+	u8 *dst = glyph->data;
+	u32 x, y, color;
+
+	for (y = 0; y < key->height; y++) {
+		for (x = 0; x < key->width; x++) {
+			color = (src[x / 8] & (0x80 >> (x & 7))) ?
+				key->fg : key->bg;
+			switch (key->bpp) {
+			case 8:
+				*dst = color;
+				break;
+			case 16:
+				*(u16 *)dst = color;
+				break;
+			case 32:
+				*(u32 *)dst = color;
+				break;
+			}
+			dst += key->bpp / 8;
+		}
+		src += spitch;
+	}
+}
+
+static struct fbcon_glyph *fbcon_glyph_get(struct fbcon_glyph_cache *cache,
+					   const struct fbcon_glyph_key *key,
+					   const u8 *src)
+{
+	struct fbcon_glyph *glyph;
+	struct hlist_node *node;
+	u32 hash = fbcon_glyph_hash(key);
+	size_t gsize, max_size = (size_t)size * 1024;
+
+	hlist_for_each_entry(glyph, node, &cache->hash[hash], node) {
+		if (!memcmp(&glyph->key, key, sizeof(*key))) {
+			list_move(&glyph->lru, &cache->lru);
+			return glyph;
+		}
+	}
+
+	gsize = key->width * key->height * (key->bpp / 8);
+	if (gsize > max_size)
+		return NULL;
+
+	glyph = kmalloc(sizeof(*glyph) + gsize, GFP_ATOMIC | __GFP_NOWARN);
+	if (!glyph)
+		return NULL;
+
+	while (cache->size + gsize > max_size)
+		fbcon_glyph_evict(cache);
+
+	glyph->key = *key;
+	glyph->size = gsize;
+	fbcon_glyph_expand(glyph, src);
+	hlist_add_head(&glyph->node, &cache->hash[hash]);
+	list_add(&glyph->lru, &cache->lru);
+	cache->size += gsize;
+
+	return glyph;
+}
+
+static bool fbcon_glyph_cache_usable(struct vc_data *vc, struct fb_info *info,
+				     const unsigned short *s)
+{
+	u32 bpp = info->var.bits_per_pixel;
+
+	if (!size || !(info->flags & FBINFO_DIRECT_DRAW) ||
+	    info->state != FBINFO_STATE_RUNNING)
+		return false;
+
+	if (bpp != 8 && bpp != 16 && bpp != 32)
+		return false;
+
+	/* Pixels are written with native stores. */
+#ifdef __BIG_ENDIAN
+	if (!fb_be_math(info))
+		return false;
+#else
+	if (fb_be_math(info))
+		return false;
+#endif
+
+	/* Attributes are only rendered on monochrome displays. */
+	if (get_attribute(info, scr_readw(s)))
+		return false;
+
+	return vc->vc_font.width <= 32 && vc->vc_font.height <= 32;
+}
+
+/*
+ * fbcon_glyph_cache_putcs - draw characters from the glyph cache
+ *
+ * Returns the number of characters drawn. The caller draws the rest
+ * through fb_imageblit().
+ */
+int fbcon_glyph_cache_putcs(struct vc_data *vc, struct fb_info *info,
+			    const unsigned short *s, int count, int yy, int xx,
+			    int fg, int bg)
+{
+	struct fbcon_ops *ops = info->fbcon_par;
+	struct fbcon_glyph_cache *cache = ops->glyph_cache;
+	u16 charmask = vc->vc_hi_font_mask ? 0x1ff : 0xff;
+	u32 cellsize = DIV_ROUND_UP(vc->vc_font.width, 8) * vc->vc_font.height;
+	u32 pitch = info->fix.line_length, bpp = info->var.bits_per_pixel;
+	u32 rowsize = vc->vc_font.width * (bpp / 8);
+	struct fbcon_glyph_key key;
+	struct fbcon_glyph *glyph;
+	int drawn = 0;
+	u8 *dst;
+	u32 y;
+
+	if (!fbcon_glyph_cache_usable(vc, info, s))
+		return 0;
+
+	/*
+	 * putcs is reached from printk with interrupts off, so nothing here
+	 * may sleep. Characters we can't cache are drawn by the caller.
+	 */
+	if (!cache) {
+		cache = kzalloc(sizeof(*cache), GFP_ATOMIC | __GFP_NOWARN);
+		if (!cache)
+			return 0;
+		INIT_LIST_HEAD(&cache->lru);
+		ops->glyph_cache = cache;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.font = vc->vc_font.data;
+	key.bpp = bpp;
+	key.width = vc->vc_font.width;
+	key.height = vc->vc_font.height;
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
+	    info->fix.visual == FB_VISUAL_DIRECTCOLOR) {
+		key.fg = ((u32 *)(info->pseudo_palette))[fg];
+		key.bg = ((u32 *)(info->pseudo_palette))[bg];
+	} else {
+		key.fg = fg;
+		key.bg = bg;
+	}
+
+	if (info->fbops->fb_sync)
+		info->fbops->fb_sync(info);
+
+	dst = (u8 __force *)info->screen_base +
+		yy * vc->vc_font.height * pitch + xx * rowsize;
+
+	for (; drawn < count; drawn++) {
+		key.index = scr_readw(s++) & charmask;
+		glyph = fbcon_glyph_get(cache, &key,
+					vc->vc_font.data + key.index * cellsize);
+		if (unlikely(!glyph))
+			break;
+
+		for (y = 0; y < key.height; y++)
+			memcpy(dst + y * pitch, glyph->data + y * rowsize,
+			       rowsize);
+		dst += rowsize;
+	}
+
+	if (drawn && !fb_damage_batch(info, xx * vc->vc_font.width,
+				      yy * vc->vc_font.height,
+				      drawn * vc->vc_font.width,
+				      vc->vc_font.height) &&
+	    info->fbops->fb_damage)
+		info->fbops->fb_damage(info, xx * vc->vc_font.width,
+				       yy * vc->vc_font.height,
+				       drawn * vc->vc_font.width,
+				       vc->vc_font.height);
+
+	return drawn;
+}
+EXPORT_SYMBOL(fbcon_glyph_cache_putcs);
+
+/*
+ * fbcon_glyph_cache_flush - drop all cached glyphs
+ *
+ * Needed whenever the pixels of a glyph may change while its key stays
+ * the same, e.g. when font data is replaced.
+ */
+void fbcon_glyph_cache_flush(struct fbcon_ops *ops)
+{
+	struct fbcon_glyph_cache *cache = ops->glyph_cache;
+
+	if (!cache)
+		return;
+
+	while (!list_empty(&cache->lru))
+		fbcon_glyph_evict(cache);
+}
+EXPORT_SYMBOL(fbcon_glyph_cache_flush);
+
+void fbcon_glyph_cache_free(struct fbcon_ops *ops)
+{
+	fbcon_glyph_cache_flush(ops);
+	kfree(ops->glyph_cache);
+	ops->glyph_cache = NULL;
+}
+EXPORT_SYMBOL(fbcon_glyph_cache_free);
+
+MODULE_DESCRIPTION("Framebuffer console glyph cache");
+MODULE_LICENSE("GPL");
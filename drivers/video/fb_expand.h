@@ -0,0 +1,171 @@
+#ifndef _FB_EXPAND_H
+#define _FB_EXPAND_H
+
+#include <asm/types.h>
+#include <linux/fb.h>
+
+#ifdef CONFIG_X86
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+#endif
+
+    /*
+     *  Monochrome to 16/32 bpp expansion a whole glyph row at a time.
+     *
+     *  Every source byte is broadcast to all lanes of a vector, each lane
+     *  tests its own bit and picks the foreground or background color.
+     *  Pixels are stored with native 16/32 bit stores, so the destination
+     *  only needs to be pixel aligned.
+     */
+
+struct fb_expand {
+	u32 mask[8];		/* Bit tested by each pixel lane */
+	u32 eor[4];		/* fg ^ bg, replicated */
+	u32 bg[4];		/* bg, replicated */
+};
+
+    /*
+     *  Pixels can be written with native stores if the layout of the
+     *  framebuffer matches the byte order of the cpu.
+     */
+
+static inline bool fb_expand_usable(struct fb_info *p, u32 bpp)
+{
+#ifdef __BIG_ENDIAN
+	if (!fb_be_math(p))
+		return false;
+#else
+	if (fb_be_math(p))
+		return false;
+#endif
+	return (bpp == 16 || bpp == 32) &&
+		(p->fix.line_length & (bpp / 8 - 1)) == 0;
+}
+
+static inline void fb_expand_init(struct fb_expand *e, u32 bpp,
+				  u32 fgcolor, u32 bgcolor)
+{
+	int i;
+
+	if (bpp == 16) {
+		fgcolor = (fgcolor & 0xffff) * 0x10001;
+		bgcolor = (bgcolor & 0xffff) * 0x10001;
+		for (i = 0; i < 4; i++)
+			e->mask[i] = (0x80 >> (2 * i)) |
+				((0x80 >> (2 * i + 1)) << 16);
+	} else {
+		for (i = 0; i < 8; i++)
+			e->mask[i] = 0x80 >> i;
+	}
+
+	for (i = 0; i < 4; i++) {
+		e->eor[i] = fgcolor ^ bgcolor;
+		e->bg[i] = bgcolor;
+	}
+}
+
+#ifdef CONFIG_X86
+
+    /*
+     *  The SSE2 kernels may only run between fb_expand_begin() and
+     *  fb_expand_end(). fb_expand_begin() fails if the fpu can't be used
+     *  in the current context.
+     */
+
+static inline bool fb_expand_begin(void)
+{
+	if (!cpu_has_xmm2 || !irq_fpu_usable())
+		return false;
+	kernel_fpu_begin();
+	return true;
+}
+
+static inline void fb_expand_end(void)
+{
+	kernel_fpu_end();
+}
+
+    /*
+     *  Expand @n source bytes to 8 * @n pixels.
+     */
+
+static inline void fb_expand_row16(void *dst, const u8 *src, u32 n,
+				   const struct fb_expand *e)
+{
+	asm volatile("movdqu   (%[e]), %%xmm4\n"
+		     "movdqu 32(%[e]), %%xmm6\n"
+		     "movdqu 48(%[e]), %%xmm7\n"
+		     "1:\n"
+		     "movzbl (%[s]), %%eax\n"
+		     "imul $0x10001, %%eax, %%eax\n"
+		     "movd %%eax, %%xmm0\n"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "pand %%xmm4, %%xmm0\n"
+		     "pcmpeqw %%xmm4, %%xmm0\n"
+		     "pand %%xmm6, %%xmm0\n"
+		     "pxor %%xmm7, %%xmm0\n"
+		     "movdqu %%xmm0, (%[d])\n"
+		     "add $1, %[s]\n"
+		     "add $16, %[d]\n"
+		     "sub $1, %[n]\n"
+		     "jnz 1b\n"
+		     : [s] "+r" (src), [d] "+r" (dst), [n] "+r" (n)
+		     : [e] "r" (e)
+		     : "eax", "memory", "cc");
+}
+
+static inline void fb_expand_row32(void *dst, const u8 *src, u32 n,
+				   const struct fb_expand *e)
+{
+	asm volatile("movdqu   (%[e]), %%xmm4\n"
+		     "movdqu 16(%[e]), %%xmm5\n"
+		     "movdqu 32(%[e]), %%xmm6\n"
+		     "movdqu 48(%[e]), %%xmm7\n"
+		     "1:\n"
+		     "movzbl (%[s]), %%eax\n"
+		     "movd %%eax, %%xmm0\n"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "movdqa %%xmm0, %%xmm1\n"
+		     "pand %%xmm4, %%xmm0\n"
+		     "pand %%xmm5, %%xmm1\n"
+		     "pcmpeqd %%xmm4, %%xmm0\n"
+		     "pcmpeqd %%xmm5, %%xmm1\n"
+		     "pand %%xmm6, %%xmm0\n"
+		     "pand %%xmm6, %%xmm1\n"
+		     "pxor %%xmm7, %%xmm0\n"
+		     "pxor %%xmm7, %%xmm1\n"
+		     "movdqu %%xmm0, (%[d])\n"
+		     "movdqu %%xmm1, 16(%[d])\n"
+		     "add $1, %[s]\n"
+		     "add $32, %[d]\n"
+		     "sub $1, %[n]\n"
+		     "jnz 1b\n"
+		     : [s] "+r" (src), [d] "+r" (dst), [n] "+r" (n)
+		     : [e] "r" (e)
+		     : "eax", "memory", "cc");
+}
+
+#else
+
+static inline bool fb_expand_begin(void)
+{
+	return false;
+}
+
+static inline void fb_expand_end(void)
+{
+}
+
+static inline void fb_expand_row16(void *dst, const u8 *src, u32 n,
+				   const struct fb_expand *e)
+{
+}
+
+static inline void fb_expand_row32(void *dst, const u8 *src, u32 n,
+				   const struct fb_expand *e)
+{
+}
+
+#endif
+
+#endif /* _FB_EXPAND_H */
@@ -21,6 +21,9 @@
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/mman.h>
+#include <linux/vmalloc.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 #include <linux/vt.h>
 #include <linux/init.h>
 #include <linux/linux_logo.h>
@@ -736,6 +739,28 @@ static struct fb_info *file_fb_info(struct file *file)
 	return info;
 }
 
+/*
+ * Framebuffers in system RAM are copied straight between user memory and
+ * screen_base. Everything else bounces through a kernel buffer, which is
+ * made as large as possible to keep the number of round trips down.
+ */
+#define FB_BOUNCE_SIZE	(64 * 1024)
+
+static void *fb_alloc_bounce(size_t count, size_t *size)
+{
+	void *buffer;
+
+	*size = min_t(size_t, count, FB_BOUNCE_SIZE);
+	if (*size > PAGE_SIZE) {
+		buffer = kmalloc(*size, GFP_KERNEL | __GFP_NOWARN);
+		if (buffer)
+			return buffer;
+		*size = PAGE_SIZE;
+	}
+
+	return kmalloc(*size, GFP_KERNEL);
+}
+
 static ssize_t
 fb_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 {
@@ -745,6 +770,7 @@ fb_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 	u8 __iomem *src;
 	int c, cnt = 0, err = 0;
 	unsigned long total_size;
+	size_t bsize;
 
 	if (!info || ! info->screen_base)
 		return -ENODEV;
@@ -769,18 +795,23 @@ fb_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 	if (count + p > total_size)
 		count = total_size - p;
 
-	buffer = kmalloc((count > PAGE_SIZE) ? PAGE_SIZE : count,
-			 GFP_KERNEL);
-	if (!buffer)
-		return -ENOMEM;
-
 	src = (u8 __iomem *) (info->screen_base + p);
 
 	if (info->fbops->fb_sync)
 		info->fbops->fb_sync(info);
 
+	if (info->flags & FBINFO_VIRTFB) {
+		c = count - copy_to_user(buf, (u8 __force *)src, count);
+		*ppos += c;
+		return (c || !count) ? c : -EFAULT;
+	}
+
+	buffer = fb_alloc_bounce(count, &bsize);
+	if (!buffer)
+		return -ENOMEM;
+
 	while (count) {
-		c  = (count > PAGE_SIZE) ? PAGE_SIZE : count;
+		c  = (count > bsize) ? bsize : count;
 		dst = buffer;
 		fb_memcpy_fromfb(dst, src, c);
 		dst += c;
@@ -810,6 +841,7 @@ fb_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 	u8 __iomem *dst;
 	int c, cnt = 0, err = 0;
 	unsigned long total_size;
+	size_t bsize;
 
 	if (!info || !info->screen_base)
 		return -ENODEV;
@@ -840,18 +872,25 @@ fb_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 		count = total_size - p;
 	}
 
-	buffer = kmalloc((count > PAGE_SIZE) ? PAGE_SIZE : count,
-			 GFP_KERNEL);
-	if (!buffer)
-		return -ENOMEM;
-
 	dst = (u8 __iomem *) (info->screen_base + p);
 
 	if (info->fbops->fb_sync)
 		info->fbops->fb_sync(info);
 
+	if (info->flags & FBINFO_VIRTFB) {
+		c = count - copy_from_user((u8 __force *)dst, buf, count);
+		if (c < count)
+			err = -EFAULT;
+		*ppos += c;
+		return (c) ? c : err;
+	}
+
+	buffer = fb_alloc_bounce(count, &bsize);
+	if (!buffer)
+		return -ENOMEM;
+
 	while (count) {
-		c = (count > PAGE_SIZE) ? PAGE_SIZE : count;
+		c = (count > bsize) ? bsize : count;
 		src = buffer;
 
 		if (copy_from_user(src, buf, c)) {
@@ -873,6 +912,103 @@ fb_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 	return (cnt) ? cnt : err;
 }
 
+static int fb_pipe_buf_steal(struct pipe_inode_info *pipe,
+			     struct pipe_buffer *buf)
+{
+	return 1;
+}
+
+static const struct pipe_buf_operations fb_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = fb_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+/*
+ * Splicing from a vmalloc'ed framebuffer links its pages into the pipe
+ * without copying them, so frames can be streamed to a file or socket
+ * with splice() or sendfile(). The pipe references the live framebuffer:
+ * what the reader gets is the screen contents at the time it consumes
+ * the pipe. Other framebuffers are read through fb_read().
+ */
+static ssize_t fb_splice_read(struct file *file, loff_t *ppos,
+			      struct pipe_inode_info *pipe, size_t len,
+			      unsigned int flags)
+{
+	struct fb_info *info = file_fb_info(file);
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages = 0,
+		.flags = flags,
+		.ops = &fb_pipe_buf_ops,
+		.spd_release = spd_release_page,
+	};
+	unsigned long p = *ppos;
+	unsigned long total_size;
+	unsigned int off, c;
+	struct page *page;
+	u8 *src;
+	ssize_t ret;
+
+	if (!info || !info->screen_base)
+		return -ENODEV;
+
+	if (info->state != FBINFO_STATE_RUNNING)
+		return -EPERM;
+
+	if (info->fbops->fb_read || !(info->flags & FBINFO_VIRTFB) ||
+	    !is_vmalloc_addr((void __force *)info->screen_base))
+		return default_file_splice_read(file, ppos, pipe, len, flags);
+
+	total_size = info->screen_size;
+
+	if (total_size == 0)
+		total_size = info->fix.smem_len;
+
+	if (p >= total_size)
+		return 0;
+
+	if (len > total_size - p)
+		len = total_size - p;
+
+	if (splice_grow_spd(pipe, &spd))
+		return -ENOMEM;
+
+	if (info->fbops->fb_sync)
+		info->fbops->fb_sync(info);
+
+	src = (u8 __force *)info->screen_base + p;
+
+	while (len && spd.nr_pages < pipe->buffers) {
+		off = offset_in_page(src);
+		c = min_t(size_t, len, PAGE_SIZE - off);
+
+		page = vmalloc_to_page(src);
+		get_page(page);
+		spd.pages[spd.nr_pages] = page;
+		spd.partial[spd.nr_pages].offset = off;
+		spd.partial[spd.nr_pages].len = c;
+		spd.nr_pages++;
+
+		src += c;
+		len -= c;
+	}
+
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret > 0)
+		*ppos += ret;
+
+	splice_shrink_spd(pipe, &spd);
+	return ret;
+}
+
 int
 fb_pan_display(struct fb_info *info, struct fb_var_screeninfo *var)
 {
@@ -1458,6 +1594,7 @@ static const struct file_operations fb_fops = {
 	.owner =	THIS_MODULE,
 	.read =		fb_read,
 	.write =	fb_write,
+	.splice_read =	fb_splice_read,
 	.unlocked_ioctl = fb_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = fb_compat_ioctl,
@@ -0,0 +1,151 @@
+/*
+ * linux/drivers/video/fbtile.c - Split software drawing across cpus
+ *
+ * Large fills and copies in system RAM framebuffers are bound by a single
+ * cpu's store bandwidth. fb_tile_run() cuts such an operation into tiles
+ * and lets idle cpus pick them up from a shared counter. The caller works
+ * on tiles too, so nothing is lost if the helpers are late, and it never
+ * sleeps: it only spins for tiles that are already in progress elsewhere.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file COPYING in the main directory of this archive
+ * for more details.
+ */
+#include <linux/module.h>
+#include <linux/fb.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/hardirq.h>
+#include <linux/kernel.h>
+
+/* Below this many bytes per tile waking up other cpus doesn't pay off */
+#define FB_TILE_MIN_BYTES	(256 * 1024)
+#define FB_TILE_MAX		8
+
+static unsigned int tile_cpus;
+module_param(tile_cpus, uint, 0644);
+MODULE_PARM_DESC(tile_cpus, "Max cpus drawing a single rectangle "
+		 "(0 = all online, 1 = no tiling)");
+
+struct fb_tile_job;
+
+struct fb_tile_worker {
+	struct work_struct work;
+	struct fb_tile_job *job;
+};
+
+struct fb_tile_job {
+	fb_tile_fn fn;
+	struct fb_info *info;
+	void *arg;
+	u32 units;
+	u32 chunk;
+	u32 tiles;
+	atomic_t next;
+	atomic_t done;
+	atomic_t refcount;
+	struct fb_tile_worker worker[FB_TILE_MAX - 1];
+};
+
+static void fb_tile_put(struct fb_tile_job *job)
+{
+	if (atomic_dec_and_test(&job->refcount))
+		kfree(job);
+}
+
+static void fb_tile_grab(struct fb_tile_job *job)
+{
+	u32 tile, start;
+
+	while ((tile = atomic_inc_return(&job->next) - 1) < job->tiles) {
+		start = tile * job->chunk;
+		job->fn(job->info, job->arg, start,
+			min(job->chunk, job->units - start));
+		smp_mb__before_atomic_inc();
+		atomic_inc(&job->done);
+	}
+}
+
+static void fb_tile_work(struct work_struct *work)
+{
+	struct fb_tile_job *job =
+		container_of(work, struct fb_tile_worker, work)->job;
+
+	fb_tile_grab(job);
+	fb_tile_put(job);
+}
+
+/*
+ * fb_tile_run - run a drawing operation on several cpus
+ * @info: frame buffer
+ * @fn: draws @count units starting at @start
+ * @arg: passed to @fn
+ * @units: number of independent units (lines or columns) to split
+ * @align: tiles start at multiples of @align units
+ * @bytes: amount of memory touched, decides how many cpus are worth it
+ *
+ * @fn must not touch memory drawn by any other range of units. Falls back
+ * to a single call of @fn when the work is small, only one cpu is online
+ * or the caller runs with interrupts disabled, e.g. from printk.
+ */
+void fb_tile_run(struct fb_info *info, fb_tile_fn fn, void *arg,
+		 u32 units, u32 align, size_t bytes)
+{
+	struct fb_tile_job *job;
+	u32 tiles, queued = 0;
+	int cpu, this_cpu;
+
+	tiles = min_t(size_t, bytes / FB_TILE_MIN_BYTES, FB_TILE_MAX);
+	tiles = min(tiles, num_online_cpus());
+	if (tile_cpus)
+		tiles = min(tiles, tile_cpus);
+	if (align)
+		tiles = min(tiles, DIV_ROUND_UP(units, align));
+
+	if (tiles <= 1 || irqs_disabled() || in_interrupt() ||
+	    oops_in_progress)
+		goto serial;
+
+	job = kmalloc(sizeof(*job), GFP_ATOMIC | __GFP_NOWARN);
+	if (!job)
+		goto serial;
+
+	job->fn = fn;
+	job->info = info;
+	job->arg = arg;
+	job->units = units;
+	job->chunk = roundup(DIV_ROUND_UP(units, tiles), align ? align : 1);
+	job->tiles = DIV_ROUND_UP(units, job->chunk);
+	atomic_set(&job->next, 0);
+	atomic_set(&job->done, 0);
+	atomic_set(&job->refcount, 1);
+
+	this_cpu = get_cpu();
+	for_each_online_cpu(cpu) {
+		struct fb_tile_worker *w = &job->worker[queued];
+
+		if (queued + 1 >= job->tiles)
+			break;
+		if (cpu == this_cpu)
+			continue;
+
+		INIT_WORK(&w->work, fb_tile_work);
+		w->job = job;
+		atomic_inc(&job->refcount);
+		queue_work_on(cpu, system_wq, &w->work);
+		queued++;
+	}
+	put_cpu();
+
+	fb_tile_grab(job);
+	while (atomic_read(&job->done) < job->tiles)
+		cpu_relax();
+	smp_mb();
+
+	fb_tile_put(job);
+	return;
+
+serial:
+	fn(info, arg, 0, units);
+}
+EXPORT_SYMBOL(fb_tile_run);
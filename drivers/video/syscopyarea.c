@@ -16,6 +16,7 @@
 #include <linux/kernel.h>
 #include <linux/string.h>
 #include <linux/fb.h>
+#include <linux/cache.h>
 #include <asm/types.h>
 #include <asm/io.h>
 #include "fb_draw.h"
@@ -312,7 +313,39 @@ bitcpy_rev(struct fb_info *p, unsigned long *dst, int dst_idx,
 	}
 }
 
-void sys_copyarea(struct fb_info *p, const struct fb_copyarea *area)
+    /*
+     *  Pixels made of whole bytes are copied with memmove(), which uses the
+     *  widest stores the cpu has and takes care of overlap within a line
+     */
+
+static void
+bytecpy_rect(struct fb_info *p, const struct fb_copyarea *area)
+{
+	u32 Bpp = p->var.bits_per_pixel / 8, pitch = p->fix.line_length;
+	u32 height = area->height;
+	size_t n = area->width * Bpp;
+	u8 *base = (u8 __force *)p->screen_base;
+	u8 *dst = base + area->dy * pitch + area->dx * Bpp;
+	u8 *src = base + area->sy * pitch + area->sx * Bpp;
+
+	if (area->dy > area->sy) {
+		dst += (height - 1) * pitch;
+		src += (height - 1) * pitch;
+		while (height--) {
+			memmove(dst, src, n);
+			dst -= pitch;
+			src -= pitch;
+		}
+	} else {
+		while (height--) {
+			memmove(dst, src, n);
+			dst += pitch;
+			src += pitch;
+		}
+	}
+}
+
+static void sys_copyarea_rect(struct fb_info *p, const struct fb_copyarea *area)
 {
 	u32 dx = area->dx, dy = area->dy, sx = area->sx, sy = area->sy;
 	u32 height = area->height, width = area->width;
@@ -321,8 +354,10 @@ void sys_copyarea(struct fb_info *p, const struct fb_copyarea *area)
 	int bits = BITS_PER_LONG, bytes = bits >> 3;
 	int dst_idx = 0, src_idx = 0, rev_copy = 0;
 
-	if (p->state != FBINFO_STATE_RUNNING)
+	if (!(p->var.bits_per_pixel % 8)) {
+		bytecpy_rect(p, area);
 		return;
+	}
 
 	/* if the beginning of the target area might overlap with the end of
 	the source area, be have to copy the area reverse. */
@@ -341,9 +376,6 @@ void sys_copyarea(struct fb_info *p, const struct fb_copyarea *area)
 	dst_idx += dy*bits_per_line + dx*p->var.bits_per_pixel;
 	src_idx += sy*bits_per_line + sx*p->var.bits_per_pixel;
 
-	if (p->fbops->fb_sync)
-		p->fbops->fb_sync(p);
-
 	if (rev_copy) {
 		while (height--) {
 			dst_idx -= bits_per_line;
@@ -369,6 +401,67 @@ void sys_copyarea(struct fb_info *p, const struct fb_copyarea *area)
 	}
 }
 
+static void sys_copyarea_lines(struct fb_info *p, void *arg, u32 start,
+			       u32 count)
+{
+	struct fb_copyarea tile = *(struct fb_copyarea *)arg;
+
+	tile.dy += start;
+	tile.sy += start;
+	tile.height = count;
+	sys_copyarea_rect(p, &tile);
+}
+
+static void sys_copyarea_columns(struct fb_info *p, void *arg, u32 start,
+				 u32 count)
+{
+	struct fb_copyarea tile = *(struct fb_copyarea *)arg;
+
+	tile.dx += start;
+	tile.sx += start;
+	tile.width = count;
+	sys_copyarea_rect(p, &tile);
+}
+
+void sys_copyarea(struct fb_info *p, const struct fb_copyarea *area)
+{
+	u32 dy = area->dy, sy = area->sy, height = area->height;
+	u32 bpp = p->var.bits_per_pixel;
+	size_t size = (size_t)area->width * height * bpp / 8;
+
+	if (p->state != FBINFO_STATE_RUNNING)
+		return;
+
+	if (p->fbops->fb_sync)
+		p->fbops->fb_sync(p);
+
+	/*
+	 * Lines can be copied in any order if no line reads what another
+	 * one writes. Partial pixels are copied with read-modify-write of
+	 * whole longs, so no long may straddle two lines either.
+	 */
+	if (dy == sy || dy + height <= sy || sy + height <= dy) {
+		if ((bpp % 8) && (p->fix.line_length % sizeof(unsigned long)))
+			size = 0;
+		fb_tile_run(p, sys_copyarea_lines, (void *)area, height, 1,
+			    size);
+		return;
+	}
+
+	/*
+	 * Overlapping lines have to be copied in order, but a vertical
+	 * scroll can still be split into columns each copied in the right
+	 * direction.
+	 */
+	if (area->dx == area->sx && !(bpp % 8)) {
+		fb_tile_run(p, sys_copyarea_columns, (void *)area, area->width,
+			    max_t(u32, L1_CACHE_BYTES / (bpp / 8), 1), size);
+		return;
+	}
+
+	sys_copyarea_rect(p, area);
+}
+
 EXPORT_SYMBOL(sys_copyarea);
 
 MODULE_AUTHOR("Antonino Daplas <adaplas@pol.net>");
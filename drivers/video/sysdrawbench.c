@@ -0,0 +1,193 @@
+/*
+ *  Benchmark for sys_fillrect() and sys_copyarea()
+ *
+ *  Times full screen fills, console style vertical scrolls and horizontal
+ *  moves on 1080p and 4K framebuffers in system RAM, and checks the copies
+ *  against a plain memmove() of the same area. Compare runs with
+ *  fb.tile_cpus=1 and the default to see what tiling buys.
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.  See the file COPYING in the main directory of this archive for
+ *  more details.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/fb.h>
+
+static unsigned int loops = 50;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Operations timed per test");
+
+static unsigned int bpp = 32;
+module_param(bpp, uint, 0444);
+MODULE_PARM_DESC(bpp, "Bits per pixel (8, 16 or 32)");
+
+struct sysdraw_mode {
+	const char *name;
+	u32 xres;
+	u32 yres;
+};
+
+static const struct sysdraw_mode sysdraw_modes[] = {
+	{ "1080p", 1920, 1080 },
+	{ "4K", 3840, 2160 },
+};
+
+static u32 sysdraw_palette[16];
+static struct fb_ops sysdraw_ops;
+
+static void sysdraw_report(const char *mode, const char *test, size_t bytes,
+			   ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (!ns)
+		ns = 1;
+	pr_info("%s %s: %llu us/op, %llu MB/s\n", mode, test,
+		(unsigned long long)div_u64(ns, loops * NSEC_PER_USEC),
+		(unsigned long long)div64_u64((u64)bytes * loops * NSEC_PER_SEC,
+					      ns * 1000000));
+}
+
+static int sysdraw_check(struct fb_info *info, const u8 *ref, const char *mode,
+			 const char *test)
+{
+	if (!memcmp((u8 __force *)info->screen_base, ref, info->screen_size))
+		return 0;
+
+	pr_err("%s %s: result differs from reference\n", mode, test);
+	return -EINVAL;
+}
+
+static void sysdraw_pattern(struct fb_info *info, u8 *ref)
+{
+	u32 *p = (u32 __force *)info->screen_base;
+	u32 i;
+
+	for (i = 0; i < info->screen_size / 4; i++)
+		p[i] = i * 2654435761u;
+	memcpy(ref, p, info->screen_size);
+}
+
+static int sysdraw_run(struct fb_info *info, const struct sysdraw_mode *m)
+{
+	u32 pitch = info->fix.line_length, Bpp = bpp / 8;
+	size_t screen = info->screen_size;
+	struct fb_fillrect fill = {
+		.dx = 0, .dy = 0, .width = m->xres, .height = m->yres,
+		.color = 7, .rop = ROP_COPY,
+	};
+	struct fb_copyarea scroll = {
+		.dx = 0, .dy = 0, .sx = 0, .sy = 16,
+		.width = m->xres, .height = m->yres - 16,
+	};
+	struct fb_copyarea move = {
+		.dx = 8, .dy = 0, .sx = 0, .sy = 0,
+		.width = m->xres - 8, .height = m->yres,
+	};
+	ktime_t start;
+	unsigned int i;
+	u8 *ref;
+	u32 y;
+	int ret = 0;
+
+	ref = vmalloc(screen);
+	if (!ref)
+		return -ENOMEM;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		sys_fillrect(info, &fill);
+	sysdraw_report(m->name, "fill", screen, start);
+
+	/* Scroll up by one 8x16 text line, like fbcon does */
+	sysdraw_pattern(info, ref);
+	sys_copyarea(info, &scroll);
+	memmove(ref, ref + 16 * pitch, (m->yres - 16) * pitch);
+	ret = sysdraw_check(info, ref, m->name, "scroll");
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		sys_copyarea(info, &scroll);
+	sysdraw_report(m->name, "scroll", (size_t)scroll.height * pitch,
+		       start);
+
+	/* Move right by one character, overlapping within every line */
+	sysdraw_pattern(info, ref);
+	sys_copyarea(info, &move);
+	for (y = 0; y < m->yres; y++)
+		memmove(ref + y * pitch + move.dx * Bpp, ref + y * pitch,
+			move.width * Bpp);
+	ret = ret ? : sysdraw_check(info, ref, m->name, "move");
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		sys_copyarea(info, &move);
+	sysdraw_report(m->name, "move", (size_t)move.width * Bpp * m->yres,
+		       start);
+
+	vfree(ref);
+	return ret;
+}
+
+static int __init sysdraw_init(void)
+{
+	struct fb_info *info;
+	unsigned int i;
+	int ret = 0;
+
+	if (bpp != 8 && bpp != 16 && bpp != 32)
+		return -EINVAL;
+
+	info = framebuffer_alloc(0, NULL);
+	if (!info)
+		return -ENOMEM;
+
+	info->fbops = &sysdraw_ops;
+	info->pseudo_palette = sysdraw_palette;
+	info->flags = FBINFO_DEFAULT | FBINFO_VIRTFB;
+	info->state = FBINFO_STATE_RUNNING;
+	info->fix.type = FB_TYPE_PACKED_PIXELS;
+	info->fix.visual = bpp == 8 ? FB_VISUAL_PSEUDOCOLOR :
+		FB_VISUAL_TRUECOLOR;
+	info->var.bits_per_pixel = bpp;
+	for (i = 0; i < ARRAY_SIZE(sysdraw_palette); i++)
+		sysdraw_palette[i] = i * 0x01010101u;
+
+	for (i = 0; i < ARRAY_SIZE(sysdraw_modes) && !ret; i++) {
+		const struct sysdraw_mode *m = &sysdraw_modes[i];
+
+		info->var.xres = info->var.xres_virtual = m->xres;
+		info->var.yres = info->var.yres_virtual = m->yres;
+		info->fix.line_length = m->xres * bpp / 8;
+		info->screen_size = info->fix.line_length * m->yres;
+		info->screen_base = (char __iomem __force *)
+			vmalloc(info->screen_size);
+		if (!info->screen_base) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = sysdraw_run(info, m);
+		vfree((void __force *)info->screen_base);
+	}
+
+	framebuffer_release(info);
+	return ret;
+}
+
+static void __exit sysdraw_exit(void)
+{
+}
+
+module_init(sysdraw_init);
+module_exit(sysdraw_exit);
+
+MODULE_DESCRIPTION("Benchmark for system RAM fill and copy");
+MODULE_LICENSE("GPL");
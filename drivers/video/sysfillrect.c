@@ -240,18 +240,17 @@ bitfill_unaligned_rev(struct fb_info *p, unsigned long *dst, int dst_idx,
 	}
 }
 
-void sys_fillrect(struct fb_info *p, const struct fb_fillrect *rect)
+static void sys_fillrect_lines(struct fb_info *p, void *arg, u32 start,
+			       u32 count)
 {
+	const struct fb_fillrect *rect = arg;
 	unsigned long pat, pat2, fg;
-	unsigned long width = rect->width, height = rect->height;
+	unsigned long width = rect->width, height = count;
 	int bits = BITS_PER_LONG, bytes = bits >> 3;
 	u32 bpp = p->var.bits_per_pixel;
 	unsigned long *dst;
 	int dst_idx, left;
 
-	if (p->state != FBINFO_STATE_RUNNING)
-		return;
-
 	if (p->fix.visual == FB_VISUAL_TRUECOLOR ||
 	    p->fix.visual == FB_VISUAL_DIRECTCOLOR )
 		fg = ((u32 *) (p->pseudo_palette))[rect->color];
@@ -262,11 +261,9 @@ void sys_fillrect(struct fb_info *p, const struct fb_fillrect *rect)
 
 	dst = (unsigned long *)((unsigned long)p->screen_base & ~(bytes-1));
 	dst_idx = ((unsigned long)p->screen_base & (bytes - 1))*8;
-	dst_idx += rect->dy*p->fix.line_length*8+rect->dx*bpp;
+	dst_idx += (rect->dy + start)*p->fix.line_length*8+rect->dx*bpp;
 	/* FIXME For now we support 1-32 bpp only */
 	left = bits % bpp;
-	if (p->fbops->fb_sync)
-		p->fbops->fb_sync(p);
 	if (!left) {
 		void (*fill_op32)(struct fb_info *p, unsigned long *dst,
 				  int dst_idx, unsigned long pat, unsigned n,
@@ -328,6 +325,28 @@ void sys_fillrect(struct fb_info *p, const struct fb_fillrect *rect)
 	}
 }
 
+void sys_fillrect(struct fb_info *p, const struct fb_fillrect *rect)
+{
+	u32 bpp = p->var.bits_per_pixel;
+	size_t size = (size_t)rect->width * rect->height * bpp / 8;
+
+	if (p->state != FBINFO_STATE_RUNNING)
+		return;
+
+	if (p->fbops->fb_sync)
+		p->fbops->fb_sync(p);
+
+	/*
+	 * Lines are filled with read-modify-write of whole longs, they can
+	 * only be handed to different cpus if no long straddles two lines.
+	 */
+	if (p->fix.line_length % sizeof(unsigned long))
+		size = 0;
+
+	fb_tile_run(p, sys_fillrect_lines, (void *)rect, rect->height, 1,
+		    size);
+}
+
 EXPORT_SYMBOL(sys_fillrect);
 
 MODULE_AUTHOR("Antonino Daplas <adaplas@pol.net>");
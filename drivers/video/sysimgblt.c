@@ -14,6 +14,7 @@
 #include <linux/string.h>
 #include <linux/fb.h>
 #include <asm/types.h>
+#include "fb_expand.h"
 
 #define DEBUG
 
@@ -237,6 +238,50 @@ static void fast_imageblit(const struct fb_image *image, struct fb_info *p,
 	}
 }
 
+/*
+ * expand_imageblit - monochrome color expansion at pixel granularity
+ *
+ * Only if:  bits_per_pixel == 16 or 32 and fb_expand_usable()
+ *
+ * Handles any destination pixel and width. Whole bytes of each row are
+ * expanded with the SIMD kernels if @simd is set, the rest one pixel at a
+ * time.
+ */
+static void expand_imageblit(const struct fb_image *image, struct fb_info *p,
+			     u8 *dst1, u32 fgcolor, u32 bgcolor, bool simd)
+{
+	u32 bpp = p->var.bits_per_pixel, spitch = (image->width + 7)/8;
+	u32 width = image->width, full = simd ? width/8 : 0;
+	const u8 *src = image->data;
+	struct fb_expand e;
+	u32 i, j;
+
+	if (full)
+		fb_expand_init(&e, bpp, fgcolor, bgcolor);
+
+	for (i = image->height; i--; ) {
+		if (bpp == 16) {
+			u16 *dst = (u16 *) dst1;
+
+			if (full)
+				fb_expand_row16(dst, src, full, &e);
+			for (j = full * 8; j < width; j++)
+				dst[j] = (src[j/8] & (0x80 >> (j & 7))) ?
+					fgcolor : bgcolor;
+		} else {
+			u32 *dst = (u32 *) dst1;
+
+			if (full)
+				fb_expand_row32(dst, src, full, &e);
+			for (j = full * 8; j < width; j++)
+				dst[j] = (src[j/8] & (0x80 >> (j & 7))) ?
+					fgcolor : bgcolor;
+		}
+		dst1 += p->fix.line_length;
+		src += spitch;
+	}
+}
+
 void sys_imageblit(struct fb_info *p, const struct fb_image *image)
 {
 	u32 fgcolor, bgcolor, start_index, bitstart, pitch_index = 0;
@@ -244,6 +289,7 @@ void sys_imageblit(struct fb_info *p, const struct fb_image *image)
 	u32 width = image->width;
 	u32 dx = image->dx, dy = image->dy;
 	void *dst1;
+	u8 *dst2;
 
 	if (p->state != FBINFO_STATE_RUNNING)
 		return;
@@ -253,6 +299,7 @@ void sys_imageblit(struct fb_info *p, const struct fb_image *image)
 	pitch_index = (p->fix.line_length & (bpl - 1)) * 8;
 
 	bitstart /= 8;
+	dst2 = (u8 __force *)p->screen_base + bitstart;
 	bitstart &= ~(bpl - 1);
 	dst1 = (void __force *)p->screen_base + bitstart;
 
@@ -269,10 +316,17 @@ void sys_imageblit(struct fb_info *p, const struct fb_image *image)
 			bgcolor = image->bg_color;
 		}
 
-		if (32 % bpp == 0 && !start_index && !pitch_index &&
+		if (fb_expand_usable(p, bpp) && width >= 8 &&
+		    fb_expand_begin()) {
+			expand_imageblit(image, p, dst2, fgcolor, bgcolor, true);
+			fb_expand_end();
+		} else if (32 % bpp == 0 && !start_index && !pitch_index &&
 		    ((width & (32/bpp-1)) == 0) &&
 		    bpp >= 8 && bpp <= 32)
 			fast_imageblit(image, p, dst1, fgcolor, bgcolor);
+		else if (fb_expand_usable(p, bpp))
+			expand_imageblit(image, p, dst2, fgcolor, bgcolor,
+					 false);
 		else
 			slow_imageblit(image, p, dst1, fgcolor, bgcolor,
 					start_index, pitch_index);
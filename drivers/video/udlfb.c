@@ -37,13 +37,13 @@ static struct fb_fix_screeninfo dlfb_fix = {
 	.type =         FB_TYPE_PACKED_PIXELS,
 	.visual =       FB_VISUAL_TRUECOLOR,
 	.xpanstep =     0,
-	.ypanstep =     0,
+	.ypanstep =     1,
 	.ywrapstep =    0,
 	.accel =        FB_ACCEL_NONE,
 };
 
 static const u32 udlfb_info_flags = FBINFO_DEFAULT | FBINFO_READS_FAST |
-		FBINFO_VIRTFB |
+		FBINFO_VIRTFB | FBINFO_DIRECT_DRAW |
 		FBINFO_HWACCEL_IMAGEBLIT | FBINFO_HWACCEL_FILLRECT |
 		FBINFO_HWACCEL_COPYAREA | FBINFO_MISC_ALWAYS_SETPAR;
 
@@ -62,6 +62,7 @@ MODULE_DEVICE_TABLE(usb, id_table);
 /* module options */
 static int console;   /* Optionally allow fbcon to consume first framebuffer */
 static int fb_defio;  /* Optionally enable experimental fb_defio mmap support */
+static int vscreens = 2; /* Virtual framebuffer height, in screens */
 
 /* dlfb keeps a list of urbs for efficient bulk transfers */
 static void dlfb_urb_completion(struct urb *urb);
@@ -266,8 +267,9 @@ static int dlfb_set_video_mode(struct dlfb_data *dev,
 	*/
 	wrptr = dlfb_vidreg_lock(buf);
 	wrptr = dlfb_set_color_depth(wrptr, 0x00);
-	/* set base for 16bpp segment to 0 */
-	wrptr = dlfb_set_base16bpp(wrptr, 0);
+	/* set base for 16bpp segment to the panned start of the fb */
+	wrptr = dlfb_set_base16bpp(wrptr,
+				   var->yoffset * dev->info->fix.line_length);
 	/* set base for 8bpp segment to end of fb */
 	wrptr = dlfb_set_base8bpp(wrptr, dev->info->fix.smem_len);
 
@@ -554,7 +556,7 @@ int dlfb_handle_damage(struct dlfb_data *dev, int x, int y,
 
 	if ((width <= 0) ||
 	    (x + width > dev->info->var.xres) ||
-	    (y + height > dev->info->var.yres))
+	    (y + height > dev->info->var.yres_virtual))
 		return -EINVAL;
 
 	if (!atomic_read(&dev->usb_active))
@@ -632,8 +634,10 @@ static void dlfb_ops_copyarea(struct fb_info *info,
 
 	sys_copyarea(info, area);
 
-	dlfb_handle_damage(dev, area->dx, area->dy,
-			area->width, area->height, info->screen_base);
+	if (!fb_damage_batch(info, area->dx, area->dy,
+			     area->width, area->height))
+		dlfb_handle_damage(dev, area->dx, area->dy,
+				area->width, area->height, info->screen_base);
 }
 
 static void dlfb_ops_imageblit(struct fb_info *info,
@@ -643,8 +647,10 @@ static void dlfb_ops_imageblit(struct fb_info *info,
 
 	sys_imageblit(info, image);
 
-	dlfb_handle_damage(dev, image->dx, image->dy,
-			image->width, image->height, info->screen_base);
+	if (!fb_damage_batch(info, image->dx, image->dy,
+			     image->width, image->height))
+		dlfb_handle_damage(dev, image->dx, image->dy,
+				image->width, image->height, info->screen_base);
 }
 
 static void dlfb_ops_fillrect(struct fb_info *info,
@@ -654,8 +660,19 @@ static void dlfb_ops_fillrect(struct fb_info *info,
 
 	sys_fillrect(info, rect);
 
-	dlfb_handle_damage(dev, rect->dx, rect->dy, rect->width,
-			      rect->height, info->screen_base);
+	if (!fb_damage_batch(info, rect->dx, rect->dy,
+			     rect->width, rect->height))
+		dlfb_handle_damage(dev, rect->dx, rect->dy, rect->width,
+				      rect->height, info->screen_base);
+}
+
+/* fbcon damage collected over a whole console update */
+static void dlfb_ops_damage(struct fb_info *info, u32 x, u32 y,
+			    u32 width, u32 height)
+{
+	struct dlfb_data *dev = info->par;
+
+	dlfb_handle_damage(dev, x, y, width, height, info->screen_base);
 }
 
 /*
@@ -789,8 +806,8 @@ static int dlfb_ops_ioctl(struct fb_info *info, unsigned int cmd,
 		if (area->y < 0)
 			area->y = 0;
 
-		if (area->y > info->var.yres)
-			area->y = info->var.yres;
+		if (area->y > info->var.yres_virtual)
+			area->y = info->var.yres_virtual;
 
 		dlfb_handle_damage(dev, area->x, area->y, area->w, area->h,
 			   info->screen_base);
@@ -1002,6 +1019,15 @@ static int dlfb_ops_check_var(struct fb_var_screeninfo *var,
 	if ((var->xres * var->yres * 2) > info->fix.smem_len)
 		return -EINVAL;
 
+	/* whatever is left of the framebuffer can be panned over */
+	var->xres_virtual = var->xres;
+	if (var->yres_virtual < var->yres)
+		var->yres_virtual = var->yres;
+	if ((var->xres * var->yres_virtual * 2) > info->fix.smem_len)
+		var->yres_virtual = info->fix.smem_len / (var->xres * 2);
+	if (var->yoffset + var->yres > var->yres_virtual)
+		var->yoffset = 0;
+
 	/* set device-specific elements of var unrelated to mode */
 	dlfb_var_color_format(var);
 
@@ -1039,6 +1065,35 @@ static int dlfb_ops_set_par(struct fb_info *info)
 	return result;
 }
 
+/*
+ * The device keeps a copy of the whole virtual framebuffer, so panning only
+ * moves the base of the displayed area. Scrolling fbcon this way sends the
+ * newly exposed line instead of the whole screen.
+ */
+static int dlfb_ops_pan_display(struct fb_var_screeninfo *var,
+				struct fb_info *info)
+{
+	struct dlfb_data *dev = info->par;
+	char *bufptr;
+	struct urb *urb;
+
+	if (!atomic_read(&dev->usb_active))
+		return 0;
+
+	urb = dlfb_get_urb(dev);
+	if (!urb)
+		return -ENOMEM;
+
+	bufptr = (char *) urb->transfer_buffer;
+	bufptr = dlfb_vidreg_lock(bufptr);
+	bufptr = dlfb_set_base16bpp(bufptr,
+				    var->yoffset * info->fix.line_length);
+	bufptr = dlfb_vidreg_unlock(bufptr);
+
+	return dlfb_submit_urb(dev, urb, bufptr -
+			       (char *) urb->transfer_buffer);
+}
+
 /*
  * In order to come back from full DPMS off, we need to set the mode again
  */
@@ -1076,11 +1131,13 @@ static struct fb_ops dlfb_ops = {
 	.fb_fillrect = dlfb_ops_fillrect,
 	.fb_copyarea = dlfb_ops_copyarea,
 	.fb_imageblit = dlfb_ops_imageblit,
+	.fb_damage = dlfb_ops_damage,
 	.fb_mmap = dlfb_ops_mmap,
 	.fb_ioctl = dlfb_ops_ioctl,
 	.fb_open = dlfb_ops_open,
 	.fb_release = dlfb_ops_release,
 	.fb_blank = dlfb_ops_blank,
+	.fb_pan_display = dlfb_ops_pan_display,
 	.fb_check_var = dlfb_ops_check_var,
 	.fb_set_par = dlfb_ops_set_par,
 };
@@ -1101,7 +1158,7 @@ static int dlfb_realloc_framebuffer(struct dlfb_data *dev, struct fb_info *info)
 
 	pr_warn("Reallocating framebuffer. Addresses will change!\n");
 
-	new_len = info->fix.line_length * info->var.yres;
+	new_len = info->fix.line_length * info->var.yres_virtual;
 
 	if (PAGE_ALIGN(new_len) > old_len) {
 		/*
@@ -1121,7 +1178,8 @@ static int dlfb_realloc_framebuffer(struct dlfb_data *dev, struct fb_info *info)
 		info->screen_base = new_fb;
 		info->fix.smem_len = PAGE_ALIGN(new_len);
 		info->fix.smem_start = (unsigned long) new_fb;
-		info->flags = udlfb_info_flags;
+		info->flags = udlfb_info_flags |
+			(info->flags & FBINFO_MISC_DAMAGE_BATCH);
 
 		/*
 		 * Second framebuffer copy to mirror the framebuffer state
@@ -1278,6 +1336,7 @@ static int dlfb_setup_modes(struct dlfb_data *dev,
 
 		fb_videomode_to_var(&info->var, default_vmode);
 		dlfb_var_color_format(&info->var);
+		info->var.yres_virtual = info->var.yres * max(vscreens, 1);
 
 		/*
 		 * with mode size info, we can now alloc our framebuffer.
@@ -1888,6 +1947,10 @@ MODULE_PARM_DESC(console, "Allow fbcon to consume first framebuffer found");
 module_param(fb_defio, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
 MODULE_PARM_DESC(fb_defio, "Enable fb_defio mmap support. *Experimental*");
 
+module_param(vscreens, int, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(vscreens, "Virtual framebuffer height in screens, "
+		 "fbcon scrolls by panning if > 1");
+
 MODULE_AUTHOR("Roberto De Ioris <roberto@unbit.it>, "
 	      "Jaya Kumar <jayakumar.lkml@gmail.com>, "
 	      "Bernie Thompson <bernie@plugable.com>");
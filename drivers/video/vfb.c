@@ -514,7 +514,7 @@ static int __devinit vfb_probe(struct platform_device *dev)
 	info->fix = vfb_fix;
 	info->pseudo_palette = info->par;
 	info->par = NULL;
-	info->flags = FBINFO_FLAG_DEFAULT;
+	info->flags = FBINFO_FLAG_DEFAULT | FBINFO_DIRECT_DRAW;
 
 	retval = fb_alloc_cmap(&info->cmap, 256, 0);
 	if (retval < 0)
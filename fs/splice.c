@@ -263,11 +263,13 @@ ssize_t splice_to_pipe(struct pipe_inode_info *pipe,
 
 	return ret;
 }
+EXPORT_SYMBOL_GPL(splice_to_pipe);
 
 void spd_release_page(struct splice_pipe_desc *spd, unsigned int i)
 {
 	page_cache_release(spd->pages[i]);
 }
+EXPORT_SYMBOL_GPL(spd_release_page);
 
 /*
  * Check if we need to grow the arrays holding pages and partial page
@@ -288,6 +290,7 @@ int splice_grow_spd(struct pipe_inode_info *pipe, struct splice_pipe_desc *spd)
 	kfree(spd->partial);
 	return -ENOMEM;
 }
+EXPORT_SYMBOL_GPL(splice_grow_spd);
 
 void splice_shrink_spd(struct pipe_inode_info *pipe,
 		       struct splice_pipe_desc *spd)
@@ -298,6 +301,7 @@ void splice_shrink_spd(struct pipe_inode_info *pipe,
 	kfree(spd->pages);
 	kfree(spd->partial);
 }
+EXPORT_SYMBOL_GPL(splice_shrink_spd);
 
 static int
 __generic_file_splice_read(struct file *in, loff_t *ppos,
@@ -57,6 +57,7 @@
 #include <linux/cdev.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/dma-buf.h>
 #if defined(__alpha__) || defined(__powerpc__)
 #include <asm/pgtable.h>	/* For pte_wrprotect */
 #endif
@@ -149,6 +150,7 @@ int drm_err(const char *func, const char *format, ...);
 #define DRIVER_IRQ_VBL2    0x800
 #define DRIVER_GEM         0x1000
 #define DRIVER_MODESET     0x2000
+#define DRIVER_PRIME       0x4000
 
 #define DRIVER_BUS_PCI 0x1
 #define DRIVER_BUS_PLATFORM 0x2
@@ -409,6 +411,16 @@ struct drm_pending_event {
 	void (*destroy)(struct drm_pending_event *event);
 };
 
+/*
+ * dma-bufs this file has imported or exported, each with the handle it
+ * maps to, so that importing the same buffer again returns the same
+ * handle.
+ */
+struct drm_prime_file_private {
+	struct list_head head;
+	struct mutex lock;
+};
+
 /** File private data */
 struct drm_file {
 	int authenticated;
@@ -422,7 +434,10 @@ struct drm_file {
 
 	/** Mapping of mm object handles to object pointers. */
 	struct idr object_idr;
-	/** Lock for synchronization of access to object_idr. */
+	/**
+	 * Lock for synchronization of changes to object_idr, lookups only
+	 * need rcu_read_lock().
+	 */
 	spinlock_t table_lock;
 
 	struct file *filp;
@@ -436,6 +451,8 @@ struct drm_file {
 	wait_queue_head_t event_wait;
 	struct list_head event_list;
 	int event_space;
+
+	struct drm_prime_file_private prime;
 };
 
 /** Wait queue */
@@ -598,6 +615,7 @@ struct drm_ati_pcigart_info {
 struct drm_gem_mm {
 	struct drm_mm offset_manager;	/**< Offset mgmt for buffer objects */
 	struct drm_open_hash offset_hash; /**< User token hash table for maps */
+	rwlock_t offset_lock;		/**< Protects the two above */
 };
 
 /**
@@ -651,6 +669,26 @@ struct drm_gem_object {
 	uint32_t pending_write_domain;
 
 	void *driver_private;
+
+	/**
+	 * dma-buf this object was exported as. Holds a reference for as
+	 * long as the object has handles, so every export of the object
+	 * yields the same dma-buf.
+	 */
+	struct dma_buf *export_dma_buf;
+
+	/* Attachment to the dma-buf this object was imported from */
+	struct dma_buf_attachment *import_attach;
+	/* Releases import_attach once the object is freed */
+	struct drm_prime_release *import_release;
+
+	/**
+	 * Handle lookups only hold rcu_read_lock() and may still look at
+	 * the refcount of an object whose last reference was just dropped.
+	 * Drivers must therefore free the memory of the object with
+	 * kfree_rcu() on this head, or otherwise after a grace period.
+	 */
+	struct rcu_head rcu;
 };
 
 #include "drm_crtc.h"
@@ -903,6 +941,35 @@ struct drm_driver {
 			    struct drm_device *dev,
 			    uint32_t handle);
 
+	/*
+	 * Buffer sharing. The ioctls call prime_handle_to_fd and
+	 * prime_fd_to_handle, usually drm_gem_prime_handle_to_fd() and
+	 * drm_gem_prime_fd_to_handle(), which in turn use gem_prime_export
+	 * and gem_prime_import. drm_gem_prime_export() and
+	 * drm_gem_prime_import() implement those on top of the
+	 * gem_prime_get_sg_table, gem_prime_import_sg_table, gem_prime_vmap,
+	 * gem_prime_vunmap and gem_prime_mmap hooks.
+	 */
+	int (*prime_handle_to_fd)(struct drm_device *dev,
+				  struct drm_file *file_priv, uint32_t handle,
+				  uint32_t flags, int *prime_fd);
+	int (*prime_fd_to_handle)(struct drm_device *dev,
+				  struct drm_file *file_priv, int prime_fd,
+				  uint32_t *handle);
+	struct dma_buf *(*gem_prime_export)(struct drm_device *dev,
+					    struct drm_gem_object *obj,
+					    int flags);
+	struct drm_gem_object *(*gem_prime_import)(struct drm_device *dev,
+						   struct dma_buf *dma_buf);
+	struct sg_table *(*gem_prime_get_sg_table)(struct drm_gem_object *obj);
+	struct drm_gem_object *(*gem_prime_import_sg_table)(
+				struct drm_device *dev, size_t size,
+				struct sg_table *sgt);
+	void *(*gem_prime_vmap)(struct drm_gem_object *obj);
+	void (*gem_prime_vunmap)(struct drm_gem_object *obj, void *vaddr);
+	int (*gem_prime_mmap)(struct drm_gem_object *obj,
+			      struct vm_area_struct *vma);
+
 	/* Driver private ops for this object */
 	struct vm_operations_struct *gem_vm_ops;
 
@@ -1497,6 +1564,7 @@ extern int drm_bufs_info(struct seq_file *m, void *data);
 extern int drm_vblank_info(struct seq_file *m, void *data);
 extern int drm_clients_info(struct seq_file *m, void* data);
 extern int drm_gem_name_info(struct seq_file *m, void *data);
+extern int drm_hashtab_info(struct seq_file *m, void *data);
 
 #if DRM_DEBUG_CODE
 extern int drm_vma_info(struct seq_file *m, void *data);
@@ -1536,6 +1604,8 @@ extern void drm_sysfs_connector_remove(struct drm_connector *connector);
 int drm_gem_init(struct drm_device *dev);
 void drm_gem_destroy(struct drm_device *dev);
 void drm_gem_object_release(struct drm_gem_object *obj);
+int drm_gem_create_mmap_offset(struct drm_gem_object *obj);
+void drm_gem_free_mmap_offset(struct drm_gem_object *obj);
 void drm_gem_object_free(struct kref *kref);
 struct drm_gem_object *drm_gem_object_alloc(struct drm_device *dev,
 					    size_t size);
@@ -1568,6 +1638,15 @@ drm_gem_object_unreference_unlocked(struct drm_gem_object *obj)
 {
 	if (obj != NULL) {
 		struct drm_device *dev = obj->dev;
+
+		/*
+		 * Only the final reference needs struct_mutex, which lets
+		 * callers holding it drop references that can't be the last,
+		 * e.g. a dma-buf released while the object still has handles.
+		 */
+		if (atomic_add_unless(&obj->refcount.refcount, -1, 1))
+			return;
+
 		mutex_lock(&dev->struct_mutex);
 		kref_put(&obj->refcount, drm_gem_object_free);
 		mutex_unlock(&dev->struct_mutex);
@@ -1627,6 +1706,9 @@ drm_gem_object_handle_unreference_unlocked(struct drm_gem_object *obj)
 struct drm_gem_object *drm_gem_object_lookup(struct drm_device *dev,
 					     struct drm_file *filp,
 					     u32 handle);
+int drm_gem_object_lookup_array(struct drm_device *dev, struct drm_file *filp,
+				const u32 *handles, unsigned int count,
+				struct drm_gem_object **objs);
 int drm_gem_close_ioctl(struct drm_device *dev, void *data,
 			struct drm_file *file_priv);
 int drm_gem_flink_ioctl(struct drm_device *dev, void *data,
@@ -1636,6 +1718,42 @@ int drm_gem_open_ioctl(struct drm_device *dev, void *data,
 void drm_gem_open(struct drm_device *dev, struct drm_file *file_private);
 void drm_gem_release(struct drm_device *dev, struct drm_file *file_private);
 
+/* Buffer sharing (drm_prime.c) */
+extern int drm_gem_prime_handle_to_fd(struct drm_device *dev,
+		struct drm_file *file_priv, uint32_t handle, uint32_t flags,
+		int *prime_fd);
+extern int drm_gem_prime_fd_to_handle(struct drm_device *dev,
+		struct drm_file *file_priv, int prime_fd, uint32_t *handle);
+extern struct dma_buf *drm_gem_prime_export(struct drm_device *dev,
+		struct drm_gem_object *obj, int flags);
+extern struct drm_gem_object *drm_gem_prime_import(struct drm_device *dev,
+		struct dma_buf *dma_buf);
+
+extern int drm_prime_handle_to_fd_ioctl(struct drm_device *dev, void *data,
+					struct drm_file *file_priv);
+extern int drm_prime_fd_to_handle_ioctl(struct drm_device *dev, void *data,
+					struct drm_file *file_priv);
+
+extern struct sg_table *drm_prime_pages_to_sg(struct page **pages,
+					      int nr_pages);
+extern int drm_prime_sg_to_page_addr_arrays(struct sg_table *sgt,
+		struct page **pages, dma_addr_t *addrs, int max_pages);
+extern void drm_prime_gem_destroy(struct drm_gem_object *obj,
+				  struct sg_table *sg);
+extern void drm_prime_flush(void);
+extern int drm_prime_init(void);
+extern void drm_prime_exit(void);
+
+extern void drm_prime_init_file_private(struct drm_prime_file_private *prime);
+extern void drm_prime_destroy_file_private(
+		struct drm_prime_file_private *prime);
+extern int drm_prime_add_buf_handle(struct drm_prime_file_private *prime,
+		struct dma_buf *dma_buf, uint32_t handle);
+extern int drm_prime_lookup_buf_handle(struct drm_prime_file_private *prime,
+		struct dma_buf *dma_buf, uint32_t *handle);
+extern void drm_prime_remove_buf_handle(struct drm_prime_file_private *prime,
+		struct dma_buf *dma_buf);
+
 extern void drm_core_ioremap(struct drm_local_map *map, struct drm_device *dev);
 extern void drm_core_ioremap_wc(struct drm_local_map *map, struct drm_device *dev);
 extern void drm_core_ioremapfree(struct drm_local_map *map, struct drm_device *dev);
@@ -512,6 +512,12 @@ struct drm_connector {
 
 	uint8_t polled; /* DRM_CONNECTOR_POLL_* */
 
+	/*
+	 * mode_config.probe_generation when @modes was last probed for
+	 * GETCONNECTOR, 0 if it has to be probed again
+	 */
+	u32 probe_generation;
+
 	/* requested DPMS state */
 	int dpms;
 
@@ -593,8 +599,12 @@ struct drm_mode_config {
 
 	/* output poll support */
 	bool poll_enabled;
+	bool poll_running; /* output_poll_work reschedules itself */
 	struct delayed_work output_poll_work;
 
+	/* bumped on every hotplug event, stales all probed mode lists */
+	atomic_t probe_generation;
+
 	/* pointers to standard properties */
 	struct list_head property_blob_list;
 	struct drm_property *edid_property;
@@ -672,6 +682,7 @@ extern void drm_mode_debug_printmodeline(struct drm_display_mode *mode);
 extern void drm_mode_config_init(struct drm_device *dev);
 extern void drm_mode_config_reset(struct drm_device *dev);
 extern void drm_mode_config_cleanup(struct drm_device *dev);
+extern void drm_mode_config_invalidate_probes(struct drm_device *dev);
 extern void drm_mode_set_name(struct drm_display_mode *mode);
 extern bool drm_mode_equal(struct drm_display_mode *mode1, struct drm_display_mode *mode2);
 extern int drm_mode_width(struct drm_display_mode *mode);
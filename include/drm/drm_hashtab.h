@@ -36,17 +36,71 @@
 #define DRM_HASHTAB_H
 
 #include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 
 #define drm_hash_entry(_ptr, _type, _member) container_of(_ptr, _type, _member)
 
+/*
+ * Tables never grow beyond this order by default. Users that want the old
+ * fixed size behaviour can set max_order to order after drm_ht_create().
+ */
+#define DRM_HT_MAX_ORDER 20
+
 struct drm_hash_item {
 	struct hlist_node head;
 	unsigned long key;
 };
 
+/*
+ * The table grows and shrinks with the number of items. Resizing is done
+ * by a work item that moves a few buckets at a time from table to
+ * new_table; items hashing to the buckets below rehash already live in
+ * new_table. Lookups never block, they retry if a move raced with them.
+ *
+ * Insertions and removals must still be serialized by the user, lookups
+ * may run under the same lock or under rcu_read_lock() if the user frees
+ * its items after a grace period.
+ */
 struct drm_open_hash {
 	struct hlist_head *table;
 	u8 order;
+	u8 min_order;
+	u8 max_order;
+	u8 new_order;
+	struct hlist_head *new_table;
+	unsigned int rehash;
+	unsigned long count;
+	unsigned int grows;
+	unsigned int shrinks;
+	spinlock_t lock;
+	seqcount_t seq;
+	struct work_struct resize_work;
+};
+
+#define DRM_HT_STATS_CHAINS 5
+
+/**
+ * struct drm_ht_stats - snapshot of a hash table's shape
+ * @order: current order, the table has 1 << @order buckets
+ * @items: number of items
+ * @used: number of buckets with at least one item
+ * @max_chain: length of the longest chain
+ * @chains: number of chains of length 1, 2-3, 4-7, 8-15 and 16 or more
+ * @grows: number of times the table grew
+ * @shrinks: number of times the table shrank
+ * @resizing: a resize is in progress and @order is the old order
+ */
+struct drm_ht_stats {
+	unsigned int order;
+	unsigned long items;
+	unsigned long used;
+	unsigned long max_chain;
+	unsigned long chains[DRM_HT_STATS_CHAINS];
+	unsigned int grows;
+	unsigned int shrinks;
+	bool resizing;
 };
 
 extern int drm_ht_create(struct drm_open_hash *ht, unsigned int order);
@@ -60,6 +114,8 @@ extern void drm_ht_verbose_list(struct drm_open_hash *ht, unsigned long key);
 extern int drm_ht_remove_key(struct drm_open_hash *ht, unsigned long key);
 extern int drm_ht_remove_item(struct drm_open_hash *ht, struct drm_hash_item *item);
 extern void drm_ht_remove(struct drm_open_hash *ht);
+extern void drm_ht_get_stats(struct drm_open_hash *ht,
+			     struct drm_ht_stats *stats);
 
 
 #endif
@@ -182,6 +182,8 @@ struct ttm_tt {
 #define TTM_MEMTYPE_FLAG_FIXED         (1 << 0)	/* Fixed (on-card) PCI memory */
 #define TTM_MEMTYPE_FLAG_MAPPABLE      (1 << 1)	/* Memory mappable */
 #define TTM_MEMTYPE_FLAG_CMA           (1 << 3)	/* Can't map aperture */
+#define TTM_MEMTYPE_FLAG_PIPELINE_EVICT (1 << 4)	/* Don't wait for eviction
+							 * moves to complete */
 
 struct ttm_mem_type_manager;
 
@@ -290,6 +292,15 @@ struct ttm_mem_type_manager_func {
  * @io_reserve_fastpath: Only use bdev::driver::io_mem_reserve to obtain
  * static information. bdev::driver::io_mem_free is never used.
  * @lru: The lru list for this memory type.
+ * @move: Sync object of the last pipelined eviction out of this memory type.
+ * Space freed by evictions may only be reused after it signals, which the
+ * driver guarantees for its accelerated moves and TTM waits for otherwise.
+ * @move_arg: Argument for the @move sync object.
+ *
+ * A memory type sets TTM_MEMTYPE_FLAG_PIPELINE_EVICT when the accelerated
+ * moves of the driver are ordered after all earlier moves out of the
+ * memory type, so that evictions don't need to wait for the copy to finish
+ * before the space is handed out again.
  *
  * This structure is used to identify and manage memory types for a device.
  * It's set up by the ttm_bo_driver::init_mem_type method.
@@ -328,6 +339,13 @@ struct ttm_mem_type_manager {
 	 */
 
 	struct list_head lru;
+
+	/*
+	 * Protected by the bdev->fence_lock.
+	 */
+
+	void *move;
+	void *move_arg;
 };
 
 /**
@@ -993,6 +1011,46 @@ extern int ttm_bo_move_memcpy(struct ttm_buffer_object *bo,
 			      bool evict, bool no_wait_reserve,
 			      bool no_wait_gpu, struct ttm_mem_reg *new_mem);
 
+/**
+ * ttm_memcpy_stream
+ *
+ * @dst: Destination mapping.
+ * @src: Source mapping.
+ * @size: Number of bytes to copy.
+ * @dst_cstate: Caching state of the destination mapping.
+ * @src_cstate: Caching state of the source mapping.
+ *
+ * Copy using streaming loads and non-temporal stores where the cpu has
+ * them, picking the variant that suits the caching states. Both mappings
+ * may be iomem mappings. Only handles 64 byte aligned copies.
+ * Returns:
+ * true if the copy was done, false if the caller needs to fall back to a
+ * regular copy.
+ */
+
+extern bool ttm_memcpy_stream(void *dst, const void *src, unsigned long size,
+			      enum ttm_caching_state dst_cstate,
+			      enum ttm_caching_state src_cstate);
+
+/**
+ * ttm_mem_type_wait_move
+ *
+ * @bdev: Pointer to a struct ttm_bo_device.
+ * @mem_type: The memory type.
+ * @interruptible: Use interruptible sleep.
+ * @no_wait: Return immediately with -EBUSY if the move isn't done.
+ *
+ * Wait for the last pipelined eviction out of @mem_type to complete. Needed
+ * before space of that memory type is accessed by the CPU or rebound.
+ * Returns:
+ * -EBUSY: @no_wait is true and the eviction is still in progress.
+ * -ERESTARTSYS: An interruptible sleep was interrupted by a signal.
+ */
+
+extern int ttm_mem_type_wait_move(struct ttm_bo_device *bdev,
+				  uint32_t mem_type, bool interruptible,
+				  bool no_wait);
+
 /**
  * ttm_bo_free_old_node
  *
@@ -691,6 +691,12 @@ struct fb_ops {
 	/* called at KDB enter and leave time to prepare the console */
 	int (*fb_debug_enter)(struct fb_info *info);
 	int (*fb_debug_leave)(struct fb_info *info);
+
+	/* push a region drawn by fbcon to the display, optional. Drivers
+	 * that implement it let fbcon batch the damage of its drawing, see
+	 * fb_damage_batch() */
+	void (*fb_damage)(struct fb_info *info, u32 x, u32 y, u32 width,
+			  u32 height);
 };
 
 #ifdef CONFIG_FB_TILEBLITTING
@@ -780,6 +786,10 @@ struct fb_tile_ops {
 
 /* hints */
 #define FBINFO_VIRTFB		0x0004 /* FB is System RAM, not device. */
+#define FBINFO_DIRECT_DRAW	0x0008 /* fbcon may draw into screen_base
+					  directly, bypassing fb_imageblit().
+					  Such draws are reported through
+					  fb_damage() if present */
 #define FBINFO_PARTIAL_PAN_OK	0x0040 /* otw use pan only for double-buffering */
 #define FBINFO_READS_FAST	0x0080 /* soft-copy faster than rendering */
 
@@ -831,6 +841,16 @@ struct fb_tile_ops {
    output like oopses */
 #define FBINFO_CAN_FORCE_OUTPUT     0x200000
 
+/* fbcon collects the damage of its drawing in fb_info.damage and flushes it
+   through fb_damage() once per console update */
+#define FBINFO_MISC_DAMAGE_BATCH    0x400000
+
+/* Bounding box of the damage collected so far, empty if x1 == x2 */
+struct fb_damage {
+	u32 x1, y1;
+	u32 x2, y2;
+};
+
 struct fb_info {
 	atomic_t count;
 	int node;
@@ -876,6 +896,7 @@ struct fb_info {
 #define FBINFO_STATE_SUSPENDED	1
 	u32 state;			/* Hardware state i.e suspend */
 	void *fbcon_par;                /* fbcon use-only private area */
+	struct fb_damage damage;	/* fbcon damage, under console lock */
 	/* From here on everything is device dependent */
 	void *par;
 	/* we need the PCI or similar aperture base/size not
@@ -994,6 +1015,12 @@ extern ssize_t fb_sys_read(struct fb_info *info, char __user *buf,
 extern ssize_t fb_sys_write(struct fb_info *info, const char __user *buf,
 			    size_t count, loff_t *ppos);
 
+/* drivers/video/fbtile.c */
+typedef void (*fb_tile_fn)(struct fb_info *info, void *arg, u32 start,
+			   u32 count);
+extern void fb_tile_run(struct fb_info *info, fb_tile_fn fn, void *arg,
+			u32 units, u32 align, size_t bytes);
+
 /* drivers/video/fbmem.c */
 extern int register_framebuffer(struct fb_info *fb_info);
 extern int unregister_framebuffer(struct fb_info *fb_info);
@@ -1046,6 +1073,37 @@ extern void fb_deferred_io_cleanup(struct fb_info *info);
 extern int fb_deferred_io_fsync(struct file *file, loff_t start,
 				loff_t end, int datasync);
 
+/*
+ * fb_damage_batch - add a drawn region to the current damage batch
+ *
+ * Drawing hooks of drivers implementing fb_damage() call this instead of
+ * pushing the region to the display right away. Returns false if fbcon
+ * isn't batching, in which case the driver has to do it itself.
+ */
+static inline bool fb_damage_batch(struct fb_info *info, u32 x, u32 y,
+				   u32 width, u32 height)
+{
+	struct fb_damage *d = &info->damage;
+
+	if (!(info->flags & FBINFO_MISC_DAMAGE_BATCH))
+		return false;
+	if (!width || !height)
+		return true;
+
+	if (d->x1 == d->x2) {
+		d->x1 = x;
+		d->y1 = y;
+		d->x2 = x + width;
+		d->y2 = y + height;
+	} else {
+		d->x1 = min(d->x1, x);
+		d->y1 = min(d->y1, y);
+		d->x2 = max(d->x2, x + width);
+		d->y2 = max(d->y2, y + height);
+	}
+	return true;
+}
+
 static inline bool fb_be_math(struct fb_info *info)
 {
 #ifdef CONFIG_FB_FOREIGN_ENDIAN
@@ -59,6 +59,10 @@ struct v4l2_file_operations {
 	struct module *owner;
 	ssize_t (*read) (struct file *, char __user *, size_t, loff_t *);
 	ssize_t (*write) (struct file *, const char __user *, size_t, loff_t *);
+	ssize_t (*splice_read) (struct file *, loff_t *,
+				struct pipe_inode_info *, size_t, unsigned int);
+	ssize_t (*splice_write) (struct pipe_inode_info *, struct file *,
+				 loff_t *, size_t, unsigned int);
 	unsigned int (*poll) (struct file *, struct poll_table_struct *);
 	long (*ioctl) (struct file *, unsigned int, unsigned long);
 	long (*unlocked_ioctl) (struct file *, unsigned int, unsigned long);
@@ -26,6 +26,10 @@
  *		The job does NOT have to end before this callback returns
  *		(and it will be the usual case). When the job finishes,
  *		v4l2_m2m_job_finish() has to be called.
+ *		A job may take as many buffers of the instance as are ready,
+ *		see v4l2_m2m_batch_size(). With more than one job slot (see
+ *		v4l2_m2m_set_slots()) this is called for other instances
+ *		while earlier jobs are still running.
  * @job_ready:	optional. Should return 0 if the driver does not have a job
  *		fully prepared to run yet (i.e. it will not be able to finish a
  *		transaction without sleeping). If not provided, it will be
@@ -123,6 +127,7 @@ int v4l2_m2m_mmap(struct file *file, struct v4l2_m2m_ctx *m2m_ctx,
 		  struct vm_area_struct *vma);
 
 struct v4l2_m2m_dev *v4l2_m2m_init(struct v4l2_m2m_ops *m2m_ops);
+void v4l2_m2m_set_slots(struct v4l2_m2m_dev *m2m_dev, unsigned int slots);
 void v4l2_m2m_release(struct v4l2_m2m_dev *m2m_dev);
 
 struct v4l2_m2m_ctx *v4l2_m2m_ctx_init(struct v4l2_m2m_dev *m2m_dev,
@@ -140,17 +145,33 @@ void v4l2_m2m_buf_queue(struct v4l2_m2m_ctx *m2m_ctx, struct vb2_buffer *vb);
 static inline
 unsigned int v4l2_m2m_num_src_bufs_ready(struct v4l2_m2m_ctx *m2m_ctx)
 {
-	return m2m_ctx->cap_q_ctx.num_rdy;
+	return m2m_ctx->out_q_ctx.num_rdy;
 }
 
 /**
- * v4l2_m2m_num_src_bufs_ready() - return the number of destination buffers
+ * v4l2_m2m_num_dst_bufs_ready() - return the number of destination buffers
  * ready for use
  */
 static inline
 unsigned int v4l2_m2m_num_dst_bufs_ready(struct v4l2_m2m_ctx *m2m_ctx)
 {
-	return m2m_ctx->out_q_ctx.num_rdy;
+	return m2m_ctx->cap_q_ctx.num_rdy;
+}
+
+/**
+ * v4l2_m2m_batch_size() - return how many source and destination buffer
+ * pairs a job can process, at most @max
+ *
+ * Meant to be called from device_run(). Only the running job takes buffers
+ * off the ready lists, so the job can remove this many of each kind even
+ * though more may be queued meanwhile.
+ */
+static inline
+unsigned int v4l2_m2m_batch_size(struct v4l2_m2m_ctx *m2m_ctx,
+				 unsigned int max)
+{
+	return min3(v4l2_m2m_num_src_bufs_ready(m2m_ctx),
+		    v4l2_m2m_num_dst_bufs_ready(m2m_ctx), max);
 }
 
 void *v4l2_m2m_next_buf(struct v4l2_m2m_queue_ctx *q_ctx);
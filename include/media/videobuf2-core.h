@@ -19,6 +19,8 @@
 
 struct vb2_alloc_ctx;
 struct vb2_fileio_data;
+struct pipe_inode_info;
+struct dma_buf;
 
 /**
  * struct vb2_mem_ops - memory handling/memory allocator operations
@@ -41,6 +43,15 @@ struct vb2_fileio_data;
  *		 argument to other ops in this structure
  * @put_userptr: inform the allocator that a USERPTR buffer will no longer
  *		 be used
+ * @attach_dmabuf: attach a shared struct dma_buf for a hardware operation;
+ *		   used for DMABUF memory types; size is the minimum plane
+ *		   size; returns an allocator private per-buffer structure
+ *		   on success, an ERR_PTR on failure
+ * @detach_dmabuf: inform the allocator that a DMABUF buffer will no longer
+ *		   be used; called with the buffer unmapped
+ * @map_dmabuf: make the attached dma_buf accessible, e.g. map it into the
+ *		kernel or the device; called before the buffer is first used
+ * @unmap_dmabuf: release the mapping done by map_dmabuf
  * @vaddr:	return a kernel virtual address to a given memory buffer
  *		associated with the passed private structure or NULL if no
  *		such mapping exists
@@ -54,6 +65,8 @@ struct vb2_fileio_data;
  *		the provided virtual memory region
  *
  * Required ops for USERPTR types: get_userptr, put_userptr.
+ * Required ops for DMABUF types: attach_dmabuf, detach_dmabuf, map_dmabuf,
+ *				  unmap_dmabuf.
  * Required ops for MMAP types: alloc, put, num_users, mmap.
  * Required ops for read/write access types: alloc, put, num_users, vaddr
  */
@@ -65,6 +78,12 @@ struct vb2_mem_ops {
 					unsigned long size, int write);
 	void		(*put_userptr)(void *buf_priv);
 
+	void		*(*attach_dmabuf)(void *alloc_ctx, struct dma_buf *dbuf,
+					  unsigned long size, int write);
+	void		(*detach_dmabuf)(void *buf_priv);
+	int		(*map_dmabuf)(void *buf_priv);
+	void		(*unmap_dmabuf)(void *buf_priv);
+
 	void		*(*vaddr)(void *buf_priv);
 	void		*(*cookie)(void *buf_priv);
 
@@ -75,6 +94,8 @@ struct vb2_mem_ops {
 
 struct vb2_plane {
 	void			*mem_priv;
+	struct dma_buf		*dbuf;
+	unsigned int		dbuf_mapped:1;
 	int			mapped:1;
 };
 
@@ -84,12 +105,14 @@ struct vb2_plane {
  * @VB2_USERPTR:	driver supports USERPTR with streaming API
  * @VB2_READ:		driver supports read() style access
  * @VB2_WRITE:		driver supports write() style access
+ * @VB2_DMABUF:		driver supports DMABUF with streaming API
  */
 enum vb2_io_modes {
 	VB2_MMAP	= (1 << 0),
 	VB2_USERPTR	= (1 << 1),
 	VB2_READ	= (1 << 2),
 	VB2_WRITE	= (1 << 3),
+	VB2_DMABUF	= (1 << 4),
 };
 
 /**
@@ -307,6 +330,11 @@ size_t vb2_read(struct vb2_queue *q, char __user *data, size_t count,
 		loff_t *ppos, int nonblock);
 size_t vb2_write(struct vb2_queue *q, char __user *data, size_t count,
 		loff_t *ppos, int nonblock);
+ssize_t vb2_splice_read(struct vb2_queue *q, loff_t *ppos,
+			struct pipe_inode_info *pipe, size_t len,
+			unsigned int flags);
+ssize_t vb2_splice_write(struct vb2_queue *q, struct pipe_inode_info *pipe,
+			 loff_t *ppos, size_t len, unsigned int flags);
 
 /**
  * vb2_is_streaming() - return streaming status of the queue
@@ -36,6 +36,21 @@ void kref_get(struct kref *kref)
 	smp_mb__after_atomic_inc();
 }
 
+/**
+ * kref_get_unless_zero - increment refcount for object unless it is zero.
+ * @kref: object.
+ *
+ * For lookups that find the object without holding a reference, e.g. under
+ * rcu_read_lock(), and so may race with the final kref_put(). The caller
+ * must make sure the memory stays valid, the release function only runs
+ * once the refcount went to zero.
+ * Return 1 if a reference was taken, 0 if the object is being released.
+ */
+int kref_get_unless_zero(struct kref *kref)
+{
+	return atomic_add_unless(&kref->refcount, 1, 0);
+}
+
 /**
  * kref_put - decrement refcount for object.
  * @kref: object.
@@ -93,5 +108,6 @@ int kref_sub(struct kref *kref, unsigned int count,
 
 EXPORT_SYMBOL(kref_init);
 EXPORT_SYMBOL(kref_get);
+EXPORT_SYMBOL(kref_get_unless_zero);
 EXPORT_SYMBOL(kref_put);
 EXPORT_SYMBOL(kref_sub);
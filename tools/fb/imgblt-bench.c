@@ -0,0 +1,375 @@
+/* $(CC) -Wall -Wextra -O2 -o imgblt-bench imgblt-bench.c */
+
+/*
+ * Benchmark for the monochrome expansion kernels of sys_imageblit() and
+ * cfb_imageblit().
+ *
+ * Renders full screens of 8x16 glyphs into a 16 and a 32 bpp buffer, one
+ * line of text per blit the way fbcon does, with each expansion kernel:
+ *
+ *   table  - the cfb_tab16/cfb_tab32 lookup of fast_imageblit(), which
+ *            needs dword aligned rows
+ *   pixel  - one pixel at a time, as used for unaligned rows without SIMD
+ *   sse2   - the whole row kernels from drivers/video/fb_expand.h
+ *
+ * Every kernel is checked against the pixel kernel before it is timed.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_SSE2 1
+#endif
+
+struct blit {
+	const uint8_t *src;	/* 1 bpp, rows of spitch bytes */
+	unsigned width, height, spitch;
+	uint8_t *dst;		/* first pixel of the destination */
+	unsigned pitch;		/* bytes per destination line */
+	uint32_t fg, bg;
+};
+
+struct expand {
+	uint32_t mask[8];
+	uint32_t eor[4];
+	uint32_t bg[4];
+};
+
+static const uint32_t tab16_le[] = {
+	0x00000000, 0xffff0000, 0x0000ffff, 0xffffffff
+};
+
+static const uint32_t tab32[] = {
+	0x00000000, 0xffffffff
+};
+
+static void blit_pixel(const struct blit *b, unsigned bpp)
+{
+	const uint8_t *src = b->src;
+	uint8_t *dst1 = b->dst;
+	unsigned i, j;
+
+	for (i = 0; i < b->height; i++) {
+		if (bpp == 16) {
+			uint16_t *dst = (uint16_t *)dst1;
+
+			for (j = 0; j < b->width; j++)
+				dst[j] = (src[j/8] & (0x80 >> (j & 7))) ?
+					b->fg : b->bg;
+		} else {
+			uint32_t *dst = (uint32_t *)dst1;
+
+			for (j = 0; j < b->width; j++)
+				dst[j] = (src[j/8] & (0x80 >> (j & 7))) ?
+					b->fg : b->bg;
+		}
+		dst1 += b->pitch;
+		src += b->spitch;
+	}
+}
+
+static int blit_table(const struct blit *b, unsigned bpp)
+{
+	uint32_t fgx = b->fg, bgx = b->bg, eorx, end_mask, bit_mask;
+	unsigned ppw = 32 / bpp, shift, i, j, k = b->width / ppw;
+	const uint32_t *tab = bpp == 16 ? tab16_le : tab32;
+	const uint8_t *s = b->src, *src;
+	uint8_t *dst1 = b->dst;
+	uint32_t *dst;
+
+	if (((uintptr_t)b->dst & 3) || (b->width % ppw))
+		return -1;
+
+	if (bpp == 16) {
+		fgx |= fgx << 16;
+		bgx |= bgx << 16;
+	}
+	bit_mask = (1 << ppw) - 1;
+	eorx = fgx ^ bgx;
+
+	for (i = 0; i < b->height; i++) {
+		dst = (uint32_t *)dst1;
+		shift = 8;
+		src = s;
+		for (j = k; j--; ) {
+			shift -= ppw;
+			end_mask = tab[(*src >> shift) & bit_mask];
+			*dst++ = (end_mask & eorx) ^ bgx;
+			if (!shift) {
+				shift = 8;
+				src++;
+			}
+		}
+		dst1 += b->pitch;
+		s += b->spitch;
+	}
+	return 0;
+}
+
+#ifdef HAVE_SSE2
+static void expand_init(struct expand *e, unsigned bpp, uint32_t fg,
+			uint32_t bg)
+{
+	int i;
+
+	if (bpp == 16) {
+		fg = (fg & 0xffff) * 0x10001;
+		bg = (bg & 0xffff) * 0x10001;
+		for (i = 0; i < 4; i++)
+			e->mask[i] = (0x80 >> (2 * i)) |
+				((0x80 >> (2 * i + 1)) << 16);
+	} else {
+		for (i = 0; i < 8; i++)
+			e->mask[i] = 0x80 >> i;
+	}
+	for (i = 0; i < 4; i++) {
+		e->eor[i] = fg ^ bg;
+		e->bg[i] = bg;
+	}
+}
+
+static void expand_row16(void *dst, const uint8_t *src, uint32_t n,
+			 const struct expand *e)
+{
+	asm volatile("movdqu   (%[e]), %%xmm4\n"
+		     "movdqu 32(%[e]), %%xmm6\n"
+		     "movdqu 48(%[e]), %%xmm7\n"
+		     "1:\n"
+		     "movzbl (%[s]), %%eax\n"
+		     "imul $0x10001, %%eax, %%eax\n"
+		     "movd %%eax, %%xmm0\n"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "pand %%xmm4, %%xmm0\n"
+		     "pcmpeqw %%xmm4, %%xmm0\n"
+		     "pand %%xmm6, %%xmm0\n"
+		     "pxor %%xmm7, %%xmm0\n"
+		     "movdqu %%xmm0, (%[d])\n"
+		     "add $1, %[s]\n"
+		     "add $16, %[d]\n"
+		     "sub $1, %[n]\n"
+		     "jnz 1b\n"
+		     : [s] "+r" (src), [d] "+r" (dst), [n] "+r" (n)
+		     : [e] "r" (e)
+		     : "eax", "xmm0", "xmm4", "xmm6", "xmm7", "memory", "cc");
+}
+
+static void expand_row32(void *dst, const uint8_t *src, uint32_t n,
+			 const struct expand *e)
+{
+	asm volatile("movdqu   (%[e]), %%xmm4\n"
+		     "movdqu 16(%[e]), %%xmm5\n"
+		     "movdqu 32(%[e]), %%xmm6\n"
+		     "movdqu 48(%[e]), %%xmm7\n"
+		     "1:\n"
+		     "movzbl (%[s]), %%eax\n"
+		     "movd %%eax, %%xmm0\n"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "movdqa %%xmm0, %%xmm1\n"
+		     "pand %%xmm4, %%xmm0\n"
+		     "pand %%xmm5, %%xmm1\n"
+		     "pcmpeqd %%xmm4, %%xmm0\n"
+		     "pcmpeqd %%xmm5, %%xmm1\n"
+		     "pand %%xmm6, %%xmm0\n"
+		     "pand %%xmm6, %%xmm1\n"
+		     "pxor %%xmm7, %%xmm0\n"
+		     "pxor %%xmm7, %%xmm1\n"
+		     "movdqu %%xmm0, (%[d])\n"
+		     "movdqu %%xmm1, 16(%[d])\n"
+		     "add $1, %[s]\n"
+		     "add $32, %[d]\n"
+		     "sub $1, %[n]\n"
+		     "jnz 1b\n"
+		     : [s] "+r" (src), [d] "+r" (dst), [n] "+r" (n)
+		     : [e] "r" (e)
+		     : "eax", "xmm0", "xmm1", "xmm4", "xmm5", "xmm6", "xmm7",
+		       "memory", "cc");
+}
+
+static int blit_sse2(const struct blit *b, unsigned bpp)
+{
+	const uint8_t *src = b->src;
+	uint8_t *dst1 = b->dst;
+	unsigned full = b->width / 8, i;
+	struct expand e;
+
+	if (!full || (b->width & 7))
+		return -1;
+
+	expand_init(&e, bpp, b->fg, b->bg);
+	for (i = 0; i < b->height; i++) {
+		if (bpp == 16)
+			expand_row16(dst1, src, full, &e);
+		else
+			expand_row32(dst1, src, full, &e);
+		dst1 += b->pitch;
+		src += b->spitch;
+	}
+	return 0;
+}
+#endif
+
+struct kernel {
+	const char *name;
+	int (*blit)(const struct blit *b, unsigned bpp);
+};
+
+static int blit_pixel_wrap(const struct blit *b, unsigned bpp)
+{
+	blit_pixel(b, bpp);
+	return 0;
+}
+
+static const struct kernel kernels[] = {
+	{ "pixel", blit_pixel_wrap },
+	{ "table", blit_table },
+#ifdef HAVE_SSE2
+	{ "sse2", blit_sse2 },
+#endif
+};
+
+static unsigned xres = 1920, yres = 1080, frames = 100;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Render one screen of text, a line of glyphs per blit. @lines holds the
+ * pre-assembled glyph bitmaps of every text line.
+ */
+static int render(const struct kernel *k, unsigned bpp, unsigned dx,
+		  const uint8_t *lines, uint8_t *fb, unsigned pitch)
+{
+	unsigned cols = xres / 8, rows = yres / 16, r;
+	struct blit b;
+
+	/* Leave room for the offset at the end of each line. */
+	b.width = (dx ? cols - 1 : cols) * 8;
+	b.height = 16;
+	b.spitch = cols;
+	b.pitch = pitch;
+	b.fg = bpp == 16 ? 0xffff : 0xffaaaaaa;
+	b.bg = bpp == 16 ? 0x0010 : 0xff000020;
+	for (r = 0; r < rows; r++) {
+		b.src = lines + r * 16 * cols;
+		b.dst = fb + r * 16 * pitch + dx * (bpp / 8);
+		if (k->blit(&b, bpp))
+			return -1;
+	}
+	return 0;
+}
+
+static void bench(unsigned bpp, unsigned dx, const uint8_t *lines)
+{
+	unsigned pitch = xres * bpp / 8, i, f;
+	size_t size = (size_t)pitch * yres;
+	uint8_t *ref = calloc(1, size), *fb = calloc(1, size);
+	double t;
+
+	if (!ref || !fb) {
+		perror("calloc");
+		exit(1);
+	}
+
+	render(&kernels[0], bpp, dx, lines, ref, pitch);
+
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		memset(fb, 0, size);
+		if (render(&kernels[i], bpp, dx, lines, fb, pitch)) {
+			printf("%2u bpp dx %u %-6s n/a\n", bpp, dx,
+			       kernels[i].name);
+			continue;
+		}
+		if (memcmp(fb, ref, size)) {
+			printf("%2u bpp dx %u %-6s MISMATCH\n", bpp, dx,
+			       kernels[i].name);
+			exit(1);
+		}
+
+		t = now();
+		for (f = 0; f < frames; f++)
+			render(&kernels[i], bpp, dx, lines, fb, pitch);
+		t = now() - t;
+
+		printf("%2u bpp dx %u %-6s %8.1f screens/s %8.1f MiB/s\n",
+		       bpp, dx, kernels[i].name, frames / t,
+		       frames * (double)size / t / (1 << 20));
+	}
+
+	free(ref);
+	free(fb);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned cols, rows, r, c, y;
+	uint8_t font[256 * 16], *lines;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "x:y:n:")) != -1) {
+		switch (opt) {
+		case 'x':
+			xres = atoi(optarg);
+			break;
+		case 'y':
+			yres = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-x xres] [-y yres] "
+				"[-n screens]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (xres < 16 || yres < 16 || !frames) {
+		fprintf(stderr, "screen too small\n");
+		return 1;
+	}
+
+	srand(1);
+	for (c = 0; c < sizeof(font); c++)
+		font[c] = rand();
+
+	/* Glyphs of every text line interleaved by scanline, as bit_putcs()
+	 * hands them to imageblit. */
+	cols = xres / 8;
+	rows = yres / 16;
+	lines = malloc(rows * 16 * cols);
+	if (!lines) {
+		perror("malloc");
+		return 1;
+	}
+	for (r = 0; r < rows; r++)
+		for (c = 0; c < cols; c++) {
+			unsigned ch = rand() & 0xff;
+
+			for (y = 0; y < 16; y++)
+				lines[(r * 16 + y) * cols + c] =
+					font[ch * 16 + y];
+		}
+
+	printf("%ux%u, %ux%u glyphs, %u screens per kernel\n",
+	       xres, yres, cols, rows, frames);
+	bench(16, 0, lines);
+	bench(16, 1, lines);
+	bench(32, 0, lines);
+	bench(32, 1, lines);
+
+	free(lines);
+	return 0;
+}